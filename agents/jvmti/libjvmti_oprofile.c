@@ -31,6 +31,7 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <pthread.h>
 
 #include "opagent.h"
 
@@ -111,126 +112,454 @@ create_debug_line_info(jint map_length, jvmtiAddrLocationMap const * map,
 }
 
 
-static void JNICALL cb_compiled_method_load(jvmtiEnv * jvmti,
-	jmethodID method, jint code_size, void const * code_addr,
-	jint map_length, jvmtiAddrLocationMap const * map,
-	void const * compile_info)
+/*
+ * Compiled code events are queued by the callbacks and written by an
+ * agent thread, so the compiler threads do not wait on the line number
+ * queries nor on the dump file. The callbacks take the timestamp of the
+ * event and copy what may be gone once the callback returns: the code,
+ * the address to location map, and the names, as the class of a method
+ * can be unloaded before the writer gets to it. The writer queries the
+ * line number tables. Until the writer is started the events are queued,
+ * if it can't be started they are written from the callbacks.
+ */
+
+enum code_event_type {
+	COMPILED_METHOD_LOAD,
+	COMPILED_METHOD_UNLOAD,
+	DYNAMIC_CODE_GENERATED
+};
+
+struct code_event {
+	struct code_event * next;
+	enum code_event_type type;
+	uint64_t timestamp;
+	jmethodID method;
+	void const * code_addr;
+	/* copy of the code or NULL */
+	void const * code;
+	jint code_size;
+	jint map_length;
+	jvmtiAddrLocationMap const * map;
+	/* symbol name of the code */
+	char const * name;
+	/* source file of a method, NULL if unknown */
+	char const * source_filename;
+};
+
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+static struct code_event * queue_head;
+static struct code_event ** queue_tail = &queue_head;
+/* events are queued rather than written from the callbacks */
+static volatile int queue_events;
+static int writer_running;
+static int writer_stopping;
+/* line number tables of methods unloaded before the writer got to them */
+static unsigned long lost_line_tables;
+
+
+static struct code_event * copy_code_event(struct code_event const * tmpl)
+{
+	size_t map_size = tmpl->map ?
+		tmpl->map_length * sizeof(jvmtiAddrLocationMap) : 0;
+	size_t code_size = tmpl->code ? tmpl->code_size : 0;
+	size_t name_size = tmpl->name ? strlen(tmpl->name) + 1 : 0;
+	size_t source_size = tmpl->source_filename ?
+		strlen(tmpl->source_filename) + 1 : 0;
+	struct code_event * ev;
+	char * p;
+
+	ev = malloc(sizeof(struct code_event) + map_size + code_size +
+		    name_size + source_size);
+	if (!ev)
+		return NULL;
+	*ev = *tmpl;
+	ev->next = NULL;
+	p = (char *)(ev + 1);
+	if (map_size) {
+		memcpy(p, tmpl->map, map_size);
+		ev->map = (jvmtiAddrLocationMap const *)p;
+		p += map_size;
+	}
+	if (code_size) {
+		memcpy(p, tmpl->code, code_size);
+		ev->code = p;
+		p += code_size;
+	}
+	if (name_size) {
+		memcpy(p, tmpl->name, name_size);
+		ev->name = p;
+		p += name_size;
+	}
+	if (source_size) {
+		memcpy(p, tmpl->source_filename, source_size);
+		ev->source_filename = p;
+	}
+	return ev;
+}
+
+
+/* return 0 if the event is queued for the writer */
+static int queue_code_event(struct code_event const * tmpl)
+{
+	struct code_event * ev;
+
+	if (!queue_events)
+		return -1;
+	ev = copy_code_event(tmpl);
+	if (!ev)
+		return -1;
+	pthread_mutex_lock(&queue_lock);
+	if (!queue_events) {
+		pthread_mutex_unlock(&queue_lock);
+		free(ev);
+		return -1;
+	}
+	*queue_tail = ev;
+	queue_tail = &ev->next;
+	pthread_cond_signal(&queue_cond);
+	pthread_mutex_unlock(&queue_lock);
+	return 0;
+}
+
+
+/* take all the queued events, called with queue_lock held */
+static struct code_event * take_code_events(void)
+{
+	struct code_event * events = queue_head;
+
+	queue_head = NULL;
+	queue_tail = &queue_head;
+	return events;
+}
+
+
+static void write_line_numbers(jvmtiEnv * jvmti, struct code_event const * ev)
 {
-	jclass declaring_class;
-	char * class_signature = NULL;
- 	char * method_name = NULL;
- 	char * method_signature = NULL;
 	jvmtiLineNumberEntry* table_ptr = NULL;
-	char * source_filename = NULL;
-	struct debug_line_info * debug_line = NULL;
- 	jvmtiError err;
+	struct debug_line_info * debug_line;
+	jint entry_count;
+	jvmtiError err;
+
+	err = (*jvmti)->GetLineNumberTable(jvmti, ev->method,
+					   &entry_count, &table_ptr);
+	if (err == JVMTI_ERROR_INVALID_METHODID) {
+		/* counted rather than reported, there can be many */
+		pthread_mutex_lock(&queue_lock);
+		lost_line_tables++;
+		pthread_mutex_unlock(&queue_lock);
+		return;
+	}
+	if (err != JVMTI_ERROR_NONE) {
+		if (err != JVMTI_ERROR_NATIVE_METHOD &&
+		    err != JVMTI_ERROR_ABSENT_INFORMATION)
+			handle_error(err, "GetLineNumberTable()", 1);
+		return;
+	}
+
+	debug_line = create_debug_line_info(ev->map_length, ev->map,
+					    entry_count, table_ptr,
+					    ev->source_filename);
+	if (debug_line &&
+	    op_write_debug_line_info_at(agent_hdl, ev->code_addr,
+					ev->map_length, debug_line,
+					ev->timestamp))
+		perror("Error: op_write_debug_line_info()");
+
+	(*jvmti)->Deallocate(jvmti, (unsigned char *)table_ptr);
+	free(debug_line);
+}
+
+
+static void write_code_event(jvmtiEnv * jvmti, struct code_event const * ev)
+{
+	switch (ev->type) {
+	case COMPILED_METHOD_LOAD:
+	case DYNAMIC_CODE_GENERATED:
+		if (op_write_native_code_at(agent_hdl, ev->name,
+					    (uint64_t)(uintptr_t) ev->code_addr,
+					    ev->code, ev->code_size,
+					    ev->timestamp)) {
+			perror("Error: op_write_native_code()");
+			break;
+		}
+		if (ev->map && ev->source_filename)
+			write_line_numbers(jvmti, ev);
+		break;
+	case COMPILED_METHOD_UNLOAD:
+		if (op_unload_native_code_at(agent_hdl,
+					     (uint64_t)(uintptr_t) ev->code_addr,
+					     ev->timestamp))
+			perror("Error: op_unload_native_code()");
+		break;
+	}
+}
+
+
+/* write and free a list of events */
+static void write_code_events(jvmtiEnv * jvmti, struct code_event * events)
+{
+	struct code_event * ev;
+
+	while ((ev = events)) {
+		events = ev->next;
+		write_code_event(jvmti, ev);
+		free(ev);
+	}
+}
+
+
+/* write an event from its callback, unless the writer takes it */
+static void handle_code_event(jvmtiEnv * jvmti, struct code_event * ev)
+{
+	ev->timestamp = op_get_timestamp();
+	if (!queue_code_event(ev))
+		return;
+	write_code_event(jvmti, ev);
+}
+
+
+static void JNICALL writer_main(jvmtiEnv * jvmti, JNIEnv * env, void * arg)
+{
+	struct code_event * events;
 
 	/* shut up compiler warning */
-	compile_info = compile_info;
+	env = env;
+	arg = arg;
+
+	pthread_mutex_lock(&queue_lock);
+	for (;;) {
+		while (!queue_head && !writer_stopping)
+			pthread_cond_wait(&queue_cond, &queue_lock);
+		if (!queue_head)
+			break;
+		events = take_code_events();
+		pthread_mutex_unlock(&queue_lock);
+		write_code_events(jvmti, events);
+		pthread_mutex_lock(&queue_lock);
+	}
+	writer_running = 0;
+	pthread_cond_broadcast(&queue_cond);
+	pthread_mutex_unlock(&queue_lock);
+}
+
+
+static int start_writer(jvmtiEnv * jvmti, JNIEnv * env)
+{
+	jclass thread_class;
+	jmethodID init;
+	jstring name;
+	jthread thread;
+	jvmtiError err;
+
+	thread_class = (*env)->FindClass(env, "java/lang/Thread");
+	if (!thread_class)
+		goto fail;
+	init = (*env)->GetMethodID(env, thread_class, "<init>",
+				   "(Ljava/lang/String;)V");
+	if (!init)
+		goto fail;
+	name = (*env)->NewStringUTF(env, "oprofile jvmti writer");
+	if (!name)
+		goto fail;
+	thread = (*env)->NewObject(env, thread_class, init, name);
+	if (!thread)
+		goto fail;
+
+	pthread_mutex_lock(&queue_lock);
+	writer_running = 1;
+	pthread_mutex_unlock(&queue_lock);
+	err = (*jvmti)->RunAgentThread(jvmti, thread, writer_main, NULL,
+				       JVMTI_THREAD_NORM_PRIORITY);
+	if (handle_error(err, "RunAgentThread()", 0)) {
+		pthread_mutex_lock(&queue_lock);
+		writer_running = 0;
+		pthread_mutex_unlock(&queue_lock);
+		return -1;
+	}
+	return 0;
+
+fail:
+	(*env)->ExceptionClear(env);
+	fprintf(stderr, "Warning: can't create the writer thread\n");
+	return -1;
+}
+
+
+/* stop queueing events and write the queued ones */
+static void stop_queueing(jvmtiEnv * jvmti)
+{
+	struct code_event * events;
+
+	pthread_mutex_lock(&queue_lock);
+	queue_events = 0;
+	writer_stopping = 1;
+	pthread_cond_signal(&queue_cond);
+	while (writer_running)
+		pthread_cond_wait(&queue_cond, &queue_lock);
+	events = take_code_events();
+	pthread_mutex_unlock(&queue_lock);
+	write_code_events(jvmti, events);
+}
+
+
+static void JNICALL cb_vm_init(jvmtiEnv * jvmti, JNIEnv * env,
+			       jthread thread)
+{
+	/* shut up compiler warning */
+	thread = thread;
+
+	if (queue_events && start_writer(jvmti, env))
+		stop_queueing(jvmti);
+}
+
+
+static void JNICALL cb_vm_death(jvmtiEnv * jvmti, JNIEnv * env)
+{
+	/* shut up compiler warning */
+	env = env;
+
+	stop_queueing(jvmti);
+	if (lost_line_tables) {
+		fprintf(stderr, "Warning: no line numbers for %lu methods "
+			"unloaded before they were written\n",
+			lost_line_tables);
+	}
+}
+
+
+/*
+ * Return the symbol name of method, allocated with malloc(), NULL on
+ * error. If source_filename is not NULL it is set to the source file of
+ * the method, to be freed with Deallocate().
+ */
+static char * method_symbol_name(jvmtiEnv * jvmti, jmethodID method,
+				 char ** source_filename)
+{
+	jclass declaring_class;
+	char * class_signature = NULL;
+	char * method_name = NULL;
+	char * method_signature = NULL;
+	char * name = NULL;
+	jvmtiError err;
 
 	err = (*jvmti)->GetMethodDeclaringClass(jvmti, method,
 						&declaring_class);
 	if (handle_error(err, "GetMethodDeclaringClass()", 1))
-		goto cleanup2;
-
-	if (can_get_line_numbers && map_length && map) {
-		jint entry_count;
-
-		err = (*jvmti)->GetLineNumberTable(jvmti, method,
-						   &entry_count, &table_ptr);
-		if (err == JVMTI_ERROR_NONE) {
-			err = (*jvmti)->GetSourceFileName(jvmti,
-				declaring_class, &source_filename);
-			if (err ==  JVMTI_ERROR_NONE) {
-				debug_line =
-					create_debug_line_info(map_length, map,
-						entry_count, table_ptr,
-						source_filename);
-			} else if (err != JVMTI_ERROR_ABSENT_INFORMATION) {
-				handle_error(err, "GetSourceFileName()", 1);
-			}
-		} else if (err != JVMTI_ERROR_NATIVE_METHOD &&
-			   err != JVMTI_ERROR_ABSENT_INFORMATION) {
-			handle_error(err, "GetLineNumberTable()", 1);
-		}
-	}
+		return NULL;
 
 	err = (*jvmti)->GetClassSignature(jvmti, declaring_class,
 					  &class_signature, NULL);
 	if (handle_error(err, "GetClassSignature()", 1))
-		goto cleanup1;
+		goto cleanup;
 
 	err = (*jvmti)->GetMethodName(jvmti, method, &method_name,
 				      &method_signature, NULL);
 	if (handle_error(err, "GetMethodName()", 1))
 		goto cleanup;
 
+	if (source_filename) {
+		err = (*jvmti)->GetSourceFileName(jvmti, declaring_class,
+						  source_filename);
+		if (err != JVMTI_ERROR_NONE) {
+			if (err != JVMTI_ERROR_ABSENT_INFORMATION)
+				handle_error(err, "GetSourceFileName()", 1);
+			*source_filename = NULL;
+		}
+	}
+
 	if (debug) {
 		fprintf(stderr, "load: declaring_class=%p, class=%s, "
-			"method=%s, signature=%s, addr=%p, size=%i \n",
-			declaring_class, class_signature, method_name,
-			method_signature, code_addr, code_size);
+			"method=%s, signature=%s\n", declaring_class,
+			class_signature, method_name, method_signature);
 	}
 
-	{
-	int cnt = strlen(method_name) + strlen(class_signature) +
-		strlen(method_signature) + 2;
-	char buf[cnt];
-	strncpy(buf, class_signature, cnt - 1);
-	strncat(buf, method_name, cnt - strlen(buf) - 1);
-	strncat(buf, method_signature, cnt - strlen(buf) - 1);
-	if (op_write_native_code(agent_hdl, buf,
-				 (uint64_t)(uintptr_t) code_addr,
-				 code_addr, code_size)) {
-		perror("Error: op_write_native_code()");
-		goto cleanup;
-	}
+	name = malloc(strlen(class_signature) + strlen(method_name) +
+		      strlen(method_signature) + 1);
+	if (name) {
+		strcpy(name, class_signature);
+		strcat(name, method_name);
+		strcat(name, method_signature);
 	}
 
-	if (debug_line)
-		if (op_write_debug_line_info(agent_hdl, code_addr, map_length,
-					     debug_line))
-			perror("Error: op_write_debug_line_info()");
-
 cleanup:
+	(*jvmti)->Deallocate(jvmti, (unsigned char *)class_signature);
 	(*jvmti)->Deallocate(jvmti, (unsigned char *)method_name);
 	(*jvmti)->Deallocate(jvmti, (unsigned char *)method_signature);
-cleanup1:
-	(*jvmti)->Deallocate(jvmti, (unsigned char *)class_signature);
-	(*jvmti)->Deallocate(jvmti, (unsigned char *)table_ptr);
+	return name;
+}
+
+
+static void JNICALL cb_compiled_method_load(jvmtiEnv * jvmti,
+	jmethodID method, jint code_size, void const * code_addr,
+	jint map_length, jvmtiAddrLocationMap const * map,
+	void const * compile_info)
+{
+	struct code_event ev;
+	char * name;
+	char * source_filename = NULL;
+	int line_numbers = can_get_line_numbers && map_length && map;
+
+	/* shut up compiler warning */
+	compile_info = compile_info;
+
+	name = method_symbol_name(jvmti, method,
+				  line_numbers ? &source_filename : NULL);
+	if (!name)
+		return;
+
+	memset(&ev, '\0', sizeof(ev));
+	ev.type = COMPILED_METHOD_LOAD;
+	ev.method = method;
+	ev.code_addr = code_addr;
+	ev.code = code_addr;
+	ev.code_size = code_size;
+	ev.name = name;
+	ev.source_filename = source_filename;
+	if (line_numbers) {
+		ev.map_length = map_length;
+		ev.map = map;
+	}
+	if (debug)
+		fprintf(stderr, "load: addr=%p, size=%i\n", code_addr, code_size);
+	handle_code_event(jvmti, &ev);
+
+	free(name);
 	(*jvmti)->Deallocate(jvmti, (unsigned char *)source_filename);
-cleanup2:
-	free(debug_line);
 }
 
 
 static void JNICALL cb_compiled_method_unload(jvmtiEnv * jvmti_env,
 	jmethodID method, void const * code_addr)
 {
-	/* shut up compiler warning */
-	jvmti_env = jvmti_env;
-	method = method;
+	struct code_event ev;
 
+	memset(&ev, '\0', sizeof(ev));
+	ev.type = COMPILED_METHOD_UNLOAD;
+	ev.method = method;
+	ev.code_addr = code_addr;
 	if (debug)
 		fprintf(stderr, "unload: addr=%p\n", code_addr);
-	if (op_unload_native_code(agent_hdl, (uint64_t)(uintptr_t) code_addr))
-		perror("Error: op_unload_native_code()");
+	handle_code_event(jvmti_env, &ev);
 }
 
 
 static void JNICALL cb_dynamic_code_generated(jvmtiEnv * jvmti_env,
 	char const * name, void const * code_addr, jint code_size)
 {
-	/* shut up compiler warning */
-	jvmti_env = jvmti_env;
+	struct code_event ev;
+
+	memset(&ev, '\0', sizeof(ev));
+	ev.type = DYNAMIC_CODE_GENERATED;
+	ev.name = name;
+	ev.code_addr = code_addr;
+	ev.code = code_addr;
+	ev.code_size = code_size;
 	if (debug) {
 		fprintf(stderr, "dyncode: name=%s, addr=%p, size=%i \n",
 			name, code_addr, code_size);
 	}
-	if (op_write_native_code(agent_hdl, name,
-				 (uint64_t)(uintptr_t) code_addr,
-				 code_addr, code_size))
-		perror("Error: op_write_native_code()");
+	handle_code_event(jvmti_env, &ev);
 }
 
 
@@ -293,11 +622,25 @@ Agent_OnLoad(JavaVM * jvm, char * options, void * reserved)
 	callbacks.CompiledMethodLoad = cb_compiled_method_load;
 	callbacks.CompiledMethodUnload = cb_compiled_method_unload;
 	callbacks.DynamicCodeGenerated = cb_dynamic_code_generated;
+	callbacks.VMInit = cb_vm_init;
+	callbacks.VMDeath = cb_vm_death;
 	error = (*jvmti)->SetEventCallbacks(jvmti, &callbacks,
 					    sizeof(callbacks));
 	if (handle_error(error, "SetEventCallbacks()", 1))
 		return -1;
 
+	/* events are queued until the writer thread is started at VM init */
+	error = (*jvmti)->SetEventNotificationMode(jvmti, JVMTI_ENABLE,
+			JVMTI_EVENT_VM_INIT, NULL);
+	if (!handle_error(error, "SetEventNotificationMode() "
+			  "JVMTI_EVENT_VM_INIT", 0)) {
+		error = (*jvmti)->SetEventNotificationMode(jvmti,
+				JVMTI_ENABLE, JVMTI_EVENT_VM_DEATH, NULL);
+		if (!handle_error(error, "SetEventNotificationMode() "
+				  "JVMTI_EVENT_VM_DEATH", 0))
+			queue_events = 1;
+	}
+
 	error = (*jvmti)->SetEventNotificationMode(jvmti, JVMTI_ENABLE,
 			JVMTI_EVENT_COMPILED_METHOD_LOAD, NULL);
 	if (handle_error(error, "SetEventNotificationMode() "
@@ -25,6 +25,9 @@
 #include "opd_perfmon.h"
 #include "opd_printf.h"
 #include "opd_extended.h"
+#include "opd_capture.h"
+#include "opd_pipeline.h"
+#include "opd_sync.h"
 
 #include "op_version.h"
 #include "op_config.h"
@@ -41,12 +44,22 @@
 #include <sys/time.h>
 #include <wait.h>
 #include <string.h>
+#include <signal.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
 
 size_t kernel_pointer_size;
 
 static fd_t devfd;
 static char * sbuf;
 static size_t s_buf_bytesize;
+/** mask of the signals handled through the main loop, with the mask before */
+static sigset_t loop_sigmask;
+static sigset_t orig_sigmask;
 extern char * session_dir;
 static char start_time_str[32];
 static int jit_conversion_running;
@@ -140,9 +153,14 @@ static void opd_do_samples(char const * opd_buf, ssize_t count)
 	opd_stats[OPD_DUMP_COUNT]++;
 
 	verbprintf(vmisc, "Read buffer of %d entries.\n", (unsigned int)num);
+
+	if (opd_capturing())
+		opd_capture_buffer(opd_buf, count);
  
 	opd_process_samples(opd_buf, num);
 
+	/* complete_dump tells opcontrol the samples are in the files */
+	opd_pipeline_flush();
 	complete_dump();
 }
  
@@ -169,6 +187,8 @@ static void opd_do_jitdumps(void)
 			gettimeofday(&tv, NULL);
 			end_time = tv.tv_sec;
 			sprintf(end_time_str, "%llu", end_time);
+			/* opjitconv must not inherit the blocked signals */
+			sigprocmask(SIG_SETMASK, &orig_sigmask, NULL);
 			sprintf(opjitconv_path, "%s/%s", OP_BINDIR, "opjitconv");
 			arg_num = 0;
 			exec_args[arg_num++] = "opjitconv";
@@ -189,61 +209,258 @@ static void opd_do_jitdumps(void)
 
 } 
 
+/*
+ * The buffer device can't be polled, a thread blocks in read() while the
+ * main loop processes the previous buffer, and signals the main loop
+ * through read_eventfd. The buffers are processed in read order.
+ */
+struct read_buffer {
+	char * buf;
+	ssize_t count;
+	/** under read_lock */
+	int full;
+};
+
+static struct read_buffer read_buffers[2];
+static pthread_mutex_t read_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t read_cond = PTHREAD_COND_INITIALIZER;
+static int read_eventfd;
+
+
+static void * opd_reader(void * arg __attribute__((unused)))
+{
+	size_t i = 0;
+	uint64_t one = 1;
+
+	while (1) {
+		struct read_buffer * rb = &read_buffers[i];
+		ssize_t count;
+
+		pthread_mutex_lock(&read_lock);
+		while (rb->full)
+			pthread_cond_wait(&read_cond, &read_lock);
+		pthread_mutex_unlock(&read_lock);
+
+		do {
+			count = op_read_device(devfd, rb->buf, s_buf_bytesize);
+		} while (count < 0);
+
+		pthread_mutex_lock(&read_lock);
+		rb->count = count;
+		rb->full = 1;
+		pthread_mutex_unlock(&read_lock);
+
+		if (write(read_eventfd, &one, sizeof(one)) != sizeof(one))
+			perror("oprofiled: couldn't signal read buffer: ");
+
+		i ^= 1;
+	}
+
+	return NULL;
+}
+
+
+/** process the buffers filled by the reader thread */
+static void opd_do_buffers(void)
+{
+	static size_t next;
+	uint64_t nr;
+
+	if (read(read_eventfd, &nr, sizeof(nr)) != sizeof(nr))
+		return;
+
+	while (1) {
+		struct read_buffer * rb = &read_buffers[next];
+		int full;
+
+		pthread_mutex_lock(&read_lock);
+		full = rb->full;
+		pthread_mutex_unlock(&read_lock);
+		if (!full)
+			break;
+
+		opd_do_samples(rb->buf, rb->count);
+
+		pthread_mutex_lock(&read_lock);
+		rb->full = 0;
+		pthread_cond_signal(&read_cond);
+		pthread_mutex_unlock(&read_lock);
+
+		next ^= 1;
+	}
+}
+
+
+static void opd_do_signals(int sigfd)
+{
+	struct signalfd_siginfo info;
+
+	while (read(sigfd, &info, sizeof(info)) == sizeof(info)) {
+		switch (info.ssi_signo) {
+		case SIGALRM:
+			opd_alarm();
+			break;
+		case SIGHUP:
+			opd_sighup();
+			break;
+		case SIGTERM:
+			opd_sigterm();
+			break;
+		case SIGCHLD:
+			opd_sigchild();
+			break;
+		case SIGUSR1:
+			perfmon_start();
+			break;
+		case SIGUSR2:
+			perfmon_stop();
+			break;
+		}
+	}
+}
+
+
+/** handle signals caught before the main loop blocked them */
+static void opd_do_early_signals(void)
+{
+	if (signal_alarm) {
+		signal_alarm = 0;
+		opd_alarm();
+	}
+
+	if (signal_hup) {
+		signal_hup = 0;
+		opd_sighup();
+	}
+
+	if (signal_term)
+		opd_sigterm();
+
+	if (signal_usr1) {
+		signal_usr1 = 0;
+		perfmon_start();
+	}
+
+	if (signal_usr2) {
+		signal_usr2 = 0;
+		perfmon_stop();
+	}
+}
+
+
+static void opd_epoll_add(int epfd, int fd)
+{
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = fd;
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev)) {
+		perror("oprofiled: epoll_ctl failed: ");
+		exit(EXIT_FAILURE);
+	}
+}
+
+
+static void opd_do_pipe(int epfd, uint32_t events)
+{
+	if (is_jitconv_requested()) {
+		verbprintf(vmisc, "Start opjitconv was triggered\n");
+		opd_do_jitdumps();
+	}
+
+	/* the writer went away, without reopening the fifo stays in hangup */
+	if (events & EPOLLHUP) {
+		epoll_ctl(epfd, EPOLL_CTL_DEL, opd_pipe_fd(), NULL);
+		opd_close_pipe();
+		opd_open_pipe();
+		opd_epoll_add(epfd, opd_pipe_fd());
+	}
+}
+
+
 /**
  * opd_do_read - enter processing loop
- * @param buf  buffer to read into
- * @param size  size of buffer
  *
- * Read some of a buffer from the device and process
- * the contents.
+ * Wait for full buffers, signals, the periodic sync timer and requests
+ * on the fifo, and handle them as they come.
  */
-static void opd_do_read(char * buf, size_t size)
+static void opd_do_read(void)
 {
+	struct itimerspec period;
+	struct epoll_event events[4];
+	pthread_t reader;
+	int epfd, sigfd, timerfd;
+	int i, nr;
+
+	sigemptyset(&loop_sigmask);
+	sigaddset(&loop_sigmask, SIGALRM);
+	sigaddset(&loop_sigmask, SIGHUP);
+	sigaddset(&loop_sigmask, SIGTERM);
+	sigaddset(&loop_sigmask, SIGCHLD);
+	sigaddset(&loop_sigmask, SIGUSR1);
+	sigaddset(&loop_sigmask, SIGUSR2);
+	/* the threads started from now on inherit the mask */
+	sigprocmask(SIG_BLOCK, &loop_sigmask, &orig_sigmask);
+
+	opd_do_early_signals();
+
 	opd_open_pipe();
 
-	while (1) {
-		ssize_t count = -1;
-
-		/* loop to handle EINTR */
-		while (count < 0) {
-			count = op_read_device(devfd, buf, size);
-
-			/* we can lose an alarm or a hup but
-			 * we don't care.
-			 */
-			if (signal_alarm) {
-				signal_alarm = 0;
-				opd_alarm();
-			}
+	epfd = epoll_create(4);
+	sigfd = signalfd(-1, &loop_sigmask, SFD_NONBLOCK | SFD_CLOEXEC);
+	timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+	read_eventfd = eventfd(0, EFD_CLOEXEC);
+	if (epfd == -1 || sigfd == -1 || timerfd == -1 || read_eventfd == -1) {
+		perror("oprofiled: couldn't set up the main loop: ");
+		exit(EXIT_FAILURE);
+	}
 
-			if (signal_hup) {
-				signal_hup = 0;
-				opd_sighup();
-			}
+	/* sync files and report stats every 10 minutes */
+	period.it_interval.tv_sec = 60 * 10;
+	period.it_interval.tv_nsec = 0;
+	period.it_value = period.it_interval;
+	timerfd_settime(timerfd, 0, &period, NULL);
 
-			if (signal_term)
-				opd_sigterm();
+	opd_epoll_add(epfd, sigfd);
+	opd_epoll_add(epfd, timerfd);
+	opd_epoll_add(epfd, read_eventfd);
+	opd_epoll_add(epfd, opd_pipe_fd());
 
-			if (signal_child)
-				opd_sigchild();
+	opd_sync_init();
 
-			if (signal_usr1) {
-				signal_usr1 = 0;
-				perfmon_start();
-			}
+	read_buffers[0].buf = sbuf;
+	read_buffers[1].buf = xmalloc(s_buf_bytesize);
+	if (pthread_create(&reader, NULL, opd_reader, NULL)) {
+		perror("oprofiled: couldn't start reader thread: ");
+		exit(EXIT_FAILURE);
+	}
 
-			if (signal_usr2) {
-				signal_usr2 = 0;
-				perfmon_stop();
-			}
+	while (1) {
+		nr = epoll_wait(epfd, events, 4, -1);
+		if (nr < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("oprofiled: epoll_wait failed: ");
+			exit(EXIT_FAILURE);
+		}
 
-			if (is_jitconv_requested()) {
-				verbprintf(vmisc, "Start opjitconv was triggered\n");
-				opd_do_jitdumps();
+		for (i = 0; i < nr; ++i) {
+			int fd = events[i].data.fd;
+
+			if (fd == read_eventfd) {
+				opd_do_buffers();
+			} else if (fd == sigfd) {
+				opd_do_signals(sigfd);
+			} else if (fd == timerfd) {
+				uint64_t expirations;
+				if (read(timerfd, &expirations,
+				         sizeof(expirations)) > 0)
+					opd_alarm();
+			} else if (fd == opd_pipe_fd()) {
+				opd_do_pipe(epfd, events[i].events);
 			}
 		}
-
-		opd_do_samples(buf, count);
 	}
 	
 	opd_close_pipe();
@@ -255,7 +472,6 @@ static void opd_alarm(void)
 {
 	sfile_sync_files();
 	opd_print_stats();
-	alarm(60 * 10);
 }
  
 
@@ -280,6 +496,9 @@ static void clean_exit(void)
 
 static void opd_sigterm(void)
 {
+	opd_pipeline_exit();
+	opd_sync_exit();
+	opd_capture_close();
 	opd_do_jitdumps();
 	opd_print_stats();
 	printf("oprofiled stopped %s", op_get_time());
@@ -350,16 +569,20 @@ static void opd_26_init(void)
 
 static void opd_26_start(void)
 {
-	/* simple sleep-then-process loop */
-	opd_do_read(sbuf, s_buf_bytesize);
+	opd_do_read();
 }
 
 
 static void opd_26_exit(void)
 {
+	opd_pipeline_exit();
+	opd_capture_close();
 	opd_print_stats();
 	printf("oprofiled stopped %s", op_get_time());
 
+	opd_sync_exit();
+
+	free(read_buffers[1].buf);
 	free(sbuf);
 	free(vmlinux);
 	/* FIXME: free kernel images, sfiles etc. */
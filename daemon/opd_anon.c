@@ -10,6 +10,12 @@
  * What is relatively common is expanding anon maps, which leaves us
  * with lots of separate sample files.
  *
+ * The mappings of a process are kept sorted by address. A pc which falls
+ * in none of them causes /proc/<tgid>/maps to be read again: mappings still
+ * present are kept with their sample files, only the ones which went away
+ * are dropped. JIT processes can have thousands of anonymous regions, so
+ * tearing them all down on each miss is not an option.
+ *
  * @remark Copyright 2005 OProfile authors
  * @remark Read the file COPYING
  *
@@ -21,6 +27,8 @@
 #include "opd_trans.h"
 #include "opd_sfile.h"
 #include "opd_printf.h"
+#include "opd_stats.h"
+#include "opd_capture.h"
 #include "op_libiberty.h"
 
 #include <limits.h>
@@ -32,132 +40,394 @@
 #define HASH_BITS (HASH_SIZE - 1)
 
 /*
- * Note that this value is tempered by the fact that when we miss in the
- * anon cache, we'll tear down all the mappings for that tgid. Thus, LRU
- * of a mapping can potentially clear out a much larger number of
+ * Note that this value is tempered by the fact that we evict whole
+ * processes: LRU of one process can clear out a much larger number of
  * mappings.
  */
 #define LRU_SIZE 8192
 #define LRU_AMOUNT (LRU_SIZE/8)
 
+/** the anonymous mappings of one tgid/app pair */
+struct anon_process {
+	pid_t tgid;
+	cookie_t app_cookie;
+	/** mappings sorted by start address */
+	struct anon_mapping ** maps;
+	size_t nr_maps;
+	size_t max_maps;
+	/** generation of the last maps read */
+	unsigned long generation;
+	/** hash list */
+	struct list_head list;
+	/** lru list */
+	struct list_head lru_list;
+};
+
 static struct list_head hashes[HASH_SIZE];
 static struct list_head lru;
+/** nr. of mappings of all processes */
 static size_t nr_lru;
+static unsigned long generation;
+
+
+static unsigned long hash_anon(pid_t tgid, cookie_t app)
+{
+	return ((app >> DCOOKIE_SHIFT) ^ (tgid >> 2)) & (HASH_SIZE - 1);
+}
 
-static void do_lru(struct transient * trans)
+
+static void drop_mapping(struct transient * trans, struct anon_mapping * m)
+{
+	if (trans->anon == m)
+		clear_trans_current(trans);
+	if (trans->last_anon == m)
+		clear_trans_last(trans);
+	sfile_clear_anon(m);
+	--nr_lru;
+	free(m);
+}
+
+
+static void clear_anon_process(struct transient * trans,
+                               struct anon_process * proc)
+{
+	size_t i;
+
+	for (i = 0; i < proc->nr_maps; ++i)
+		drop_mapping(trans, proc->maps[i]);
+
+	if (vmisc) {
+		char const * name = verbose_cookie(proc->app_cookie);
+		printf("Cleared anon maps for tgid %u (%s).\n",
+		       proc->tgid, name);
+	}
+
+	list_del(&proc->list);
+	list_del(&proc->lru_list);
+	free(proc->maps);
+	free(proc);
+}
+
+
+static void do_lru(struct transient * trans, struct anon_process * keep)
 {
-	size_t nr_to_kill = LRU_AMOUNT;
 	struct list_head * pos;
 	struct list_head * pos2;
-	struct anon_mapping * entry;
+	struct anon_process * proc;
 
 	list_for_each_safe(pos, pos2, &lru) {
-		entry = list_entry(pos, struct anon_mapping, lru_list);
-		if (trans->anon == entry)
-			clear_trans_current(trans);
-		if (trans->last_anon == entry)
-			clear_trans_last(trans);
-		sfile_clear_anon(entry);
-		list_del(&entry->list);
-		list_del(&entry->lru_list);
-		--nr_lru;
-		free(entry);
-		if (nr_to_kill-- == 0)
+		if (nr_lru <= LRU_SIZE - LRU_AMOUNT)
 			break;
+		proc = list_entry(pos, struct anon_process, lru_list);
+		if (proc != keep)
+			clear_anon_process(trans, proc);
 	}
 }
 
 
-static unsigned long hash_anon(pid_t tgid, cookie_t app)
+static struct anon_process * find_process(pid_t tgid, cookie_t app)
 {
-	return ((app >> DCOOKIE_SHIFT) ^ (tgid >> 2)) & (HASH_SIZE - 1);
+	unsigned long hash = hash_anon(tgid, app);
+	struct list_head * pos;
+	struct anon_process * proc;
+
+	list_for_each(pos, &hashes[hash]) {
+		proc = list_entry(pos, struct anon_process, list);
+		if (proc->tgid == tgid && proc->app_cookie == app) {
+			list_del(&proc->lru_list);
+			list_add_tail(&proc->lru_list, &lru);
+			return proc;
+		}
+	}
+
+	return NULL;
 }
- 
 
-static void clear_anon_maps(struct transient * trans)
+
+static struct anon_process * create_process(pid_t tgid, cookie_t app)
 {
-	unsigned long hash = hash_anon(trans->tgid, trans->app_cookie);
-	pid_t tgid = trans->tgid;
-	cookie_t app = trans->app_cookie;
-	struct list_head * pos;
-	struct list_head * pos2;
-	struct anon_mapping * entry;
+	struct anon_process * proc = xmalloc(sizeof(struct anon_process));
+
+	proc->tgid = tgid;
+	proc->app_cookie = app;
+	proc->maps = NULL;
+	proc->nr_maps = 0;
+	proc->max_maps = 0;
+	proc->generation = 0;
+	list_add(&proc->list, &hashes[hash_anon(tgid, app)]);
+	list_add_tail(&proc->lru_list, &lru);
+	return proc;
+}
+
+
+/** binary search of the mapping containing pc */
+static struct anon_mapping *
+lookup_mapping(struct anon_process const * proc, vma_t pc)
+{
+	size_t lo = 0;
+	size_t hi = proc->nr_maps;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		struct anon_mapping * m = proc->maps[mid];
+		if (pc < m->start)
+			hi = mid;
+		else if (pc >= m->end)
+			lo = mid + 1;
+		else
+			return m;
+	}
+
+	return NULL;
+}
 
-	clear_trans_current(trans);
 
-	list_for_each_safe(pos, pos2, &hashes[hash]) {
-		entry = list_entry(pos, struct anon_mapping, list);
-		if (entry->tgid == tgid && entry->app_cookie == app) {
-			if (trans->last_anon == entry)
-				clear_trans_last(trans);
-			sfile_clear_anon(entry);
-			list_del(&entry->list);
-			list_del(&entry->lru_list);
-			--nr_lru;
-			free(entry);
+/**
+ * Return the text of /proc/<tgid>/maps in a malloc'ed buffer, NULL if the
+ * process is gone. /proc files have no size, read them until EOF.
+ */
+static char * read_maps(pid_t tgid, size_t * size)
+{
+	char path[PATH_MAX];
+	FILE * fp;
+	char * text;
+	size_t alloc = 4096;
+	size_t len = 0;
+	size_t n;
+
+	snprintf(path, PATH_MAX, "/proc/%d/maps", tgid);
+	fp = fopen(path, "r");
+	if (!fp)
+		return NULL;
+
+	text = xmalloc(alloc);
+	while ((n = fread(text + len, 1, alloc - len, fp)) > 0) {
+		len += n;
+		if (len == alloc) {
+			alloc *= 2;
+			text = xrealloc(text, alloc);
 		}
 	}
 
-	if (vmisc) {
-		char const * name = verbose_cookie(app);
-		printf("Cleared anon maps for tgid %u (%s).\n", tgid, name);
+	fclose(fp);
+	*size = len;
+	return text;
+}
+
+
+static char const * parse_hex(char const * pos, char const * end, vma_t * val)
+{
+	char const * start = pos;
+
+	*val = 0;
+	for (; pos < end; ++pos) {
+		unsigned int digit;
+		if (*pos >= '0' && *pos <= '9')
+			digit = *pos - '0';
+		else if (*pos >= 'a' && *pos <= 'f')
+			digit = *pos - 'a' + 10;
+		else if (*pos >= 'A' && *pos <= 'F')
+			digit = *pos - 'A' + 10;
+		else
+			break;
+		*val = (*val << 4) | digit;
+	}
+
+	return pos == start ? NULL : pos;
+}
+
+
+static char const * skip_blanks(char const * pos, char const * end)
+{
+	while (pos < end && (*pos == ' ' || *pos == '\t'))
+		++pos;
+	return pos;
+}
+
+
+static char const * skip_field(char const * pos, char const * end)
+{
+	while (pos < end && *pos != ' ' && *pos != '\t')
+		++pos;
+	return pos;
+}
+
+
+/*
+ * 42000000-4212f000 r-xp 00000000 16:03 424334 /lib/tls/libc-2.3.2.so
+ *
+ * Return 0 if line is not an anonymous mapping. Some anon maps have labels
+ * like [heap], [stack], [vdso], [vsyscall] ... Keep track of these labels.
+ * If a map has no name, call it "anon". Ignore all mappings starting with
+ * "/" (file or shared memory object).
+ */
+static int parse_maps_line(char const * pos, char const * end,
+                           vma_t * start, vma_t * stop, char * name)
+{
+	size_t len;
+	int i;
+
+	pos = parse_hex(pos, end, start);
+	if (!pos || pos == end || *pos != '-')
+		return 0;
+	pos = parse_hex(pos + 1, end, stop);
+	if (!pos)
+		return 0;
+
+	/* perms, offset, dev, inode */
+	for (i = 0; i < 4; ++i) {
+		pos = skip_blanks(pos, end);
+		if (pos == end)
+			return 0;
+		pos = skip_field(pos, end);
+	}
+
+	pos = skip_blanks(pos, end);
+	if (pos == end) {
+		strcpy(name, "anon");
+		return 1;
 	}
+
+	if (*pos == '/')
+		return 0;
+
+	len = skip_field(pos, end) - pos;
+	if (len > MAX_IMAGE_NAME_SIZE)
+		len = MAX_IMAGE_NAME_SIZE;
+	memcpy(name, pos, len);
+	name[len] = '\0';
+	return 1;
 }
 
 
-static void
-add_anon_mapping(struct transient * trans, vma_t start, vma_t end, char * name)
+static void add_mapping(struct anon_process * proc, struct anon_mapping * m)
+{
+	if (proc->nr_maps == proc->max_maps) {
+		proc->max_maps = proc->max_maps ? proc->max_maps * 2 : 16;
+		proc->maps = xrealloc(proc->maps,
+		               proc->max_maps * sizeof(struct anon_mapping *));
+	}
+	proc->maps[proc->nr_maps++] = m;
+}
+
+
+static struct anon_mapping *
+create_mapping(struct anon_process const * proc, vma_t start, vma_t end,
+               char const * name)
 {
-	unsigned long hash = hash_anon(trans->tgid, trans->app_cookie);
 	struct anon_mapping * m = xmalloc(sizeof(struct anon_mapping));
-	m->tgid = trans->tgid;
-	m->app_cookie = trans->app_cookie;
+
+	m->tgid = proc->tgid;
+	m->app_cookie = proc->app_cookie;
 	m->start = start;
 	m->end = end;
-	strncpy(m->name, name, MAX_IMAGE_NAME_SIZE + 1);
-	list_add_tail(&m->list, &hashes[hash]);
-	list_add_tail(&m->lru_list, &lru);
-	if (++nr_lru == LRU_SIZE)
-		do_lru(trans);
+	m->generation = proc->generation;
+	strcpy(m->name, name);
+	++nr_lru;
+
 	if (vmisc) {
-		char const * name = verbose_cookie(m->app_cookie);
+		char const * app = verbose_cookie(m->app_cookie);
 		printf("Added anon map 0x%llx-0x%llx for tgid %u (%s).\n",
-		       start, end, m->tgid, name);
+		       start, end, m->tgid, app);
 	}
+
+	return m;
 }
 
 
-/* 42000000-4212f000 r-xp 00000000 16:03 424334 /lib/tls/libc-2.3.2.so */
-static void get_anon_maps(struct transient * trans)
+static int compare_mapping(void const * a, void const * b)
 {
-	FILE * fp = NULL;
-	char buf[PATH_MAX];
-	vma_t start, end;
-	int ret;
+	struct anon_mapping const * m1 = *(struct anon_mapping * const *)a;
+	struct anon_mapping const * m2 = *(struct anon_mapping * const *)b;
 
-	snprintf(buf, PATH_MAX, "/proc/%d/maps", trans->tgid);
-	fp = fopen(buf, "r");
-	if (!fp)
-		return;
+	if (m1->start < m2->start)
+		return -1;
+	return m1->start > m2->start;
+}
+
+
+/**
+ * Read the maps of proc again. Mappings already known with the same range
+ * and name are kept, the ones gone from the maps are dropped. If the
+ * process is gone or has no anonymous mapping left, proc is freed and 0
+ * returned: the LRU counts mappings, it would never evict it.
+ */
+static int refresh_process(struct transient * trans,
+                           struct anon_process * proc)
+{
+	struct anon_mapping ** old_maps = proc->maps;
+	size_t nr_old = proc->nr_maps;
+	size_t i = 0;
+	char * text = NULL;
+	char const * pos;
+	char const * text_end;
+	size_t size = 0;
+	int sorted = 1;
+
+	if (opd_replaying()) {
+		pos = opd_replay_maps(proc->tgid, &size);
+	} else {
+		pos = text = read_maps(proc->tgid, &size);
+		if (text && opd_capturing())
+			opd_capture_maps(proc->tgid, text, size);
+	}
 
-	while (fgets(buf, PATH_MAX, fp) != NULL) {
-		char tmp[MAX_IMAGE_NAME_SIZE + 1];
+	proc->generation = ++generation;
+	proc->maps = NULL;
+	proc->nr_maps = 0;
+	proc->max_maps = 0;
+
+	/* the maps are in address order, as old_maps */
+	text_end = pos + size;
+	while (pos && pos < text_end) {
 		char name[MAX_IMAGE_NAME_SIZE + 1];
-		/* Some anon maps have labels like
-		 * [heap], [stack], [vdso], [vsyscall] ...
-		 * Keep track of these labels. If a map has no name, call it "anon".
-		 * Ignore all mappings starting with "/" (file or shared memory object)
-		 */
-		strcpy(name, "anon");
-		ret = sscanf(buf, "%llx-%llx %20s %20s %20s %20s %20s",
-		             &start, &end, tmp, tmp, tmp, tmp, name);
-		if (ret < 6 || name[0] == '/')
+		char const * eol = memchr(pos, '\n', text_end - pos);
+		char const * line_end = eol ? eol : text_end;
+		struct anon_mapping * m;
+		vma_t start, end;
+
+		int ok = parse_maps_line(pos, line_end, &start, &end, name);
+
+		pos = eol ? eol + 1 : text_end;
+		if (!ok)
 			continue;
 
-		add_anon_mapping(trans, start, end, name);
+		while (i < nr_old && old_maps[i]->start < start)
+			++i;
+		if (i < nr_old && old_maps[i]->start == start &&
+		    old_maps[i]->end == end && !strcmp(old_maps[i]->name, name)) {
+			m = old_maps[i++];
+			m->generation = proc->generation;
+		} else {
+			m = create_mapping(proc, start, end, name);
+		}
+
+		if (proc->nr_maps && proc->maps[proc->nr_maps - 1]->start > start)
+			sorted = 0;
+		add_mapping(proc, m);
 	}
 
-	fclose(fp);
+	for (i = 0; i < nr_old; ++i) {
+		if (old_maps[i]->generation != proc->generation)
+			drop_mapping(trans, old_maps[i]);
+	}
+
+	if (!sorted)
+		qsort(proc->maps, proc->nr_maps, sizeof(struct anon_mapping *),
+		      compare_mapping);
+
+	free(old_maps);
+	free(text);
+
+	if (!proc->nr_maps) {
+		clear_anon_process(trans, proc);
+		return 0;
+	}
+
+	if (nr_lru > LRU_SIZE)
+		do_lru(trans, proc);
+
+	return 1;
 }
 
 
@@ -178,37 +448,38 @@ anon_match(struct transient const * trans, struct anon_mapping const * anon)
 
 struct anon_mapping * find_anon_mapping(struct transient * trans)
 {
-	unsigned long hash = hash_anon(trans->tgid, trans->app_cookie);
-	struct list_head * pos;
+	struct anon_process * proc;
 	struct anon_mapping * entry;
-	int tried = 0;
 
-	if (anon_match(trans, trans->anon))
+	if (anon_match(trans, trans->anon)) {
+		opd_stats[OPD_ANON_CACHE_HIT]++;
 		return (trans->anon);
+	}
 
-retry:
-	list_for_each(pos, &hashes[hash]) {
-		entry = list_entry(pos, struct anon_mapping, list);
-		if (anon_match(trans, entry))
+	proc = find_process(trans->tgid, trans->app_cookie);
+	if (proc) {
+		entry = lookup_mapping(proc, trans->pc);
+		if (entry) {
+			opd_stats[OPD_ANON_CACHE_HIT]++;
 			goto success;
+		}
+	} else {
+		proc = create_process(trans->tgid, trans->app_cookie);
 	}
 
-	if (!tried) {
-		clear_anon_maps(trans);
-		get_anon_maps(trans);
-		tried = 1;
-		goto retry;
-	}
+	opd_stats[OPD_ANON_CACHE_MISS]++;
+	clear_trans_current(trans);
+	if (!refresh_process(trans, proc))
+		return NULL;
 
-	return NULL;
+	entry = lookup_mapping(proc, trans->pc);
+	if (!entry)
+		return NULL;
 
 success:
-	/*
-	 * Typically, there's one big mapping that matches. Let's go
-	 * faster.
-	 */
-	list_del(&entry->list);
-	list_add(&entry->list, &hashes[hash]);
+	/* the sfile of another mapping is no use */
+	if (entry != trans->anon)
+		clear_trans_current(trans);
 
 	verbprintf(vmisc, "Found range 0x%llx-0x%llx for tgid %u, pc %llx.\n",
 	           entry->start, entry->end, (unsigned int)entry->tgid,
@@ -0,0 +1,420 @@
+/**
+ * @file daemon/opd_capture.c
+ * Capture of the kernel sample buffers and their offline replay
+ *
+ * @remark Copyright 2013 OProfile authors
+ * @remark Read the file COPYING
+ */
+
+#include "config.h"
+
+#include "opd_capture.h"
+#include "oprofiled.h"
+#include "opd_kernel.h"
+#include "opd_trans.h"
+#include "opd_sfile.h"
+#include "opd_anon.h"
+#include "opd_stats.h"
+#include "opd_pipeline.h"
+#include "opd_printf.h"
+
+#include "op_list.h"
+#include "op_libiberty.h"
+#include "op_get_time.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#define HASH_SIZE 256
+
+extern op_cpu cpu_type;
+
+/* capture side */
+static FILE * capture_file;
+
+/* replay side */
+static char const * replay_base;
+static size_t replay_size;
+
+struct replay_cookie {
+	cookie_t cookie;
+	char const * name;
+	struct list_head list;
+};
+
+struct replay_maps {
+	pid_t tgid;
+	size_t nr_texts;
+	size_t next;
+	char const ** texts;
+	size_t * sizes;
+	struct list_head list;
+};
+
+static struct list_head replay_cookies[HASH_SIZE];
+static struct list_head replay_maps[HASH_SIZE];
+
+
+static void capture_write(u32 type, void const * a, size_t a_size,
+                          void const * b, size_t b_size)
+{
+	static char const pad[8];
+	struct opd_capture_record rec;
+	size_t padding;
+
+	if (!capture_file)
+		return;
+
+	rec.type = type;
+	rec.size = a_size + b_size;
+	padding = (8 - (rec.size & 7)) & 7;
+
+	if (fwrite(&rec, sizeof(rec), 1, capture_file) != 1 ||
+	    fwrite(a, a_size, 1, capture_file) != 1 ||
+	    (b_size && fwrite(b, b_size, 1, capture_file) != 1) ||
+	    (padding && fwrite(pad, padding, 1, capture_file) != 1)) {
+		perror("oprofiled: capture write failed, capture stopped: ");
+		opd_capture_close();
+	}
+}
+
+
+void opd_capture_open(char const * filename)
+{
+	struct opd_capture_header header;
+
+	capture_file = fopen(filename, "w");
+	if (!capture_file) {
+		fprintf(stderr, "oprofiled: couldn't open capture file %s: %s\n",
+		        filename, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, OPD_CAPTURE_MAGIC, sizeof(header.magic));
+	header.version = OPD_CAPTURE_VERSION;
+	header.pointer_size = kernel_pointer_size;
+	header.cpu_type = cpu_type;
+	if (fwrite(&header, sizeof(header), 1, capture_file) != 1) {
+		fprintf(stderr, "oprofiled: couldn't write capture file %s\n",
+		        filename);
+		exit(EXIT_FAILURE);
+	}
+}
+
+
+void opd_capture_close(void)
+{
+	if (capture_file)
+		fclose(capture_file);
+	capture_file = NULL;
+}
+
+
+int opd_capturing(void)
+{
+	return capture_file != NULL;
+}
+
+
+void opd_capture_buffer(char const * buf, size_t count)
+{
+	capture_write(OPD_CAPTURE_BUFFER, buf, count, NULL, 0);
+}
+
+
+void opd_capture_cookie(cookie_t cookie, char const * name)
+{
+	u64 value = cookie;
+
+	if (!name)
+		name = "";
+	capture_write(OPD_CAPTURE_COOKIE, &value, sizeof(value),
+	              name, strlen(name) + 1);
+}
+
+
+void opd_capture_maps(pid_t tgid, char const * text, size_t size)
+{
+	u32 value[2] = { tgid, 0 };
+
+	capture_write(OPD_CAPTURE_MAPS, value, sizeof(value), text, size);
+}
+
+
+static unsigned long hash_replay_cookie(cookie_t cookie)
+{
+	return (cookie >> DCOOKIE_SHIFT) & (HASH_SIZE - 1);
+}
+
+
+static void add_replay_cookie(char const * payload, size_t size)
+{
+	struct replay_cookie * entry;
+	u64 cookie;
+
+	if (size <= sizeof(u64) || payload[size - 1] != '\0' ||
+	    size - sizeof(u64) > PATH_MAX) {
+		fprintf(stderr, "oprofiled: invalid cookie in capture file\n");
+		exit(EXIT_FAILURE);
+	}
+
+	memcpy(&cookie, payload, sizeof(cookie));
+	entry = xmalloc(sizeof(struct replay_cookie));
+	entry->cookie = cookie;
+	entry->name = payload + sizeof(u64);
+	if (!*entry->name)
+		entry->name = NULL;
+	list_add(&entry->list, &replay_cookies[hash_replay_cookie(cookie)]);
+}
+
+
+static void add_replay_maps(char const * payload, size_t size)
+{
+	struct list_head * pos;
+	struct replay_maps * entry;
+	u32 tgid;
+	unsigned long hash;
+
+	if (size < 2 * sizeof(u32)) {
+		fprintf(stderr, "oprofiled: invalid maps in capture file\n");
+		exit(EXIT_FAILURE);
+	}
+
+	memcpy(&tgid, payload, sizeof(tgid));
+	hash = tgid & (HASH_SIZE - 1);
+
+	list_for_each(pos, &replay_maps[hash]) {
+		entry = list_entry(pos, struct replay_maps, list);
+		if (entry->tgid == (pid_t)tgid)
+			goto found;
+	}
+
+	entry = xmalloc(sizeof(struct replay_maps));
+	entry->tgid = tgid;
+	entry->nr_texts = 0;
+	entry->next = 0;
+	entry->texts = NULL;
+	entry->sizes = NULL;
+	list_add(&entry->list, &replay_maps[hash]);
+
+found:
+	entry->texts = xrealloc(entry->texts,
+	                        (entry->nr_texts + 1) * sizeof(char const *));
+	entry->sizes = xrealloc(entry->sizes,
+	                        (entry->nr_texts + 1) * sizeof(size_t));
+	entry->texts[entry->nr_texts] = payload + 2 * sizeof(u32);
+	entry->sizes[entry->nr_texts] = size - 2 * sizeof(u32);
+	++entry->nr_texts;
+}
+
+
+/**
+ * Return the record at *offset and advance *offset to the next one, NULL
+ * at the end of the capture. A capture stopped while writing ends with a
+ * truncated record, it is ignored.
+ */
+static struct opd_capture_record const * next_record(size_t * offset)
+{
+	struct opd_capture_record const * rec;
+	size_t left, size;
+
+	if (*offset + sizeof(*rec) > replay_size)
+		return NULL;
+
+	rec = (struct opd_capture_record const *)(replay_base + *offset);
+	left = replay_size - *offset - sizeof(*rec);
+	/* rec->size comes from the file, padding a huge one wraps around */
+	size = ((size_t)rec->size + 7) & ~(size_t)7;
+	if (rec->size > left || size > left) {
+		fprintf(stderr, "oprofiled: ignoring truncated capture record\n");
+		*offset = replay_size;
+		return NULL;
+	}
+
+	*offset += sizeof(*rec) + size;
+	return rec;
+}
+
+
+void opd_replay_open(char const * filename, op_cpu * cpu)
+{
+	struct opd_capture_header const * header;
+	struct opd_capture_record const * rec;
+	struct stat st;
+	size_t offset;
+	size_t i;
+	int fd;
+
+	fd = open(filename, O_RDONLY);
+	if (fd == -1 || fstat(fd, &st)) {
+		fprintf(stderr, "oprofiled: couldn't open capture file %s: %s\n",
+		        filename, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	replay_size = st.st_size;
+	if (replay_size < sizeof(*header)) {
+		fprintf(stderr, "oprofiled: %s is not a capture file\n",
+		        filename);
+		exit(EXIT_FAILURE);
+	}
+
+	replay_base = mmap(NULL, replay_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (replay_base == MAP_FAILED) {
+		perror("oprofiled: couldn't mmap capture file: ");
+		exit(EXIT_FAILURE);
+	}
+
+	header = (struct opd_capture_header const *)replay_base;
+	if (memcmp(header->magic, OPD_CAPTURE_MAGIC, sizeof(header->magic)) ||
+	    header->version != OPD_CAPTURE_VERSION ||
+	    (header->pointer_size != 4 && header->pointer_size != 8)) {
+		fprintf(stderr, "oprofiled: %s is not a capture file of a "
+		        "supported version\n", filename);
+		exit(EXIT_FAILURE);
+	}
+
+	kernel_pointer_size = header->pointer_size;
+	*cpu = header->cpu_type;
+
+	for (i = 0; i < HASH_SIZE; ++i) {
+		list_init(&replay_cookies[i]);
+		list_init(&replay_maps[i]);
+	}
+
+	/* lookups happen while processing, index them all beforehand */
+	offset = sizeof(*header);
+	while ((rec = next_record(&offset))) {
+		if (rec->type == OPD_CAPTURE_COOKIE)
+			add_replay_cookie((char const *)(rec + 1), rec->size);
+		else if (rec->type == OPD_CAPTURE_MAPS)
+			add_replay_maps((char const *)(rec + 1), rec->size);
+	}
+}
+
+
+int opd_replaying(void)
+{
+	return replay_base != NULL;
+}
+
+
+char const * opd_replay_cookie(cookie_t cookie)
+{
+	struct list_head * pos;
+	struct replay_cookie * entry;
+
+	list_for_each(pos, &replay_cookies[hash_replay_cookie(cookie)]) {
+		entry = list_entry(pos, struct replay_cookie, list);
+		if (entry->cookie == cookie)
+			return entry->name;
+	}
+
+	return NULL;
+}
+
+
+char const * opd_replay_maps(pid_t tgid, size_t * size)
+{
+	struct list_head * pos;
+	struct replay_maps * entry;
+
+	list_for_each(pos, &replay_maps[tgid & (HASH_SIZE - 1)]) {
+		entry = list_entry(pos, struct replay_maps, list);
+		if (entry->tgid == tgid) {
+			size_t i = entry->next;
+			if (entry->next + 1 < entry->nr_texts)
+				++entry->next;
+			*size = entry->sizes[i];
+			return entry->texts[i];
+		}
+	}
+
+	return NULL;
+}
+
+
+static unsigned long long replay_entries;
+static struct timeval replay_start;
+static struct timeval replay_end;
+
+
+static void opd_replay_init(void)
+{
+	size_t i;
+
+	opd_create_vmlinux(vmlinux, kernel_range);
+	opd_create_xen(xenimage, xen_range);
+
+	opd_reread_module_info();
+
+	for (i = 0; i < OPD_MAX_STATS; i++)
+		opd_stats[i] = 0;
+
+	cookie_init();
+	sfile_init();
+	anon_init();
+}
+
+
+static void opd_replay_start(void)
+{
+	struct opd_capture_record const * rec;
+	size_t offset = sizeof(struct opd_capture_header);
+
+	gettimeofday(&replay_start, NULL);
+
+	while ((rec = next_record(&offset))) {
+		size_t num;
+
+		if (rec->type != OPD_CAPTURE_BUFFER)
+			continue;
+
+		num = rec->size / kernel_pointer_size;
+		opd_stats[OPD_DUMP_COUNT]++;
+		verbprintf(vmisc, "Replay buffer of %u entries.\n",
+		           (unsigned int)num);
+		opd_process_samples((char const *)(rec + 1), num);
+		replay_entries += num;
+	}
+
+	opd_pipeline_flush();
+	gettimeofday(&replay_end, NULL);
+}
+
+
+static void opd_replay_exit(void)
+{
+	double elapsed;
+
+	sfile_close_files();
+	opd_pipeline_exit();
+
+	elapsed = (replay_end.tv_sec - replay_start.tv_sec) +
+		(replay_end.tv_usec - replay_start.tv_usec) / 1e6;
+
+	opd_print_stats();
+	printf("Replayed %lu buffers, %llu entries in %.3f seconds",
+	       opd_stats[OPD_DUMP_COUNT], replay_entries, elapsed);
+	if (elapsed > 0)
+		printf(", %.0f entries/second", replay_entries / elapsed);
+	printf("\n");
+	fflush(stdout);
+}
+
+
+struct oprofiled_ops opd_replay_ops = {
+	.init = opd_replay_init,
+	.start = opd_replay_start,
+	.exit = opd_replay_exit,
+};
@@ -0,0 +1,111 @@
+/**
+ * @file daemon/opd_capture.h
+ * Capture of the kernel sample buffers and their offline replay
+ *
+ * @remark Copyright 2013 OProfile authors
+ * @remark Read the file COPYING
+ */
+
+#ifndef OPD_CAPTURE_H
+#define OPD_CAPTURE_H
+
+#include "opd_cookie.h"
+#include "op_cpu_type.h"
+#include "op_types.h"
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/*
+ * A capture file is, in native byte order:
+ *
+ * struct opd_capture_header
+ * records, each a struct opd_capture_record followed by size bytes of
+ * payload padded to 8 bytes
+ *
+ * Buffer records hold the buffers read from the kernel, in read order.
+ * The daemon resolves cookies and anonymous mappings through the running
+ * system while processing buffers, so what it got is recorded too: a
+ * cookie record holds a u64 cookie followed by its name, an empty name
+ * for a failed lookup; a maps record holds a u32 tgid, 4 bytes of padding
+ * and the text of /proc/<tgid>/maps as it was read.
+ */
+
+#define OPD_CAPTURE_MAGIC "OPDCAPT"
+#define OPD_CAPTURE_VERSION 1
+
+enum opd_capture_type {
+	OPD_CAPTURE_BUFFER,
+	OPD_CAPTURE_COOKIE,
+	OPD_CAPTURE_MAPS
+};
+
+struct opd_capture_header {
+	char magic[8];
+	u32 version;
+	/** kernel_pointer_size of the buffers */
+	u32 pointer_size;
+	/** an op_cpu */
+	u32 cpu_type;
+	u32 reserved;
+};
+
+struct opd_capture_record {
+	u32 type;
+	u32 size;
+};
+
+/**
+ * opd_capture_open - start capturing to filename
+ *
+ * Failure is fatal.
+ */
+void opd_capture_open(char const * filename);
+
+/** stop capturing */
+void opd_capture_close(void);
+
+/** true if buffers are captured */
+int opd_capturing(void);
+
+/** record a buffer of count bytes read from the kernel */
+void opd_capture_buffer(char const * buf, size_t count);
+
+/** record the result of a cookie lookup, name is NULL if it failed */
+void opd_capture_cookie(cookie_t cookie, char const * name);
+
+/** record the text of /proc/<tgid>/maps */
+void opd_capture_maps(pid_t tgid, char const * text, size_t size);
+
+/**
+ * opd_replay_open - open a capture file to replay
+ * @param filename  the capture file
+ * @param cpu_type  set to the cpu type of the capture
+ *
+ * kernel_pointer_size is set from the capture. Failure is fatal.
+ */
+void opd_replay_open(char const * filename, op_cpu * cpu_type);
+
+/** true if a capture file is replayed */
+int opd_replaying(void);
+
+/**
+ * opd_replay_cookie - the name of a cookie in the replayed capture
+ *
+ * Return NULL if the lookup failed or the cookie was not captured.
+ */
+char const * opd_replay_cookie(cookie_t cookie);
+
+/**
+ * opd_replay_maps - the next maps text captured for tgid
+ * @param size  set to the size of the text
+ *
+ * Maps of a tgid are returned in capture order, the last one is returned
+ * again once they are all used. Return NULL if none were captured.
+ */
+char const * opd_replay_maps(pid_t tgid, size_t * size);
+
+/** daemon operations replaying the capture file */
+extern struct oprofiled_ops opd_replay_ops;
+
+#endif /* OPD_CAPTURE_H */
@@ -10,6 +10,8 @@
 
 #include "opd_cookie.h"
 #include "oprofiled.h"
+#include "opd_capture.h"
+#include "op_string.h"
 #include "op_list.h"
 #include "op_libiberty.h"
 
@@ -18,6 +20,7 @@
 #include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <errno.h>
 
 #ifndef __NR_lookup_dcookie
@@ -87,37 +90,81 @@ static inline int lookup_dcookie(cookie_t cookie, char * buf, size_t size)
 #endif
 
 
-struct cookie_entry {
-	cookie_t value;
+/** a resolved path, shared by the cookies of the same image */
+struct cookie_image {
 	char * name;
+	/** memoized is_image_ignored() */
 	int ignored;
 	struct list_head list;
 };
 
+struct cookie_entry {
+	cookie_t value;
+	/** NULL if the lookup failed */
+	struct cookie_image * image;
+	struct list_head list;
+};
+
 
-#define HASH_SIZE 512
-#define HASH_BITS (HASH_SIZE - 1)
+/* cookies hash, grown when it holds on average more than two per chain */
+#define INITIAL_HASH_SIZE 1024
+#define IMAGE_HASH_SIZE 4096
+
+static struct list_head * hashes;
+static size_t hash_size;
+static size_t nr_cookies;
+static struct cookie_entry * last_entry;
+static struct list_head images[IMAGE_HASH_SIZE];
+
+
+static struct cookie_image * get_image(char const * name)
+{
+	unsigned long hash = op_hash_string(name) & (IMAGE_HASH_SIZE - 1);
+	struct list_head * pos;
+	struct cookie_image * image;
+
+	list_for_each(pos, &images[hash]) {
+		image = list_entry(pos, struct cookie_image, list);
+		if (!strcmp(image->name, name))
+			return image;
+	}
+
+	image = xmalloc(sizeof(struct cookie_image));
+	image->name = xstrdup(name);
+	image->ignored = is_image_ignored(name);
+	list_add(&image->list, &images[hash]);
+	return image;
+}
 
-static struct list_head hashes[HASH_SIZE];
 
 static struct cookie_entry * create_cookie(cookie_t cookie)
 {
 	int err;
+	char name[PATH_MAX + 1];
 	struct cookie_entry * entry = xmalloc(sizeof(struct cookie_entry));
 
 	entry->value = cookie;
-	entry->name = xmalloc(PATH_MAX + 1);
 
-	err = lookup_dcookie(cookie, entry->name, PATH_MAX);
+	if (opd_replaying()) {
+		char const * replay_name = opd_replay_cookie(cookie);
+		err = replay_name ? 0 : -1;
+		errno = replay_name ? 0 : ENOENT;
+		if (replay_name)
+			strcpy(name, replay_name);
+	} else {
+		err = lookup_dcookie(cookie, name, PATH_MAX);
+		if (err >= 0)
+			name[err < PATH_MAX ? err : PATH_MAX] = '\0';
+		if (opd_capturing())
+			opd_capture_cookie(cookie, err < 0 ? NULL : name);
+	}
 
 	if (err < 0) {
 		fprintf(stderr, "Lookup of cookie %llx failed, errno=%d\n",
 		       cookie, errno); 
-		free(entry->name);
-		entry->name = NULL;
-		entry->ignored = 0;
+		entry->image = NULL;
 	} else {
-		entry->ignored = is_image_ignored(entry->name);
+		entry->image = get_image(name);
 	}
 
 	return entry;
@@ -127,59 +174,99 @@ static struct cookie_entry * create_cookie(cookie_t cookie)
 /* Cookie monster want cookie! */
 static unsigned long hash_cookie(cookie_t cookie)
 {
-	return (cookie >> DCOOKIE_SHIFT) & (HASH_SIZE - 1);
+	return (cookie >> DCOOKIE_SHIFT) & (hash_size - 1);
 }
- 
 
-char const * find_cookie(cookie_t cookie)
+
+static void grow_hash(void)
+{
+	struct list_head * old = hashes;
+	size_t old_size = hash_size;
+	size_t i;
+
+	hash_size *= 2;
+	hashes = xmalloc(hash_size * sizeof(struct list_head));
+	for (i = 0; i < hash_size; ++i)
+		list_init(&hashes[i]);
+
+	for (i = 0; i < old_size; ++i) {
+		struct list_head * pos;
+		struct list_head * pos2;
+		list_for_each_safe(pos, pos2, &old[i]) {
+			struct cookie_entry * entry =
+				list_entry(pos, struct cookie_entry, list);
+			list_add(&entry->list, &hashes[hash_cookie(entry->value)]);
+		}
+	}
+
+	free(old);
+}
+
+
+static struct cookie_entry * lookup_cookie(cookie_t cookie)
 {
-	unsigned long hash = hash_cookie(cookie);
 	struct list_head * pos;
 	struct cookie_entry * entry;
 
-	if (cookie == INVALID_COOKIE || cookie == NO_COOKIE)
-		return NULL;
+	/* samples come in runs from the same binary */
+	if (last_entry && last_entry->value == cookie)
+		return last_entry;
 
-	list_for_each(pos, &hashes[hash]) {
+	list_for_each(pos, &hashes[hash_cookie(cookie)]) {
 		entry = list_entry(pos, struct cookie_entry, list);
-		if (entry->value == cookie)
-			goto out;
+		if (entry->value == cookie) {
+			last_entry = entry;
+			return entry;
+		}
 	}
 
-	/* not sure this can ever happen due to is_cookie_ignored */
+	return NULL;
+}
+
+
+static struct cookie_entry * get_cookie(cookie_t cookie)
+{
+	struct cookie_entry * entry = lookup_cookie(cookie);
+
+	if (entry)
+		return entry;
+
 	entry = create_cookie(cookie);
-	list_add(&entry->list, &hashes[hash]);
-out:
-	return entry->name;
+	list_add(&entry->list, &hashes[hash_cookie(cookie)]);
+	if (++nr_cookies > 2 * hash_size)
+		grow_hash();
+	last_entry = entry;
+	return entry;
+}
+ 
+
+char const * find_cookie(cookie_t cookie)
+{
+	struct cookie_entry * entry;
+
+	if (cookie == INVALID_COOKIE || cookie == NO_COOKIE)
+		return NULL;
+
+	/* not sure the creation can ever happen due to is_cookie_ignored */
+	entry = get_cookie(cookie);
+	return entry->image ? entry->image->name : NULL;
 }
 
 
 int is_cookie_ignored(cookie_t cookie)
 {
-	unsigned long hash = hash_cookie(cookie);
-	struct list_head * pos;
 	struct cookie_entry * entry;
 
 	if (cookie == INVALID_COOKIE || cookie == NO_COOKIE)
 		return 1;
 
-	list_for_each(pos, &hashes[hash]) {
-		entry = list_entry(pos, struct cookie_entry, list);
-		if (entry->value == cookie)
-			goto out;
-	}
-
-	entry = create_cookie(cookie);
-	list_add(&entry->list, &hashes[hash]);
-out:
-	return entry->ignored;
+	entry = get_cookie(cookie);
+	return entry->image ? entry->image->ignored : 0;
 }
 
 
 char const * verbose_cookie(cookie_t cookie)
 {
-	unsigned long hash = hash_cookie(cookie);
-	struct list_head * pos;
 	struct cookie_entry * entry;
 
 	if (cookie == INVALID_COOKIE)
@@ -188,16 +275,12 @@ char const * verbose_cookie(cookie_t cookie)
 	if (cookie == NO_COOKIE)
 		return "anonymous";
 
-	list_for_each(pos, &hashes[hash]) {
-		entry = list_entry(pos, struct cookie_entry, list);
-		if (entry->value == cookie) {
-			if (!entry->name)
-				return "failed lookup";
-			return entry->name;
-		}
-	}
-
-	return "not hashed";
+	entry = lookup_cookie(cookie);
+	if (!entry)
+		return "not hashed";
+	if (!entry->image)
+		return "failed lookup";
+	return entry->image->name;
 }
 
 
@@ -205,6 +288,11 @@ void cookie_init(void)
 {
 	size_t i;
 
-	for (i = 0; i < HASH_SIZE; ++i)
+	hash_size = INITIAL_HASH_SIZE;
+	hashes = xmalloc(hash_size * sizeof(struct list_head));
+	for (i = 0; i < hash_size; ++i)
 		list_init(&hashes[i]);
+
+	for (i = 0; i < IMAGE_HASH_SIZE; ++i)
+		list_init(&images[i]);
 }
@@ -19,6 +19,7 @@
 #include "opd_printf.h"
 #include "opd_events.h"
 #include "oprofiled.h"
+#include "opd_pipeline.h"
 
 #include "op_file.h"
 #include "op_sample_file.h"
@@ -179,6 +180,10 @@ retry:
 		goto out;
 	}
 
+	/* an already open file may be grown by its writer meanwhile */
+	if (odb_open_count(file) > 1)
+		opd_pipeline_flush_file(file);
+
 	if (!sf->kernel)
 		binary = find_cookie(sf->cookie);
 	else
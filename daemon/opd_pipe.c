@@ -51,7 +51,15 @@ void opd_close_pipe(void)
 {
 	if (fifo_fd)
 		fclose(fifo_fd);
-	close(fifo);
+	else
+		close(fifo);
+	fifo_fd = NULL;
+}
+
+
+int opd_pipe_fd(void)
+{
+	return fifo;
 }
 
 
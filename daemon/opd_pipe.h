@@ -33,6 +33,14 @@ void opd_open_pipe(void);
  */
 void opd_close_pipe(void);
 
+/**
+ * opd_pipe_fd - the file descriptor of the opened fifo
+ *
+ * For polling the fifo, the requests must be read with
+ * is_jitconv_requested().
+ */
+int opd_pipe_fd(void);
+
 /**
  * is_jitconv_requested - check for request to jit conversion
  *
@@ -0,0 +1,273 @@
+/**
+ * @file daemon/opd_pipeline.c
+ * Sample file updates handed off to writer threads
+ *
+ * The thread processing the buffers decodes them, looks up the sample
+ * files and queues the updates in batches. A sample file is owned by the
+ * writer its mapped data hashes to, updates of a file are thus done in
+ * order by a single thread. Opening, closing or syncing a file happens on
+ * the processing thread once the writer owning it is idle.
+ *
+ * @remark Copyright 2013 OProfile authors
+ * @remark Read the file COPYING
+ */
+
+#include "opd_pipeline.h"
+#include "opd_printf.h"
+
+#include "op_libiberty.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BATCH_SIZE 4096
+#define MAX_WRITERS 64
+
+struct update {
+	odb_t * file;
+	odb_key_t key;
+	unsigned long count;
+};
+
+struct batch {
+	struct batch * next;
+	size_t nr;
+	struct update updates[BATCH_SIZE];
+};
+
+struct writer {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	/** signaled when a batch is queued or the writer must stop */
+	pthread_cond_t work;
+	/** signaled when the queue is drained */
+	pthread_cond_t idle;
+	/** queued batches, under lock */
+	struct batch * head;
+	struct batch * tail;
+	/** batches done, reused for new updates, under lock */
+	struct batch * free_list;
+	/** batch filled by the processing thread, not queued yet */
+	struct batch * current;
+	int busy;
+	int stop;
+};
+
+static struct writer * writers;
+static int nr_writers;
+
+
+static void apply_batch(struct batch const * b)
+{
+	size_t i;
+
+	for (i = 0; i < b->nr; ++i) {
+		struct update const * u = &b->updates[i];
+		int err = odb_update_node_with_offset(u->file, u->key,
+		                                      u->count);
+		if (err) {
+			fprintf(stderr, "%s: %s\n", __FUNCTION__, strerror(err));
+			abort();
+		}
+	}
+}
+
+
+static void * writer_thread(void * arg)
+{
+	struct writer * w = arg;
+	struct batch * b;
+
+	pthread_mutex_lock(&w->lock);
+	for (;;) {
+		while (!w->head && !w->stop)
+			pthread_cond_wait(&w->work, &w->lock);
+		if (!w->head)
+			break;
+
+		b = w->head;
+		w->head = b->next;
+		if (!w->head)
+			w->tail = NULL;
+		w->busy = 1;
+		pthread_mutex_unlock(&w->lock);
+
+		apply_batch(b);
+
+		pthread_mutex_lock(&w->lock);
+		b->next = w->free_list;
+		w->free_list = b;
+		w->busy = 0;
+		if (!w->head)
+			pthread_cond_broadcast(&w->idle);
+	}
+	pthread_mutex_unlock(&w->lock);
+
+	return NULL;
+}
+
+
+void opd_pipeline_init(int nr)
+{
+	sigset_t mask, orig_mask;
+	int i;
+
+	if (nr <= 0)
+		return;
+	if (nr > MAX_WRITERS)
+		nr = MAX_WRITERS;
+
+	/* signals are for the main loop, the writers inherit this mask */
+	sigfillset(&mask);
+	pthread_sigmask(SIG_BLOCK, &mask, &orig_mask);
+
+	writers = xcalloc(nr, sizeof(struct writer));
+	for (i = 0; i < nr; ++i) {
+		struct writer * w = &writers[i];
+		pthread_mutex_init(&w->lock, NULL);
+		pthread_cond_init(&w->work, NULL);
+		pthread_cond_init(&w->idle, NULL);
+		if (pthread_create(&w->thread, NULL, writer_thread, w)) {
+			perror("oprofiled: couldn't start sample file writer, "
+			       "writing sample files directly: ");
+			break;
+		}
+	}
+
+	pthread_sigmask(SIG_SETMASK, &orig_mask, NULL);
+
+	nr_writers = i;
+	if (!nr_writers) {
+		free(writers);
+		writers = NULL;
+	}
+
+	verbprintf(vmisc, "%d sample file writer threads\n", nr_writers);
+}
+
+
+int opd_pipeline_active(void)
+{
+	return nr_writers != 0;
+}
+
+
+static void submit(struct writer * w)
+{
+	struct batch * b = w->current;
+
+	w->current = NULL;
+	b->next = NULL;
+
+	pthread_mutex_lock(&w->lock);
+	if (w->tail)
+		w->tail->next = b;
+	else
+		w->head = b;
+	w->tail = b;
+	pthread_cond_signal(&w->work);
+	pthread_mutex_unlock(&w->lock);
+}
+
+
+static struct writer * file_owner(odb_t const * file)
+{
+	/* the data is shared by every odb_t opened on the same file */
+	return &writers[((unsigned long)file->data >> 4) % nr_writers];
+}
+
+
+void opd_pipeline_update(odb_t * file, odb_key_t key, unsigned long count)
+{
+	struct writer * w = file_owner(file);
+	struct update * u;
+
+	if (!w->current) {
+		pthread_mutex_lock(&w->lock);
+		w->current = w->free_list;
+		if (w->current)
+			w->free_list = w->current->next;
+		pthread_mutex_unlock(&w->lock);
+		if (!w->current)
+			w->current = xmalloc(sizeof(struct batch));
+		w->current->nr = 0;
+	}
+
+	u = &w->current->updates[w->current->nr++];
+	u->file = file;
+	u->key = key;
+	u->count = count;
+
+	if (w->current->nr == BATCH_SIZE)
+		submit(w);
+}
+
+
+static void wait_idle(struct writer * w)
+{
+	pthread_mutex_lock(&w->lock);
+	while (w->head || w->busy)
+		pthread_cond_wait(&w->idle, &w->lock);
+	pthread_mutex_unlock(&w->lock);
+}
+
+
+void opd_pipeline_flush(void)
+{
+	int i;
+
+	for (i = 0; i < nr_writers; ++i) {
+		if (writers[i].current && writers[i].current->nr)
+			submit(&writers[i]);
+	}
+
+	for (i = 0; i < nr_writers; ++i)
+		wait_idle(&writers[i]);
+}
+
+
+void opd_pipeline_flush_file(odb_t const * file)
+{
+	struct writer * w;
+
+	/* never opened or already closed, no update can be queued */
+	if (!nr_writers || !file->data)
+		return;
+
+	w = file_owner(file);
+	if (w->current && w->current->nr)
+		submit(w);
+	wait_idle(w);
+}
+
+
+void opd_pipeline_exit(void)
+{
+	int i;
+
+	opd_pipeline_flush();
+
+	for (i = 0; i < nr_writers; ++i) {
+		struct writer * w = &writers[i];
+		struct batch * b;
+
+		pthread_mutex_lock(&w->lock);
+		w->stop = 1;
+		pthread_cond_signal(&w->work);
+		pthread_mutex_unlock(&w->lock);
+		pthread_join(w->thread, NULL);
+
+		while ((b = w->free_list)) {
+			w->free_list = b->next;
+			free(b);
+		}
+		free(w->current);
+	}
+
+	free(writers);
+	writers = NULL;
+	nr_writers = 0;
+}
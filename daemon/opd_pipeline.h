@@ -0,0 +1,54 @@
+/**
+ * @file daemon/opd_pipeline.h
+ * Sample file updates handed off to writer threads
+ *
+ * @remark Copyright 2013 OProfile authors
+ * @remark Read the file COPYING
+ */
+
+#ifndef OPD_PIPELINE_H
+#define OPD_PIPELINE_H
+
+#include "odb.h"
+
+/**
+ * opd_pipeline_init - start the writer threads
+ * @param nr_writers  number of writer threads, 0 to update sample files
+ *  from the thread processing the buffers
+ *
+ * Each sample file is owned by one writer, so a file is never updated
+ * concurrently and the writers need no locking. Failure to start the
+ * threads is not fatal, sample files are then updated directly.
+ */
+void opd_pipeline_init(int nr_writers);
+
+/** true if sample file updates go to the writer threads */
+int opd_pipeline_active(void);
+
+/**
+ * opd_pipeline_update - queue count samples at key in file
+ *
+ * The update is done by the writer owning file, some time before the
+ * next opd_pipeline_flush() returns.
+ */
+void opd_pipeline_update(odb_t * file, odb_key_t key, unsigned long count);
+
+/**
+ * opd_pipeline_flush - wait until every queued update is done
+ *
+ * Must be called before sample files are synced.
+ */
+void opd_pipeline_flush(void);
+
+/**
+ * opd_pipeline_flush_file - wait until the queued updates of file are done
+ *
+ * Only the writer owning file is waited for. Must be called before the
+ * file is closed, or its mapping is touched by the processing thread.
+ */
+void opd_pipeline_flush_file(odb_t const * file);
+
+/** flush and stop the writer threads */
+void opd_pipeline_exit(void);
+
+#endif /* OPD_PIPELINE_H */
@@ -18,6 +18,8 @@
 #include "opd_printf.h"
 #include "opd_stats.h"
 #include "opd_extended.h"
+#include "opd_pipeline.h"
+#include "opd_sync.h"
 #include "oprofiled.h"
 
 #include "op_libiberty.h"
@@ -227,6 +229,7 @@ create_sfile(unsigned long hash, struct transient const * trans,
 	sf->cpu = 0;
 	sf->kernel = ki;
 	sf->anon = trans->anon;
+	sf->dirty = 0;
 
 	for (i = 0 ; i < op_nr_counters ; ++i)
 		odb_init(&sf->files[i]);
@@ -385,6 +388,7 @@ void sfile_dup(struct sfile * to, struct sfile * from)
 	size_t i;
 
 	memcpy(to, from, sizeof (struct sfile));
+	to->dirty = 0;
 
 	for (i = 0 ; i < op_nr_counters ; ++i)
 		odb_init(&to->files[i]);
@@ -408,6 +412,8 @@ static odb_t * get_file(struct transient const * trans, int is_cg)
 	unsigned long hash;
 	odb_t * file;
 
+	sf->dirty = 1;
+
 	if ((trans->ext) != NULL)
 		return opd_ext_sfile_get(trans, is_cg);
 
@@ -430,6 +436,7 @@ static odb_t * get_file(struct transient const * trans, int is_cg)
 	list_for_each(pos, &sf->cg_hash[hash]) {
 		cg = list_entry(pos, struct cg_entry, hash);
 		if (sfile_equal(last, &cg->to)) {
+			cg->to.dirty = 1;
 			file = &cg->to.files[trans->event];
 			goto open;
 		}
@@ -437,6 +444,7 @@ static odb_t * get_file(struct transient const * trans, int is_cg)
 
 	cg = xmalloc(sizeof(struct cg_entry));
 	sfile_dup(&cg->to, last);
+	cg->to.dirty = 1;
 	list_add(&cg->hash, &sf->cg_hash[hash]);
 	file = &cg->to.files[trans->event];
 
@@ -523,6 +531,11 @@ static void sfile_log_arc(struct transient const * trans)
 	key = to & (0xffffffff);
 	key |= ((uint64_t)from) << 32;
 
+	if (opd_pipeline_active()) {
+		opd_pipeline_update(file, key, 1);
+		return;
+	}
+
 	err = odb_update_node(file, key);
 	if (err) {
 		fprintf(stderr, "%s: %s\n", __FUNCTION__, strerror(err));
@@ -569,6 +582,11 @@ void sfile_log_sample_count(struct transient const * trans,
 		return;
 	}
 
+	if (opd_pipeline_active()) {
+		opd_pipeline_update(file, (odb_key_t)pc, count);
+		return;
+	}
+
 	err = odb_update_node_with_offset(file,
 					  (odb_key_t)pc,
 					  count);
@@ -595,6 +613,17 @@ static int close_sfile(struct sfile * sf, void * data __attribute__((unused)))
 
 static void kill_sfile(struct sfile * sf)
 {
+	size_t i;
+
+	/* the owning writers must be done with the files before they go,
+	 * the extended files are private to their handlers */
+	if (sf->ext_files) {
+		opd_pipeline_flush();
+	} else {
+		for (i = 0; i < op_nr_counters; ++i)
+			opd_pipeline_flush_file(&sf->files[i]);
+	}
+
 	close_sfile(sf, NULL);
 	list_del(&sf->hash);
 	list_del(&sf->lru);
@@ -605,8 +634,16 @@ static int sync_sfile(struct sfile * sf, void * data __attribute__((unused)))
 {
 	size_t i;
 
-	for (i = 0; i < op_nr_counters; ++i)
-		odb_sync(&sf->files[i]);
+	if (!sf->dirty)
+		return 0;
+	sf->dirty = 0;
+
+	for (i = 0; i < op_nr_counters; ++i) {
+		if (opd_sync_active())
+			opd_sync_add(&sf->files[i]);
+		else
+			odb_sync(&sf->files[i]);
+	}
 
 	opd_ext_sfile_sync(sf);
 
@@ -660,6 +697,9 @@ static void for_each_sfile(sfile_func func, void * data)
 	struct list_head * pos;
 	struct list_head * pos2;
 
+	/* the files are closed or synced below */
+	opd_pipeline_flush();
+
 	list_for_each_safe(pos, pos2, &lru_list) {
 		struct sfile * sf = list_entry(pos, struct sfile, lru);
 		for_one_sfile(sf, func, data);
@@ -682,6 +722,7 @@ void sfile_clear_anon(struct anon_mapping * anon)
 void sfile_sync_files(void)
 {
 	for_each_sfile(sync_sfile, NULL);
+	opd_sync_submit();
 }
 
 
@@ -60,6 +60,8 @@ struct sfile {
 	struct list_head lru;
 	/** true if this file should be ignored in profiles */
 	int ignored;
+	/** true if samples were logged since the last sync */
+	int dirty;
 	/** opened sample files */
 	odb_t files[OP_MAX_COUNTERS];
 	/** extended sample files */
@@ -84,7 +86,10 @@ struct anon_mapping;
 /** clear any sfiles for the given anon mapping */
 void sfile_clear_anon(struct anon_mapping *);
 
-/** sync sample files */
+/**
+ * sync sample files updated since the last sync, by the sync thread if it
+ * runs
+ */
 void sfile_sync_files(void);
 
 /** close sample files */
@@ -54,6 +54,10 @@ void opd_print_stats(void)
 		opd_stats[OPD_LOST_NO_MAPPING]);
 	printf("Nr. user context kernel samples lost due to no app info available: %lu\n",
 	       opd_stats[OPD_NO_APP_KERNEL_SAMPLE]);
+	printf("Nr. anon mapping cache hits: %lu\n",
+	       opd_stats[OPD_ANON_CACHE_HIT]);
+	printf("Nr. anon mapping cache misses: %lu\n",
+	       opd_stats[OPD_ANON_CACHE_MISS]);
 	print_if("Nr. samples lost due to buffer overflow: %u\n",
 	       "/dev/oprofile/stats", "event_lost_overflow", 1);
 	print_if("Nr. samples lost due to no mapping: %u\n",
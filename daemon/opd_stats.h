@@ -24,6 +24,8 @@ enum {	OPD_SAMPLES, /**< nr. samples */
 	OPD_DUMP_COUNT, /**< nr. of times buffer is read */
 	OPD_DANGLING_CODE, /**< nr. partial code notifications (buffer overflow */
 	OPD_NO_APP_KERNEL_SAMPLE, /**<nr. user ctx kernel samples dropped due to no app cookie available */
+	OPD_ANON_CACHE_HIT, /**< nr. anon lookups found in the cache */
+	OPD_ANON_CACHE_MISS, /**< nr. anon lookups which read /proc maps */
 	OPD_MAX_STATS /**< end of stats */
 };
 
@@ -0,0 +1,197 @@
+/**
+ * @file daemon/opd_sync.c
+ * Background syncing of the sample files
+ *
+ * The thread processing the buffers only records the files to sync, the
+ * sync thread starts their writeback one file at a time, as msync() with
+ * MS_ASYNC does. The daemon never stops reading the kernel buffer to wait
+ * on the disk.
+ *
+ * Files are recorded with a dup() of their descriptor, not their mapping:
+ * the writers can grow a file and the processing thread can close it while
+ * its sync is queued, the descriptor stays valid through both.
+ *
+ * @remark Copyright 2013 OProfile authors
+ * @remark Read the file COPYING
+ */
+
+#define _GNU_SOURCE
+
+#include "opd_sync.h"
+#include "opd_printf.h"
+
+#include "op_libiberty.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/*
+ * Descriptors queued at most, the daemon relies on EMFILE to evict sample
+ * files and must not run out of them because of us. Files beyond this are
+ * synced by the caller.
+ */
+#define MAX_QUEUED_FILES 256
+
+struct sync_file {
+	int fd;
+	size_t size;
+};
+
+struct sync_list {
+	struct sync_file * files;
+	size_t nr;
+	size_t max;
+};
+
+static pthread_t sync_thread;
+static pthread_mutex_t sync_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sync_cond = PTHREAD_COND_INITIALIZER;
+static int running;
+/** under sync_lock */
+static int stop;
+/** handed to the thread, under sync_lock */
+static struct sync_list submitted;
+/** descriptors not closed yet by the thread, under sync_lock */
+static size_t nr_queued;
+/** filled by opd_sync_add() */
+static struct sync_list pending;
+
+
+static void * sync_main(void * arg __attribute__((unused)))
+{
+	struct sync_list list;
+	size_t i;
+
+	pthread_mutex_lock(&sync_lock);
+	for (;;) {
+		while (!submitted.nr && !stop)
+			pthread_cond_wait(&sync_cond, &sync_lock);
+		/* what was submitted before the stop is still synced */
+		if (!submitted.nr)
+			break;
+
+		list = submitted;
+		submitted.files = NULL;
+		submitted.nr = submitted.max = 0;
+		pthread_mutex_unlock(&sync_lock);
+
+		for (i = 0; i < list.nr; ++i) {
+			sync_file_range(list.files[i].fd, 0, list.files[i].size,
+			                SYNC_FILE_RANGE_WRITE);
+			close(list.files[i].fd);
+		}
+
+		verbprintf(vsfile, "Synced %lu sample files.\n",
+		           (unsigned long)list.nr);
+		free(list.files);
+
+		pthread_mutex_lock(&sync_lock);
+		nr_queued -= list.nr;
+	}
+	pthread_mutex_unlock(&sync_lock);
+
+	return NULL;
+}
+
+
+void opd_sync_init(void)
+{
+	if (pthread_create(&sync_thread, NULL, sync_main, NULL)) {
+		perror("oprofiled: couldn't start sync thread: ");
+		return;
+	}
+	running = 1;
+}
+
+
+int opd_sync_active(void)
+{
+	return running;
+}
+
+
+void opd_sync_add(odb_t const * file)
+{
+	struct sync_file sync;
+	int full;
+
+	pthread_mutex_lock(&sync_lock);
+	full = nr_queued >= MAX_QUEUED_FILES;
+	if (!full)
+		++nr_queued;
+	pthread_mutex_unlock(&sync_lock);
+
+	sync.fd = full ? -1 : odb_dup_fd(file, &sync.size);
+	if (sync.fd == -1) {
+		if (!full) {
+			pthread_mutex_lock(&sync_lock);
+			--nr_queued;
+			pthread_mutex_unlock(&sync_lock);
+		}
+		odb_sync(file);
+		return;
+	}
+
+	if (pending.nr == pending.max) {
+		pending.max = pending.max ? pending.max * 2 : 256;
+		pending.files = xrealloc(pending.files,
+		                 pending.max * sizeof(struct sync_file));
+	}
+	pending.files[pending.nr++] = sync;
+}
+
+
+void opd_sync_submit(void)
+{
+	size_t i;
+
+	if (!pending.nr)
+		return;
+
+	pthread_mutex_lock(&sync_lock);
+	if (!submitted.nr) {
+		submitted = pending;
+		pending.files = NULL;
+		pending.max = 0;
+	} else {
+		/* the thread is late, the new files go after the others */
+		for (i = 0; i < pending.nr; ++i) {
+			if (submitted.nr == submitted.max) {
+				submitted.max *= 2;
+				submitted.files = xrealloc(submitted.files,
+				         submitted.max * sizeof(struct sync_file));
+			}
+			submitted.files[submitted.nr++] = pending.files[i];
+		}
+	}
+	pthread_cond_signal(&sync_cond);
+	pthread_mutex_unlock(&sync_lock);
+
+	pending.nr = 0;
+}
+
+
+void opd_sync_exit(void)
+{
+	if (!running)
+		return;
+
+	/* the thread syncs everything submitted before it stops */
+	opd_sync_submit();
+
+	pthread_mutex_lock(&sync_lock);
+	stop = 1;
+	pthread_cond_signal(&sync_cond);
+	pthread_mutex_unlock(&sync_lock);
+	pthread_join(sync_thread, NULL);
+	running = 0;
+
+	free(submitted.files);
+	free(pending.files);
+	submitted.files = pending.files = NULL;
+	submitted.nr = submitted.max = 0;
+	pending.nr = pending.max = 0;
+}
@@ -0,0 +1,38 @@
+/**
+ * @file daemon/opd_sync.h
+ * Background syncing of the sample files
+ *
+ * @remark Copyright 2013 OProfile authors
+ * @remark Read the file COPYING
+ */
+
+#ifndef OPD_SYNC_H
+#define OPD_SYNC_H
+
+#include "odb.h"
+
+/**
+ * opd_sync_init - start the sync thread
+ *
+ * Failure to start it is not fatal, sample files are then synced by the
+ * caller of sfile_sync_files().
+ */
+void opd_sync_init(void);
+
+/** true if the sync thread runs */
+int opd_sync_active(void);
+
+/** add file to the files synced at the next opd_sync_submit() */
+void opd_sync_add(odb_t const * file);
+
+/**
+ * opd_sync_submit - hand the added files over to the sync thread
+ *
+ * Files of a previous submit not synced yet are synced first.
+ */
+void opd_sync_submit(void);
+
+/** sync the files added and not synced yet, then stop the sync thread */
+void opd_sync_exit(void);
+
+#endif /* OPD_SYNC_H */
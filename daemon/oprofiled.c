@@ -18,6 +18,8 @@
 #include "opd_printf.h"
 #include "opd_events.h"
 #include "opd_extended.h"
+#include "opd_capture.h"
+#include "opd_pipeline.h"
 
 #include "op_config.h"
 #include "op_version.h"
@@ -76,6 +78,9 @@ static char * binary_name_filter;
 static char * events;
 static char * ext_feature;
 static int showvers;
+static char * capture;
+static char * replay;
+static int nr_writers;
 static struct oprofiled_ops * opd_ops;
 extern struct oprofiled_ops opd_26_ops;
 
@@ -98,6 +103,9 @@ static struct poptOption options[] = {
 	{ "version", 'v', POPT_ARG_NONE, &showvers, 0, "show version", NULL, },
 	{ "verbose", 'V', POPT_ARG_STRING, &verbose, 0, "be verbose in log file", "all,sfile,arcs,samples,module,misc", },
 	{ "ext-feature", 'x', POPT_ARG_STRING, &ext_feature, 1, "enable extended feature", "<extended-feature-name>:[args]", },
+	{ "capture", 0, POPT_ARG_STRING, &capture, 0, "record the sample buffers read to file", "file", },
+	{ "replay", 0, POPT_ARG_STRING, &replay, 0, "process the buffers recorded in file into --session-dir then exit", "file", },
+	{ "writers", 0, POPT_ARG_INT, &nr_writers, 0, "number of threads writing sample files", "num", },
 	POPT_AUTOHELP
 	{ NULL, 0, 0, NULL, 0, NULL, NULL, },
 };
@@ -409,7 +417,23 @@ static void opd_options(int argc, char const * argv[])
 	if (separate_kernel)
 		separate_lib = 1;
 
-	cpu_type = op_get_cpu_type();
+	if (capture && replay) {
+		fprintf(stderr, "oprofiled: --capture and --replay are "
+		        "exclusive.\n");
+		exit(EXIT_FAILURE);
+	}
+
+	/* a replay must not write over the samples of the live session */
+	if (replay && (!session_dir || !strcmp("", session_dir))) {
+		fprintf(stderr, "oprofiled: --replay needs --session-dir.\n");
+		poptPrintHelp(optcon, stderr, 0);
+		exit(EXIT_FAILURE);
+	}
+
+	if (replay)
+		opd_replay_open(replay, &cpu_type);
+	else
+		cpu_type = op_get_cpu_type();
 	op_nr_counters = op_get_nr_counters(cpu_type);
 
 	if (!no_vmlinux) {
@@ -509,14 +533,27 @@ int main(int argc, char const * argv[])
 
 	opd_write_abi();
 
+	if (replay) {
+		opd_ops = &opd_replay_ops;
+		opd_ops->init();
+		opd_pipeline_init(nr_writers);
+		opd_ops->start();
+		opd_ops->exit();
+		return 0;
+	}
+
 	opd_ops = get_ops();
 
 	opd_ops->init();
 
+	/* kernel_pointer_size is known once the interface is set up */
+	if (capture)
+		opd_capture_open(capture);
+
 	opd_go_daemon();
 
-	/* clean up every 10 minutes */
-	alarm(60 * 10);
+	/* fork() only keeps the calling thread, start them afterwards */
+	opd_pipeline_init(nr_writers);
 
 	if (op_write_lock_file(op_lock_file)) {
 		fprintf(stderr, "oprofiled: could not create lock file %s\n",
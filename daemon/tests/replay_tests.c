@@ -0,0 +1,309 @@
+/**
+ * @file daemon/tests/replay_tests.c
+ * Replay a capture through oprofiled and check the sample files
+ *
+ * @remark Copyright 2013 OProfile authors
+ * @remark Read the file COPYING
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include "opd_capture.h"
+#include "opd_interface.h"
+#include "op_sample_file.h"
+#include "odb.h"
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <ftw.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define OPROFILED "../oprofiled"
+#define EVENTS "CYCLES:0x76:0:100000:0:1:1"
+#define EVENT_FILE "CYCLES.100000.0.all.all.all"
+
+#define APP_COOKIE 0x1080
+#define APP_NAME "/replay/app"
+#define TGID 4242
+/* a process gone before its maps could be read */
+#define GONE_TGID 4343
+#define HEAP_START 0x600000
+#define HEAP_END 0x601000
+#define HEAP_MAPS "00600000-00601000 rw-p 00000000 00:00 0 [heap]\n"
+
+#define ESCAPE_CODE (~0UL)
+
+struct expected {
+	odb_key_t key;
+	odb_value_t value;
+};
+
+/* sorted by key */
+static struct expected const app_samples[] = {
+	{ 0x400, 3 }, { 0x800, 1 }, { 0, 0 }
+};
+
+static struct expected const heap_samples[] = {
+	{ 0x10, 2 }, { 0, 0 }
+};
+
+static int nr_error;
+
+
+static void write_record(FILE * fp, u32 type, void const * a, size_t a_size,
+                         void const * b, size_t b_size)
+{
+	static char const pad[8];
+	struct opd_capture_record rec;
+
+	rec.type = type;
+	rec.size = a_size + b_size;
+	fwrite(&rec, sizeof(rec), 1, fp);
+	fwrite(a, a_size, 1, fp);
+	if (b_size)
+		fwrite(b, b_size, 1, fp);
+	fwrite(pad, (8 - (rec.size & 7)) & 7, 1, fp);
+}
+
+
+/**
+ * The fixture: one process sampled in its binary and in its heap, and the
+ * anonymous samples of a process without maps, which are lost. This is
+ * what the kernel buffer would show on a native build. With bad_tail, the
+ * capture ends with a record whose size is past the end of the file and
+ * wraps around when padded, it must be ignored.
+ */
+static void write_capture(char const * filename, int bad_tail)
+{
+	unsigned long const buffer[] = {
+		ESCAPE_CODE, CPU_SWITCH_CODE, 0,
+		ESCAPE_CODE, CTX_SWITCH_CODE, TGID, APP_COOKIE,
+		ESCAPE_CODE, CTX_TGID_CODE, TGID,
+		ESCAPE_CODE, USER_ENTER_SWITCH_CODE,
+		ESCAPE_CODE, COOKIE_SWITCH_CODE, APP_COOKIE,
+		0x400, 0, 0x800, 0, 0x400, 0,
+		ESCAPE_CODE, COOKIE_SWITCH_CODE, NO_COOKIE,
+		HEAP_START + 0x10, 0, HEAP_START + 0x10, 0,
+		ESCAPE_CODE, COOKIE_SWITCH_CODE, APP_COOKIE,
+		0x400, 0,
+		ESCAPE_CODE, CTX_SWITCH_CODE, GONE_TGID, APP_COOKIE,
+		ESCAPE_CODE, CTX_TGID_CODE, GONE_TGID,
+		ESCAPE_CODE, COOKIE_SWITCH_CODE, NO_COOKIE,
+		HEAP_START, 0, HEAP_START, 0,
+	};
+	struct opd_capture_header header;
+	u64 cookie = APP_COOKIE;
+	u32 tgid[2] = { TGID, 0 };
+	FILE * fp;
+
+	fp = fopen(filename, "w");
+	if (!fp) {
+		perror(filename);
+		exit(EXIT_FAILURE);
+	}
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, OPD_CAPTURE_MAGIC, sizeof(header.magic));
+	header.version = OPD_CAPTURE_VERSION;
+	header.pointer_size = sizeof(unsigned long);
+	header.cpu_type = CPU_ATHLON;
+	fwrite(&header, sizeof(header), 1, fp);
+
+	write_record(fp, OPD_CAPTURE_COOKIE, &cookie, sizeof(cookie),
+	             APP_NAME, sizeof(APP_NAME));
+	write_record(fp, OPD_CAPTURE_MAPS, tgid, sizeof(tgid),
+	             HEAP_MAPS, strlen(HEAP_MAPS));
+	write_record(fp, OPD_CAPTURE_BUFFER, buffer, sizeof(buffer), NULL, 0);
+
+	if (bad_tail) {
+		struct opd_capture_record rec;
+
+		rec.type = OPD_CAPTURE_BUFFER;
+		rec.size = 0xfffffff9;
+		fwrite(&rec, sizeof(rec), 1, fp);
+		fwrite(buffer, sizeof(buffer), 1, fp);
+	}
+
+	if (fclose(fp)) {
+		perror(filename);
+		exit(EXIT_FAILURE);
+	}
+}
+
+
+static void replay(char const * capture, char const * session_dir,
+                   int nr_writers)
+{
+	char capture_arg[PATH_MAX + 16];
+	char session_arg[PATH_MAX + 16];
+	char writers_arg[32];
+	char log[PATH_MAX];
+	int status;
+	pid_t pid;
+
+	snprintf(capture_arg, sizeof(capture_arg), "--replay=%s", capture);
+	snprintf(session_arg, sizeof(session_arg), "--session-dir=%s",
+	         session_dir);
+	snprintf(writers_arg, sizeof(writers_arg), "--writers=%d", nr_writers);
+	snprintf(log, sizeof(log), "%s/log", session_dir);
+
+	pid = fork();
+	if (pid == -1) {
+		perror("fork");
+		exit(EXIT_FAILURE);
+	}
+
+	if (!pid) {
+		int fd = open(log, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (fd == -1 || dup2(fd, 1) == -1) {
+			perror(log);
+			_exit(EXIT_FAILURE);
+		}
+		execl(OPROFILED, OPROFILED, capture_arg, session_arg,
+		      writers_arg, "--no-vmlinux", "--events=" EVENTS,
+		      (char *)NULL);
+		perror(OPROFILED);
+		_exit(EXIT_FAILURE);
+	}
+
+	if (waitpid(pid, &status, 0) == -1 ||
+	    !WIFEXITED(status) || WEXITSTATUS(status)) {
+		fprintf(stderr, "%s failed to replay with %d writers, "
+		        "see %s\n", OPROFILED, nr_writers, log);
+		exit(EXIT_FAILURE);
+	}
+}
+
+
+static int compare_node(void const * lhs, void const * rhs)
+{
+	odb_node_t const * a = lhs;
+	odb_node_t const * b = rhs;
+
+	if (a->key != b->key)
+		return a->key < b->key ? -1 : 1;
+	return 0;
+}
+
+
+static void check_samples(char const * filename,
+                          struct expected const * expected)
+{
+	odb_node_nr_t nr_nodes, i;
+	odb_node_t * nodes;
+	odb_t file;
+	int err;
+
+	odb_init(&file);
+	err = odb_open(&file, filename, ODB_RDONLY, sizeof(struct opd_header));
+	if (err) {
+		fprintf(stderr, "can't open %s: %s\n", filename, strerror(err));
+		++nr_error;
+		return;
+	}
+
+	/* the iterator array is the mapping, sort a copy */
+	nodes = odb_get_iterator(&file, &nr_nodes);
+	nodes = memcpy(malloc(nr_nodes * sizeof(odb_node_t)), nodes,
+	               nr_nodes * sizeof(odb_node_t));
+	qsort(nodes, nr_nodes, sizeof(odb_node_t), compare_node);
+
+	for (i = 0; i < nr_nodes && expected[i].value; ++i) {
+		if (nodes[i].key != expected[i].key ||
+		    nodes[i].value != expected[i].value)
+			break;
+	}
+
+	if (i != nr_nodes || expected[i].value) {
+		fprintf(stderr, "%s: unexpected samples\n", filename);
+		for (i = 0; i < nr_nodes; ++i)
+			fprintf(stderr, "\t0x%llx: %u\n",
+			        (unsigned long long)nodes[i].key,
+			        (unsigned int)nodes[i].value);
+		++nr_error;
+	}
+
+	free(nodes);
+	odb_close(&file);
+}
+
+
+static void check_session(char const * session_dir)
+{
+	char filename[PATH_MAX];
+	char heap[64];
+
+	snprintf(filename, sizeof(filename),
+	         "%s/samples/current/{root}%s/{dep}/{root}%s/" EVENT_FILE,
+	         session_dir, APP_NAME, APP_NAME);
+	check_samples(filename, app_samples);
+
+	snprintf(heap, sizeof(heap), "%d.0x%x.0x%x",
+	         TGID, HEAP_START, HEAP_END);
+	snprintf(filename, sizeof(filename),
+	         "%s/samples/current/{root}%s/{dep}/{anon:[heap]}/%s/"
+	         EVENT_FILE, session_dir, APP_NAME, heap);
+	check_samples(filename, heap_samples);
+}
+
+
+static int remove_entry(char const * path,
+                        struct stat const * st __attribute__((unused)),
+                        int flag __attribute__((unused)),
+                        struct FTW * ftw __attribute__((unused)))
+{
+	return remove(path);
+}
+
+
+int main(void)
+{
+	static int const nr_writers[] = { 0, 2 };
+	char dir[] = "replay-test-XXXXXX";
+	char capture[PATH_MAX];
+	char bad_capture[PATH_MAX];
+	char session_dir[PATH_MAX];
+	size_t i;
+
+	if (!mkdtemp(dir)) {
+		perror("mkdtemp");
+		return EXIT_FAILURE;
+	}
+
+	snprintf(capture, sizeof(capture), "%s/capture", dir);
+	write_capture(capture, 0);
+	snprintf(bad_capture, sizeof(bad_capture), "%s/bad-capture", dir);
+	write_capture(bad_capture, 1);
+
+	/* the writer threads must not change what ends in the files */
+	for (i = 0; i < sizeof(nr_writers) / sizeof(nr_writers[0]); ++i) {
+		snprintf(session_dir, sizeof(session_dir), "%s/session-%d",
+		         dir, nr_writers[i]);
+		if (mkdir(session_dir, 0755)) {
+			perror(session_dir);
+			return EXIT_FAILURE;
+		}
+		replay(capture, session_dir, nr_writers[i]);
+		check_session(session_dir);
+	}
+
+	/* a bad record at the end loses nothing before it */
+	snprintf(session_dir, sizeof(session_dir), "%s/session-bad", dir);
+	if (mkdir(session_dir, 0755)) {
+		perror(session_dir);
+		return EXIT_FAILURE;
+	}
+	replay(bad_capture, session_dir, 0);
+	check_session(session_dir);
+
+	if (!nr_error)
+		nftw(dir, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+
+	return nr_error ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -305,3 +305,15 @@ void odb_sync(odb_t const * odb)
 	size = tables_size(data, data->descr->size);
 	msync(data->base_memory, size, MS_ASYNC);
 }
+
+
+int odb_dup_fd(odb_t const * odb, size_t * size)
+{
+	odb_data_t * data = odb->data;
+
+	if (!data || data->fd < 0)
+		return -1;
+
+	*size = tables_size(data, data->descr->size);
+	return dup(data->fd);
+}
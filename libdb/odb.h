@@ -135,6 +135,17 @@ void * odb_get_data(odb_t * odb);
 /** issue a msync on the used size of the mmaped file */
 void odb_sync(odb_t const * odb);
 
+/**
+ * odb_dup_fd - a descriptor to sync the file of odb from another thread
+ * @param odb  the data base
+ * @param size  set to the size odb_sync() would sync
+ *
+ * Return a dup() of the file descriptor, to be closed by the caller, or -1
+ * if odb is not open or dup() fails. Unlike the mapping, the descriptor
+ * stays valid when the file is grown or closed.
+ */
+int odb_dup_fd(odb_t const * odb, size_t * size);
+
 /**
  * grow the hashtable in such way current_size is the index of the first free
  * node. Take care all node pointer can be invalidated by this call.
@@ -19,144 +19,135 @@
 #include "op_libiberty.h"
 
 
-typedef struct counter_arc_head {
-	/** the head of allowed counter for this event */
-	struct list_head next;
-} counter_arc_head;
-
-
-typedef struct counter_arc {
-	/** counter nr */
-	int counter;
-	/** the next counter allowed for this event */
-	struct list_head next;
-} counter_arc;
+/** matching state of the counter allocator */
+struct counter_match {
+	/** allowed counters of each event */
+	u32 const * allowed;
+	/** event owning each counter or -1 */
+	int owner[32];
+};
 
 
 /**
- * @param pev  an array of event
- * @param nr_events  number of entry in pev
+ * @param match  matching state
+ * @param event  event to bind
+ * @param visited  counters already seen in this search, updated
  *
- * build an array of counter list allowed for each events
- *  counter_arc_head[i] is the list of allowed counter for pev[i] events
- * The returned pointer is an array of nr_events entry
+ * Try to bind event to a counter, moving other events along an
+ * augmenting path if needed. Return non zero on success.
  */
-static counter_arc_head *
-build_counter_arc(struct op_event const * pev[], int nr_events)
+static int augment(struct counter_match * match, int event, u32 * visited)
 {
-	counter_arc_head * ctr_arc;
-	int i;
+	u32 mask = match->allowed[event] & ~*visited;
+	int ctr;
 
-	ctr_arc = xmalloc(nr_events * sizeof(*ctr_arc));
+	for (ctr = 0; mask; ++ctr, mask >>= 1) {
+		if (!(mask & 1))
+			continue;
 
-	for (i = 0; i < nr_events; ++i) {
-		int j;
-		u32 mask = pev[i]->counter_mask;
-
-		list_init(&ctr_arc[i].next);
-		for (j = 0; mask; ++j) {
-			if (mask & (1 << j)) {
-				counter_arc * arc = 
-					xmalloc(sizeof(counter_arc));
-				arc->counter = j;
-				/* we are looping by increasing counter number,
-				 * allocation use a left to right tree walking
-				 * so we add at end to ensure counter will
-				 * be allocated by increasing number: it's not
-				 * required but a bit less surprising when
-				 * debugging code
-				 */
-				list_add_tail(&arc->next, &ctr_arc[i].next);
-				mask &= ~(1 << j);
-			}
+		*visited |= 1U << ctr;
+		if (match->owner[ctr] < 0 ||
+		    augment(match, match->owner[ctr], visited)) {
+			match->owner[ctr] = event;
+			return 1;
 		}
 	}
 
-	return ctr_arc;
+	return 0;
 }
 
 
 /**
- * @param ctr_arc  the array to deallocate
- * @param nr_events  number of entry in array
+ * @param allowed  allowed counters of each event
+ * @param first  first event to bind
+ * @param nr_events  number of entry in allowed
+ * @param used_mask  counters not available to these events
  *
- *  deallocate all previously allocated resource by build_counter_arc()
+ * return non zero if events first to nr_events - 1 can all be bound to
+ * distinct counters outside used_mask. Events allowing no counter at all
+ * are skipped, they don't use a physical counter.
  */
-static void delete_counter_arc(counter_arc_head * ctr_arc, int nr_events)
+static int can_allocate(u32 const * allowed, int first, int nr_events,
+			u32 used_mask)
 {
-	int i;
-	for (i = 0; i < nr_events; ++i) {
-		struct list_head * pos, * pos2;
-		list_for_each_safe(pos, pos2, &ctr_arc[i].next) {
-			counter_arc * arc = list_entry(pos, counter_arc, next);
-			list_del(&arc->next);
-			free(arc);
-		}
+	struct counter_match match;
+	u32 * masked;
+	int i, ok = 1;
+
+	masked = xmalloc(nr_events * sizeof(*masked));
+	for (i = 0; i < nr_events; ++i)
+		masked[i] = allowed[i] & ~used_mask;
+	match.allowed = masked;
+	for (i = 0; i < 32; ++i)
+		match.owner[i] = -1;
+
+	for (i = first; i < nr_events && ok; ++i) {
+		u32 visited = 0;
+		if (allowed[i])
+			ok = augment(&match, i, &visited);
 	}
-	free(ctr_arc);
+
+	free(masked);
+	return ok;
 }
 
 
 /**
- * @param ctr_arc  tree description, ctr_arc[i] is the i-th level of tree.
- * @param max_depth  number of entry in array ctr_arc == depth of tree
- * @param depth  current level we are exploring
- * @param allocated_mask  current counter already allocated mask
+ * @param allowed  allowed counters of each event
+ * @param nr_events  number of entry in allowed
+ * @param unavailable_mask  counters which can't be used
  * @param counter_map  array of counter number mapping, returned results go
  *   here
  *
- * return non zero on succees, in this case counter_map is set to the counter
+ * return non zero on success, in this case counter_map is set to the counter
  * mapping number.
  *
- * Solution is searched through a simple backtracking exploring recursively all
- * possible solution until one is found, prunning is done in O(1) by tracking
- * a bitmask of already allocated counter. Walking through node is done in
- * preorder left to right.
+ * Events are bound in order, each one to the lowest counter that still
+ * leaves a complete binding for the following events; whether one exists
+ * is a bipartite matching problem. This gives the same binding as a
+ * left to right backtracking through counters, but in polynomial time
+ * rather than exponential when many events share overlapping counters.
  *
  * In case of extended events (required no phisical counters), the associated
  * counter_map entry will be -1.
- *
- * Possible improvment if neccessary: partition counters in class of counter,
- * two counter belong to the same class if they allow exactly the same set of
- * event. Now using a variant of the backtrack algo can works on class of
- * counter rather on counter (this is not an improvment if each counter goes
- * in it's own class)
  */
 static int
-allocate_counter(counter_arc_head const * ctr_arc, int max_depth, int depth,
-		 u32 allocated_mask, size_t * counter_map)
+allocate_counter(u32 const * allowed, int nr_events, u32 unavailable_mask,
+		 size_t * counter_map)
 {
-	struct list_head * pos;
+	u32 used_mask = unavailable_mask;
+	int i;
 
-	if (depth == max_depth)
-		return 1;
+	if (!can_allocate(allowed, 0, nr_events, used_mask))
+		return 0;
 
-	/* If ctr_arc is not available, counter_map is -1 */
-	if((&ctr_arc[depth].next)->next == &ctr_arc[depth].next) {
-		counter_map[depth] = -1;
-		if (allocate_counter(ctr_arc, max_depth, depth + 1,
-		                     allocated_mask,
-		                     counter_map))
-			return 1;
-	} else {
-		list_for_each(pos, &ctr_arc[depth].next) {
-			counter_arc const * arc = list_entry(pos, counter_arc, next);
-
-			if (allocated_mask & (1 << arc->counter))
-				continue;
+	for (i = 0; i < nr_events; ++i) {
+		u32 mask = allowed[i] & ~used_mask;
+		int ctr;
 
-			counter_map[depth] = arc->counter;
+		if (!allowed[i]) {
+			counter_map[i] = -1;
+			continue;
+		}
 
-			if (allocate_counter(ctr_arc, max_depth, depth + 1,
-					     allocated_mask | (1 << arc->counter),
-					     counter_map))
-				return 1;
+		/* the last candidate must succeed since a binding exists */
+		for (ctr = 0; mask; ++ctr, mask >>= 1) {
+			if (!(mask & 1))
+				continue;
+			if ((mask >> 1) == 0 ||
+			    can_allocate(allowed, i + 1, nr_events,
+					 used_mask | (1U << ctr)))
+				break;
 		}
+
+		counter_map[i] = ctr;
+		used_mask |= 1U << ctr;
 	}
 
-	return 0;
+	return 1;
 }
 
+
 /* determine which directories are counter directories
  */
 static int perfcounterdir(const struct dirent * entry)
@@ -199,48 +190,159 @@ static int op_get_counter_mask(u32 * mask)
 	return count;
 }
 
-size_t * map_event_to_counter(struct op_event const * pev[], int nr_events,
-                              op_cpu cpu_type)
+/**
+ * @param cpu_type  cpu type
+ * @param unavailable  pointer where to place bit mask of unavailable counters
+ *
+ * return the number of counters
+ */
+static int get_counters(op_cpu cpu_type, u32 * unavailable)
 {
-	counter_arc_head * ctr_arc;
-	size_t * counter_map;
-	int i, nr_counters, nr_pmc_events;
-	op_cpu curr_cpu_type;
-	u32 unavailable_counters = 0;
+	int nr_counters;
+
+	*unavailable = 0;
 
 	/* Either ophelp or one of the libop tests may invoke this
 	 * function with a non-native cpu_type.  If so, we should not
 	 * call op_get_counter_mask because that will look for real counter
 	 * information in oprofilefs.
 	 */
-	curr_cpu_type = op_get_cpu_type();
-	if (cpu_type != curr_cpu_type)
+	if (cpu_type != op_get_cpu_type())
 		nr_counters = op_get_nr_counters(cpu_type);
 	else
-		nr_counters = op_get_counter_mask(&unavailable_counters);
+		nr_counters = op_get_counter_mask(unavailable);
 
 	/* no counters then probably perfmon managing perfmon hw */
 	if (nr_counters <= 0) {
 		nr_counters = op_get_nr_counters(cpu_type);
-		unavailable_counters = (~0) << nr_counters;
+		*unavailable = (~0U) << nr_counters;
 	}
 
+	return nr_counters;
+}
+
+
+/** return the number of events using a physical counter */
+static int count_pmc_events(struct op_event const * pev[], int nr_events)
+{
+	int i, nr_pmc_events = 0;
+
+	for (i = 0; i < nr_events; i++)
+		if (pev[i]->ext == NULL)
+			++nr_pmc_events;
+	return nr_pmc_events;
+}
+
+
+static u32 * build_allowed(struct op_event const * pev[], int nr_events)
+{
+	u32 * allowed = xmalloc(nr_events * sizeof(*allowed));
+	int i;
+
+	for (i = 0; i < nr_events; ++i)
+		allowed[i] = pev[i]->counter_mask;
+	return allowed;
+}
+
+
+size_t * map_event_to_counter(struct op_event const * pev[], int nr_events,
+                              op_cpu cpu_type)
+{
+	u32 * allowed;
+	size_t * counter_map;
+	int nr_counters;
+	u32 unavailable_counters;
+
+	nr_counters = get_counters(cpu_type, &unavailable_counters);
+
 	/* Check to see if we have enough physical counters to map events*/
-	for (i = 0, nr_pmc_events = 0; i < nr_events; i++)
-		if(pev[i]->ext == NULL)
-			if (++nr_pmc_events > nr_counters)
-				return 0;
+	if (count_pmc_events(pev, nr_events) > nr_counters)
+		return 0;
 
-	ctr_arc = build_counter_arc(pev, nr_events);
+	allowed = build_allowed(pev, nr_events);
 
 	counter_map = xmalloc(nr_events * sizeof(size_t));
 
-	if (!allocate_counter(ctr_arc, nr_events, 0, unavailable_counters,
+	if (!allocate_counter(allowed, nr_events, unavailable_counters,
 			      counter_map)) {
 		free(counter_map);
 		counter_map = 0;
 	}
 
-	delete_counter_arc(ctr_arc, nr_events);
+	free(allowed);
 	return counter_map;
 }
+
+
+int find_counter_conflict(struct op_event const * pev[], int nr_events,
+                          op_cpu cpu_type, int * conflict)
+{
+	struct counter_match match;
+	u32 * allowed;
+	int i, nr_counters, size = 0;
+	u32 unavailable_counters;
+
+	for (i = 0; i < nr_events; ++i)
+		conflict[i] = 0;
+
+	nr_counters = get_counters(cpu_type, &unavailable_counters);
+
+	if (count_pmc_events(pev, nr_events) > nr_counters) {
+		for (i = 0; i < nr_events; ++i) {
+			if (pev[i]->ext == NULL) {
+				conflict[i] = 1;
+				++size;
+			}
+		}
+		return size;
+	}
+
+	allowed = build_allowed(pev, nr_events);
+	for (i = 0; i < nr_events; ++i) {
+		if (allowed[i])
+			allowed[i] &= ~unavailable_counters;
+		else
+			conflict[i] = -1;
+	}
+	match.allowed = allowed;
+	for (i = 0; i < 32; ++i)
+		match.owner[i] = -1;
+
+	for (i = 0; i < nr_events; ++i) {
+		u32 visited = 0, reached, seen = 0;
+		int ctr;
+
+		if (conflict[i] < 0 || augment(&match, i, &visited))
+			continue;
+
+		/*
+		 * i can't be bound: every counter reachable from i through
+		 * alternating paths is taken. These counters and their owners
+		 * plus i are one event more than counters, Hall's condition.
+		 */
+		conflict[i] = 1;
+		size = 1;
+		reached = allowed[i];
+		while (reached & ~seen) {
+			int owner;
+			for (ctr = 0; !((reached & ~seen) & (1U << ctr)); ++ctr)
+				;
+			seen |= 1U << ctr;
+			owner = match.owner[ctr];
+			if (!conflict[owner]) {
+				conflict[owner] = 1;
+				++size;
+				reached |= allowed[owner];
+			}
+		}
+		break;
+	}
+
+	for (i = 0; i < nr_events; ++i) {
+		if (conflict[i] < 0)
+			conflict[i] = 0;
+	}
+
+	free(allowed);
+	return size;
+}
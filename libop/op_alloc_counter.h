@@ -36,6 +36,20 @@ extern "C" {
 size_t * map_event_to_counter(struct op_event const * pev[], int nr_events,
                               op_cpu cpu_type);
 
+/**
+ * @param pev  array of selected event we want to bind to counter
+ * @param nr_events  size of pev array
+ * @param cpu_type  cpu type
+ * @param conflict  array of nr_events entries, conflict[i] is set to non
+ *   zero if pev[i] belongs to the returned conflict set
+ *
+ * When map_event_to_counter() fails, find a set of events which can't be
+ * bound together: taken together they allow fewer counters than there are
+ * events in the set. Return the size of this set, 0 if a binding exists.
+ */
+int find_counter_conflict(struct op_event const * pev[], int nr_events,
+                          op_cpu cpu_type, int * conflict);
+
 #ifdef __cplusplus
 }
 #endif
@@ -18,7 +18,10 @@
 #include "op_cpufreq.h"
 #include "op_hw_specific.h"
 #include "op_parse_event.h"
+#include "op_events_db.h"
 
+#include <sys/types.h>
+#include <sys/stat.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -30,24 +33,66 @@ static LIST_HEAD(um_list);
 static char const * filename;
 static unsigned int line_nr;
 
+/* set by op_events_compile(), which records every description file read */
+static int compiling;
+static char ** sources;
+static size_t nr_sources;
+
+/* find_event_by_name() hash, rebuilt when the events list changes */
+#define NAME_HASH_SIZE 1024
+static struct op_event * name_hash[NAME_HASH_SIZE];
+static int name_hash_valid;
+
 static void delete_event(struct op_event * event);
 static void read_events(char const * file);
 static void read_unit_masks(char const * file);
 static void free_unit_mask(struct op_unit_mask * um);
 
-static char *build_fn(const char *cpu_name, const char *fn)
+static const char *events_dir(void)
 {
-	char *s;
 	static const char *dir;
 	if (dir == NULL)
 		dir = getenv("OPROFILE_EVENTS_DIR");
 	if (dir == NULL)
 		dir = OP_DATADIR;
+	return dir;
+}
+
+static char *build_fn(const char *cpu_name, const char *fn)
+{
+	char *s;
+	const char *dir = events_dir();
 	s = xmalloc(strlen(dir) + strlen(cpu_name) + strlen(fn) + 5);
 	sprintf(s, "%s/%s/%s", dir, cpu_name, fn);
 	return s;
 }
 
+/* the event database normally sits beside the description files, but
+ * make check puts it elsewhere since the source tree can be read only */
+static char *build_db_fn(const char *cpu_name)
+{
+	char *s;
+	const char *dir = getenv("OPROFILE_EVENTS_DB_DIR");
+	if (dir == NULL)
+		return build_fn(cpu_name, OP_EVENTS_DB_NAME);
+	s = xmalloc(strlen(dir) + strlen(cpu_name) +
+		    strlen(OP_EVENTS_DB_NAME) + 5);
+	sprintf(s, "%s/%s/%s", dir, cpu_name, OP_EVENTS_DB_NAME);
+	return s;
+}
+
+static void record_source(char const * file)
+{
+	size_t dir_len = strlen(events_dir());
+
+	if (!compiling)
+		return;
+
+	/* build_fn() names are always below the events directory */
+	sources = xrealloc(sources, (nr_sources + 1) * sizeof(char *));
+	sources[nr_sources++] = xstrdup(file + dir_len + 1);
+}
+
 static void parse_error(char const * context)
 {
 	fprintf(stderr, "oprofile: parse error in %s, line %u\n",
@@ -274,6 +319,7 @@ static void read_unit_masks(char const * file)
 		exit(EXIT_FAILURE);
 	}
 
+	record_source(file);
 	filename = file;
 	line_nr = 1;
 
@@ -453,6 +499,7 @@ static struct op_event * new_event(void)
 	struct op_event * event = xmalloc(sizeof(struct op_event));
 	memset(event, '\0', sizeof(struct op_event));
 	list_add_tail(&event->event_next, &events_list);
+	name_hash_valid = 0;
 
 	return event;
 }
@@ -460,6 +507,7 @@ static struct op_event * new_event(void)
 static void free_event(struct op_event * event)
 {
 	list_del(&event->event_next);
+	name_hash_valid = 0;
 	free(event);
 }
 
@@ -481,6 +529,7 @@ static void read_events(char const * file)
 		exit(EXIT_FAILURE);
 	}
 
+	record_source(file);
 	filename = file;
 	line_nr = 1;
 
@@ -522,7 +571,10 @@ static void read_events(char const * file)
 				if (seen_counters)
 					parse_error("duplicate counters: tag");
 				seen_counters = 1;
-				if (!strcmp(value, "cpuid"))
+				/* the database is not tied to the build host cpu */
+				if (!strcmp(value, "cpuid") && compiling)
+					event->counter_mask = OP_EVENTS_DB_CPUID_COUNTERS;
+				else if (!strcmp(value, "cpuid"))
 					event->counter_mask = arch_get_counter_mask();
 				else
 					event->counter_mask = parse_counter_mask(value);
@@ -632,11 +684,116 @@ static void arch_filter_events(op_cpu cpu_type)
 	}
 }
 
+/* are the description files the database was compiled from unchanged */
+static int events_db_fresh(struct op_events_db const * db)
+{
+	char const * dir = events_dir();
+	u32 i;
+
+	for (i = 0; i < db->header->nr_sources; ++i) {
+		struct op_events_db_source const * source =
+			op_events_db_get_source(db, i);
+		char const * name = op_events_db_string(db, source->name);
+		char * path = xmalloc(strlen(dir) + strlen(name) + 2);
+		struct stat st;
+		int err;
+
+		sprintf(path, "%s/%s", dir, name);
+		err = stat(path, &st);
+		free(path);
+
+		if (err || (u64)st.st_size != source->size ||
+		    (u64)st.st_mtime != source->mtime)
+			return 0;
+	}
+
+	return 1;
+}
+
+static char * db_strdup(struct op_events_db const * db, u32 offset)
+{
+	if (offset == OP_EVENTS_DB_NO_STRING)
+		return NULL;
+	return xstrdup(op_events_db_string(db, offset));
+}
+
+/* build the lists from the cpu event database, return 0 if there is no
+ * usable database */
+static int load_events_db(const char *cpu_name)
+{
+	struct op_events_db db;
+	struct op_unit_mask ** unit_masks;
+	char * db_file;
+	u32 i, j;
+	int err;
+
+	db_file = build_db_fn(cpu_name);
+	err = op_events_db_open(&db, db_file);
+	free(db_file);
+	if (err)
+		return 0;
+
+	if (!events_db_fresh(&db)) {
+		op_events_db_close(&db);
+		return 0;
+	}
+
+	unit_masks = xmalloc((db.header->nr_unit_masks + 1) *
+			     sizeof(struct op_unit_mask *));
+
+	for (i = 0; i < db.header->nr_unit_masks; ++i) {
+		struct op_events_db_unit_mask const * db_um =
+			op_events_db_get_unit_mask(&db, i);
+		struct op_unit_mask * um = new_unit_mask();
+
+		um->name = db_strdup(&db, db_um->name);
+		um->num = db_um->num;
+		um->unit_type_mask = db_um->type;
+		um->default_mask = db_um->default_mask;
+		um->used = db_um->used;
+		for (j = 0; j < um->num; ++j) {
+			struct op_events_db_um_entry const * entry =
+				op_events_db_get_um_entry(&db,
+					db_um->first_entry + j);
+			um->um[j].extra = entry->extra;
+			um->um[j].value = entry->value;
+			um->um[j].desc = db_strdup(&db, entry->desc);
+		}
+		unit_masks[i] = um;
+	}
+
+	for (i = 0; i < db.header->nr_events; ++i) {
+		struct op_events_db_event const * db_event =
+			op_events_db_get_event(&db, i);
+		struct op_event * event = new_event();
+
+		event->counter_mask = db_event->counter_mask;
+		if (event->counter_mask == OP_EVENTS_DB_CPUID_COUNTERS)
+			event->counter_mask = arch_get_counter_mask();
+		event->val = db_event->val;
+		event->unit = unit_masks[db_event->unit];
+		event->name = db_strdup(&db, db_event->name);
+		event->desc = db_strdup(&db, db_event->desc);
+		event->ext = db_strdup(&db, db_event->ext);
+		event->min_count = (int)db_event->min_count;
+		event->filter = (int)db_event->filter;
+	}
+
+	free(unit_masks);
+	op_events_db_close(&db);
+	return 1;
+}
+
 static void load_events_name(const char *cpu_name)
 {
 	char * event_file;
 	char * um_file;
 
+	/* the text files stay authoritative: a missing, stale or invalid
+	 * database, e.g. for custom OPROFILE_EVENTS_DIR files, is ignored */
+	if (!compiling && load_events_db(cpu_name))
+		return;
+
 	event_file = build_fn(cpu_name, "events");
 	um_file = build_fn(cpu_name, "unit_masks");
 
@@ -722,6 +879,30 @@ static void load_events(op_cpu cpu_type)
 	event->filter = -1;
 }
 
+int op_events_compile(char const * cpu_name, char const * db_file)
+{
+	size_t i;
+	int err;
+
+	op_free_events();
+
+	compiling = 1;
+	load_events_name(cpu_name);
+	err = op_events_db_write(db_file, events_dir(),
+				 (char const * const *)sources, nr_sources,
+				 &events_list, &um_list);
+	compiling = 0;
+
+	op_free_events();
+	for (i = 0; i < nr_sources; ++i)
+		free(sources[i]);
+	free(sources);
+	sources = NULL;
+	nr_sources = 0;
+
+	return err;
+}
+
 struct list_head * op_events(op_cpu cpu_type)
 {
 	load_events(cpu_type);
@@ -754,6 +935,7 @@ static void delete_event(struct op_event * event)
 		free(event->desc);
 
 	list_del(&event->event_next);
+	name_hash_valid = 0;
 	free(event);
 }
 
@@ -958,12 +1140,37 @@ static int match_event(int i, struct op_event *event, unsigned um)
 	abort();
 }
 
-struct op_event * find_event_by_name(char const * name, unsigned um, int um_valid)
+static unsigned int hash_name(char const * name)
+{
+	unsigned int hash = 5381;
+	while (*name)
+		hash = hash * 33 + (unsigned char)*name++;
+	return hash % NAME_HASH_SIZE;
+}
+
+/* chains keep the events list order, so the first match is unchanged */
+static void build_name_hash(void)
 {
 	struct list_head * pos;
 
-	list_for_each(pos, &events_list) {
+	memset(name_hash, 0, sizeof(name_hash));
+	for (pos = events_list.prev; pos != &events_list; pos = pos->prev) {
 		struct op_event * event = list_entry(pos, struct op_event, event_next);
+		unsigned int hash = hash_name(event->name);
+		event->name_next = name_hash[hash];
+		name_hash[hash] = event;
+	}
+	name_hash_valid = 1;
+}
+
+struct op_event * find_event_by_name(char const * name, unsigned um, int um_valid)
+{
+	struct op_event * event;
+
+	if (!name_hash_valid)
+		build_name_hash();
+
+	for (event = name_hash[hash_name(name)]; event; event = event->name_next) {
 		if (strcmp(event->name, name) == 0) {
 			if (um_valid) {
 				unsigned i;
@@ -77,11 +77,23 @@ struct op_event {
 	int filter;		/**< architecture specific filter or -1 */
 	char * ext;		/**< extended events */
 	struct list_head event_next;   /**< next event in list */
+	struct op_event * name_next;   /**< next event in name hash chain */
 };
 
 /** Return the known events list. Idempotent */
 struct list_head * op_events(op_cpu cpu_type);
 
+/**
+ * op_events_compile - compile cpu events into an event database
+ * @param cpu_name  the cpu events directory, as op_get_cpu_name()
+ * @param db_file  the database filename
+ *
+ * Parse the cpu events and unit_masks description files and write them to
+ * db_file, see op_events_db.h. Any loaded events are freed first.
+ * Return 0 on success, -1 with errno set on failure.
+ */
+int op_events_compile(char const * cpu_name, char const * db_file);
+
 /** Find a given event, returns NULL on error */
 struct op_event * op_find_event(op_cpu cpu_type, u32 nr, u32 um);
 struct op_event * op_find_event_any(op_cpu cpu_type, u32 nr);
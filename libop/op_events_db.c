@@ -0,0 +1,423 @@
+/**
+ * @file op_events_db.c
+ * Reader and writer of the precompiled event database
+ *
+ * @remark Copyright 2013 OProfile authors
+ * @remark Read the file COPYING
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "op_events_db.h"
+#include "op_events.h"
+#include "op_libiberty.h"
+
+/* is [offset, offset + count * stride) inside the file and aligned */
+static int check_range(size_t size, u64 offset, u64 count, size_t stride)
+{
+	if (offset % sizeof(u64) || offset > size)
+		return 0;
+	return count <= (size - offset) / stride;
+}
+
+
+static int check_string(struct op_events_db const * db, u32 offset)
+{
+	return offset < db->header->strings_size;
+}
+
+
+static int check_records(struct op_events_db const * db)
+{
+	struct op_events_db_header const * header = db->header;
+	u32 i;
+
+	for (i = 0; i < header->nr_sources; ++i) {
+		if (!check_string(db, op_events_db_get_source(db, i)->name))
+			return 0;
+	}
+
+	for (i = 0; i < header->nr_unit_masks; ++i) {
+		struct op_events_db_unit_mask const * um =
+			op_events_db_get_unit_mask(db, i);
+		if (!check_string(db, um->name) || um->num > MAX_UNIT_MASK ||
+		    um->first_entry > header->nr_um_entries ||
+		    um->num > header->nr_um_entries - um->first_entry ||
+		    um->type > utm_bitmask)
+			return 0;
+	}
+
+	for (i = 0; i < header->nr_um_entries; ++i) {
+		if (!check_string(db, op_events_db_get_um_entry(db, i)->desc))
+			return 0;
+	}
+
+	for (i = 0; i < header->nr_events; ++i) {
+		struct op_events_db_event const * event =
+			op_events_db_get_event(db, i);
+		if (event->unit >= header->nr_unit_masks ||
+		    !check_string(db, event->name) ||
+		    (event->desc != OP_EVENTS_DB_NO_STRING &&
+		     !check_string(db, event->desc)) ||
+		    (event->ext != OP_EVENTS_DB_NO_STRING &&
+		     !check_string(db, event->ext)))
+			return 0;
+	}
+
+	return 1;
+}
+
+
+static int check_header(struct op_events_db const * db)
+{
+	struct op_events_db_header const * header = db->header;
+	char const * strings;
+
+	if (db->size < sizeof(*header) ||
+	    memcmp(header->magic, OP_EVENTS_DB_MAGIC, sizeof(header->magic)) ||
+	    header->version != OP_EVENTS_DB_VERSION)
+		return 0;
+
+	if (!check_range(db->size, header->sources_offset, header->nr_sources,
+	                 sizeof(struct op_events_db_source)) ||
+	    !check_range(db->size, header->unit_masks_offset,
+	                 header->nr_unit_masks,
+	                 sizeof(struct op_events_db_unit_mask)) ||
+	    !check_range(db->size, header->um_entries_offset,
+	                 header->nr_um_entries,
+	                 sizeof(struct op_events_db_um_entry)) ||
+	    !check_range(db->size, header->events_offset, header->nr_events,
+	                 sizeof(struct op_events_db_event)) ||
+	    !check_range(db->size, header->strings_offset,
+	                 header->strings_size, 1))
+		return 0;
+
+	/* the string table must end with a nul so lookups are bounded */
+	strings = (char const *)db->base + header->strings_offset;
+	if (header->strings_size && strings[header->strings_size - 1])
+		return 0;
+
+	return check_records(db);
+}
+
+
+int op_events_db_open(struct op_events_db * db, char const * filename)
+{
+	struct stat st;
+	int fd;
+
+	memset(db, 0, sizeof(*db));
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return -1;
+
+	if (fstat(fd, &st) < 0)
+		goto fail;
+
+	if ((size_t)st.st_size < sizeof(struct op_events_db_header)) {
+		errno = EINVAL;
+		goto fail;
+	}
+
+	db->size = st.st_size;
+	db->base = mmap(0, db->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (db->base == MAP_FAILED) {
+		db->base = 0;
+		goto fail;
+	}
+
+	close(fd);
+
+	db->header = db->base;
+	if (!check_header(db)) {
+		op_events_db_close(db);
+		errno = EINVAL;
+		return -1;
+	}
+
+	return 0;
+
+fail:
+	close(fd);
+	return -1;
+}
+
+
+void op_events_db_close(struct op_events_db * db)
+{
+	if (db->base)
+		munmap(db->base, db->size);
+	memset(db, 0, sizeof(*db));
+}
+
+
+static void const * get_record(struct op_events_db const * db, u64 offset,
+                               size_t stride, u32 count, u32 index)
+{
+	char const * base = db->base;
+
+	if (index >= count)
+		return NULL;
+
+	return base + offset + index * stride;
+}
+
+
+struct op_events_db_source const *
+op_events_db_get_source(struct op_events_db const * db, u32 index)
+{
+	struct op_events_db_header const * header = db->header;
+	return get_record(db, header->sources_offset,
+	                  sizeof(struct op_events_db_source),
+	                  header->nr_sources, index);
+}
+
+
+struct op_events_db_unit_mask const *
+op_events_db_get_unit_mask(struct op_events_db const * db, u32 index)
+{
+	struct op_events_db_header const * header = db->header;
+	return get_record(db, header->unit_masks_offset,
+	                  sizeof(struct op_events_db_unit_mask),
+	                  header->nr_unit_masks, index);
+}
+
+
+struct op_events_db_um_entry const *
+op_events_db_get_um_entry(struct op_events_db const * db, u32 index)
+{
+	struct op_events_db_header const * header = db->header;
+	return get_record(db, header->um_entries_offset,
+	                  sizeof(struct op_events_db_um_entry),
+	                  header->nr_um_entries, index);
+}
+
+
+struct op_events_db_event const *
+op_events_db_get_event(struct op_events_db const * db, u32 index)
+{
+	struct op_events_db_header const * header = db->header;
+	return get_record(db, header->events_offset,
+	                  sizeof(struct op_events_db_event),
+	                  header->nr_events, index);
+}
+
+
+char const * op_events_db_string(struct op_events_db const * db, u32 offset)
+{
+	struct op_events_db_header const * header = db->header;
+	char const * base = db->base;
+
+	if (offset >= header->strings_size)
+		return NULL;
+
+	return base + header->strings_offset + offset;
+}
+
+
+/* string table under construction */
+struct string_table {
+	char * data;
+	size_t size;
+	size_t capacity;
+};
+
+
+static u32 add_string(struct string_table * table, char const * str)
+{
+	size_t len;
+	u32 offset;
+
+	if (!str)
+		return OP_EVENTS_DB_NO_STRING;
+
+	len = strlen(str) + 1;
+	if (table->size + len > table->capacity) {
+		table->capacity = (table->capacity + len) * 2;
+		table->data = xrealloc(table->data, table->capacity);
+	}
+
+	offset = table->size;
+	memcpy(table->data + offset, str, len);
+	table->size += len;
+	return offset;
+}
+
+
+static u32 list_length(struct list_head * list)
+{
+	struct list_head * pos;
+	u32 count = 0;
+
+	list_for_each(pos, list)
+		++count;
+	return count;
+}
+
+
+static u32 unit_mask_index(struct op_unit_mask const * const * unit_masks,
+                           u32 nr_unit_masks, struct op_unit_mask const * um)
+{
+	u32 i;
+
+	for (i = 0; i < nr_unit_masks; ++i) {
+		if (unit_masks[i] == um)
+			break;
+	}
+	return i;
+}
+
+
+int op_events_db_write(char const * filename, char const * events_dir,
+                       char const * const * sources, size_t nr_sources,
+                       struct list_head * events,
+                       struct list_head * unit_masks)
+{
+	struct op_events_db_header header;
+	struct op_events_db_source * db_sources;
+	struct op_events_db_unit_mask * db_unit_masks;
+	struct op_events_db_um_entry * db_um_entries;
+	struct op_events_db_event * db_events;
+	struct op_unit_mask const ** um_index;
+	struct string_table strings = { NULL, 0, 0 };
+	struct list_head * pos;
+	char * tmp_file;
+	FILE * fp;
+	u32 i, nr_um_entries;
+	int err = -1;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, OP_EVENTS_DB_MAGIC, sizeof(header.magic));
+	header.version = OP_EVENTS_DB_VERSION;
+	header.nr_sources = nr_sources;
+	header.nr_unit_masks = list_length(unit_masks);
+	header.nr_events = list_length(events);
+
+	db_sources = xcalloc(nr_sources + 1, sizeof(*db_sources));
+	db_unit_masks = xcalloc(header.nr_unit_masks + 1,
+	                        sizeof(*db_unit_masks));
+	db_um_entries = xcalloc(header.nr_unit_masks * MAX_UNIT_MASK + 1,
+	                        sizeof(*db_um_entries));
+	db_events = xcalloc(header.nr_events + 1, sizeof(*db_events));
+	um_index = xcalloc(header.nr_unit_masks + 1, sizeof(*um_index));
+	tmp_file = xmalloc(strlen(filename) + 5);
+	sprintf(tmp_file, "%s.tmp", filename);
+
+	for (i = 0; i < nr_sources; ++i) {
+		struct stat st;
+		char * path = xmalloc(strlen(events_dir) + strlen(sources[i]) + 2);
+
+		sprintf(path, "%s/%s", events_dir, sources[i]);
+		if (stat(path, &st) < 0) {
+			free(path);
+			goto out;
+		}
+		free(path);
+
+		db_sources[i].size = st.st_size;
+		db_sources[i].mtime = st.st_mtime;
+		db_sources[i].name = add_string(&strings, sources[i]);
+	}
+
+	i = 0;
+	nr_um_entries = 0;
+	list_for_each(pos, unit_masks) {
+		struct op_unit_mask const * um =
+			list_entry(pos, struct op_unit_mask, um_next);
+		u32 j;
+
+		um_index[i] = um;
+		db_unit_masks[i].name = add_string(&strings, um->name);
+		db_unit_masks[i].num = um->num;
+		db_unit_masks[i].type = um->unit_type_mask;
+		db_unit_masks[i].default_mask = um->default_mask;
+		db_unit_masks[i].first_entry = nr_um_entries;
+		db_unit_masks[i].used = um->used;
+
+		for (j = 0; j < um->num; ++j, ++nr_um_entries) {
+			db_um_entries[nr_um_entries].extra = um->um[j].extra;
+			db_um_entries[nr_um_entries].value = um->um[j].value;
+			db_um_entries[nr_um_entries].desc =
+				add_string(&strings, um->um[j].desc);
+		}
+		++i;
+	}
+	header.nr_um_entries = nr_um_entries;
+
+	i = 0;
+	list_for_each(pos, events) {
+		struct op_event const * event =
+			list_entry(pos, struct op_event, event_next);
+
+		db_events[i].counter_mask = event->counter_mask;
+		db_events[i].val = event->val;
+		db_events[i].unit = unit_mask_index(um_index,
+			header.nr_unit_masks, event->unit);
+		if (db_events[i].unit == header.nr_unit_masks) {
+			errno = EINVAL;
+			goto out;
+		}
+		db_events[i].name = add_string(&strings, event->name);
+		db_events[i].desc = add_string(&strings, event->desc);
+		db_events[i].ext = add_string(&strings, event->ext);
+		db_events[i].min_count = event->min_count;
+		db_events[i].filter = event->filter;
+		++i;
+	}
+
+	/* every record size is a multiple of 8 so each part stays aligned */
+	header.sources_offset = sizeof(header);
+	header.unit_masks_offset = header.sources_offset +
+		header.nr_sources * sizeof(*db_sources);
+	header.um_entries_offset = header.unit_masks_offset +
+		header.nr_unit_masks * sizeof(*db_unit_masks);
+	header.events_offset = header.um_entries_offset +
+		header.nr_um_entries * sizeof(*db_um_entries);
+	header.strings_offset = header.events_offset +
+		header.nr_events * sizeof(*db_events);
+	header.strings_size = strings.size;
+
+	fp = fopen(tmp_file, "wb");
+	if (!fp)
+		goto out;
+
+	if (fwrite(&header, sizeof(header), 1, fp) != 1 ||
+	    fwrite(db_sources, sizeof(*db_sources), header.nr_sources, fp)
+		!= header.nr_sources ||
+	    fwrite(db_unit_masks, sizeof(*db_unit_masks),
+	           header.nr_unit_masks, fp) != header.nr_unit_masks ||
+	    fwrite(db_um_entries, sizeof(*db_um_entries),
+	           header.nr_um_entries, fp) != header.nr_um_entries ||
+	    fwrite(db_events, sizeof(*db_events), header.nr_events, fp)
+		!= header.nr_events ||
+	    fwrite(strings.data, 1, strings.size, fp) != strings.size) {
+		fclose(fp);
+		unlink(tmp_file);
+		goto out;
+	}
+
+	if (fclose(fp) || rename(tmp_file, filename)) {
+		unlink(tmp_file);
+		goto out;
+	}
+
+	err = 0;
+out:
+	free(tmp_file);
+	free(um_index);
+	free(db_events);
+	free(db_um_entries);
+	free(db_unit_masks);
+	free(db_sources);
+	free(strings.data);
+	return err;
+}
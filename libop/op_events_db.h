@@ -0,0 +1,171 @@
+/**
+ * @file op_events_db.h
+ * Precompiled event database, written at install time from the
+ * events and unit_masks description files
+ *
+ * @remark Copyright 2013 OProfile authors
+ * @remark Read the file COPYING
+ */
+
+#ifndef OP_EVENTS_DB_H
+#define OP_EVENTS_DB_H
+
+#include <stddef.h>
+
+#include "op_types.h"
+#include "op_list.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * An event database is, in native byte order and with every part 8 bytes
+ * aligned:
+ *
+ * struct op_events_db_header
+ * nr_sources struct op_events_db_source
+ * nr_unit_masks struct op_events_db_unit_mask
+ * nr_um_entries struct op_events_db_um_entry
+ * nr_events struct op_events_db_event
+ * the string table, nul terminated strings
+ *
+ * Sources are the description files the database was compiled from,
+ * named relative to the events directory. A database whose sources no
+ * longer match their size or mtime is stale and must not be used.
+ * Unit masks and events are in description file order, events reference
+ * their unit mask by index and strings are referenced by their offset in
+ * the string table.
+ */
+
+#define OP_EVENTS_DB_MAGIC "OPEVTSDB"
+#define OP_EVENTS_DB_VERSION 1
+/** filename of the database in a cpu events directory */
+#define OP_EVENTS_DB_NAME "events.db"
+/** string offset for "no string" */
+#define OP_EVENTS_DB_NO_STRING 0xffffffffu
+/** counter mask of a "counters:cpuid" event, resolved at load time */
+#define OP_EVENTS_DB_CPUID_COUNTERS 0xffffffffu
+
+struct op_events_db_header {
+	u8 magic[8];
+	u32 version;
+	u32 nr_sources;
+	u32 nr_unit_masks;
+	u32 nr_um_entries;
+	u32 nr_events;
+	u32 reserved;
+	u64 sources_offset;
+	u64 unit_masks_offset;
+	u64 um_entries_offset;
+	u64 events_offset;
+	u64 strings_offset;
+	u64 strings_size;
+};
+
+struct op_events_db_source {
+	u64 size;
+	u64 mtime;
+	/** filename relative to the events directory */
+	u32 name;
+	u32 reserved;
+};
+
+struct op_events_db_unit_mask {
+	u32 name;
+	u32 num;
+	/** an enum unit_mask_type */
+	u32 type;
+	u32 default_mask;
+	/** index of the first of the num entries */
+	u32 first_entry;
+	u32 used;
+};
+
+struct op_events_db_um_entry {
+	u32 extra;
+	u32 value;
+	u32 desc;
+	u32 reserved;
+};
+
+struct op_events_db_event {
+	u32 counter_mask;
+	u32 val;
+	/** unit mask index */
+	u32 unit;
+	u32 name;
+	/** description or OP_EVENTS_DB_NO_STRING */
+	u32 desc;
+	/** extended event or OP_EVENTS_DB_NO_STRING */
+	u32 ext;
+	u32 min_count;
+	/** architecture specific filter, (u32)-1 for none */
+	u32 filter;
+};
+
+/** a mapped event database */
+struct op_events_db {
+	void * base;
+	size_t size;
+	struct op_events_db_header const * header;
+};
+
+/**
+ * op_events_db_open - map an event database
+ * @param db  database to fill
+ * @param filename  the database filename
+ *
+ * The whole database is checked: every index and string offset of a
+ * successfully opened database is in range. Return 0 on success. On
+ * failure return -1 with errno set, EINVAL if the file is not a database
+ * of this version.
+ */
+int op_events_db_open(struct op_events_db * db, char const * filename);
+
+/** unmap a database opened by op_events_db_open() */
+void op_events_db_close(struct op_events_db * db);
+
+/** return source index or NULL if out of range */
+struct op_events_db_source const *
+op_events_db_get_source(struct op_events_db const * db, u32 index);
+
+/** return unit mask index or NULL if out of range */
+struct op_events_db_unit_mask const *
+op_events_db_get_unit_mask(struct op_events_db const * db, u32 index);
+
+/** return unit mask entry index or NULL if out of range */
+struct op_events_db_um_entry const *
+op_events_db_get_um_entry(struct op_events_db const * db, u32 index);
+
+/** return event index or NULL if out of range */
+struct op_events_db_event const *
+op_events_db_get_event(struct op_events_db const * db, u32 index);
+
+/** return the string at offset or NULL if out of range */
+char const * op_events_db_string(struct op_events_db const * db, u32 offset);
+
+/**
+ * op_events_db_write - write an event database
+ * @param filename  the database filename
+ * @param events_dir  the directory sources are relative to
+ * @param sources  the nr_sources description filenames
+ * @param nr_sources  number of sources
+ * @param events  list of struct op_event
+ * @param unit_masks  list of struct op_unit_mask, containing every unit
+ *  mask referenced by events
+ *
+ * The database is written to a temporary file renamed over filename so
+ * a reader never sees it half written. Return 0 on success, -1 with errno
+ * set on failure.
+ */
+int op_events_db_write(char const * filename, char const * events_dir,
+                       char const * const * sources, size_t nr_sources,
+                       struct list_head * events,
+                       struct list_head * unit_masks);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* OP_EVENTS_DB_H */
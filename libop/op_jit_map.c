@@ -0,0 +1,220 @@
+/**
+ * @file op_jit_map.c
+ * Reader and writer of JIT symbol maps
+ *
+ * @remark Copyright 2013 OProfile authors
+ * @remark Read the file COPYING
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "op_jit_map.h"
+#include "op_libiberty.h"
+
+/* is [offset, offset + count * stride) inside the file and aligned */
+static int check_range(size_t size, u64 offset, u64 count, size_t stride)
+{
+	if (offset % sizeof(u64) || offset > size)
+		return 0;
+	return count <= (size - offset) / stride;
+}
+
+
+static int check_map(struct op_jit_map const * map)
+{
+	struct op_jit_map_header const * header = map->header;
+	struct op_jit_map_symbol const * syms;
+	char const * strings;
+	u32 i;
+
+	if (map->size < sizeof(*header) ||
+	    memcmp(header->magic, OP_JIT_MAP_MAGIC, sizeof(header->magic)) ||
+	    header->version != OP_JIT_MAP_VERSION)
+		return 0;
+
+	if (!check_range(map->size, header->symbols_offset,
+	                 header->nr_symbols, sizeof(*syms)) ||
+	    !check_range(map->size, header->strings_offset,
+	                 header->strings_size, 1))
+		return 0;
+
+	/* the string table must end with a nul so lookups are bounded */
+	strings = (char const *)map->base + header->strings_offset;
+	if (header->strings_size && strings[header->strings_size - 1])
+		return 0;
+
+	syms = (struct op_jit_map_symbol const *)
+		((char const *)map->base + header->symbols_offset);
+	for (i = 0; i < header->nr_symbols; ++i) {
+		if (syms[i].name >= header->strings_size ||
+		    syms[i].vma + syms[i].size < syms[i].vma)
+			return 0;
+		if (i && syms[i].vma < syms[i - 1].vma + syms[i - 1].size)
+			return 0;
+	}
+	return 1;
+}
+
+
+int op_jit_map_open(struct op_jit_map * map, char const * filename)
+{
+	struct stat st;
+	int fd;
+
+	memset(map, 0, sizeof(*map));
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return -1;
+
+	if (fstat(fd, &st) < 0)
+		goto fail;
+
+	if ((size_t)st.st_size < sizeof(struct op_jit_map_header)) {
+		errno = EINVAL;
+		goto fail;
+	}
+
+	map->size = st.st_size;
+	map->base = mmap(0, map->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map->base == MAP_FAILED) {
+		map->base = 0;
+		goto fail;
+	}
+
+	close(fd);
+
+	map->header = map->base;
+	if (!check_map(map)) {
+		op_jit_map_close(map);
+		errno = EINVAL;
+		return -1;
+	}
+
+	return 0;
+
+fail:
+	close(fd);
+	return -1;
+}
+
+
+void op_jit_map_close(struct op_jit_map * map)
+{
+	if (map->base)
+		munmap(map->base, map->size);
+	memset(map, 0, sizeof(*map));
+}
+
+
+struct op_jit_map_symbol const *
+op_jit_map_get_symbol(struct op_jit_map const * map, u32 index)
+{
+	struct op_jit_map_header const * header = map->header;
+	char const * base = map->base;
+
+	if (index >= header->nr_symbols)
+		return NULL;
+
+	base += header->symbols_offset + index * sizeof(struct op_jit_map_symbol);
+	return (struct op_jit_map_symbol const *)base;
+}
+
+
+char const * op_jit_map_string(struct op_jit_map const * map, u32 offset)
+{
+	struct op_jit_map_header const * header = map->header;
+	char const * base = map->base;
+
+	if (offset >= header->strings_size)
+		return NULL;
+
+	return base + header->strings_offset + offset;
+}
+
+
+int op_jit_map_write(char const * filename,
+                     struct op_jit_map_entry const * entries,
+                     size_t nr_entries)
+{
+	struct op_jit_map_header header;
+	struct op_jit_map_symbol * syms;
+	char * strings;
+	char * tmp_file;
+	size_t i, strings_size, len;
+	FILE * fp;
+	int err = -1;
+
+	strings_size = 0;
+	for (i = 0; i < nr_entries; ++i) {
+		if (i && entries[i].vma <
+		    entries[i - 1].vma + entries[i - 1].size) {
+			errno = EINVAL;
+			return -1;
+		}
+		strings_size += strlen(entries[i].name) + 1;
+	}
+	/* keep the file size a multiple of 8 */
+	strings_size = (strings_size + 7) & ~(size_t)7;
+	if (nr_entries > 0xffffffffu || strings_size > 0xffffffffu) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, OP_JIT_MAP_MAGIC, sizeof(header.magic));
+	header.version = OP_JIT_MAP_VERSION;
+	header.nr_symbols = nr_entries;
+	header.symbols_offset = sizeof(header);
+	header.strings_offset = header.symbols_offset +
+		nr_entries * sizeof(*syms);
+	header.strings_size = strings_size;
+
+	syms = xcalloc(nr_entries + 1, sizeof(*syms));
+	strings = xcalloc(strings_size + 1, 1);
+	tmp_file = xmalloc(strlen(filename) + 5);
+	sprintf(tmp_file, "%s.tmp", filename);
+
+	strings_size = 0;
+	for (i = 0; i < nr_entries; ++i) {
+		len = strlen(entries[i].name) + 1;
+		syms[i].vma = entries[i].vma;
+		syms[i].size = entries[i].size;
+		syms[i].name = strings_size;
+		memcpy(strings + strings_size, entries[i].name, len);
+		strings_size += len;
+	}
+
+	fp = fopen(tmp_file, "wb");
+	if (!fp)
+		goto out;
+
+	if (fwrite(&header, sizeof(header), 1, fp) != 1 ||
+	    fwrite(syms, sizeof(*syms), nr_entries, fp) != nr_entries ||
+	    fwrite(strings, 1, header.strings_size, fp)
+		!= header.strings_size) {
+		fclose(fp);
+		unlink(tmp_file);
+		goto out;
+	}
+
+	if (fclose(fp) || rename(tmp_file, filename)) {
+		unlink(tmp_file);
+		goto out;
+	}
+
+	err = 0;
+out:
+	free(tmp_file);
+	free(strings);
+	free(syms);
+	return err;
+}
@@ -0,0 +1,111 @@
+/**
+ * @file op_jit_map.h
+ * Symbols of JIT compiled code written by operf --jit-symbols, read in
+ * place of an ELF image for anonymous samples
+ *
+ * @remark Copyright 2013 OProfile authors
+ * @remark Read the file COPYING
+ */
+
+#ifndef OP_JIT_MAP_H
+#define OP_JIT_MAP_H
+
+#include <stddef.h>
+
+#include "op_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A JIT symbol map is, in native byte order and with every part 8 bytes
+ * aligned:
+ *
+ * struct op_jit_map_header
+ * nr_symbols struct op_jit_map_symbol
+ * the string table, nul terminated strings
+ *
+ * Symbols are sorted by vma and don't overlap, their vma is the address
+ * the code had when it was sampled. A map is stored as <tgid>.jitmap in
+ * the {anon:anon} directory of the samples of the process, where an ELF
+ * image produced by opjitconv would be stored as <tgid>.jo.
+ */
+
+#define OP_JIT_MAP_MAGIC "OPJITMAP"
+#define OP_JIT_MAP_VERSION 1
+/** filename suffix of a map */
+#define OP_JIT_MAP_SUFFIX ".jitmap"
+
+struct op_jit_map_header {
+	u8 magic[8];
+	u32 version;
+	u32 nr_symbols;
+	u64 symbols_offset;
+	u64 strings_offset;
+	u64 strings_size;
+};
+
+struct op_jit_map_symbol {
+	u64 vma;
+	u64 size;
+	/** offset of the name in the string table */
+	u32 name;
+	u32 reserved;
+};
+
+/** a mapped JIT symbol map */
+struct op_jit_map {
+	void * base;
+	size_t size;
+	struct op_jit_map_header const * header;
+};
+
+/** a symbol to write */
+struct op_jit_map_entry {
+	u64 vma;
+	u64 size;
+	char const * name;
+};
+
+/**
+ * op_jit_map_open - map a JIT symbol map
+ * @param map  map to fill
+ * @param filename  the map filename
+ *
+ * The whole map is checked: symbols of a successfully opened map are
+ * sorted, don't overlap and their names are in range. Return 0 on
+ * success. On failure return -1 with errno set, EINVAL if the file is
+ * not a map of this version.
+ */
+int op_jit_map_open(struct op_jit_map * map, char const * filename);
+
+/** unmap a map opened by op_jit_map_open() */
+void op_jit_map_close(struct op_jit_map * map);
+
+/** return symbol index or NULL if out of range */
+struct op_jit_map_symbol const *
+op_jit_map_get_symbol(struct op_jit_map const * map, u32 index);
+
+/** return the string at offset or NULL if out of range */
+char const * op_jit_map_string(struct op_jit_map const * map, u32 offset);
+
+/**
+ * op_jit_map_write - write a JIT symbol map
+ * @param filename  the map filename
+ * @param entries  the symbols, sorted by vma and not overlapping
+ * @param nr_entries  number of symbols
+ *
+ * The map is written to a temporary file renamed over filename so a
+ * reader never sees it half written. Return 0 on success, -1 with errno
+ * set on failure, EINVAL if entries are not sorted or overlap.
+ */
+int op_jit_map_write(char const * filename,
+                     struct op_jit_map_entry const * entries,
+                     size_t nr_entries);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* OP_JIT_MAP_H */
@@ -0,0 +1,174 @@
+/**
+ * @file op_report_file.c
+ * Reader of the binary report format
+ *
+ * @remark Copyright 2013 OProfile authors
+ * @remark Read the file COPYING
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#include "op_report_file.h"
+
+static size_t symbol_stride(struct op_report_header const * header)
+{
+	return sizeof(struct op_report_symbol) + header->nr_classes * sizeof(u64);
+}
+
+
+static size_t arc_stride(struct op_report_header const * header)
+{
+	return sizeof(struct op_report_arc) + header->nr_classes * sizeof(u64);
+}
+
+
+/* is [offset, offset + count * stride) inside the file and aligned */
+static int check_range(size_t size, u64 offset, u64 count, size_t stride)
+{
+	if (offset % sizeof(u64) || offset > size)
+		return 0;
+	return count <= (size - offset) / stride;
+}
+
+
+static int check_header(struct op_report const * report)
+{
+	struct op_report_header const * header = report->header;
+	char const * strings;
+
+	if (report->size < sizeof(*header) ||
+	    memcmp(header->magic, OP_REPORT_MAGIC, sizeof(header->magic)) ||
+	    header->version != OP_REPORT_VERSION ||
+	    header->nr_listed > header->nr_symbols)
+		return 0;
+
+	if (!check_range(report->size, header->totals_offset,
+	                 header->nr_classes, sizeof(u64)) ||
+	    !check_range(report->size, header->symbols_offset,
+	                 header->nr_symbols, symbol_stride(header)) ||
+	    !check_range(report->size, header->arcs_offset,
+	                 header->nr_arcs, arc_stride(header)) ||
+	    !check_range(report->size, header->strings_offset,
+	                 header->strings_size, 1))
+		return 0;
+
+	/* the string table must end with a nul so lookups are bounded */
+	strings = (char const *)report->base + header->strings_offset;
+	return !header->strings_size || !strings[header->strings_size - 1];
+}
+
+
+int op_report_open(struct op_report * report, char const * filename)
+{
+	struct stat st;
+	int fd;
+
+	memset(report, 0, sizeof(*report));
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return -1;
+
+	if (fstat(fd, &st) < 0)
+		goto fail;
+
+	if ((size_t)st.st_size < sizeof(struct op_report_header)) {
+		errno = EINVAL;
+		goto fail;
+	}
+
+	report->size = st.st_size;
+	report->base = mmap(0, report->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (report->base == MAP_FAILED) {
+		report->base = 0;
+		goto fail;
+	}
+
+	close(fd);
+
+	report->header = report->base;
+	if (!check_header(report)) {
+		op_report_close(report);
+		errno = EINVAL;
+		return -1;
+	}
+
+	return 0;
+
+fail:
+	close(fd);
+	return -1;
+}
+
+
+void op_report_close(struct op_report * report)
+{
+	if (report->base)
+		munmap(report->base, report->size);
+	memset(report, 0, sizeof(*report));
+}
+
+
+u64 const * op_report_totals(struct op_report const * report)
+{
+	char const * base = report->base;
+	return (u64 const *)(base + report->header->totals_offset);
+}
+
+
+struct op_report_symbol const *
+op_report_get_symbol(struct op_report const * report, u32 index)
+{
+	struct op_report_header const * header = report->header;
+	char const * base = report->base;
+
+	if (index >= header->nr_symbols)
+		return NULL;
+
+	base += header->symbols_offset + index * symbol_stride(header);
+	return (struct op_report_symbol const *)base;
+}
+
+
+u64 const * op_report_symbol_counts(struct op_report_symbol const * sym)
+{
+	return (u64 const *)(sym + 1);
+}
+
+
+struct op_report_arc const *
+op_report_get_arc(struct op_report const * report, u32 index)
+{
+	struct op_report_header const * header = report->header;
+	char const * base = report->base;
+
+	if (index >= header->nr_arcs)
+		return NULL;
+
+	base += header->arcs_offset + index * arc_stride(header);
+	return (struct op_report_arc const *)base;
+}
+
+
+u64 const * op_report_arc_counts(struct op_report_arc const * arc)
+{
+	return (u64 const *)(arc + 1);
+}
+
+
+char const * op_report_string(struct op_report const * report, u32 offset)
+{
+	struct op_report_header const * header = report->header;
+	char const * base = report->base;
+
+	if (offset >= header->strings_size)
+		return NULL;
+
+	return base + header->strings_offset + offset;
+}
@@ -0,0 +1,121 @@
+/**
+ * @file op_report_file.h
+ * Binary report format written by opreport --binary, and its reader
+ *
+ * @remark Copyright 2013 OProfile authors
+ * @remark Read the file COPYING
+ */
+
+#ifndef OP_REPORT_FILE_H
+#define OP_REPORT_FILE_H
+
+#include <stddef.h>
+
+#include "op_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A binary report is, in native byte order and with every part 8 bytes
+ * aligned:
+ *
+ * struct op_report_header
+ * nr_classes u64, the total sample count of each profile class
+ * nr_symbols struct op_report_symbol, each followed by nr_classes u64
+ * nr_arcs struct op_report_arc, each followed by nr_classes u64
+ * the string table, nul terminated strings
+ *
+ * The first nr_listed symbols are the report itself, in report order.
+ * The others are only there as the end of a call graph arc. Strings are
+ * referenced by their offset in the string table.
+ */
+
+#define OP_REPORT_MAGIC "OPREPORT"
+#define OP_REPORT_VERSION 1
+/** string offset for "no string" */
+#define OP_REPORT_NO_STRING 0xffffffffu
+
+struct op_report_header {
+	u8 magic[8];
+	u32 version;
+	u32 nr_classes;
+	u32 nr_symbols;
+	u32 nr_listed;
+	u32 nr_arcs;
+	u32 reserved;
+	u64 totals_offset;
+	u64 symbols_offset;
+	u64 arcs_offset;
+	u64 strings_offset;
+	u64 strings_size;
+};
+
+struct op_report_symbol {
+	u64 vma;
+	u64 size;
+	/** demangled symbol name */
+	u32 name;
+	/** image containing the symbol */
+	u32 image;
+	/** owning application */
+	u32 app;
+	/** source filename or OP_REPORT_NO_STRING */
+	u32 source_file;
+	u32 source_line;
+	u32 reserved;
+};
+
+struct op_report_arc {
+	/** symbol index of the caller */
+	u32 caller;
+	/** symbol index of the callee */
+	u32 callee;
+};
+
+/** a mapped report */
+struct op_report {
+	void * base;
+	size_t size;
+	struct op_report_header const * header;
+};
+
+/**
+ * op_report_open - map a binary report
+ * @param report  report to fill
+ * @param filename  the report filename
+ *
+ * Return 0 on success. On failure return -1 with errno set, EINVAL if the
+ * file is not a report of this version.
+ */
+int op_report_open(struct op_report * report, char const * filename);
+
+/** unmap a report opened by op_report_open() */
+void op_report_close(struct op_report * report);
+
+/** return the total sample count of each profile class */
+u64 const * op_report_totals(struct op_report const * report);
+
+/** return symbol index or NULL if out of range */
+struct op_report_symbol const *
+op_report_get_symbol(struct op_report const * report, u32 index);
+
+/** return the nr_classes sample counts of sym */
+u64 const * op_report_symbol_counts(struct op_report_symbol const * sym);
+
+/** return arc index or NULL if out of range */
+struct op_report_arc const *
+op_report_get_arc(struct op_report const * report, u32 index);
+
+/** return the nr_classes sample counts of arc */
+u64 const * op_report_arc_counts(struct op_report_arc const * arc);
+
+/** return the string at offset or NULL if out of range */
+char const * op_report_string(struct op_report const * report, u32 offset);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* OP_REPORT_FILE_H */
@@ -10,6 +10,8 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <time.h>
 
 #include "op_parse_event.h"
 #include "op_alloc_counter.h"
@@ -204,6 +206,215 @@ free_events:
 }
 
 
+/* synthetic constraint sets use the cpu with the most counters */
+#define SYNTH_CPU CPU_AXP_EV67
+#define SYNTH_COUNTERS 20
+
+
+/* the allocation must be a valid binding */
+static void check_binding(u32 const * masks, size_t const * counter_map,
+                          int nr_events)
+{
+	u32 used = 0;
+	int i;
+
+	for (i = 0; i < nr_events; ++i) {
+		if (!masks[i]) {
+			if (counter_map[i] != (size_t)-1)
+				break;
+			continue;
+		}
+		if (counter_map[i] >= 32 ||
+		    !(masks[i] & (1U << counter_map[i])) ||
+		    (used & (1U << counter_map[i])))
+			break;
+		used |= 1U << counter_map[i];
+	}
+
+	if (i != nr_events) {
+		printf("Invalid binding for synthetic event %d\n", i);
+		exit(EXIT_FAILURE);
+	}
+}
+
+
+/* the conflict set must be a real conflict */
+static void check_conflict(u32 const * masks, int const * conflict,
+                           int size, int nr_events)
+{
+	u32 reached = 0;
+	int i, nr = 0, nr_counters = 0;
+
+	for (i = 0; i < nr_events; ++i) {
+		if (conflict[i]) {
+			reached |= masks[i];
+			++nr;
+		}
+	}
+	for (i = 0; i < 32; ++i)
+		if (reached & (1U << i))
+			++nr_counters;
+
+	if (!size || size != nr || nr_counters >= nr) {
+		printf("Invalid conflict set of size %d: %d events "
+		       "on %d counters\n", size, nr, nr_counters);
+		exit(EXIT_FAILURE);
+	}
+}
+
+
+/* the binding map_event_to_counter() must give, by left to right
+ * backtracking as the allocator did before it used matching */
+static int reference_binding(u32 const * masks, int nr_events, int depth,
+                             u32 used, size_t * counter_map)
+{
+	int ctr;
+
+	if (depth == nr_events)
+		return 1;
+
+	if (!masks[depth]) {
+		counter_map[depth] = -1;
+		return reference_binding(masks, nr_events, depth + 1, used,
+		                         counter_map);
+	}
+
+	for (ctr = 0; ctr < 32; ++ctr) {
+		if (!(masks[depth] & (1U << ctr)) || (used & (1U << ctr)))
+			continue;
+		counter_map[depth] = ctr;
+		if (reference_binding(masks, nr_events, depth + 1,
+		                      used | (1U << ctr), counter_map))
+			return 1;
+	}
+
+	return 0;
+}
+
+
+/**
+ * @param masks  counter mask of each synthetic event
+ * @param nr_events  number of events
+ * @param expect  expected binding, NULL to only check it's valid
+ *
+ * return non zero if the events could be bound
+ */
+static int do_synthetic_test(u32 const * masks, int nr_events,
+                             size_t const * expect)
+{
+	struct op_event events[MAX_EVENTS];
+	struct op_event const * pev[MAX_EVENTS];
+	int conflict[MAX_EVENTS];
+	size_t * counter_map;
+	int i, size;
+
+	memset(events, 0, sizeof(events));
+	for (i = 0; i < nr_events; ++i) {
+		events[i].counter_mask = masks[i];
+		events[i].ext = masks[i] ? NULL : "ext";
+		pev[i] = &events[i];
+	}
+
+	counter_map = map_event_to_counter(pev, nr_events, SYNTH_CPU);
+	size = find_counter_conflict(pev, nr_events, SYNTH_CPU, conflict);
+
+	if (!counter_map) {
+		check_conflict(masks, conflict, size, nr_events);
+		return 0;
+	}
+
+	if (size) {
+		printf("Conflict found for events which can be bound\n");
+		exit(EXIT_FAILURE);
+	}
+
+	check_binding(masks, counter_map, nr_events);
+	if (expect && memcmp(expect, counter_map, nr_events * sizeof(size_t))) {
+		printf("Incorrect allocation map for synthetic events:\n"
+		       "(expect, found):\n");
+		show_counter_map(expect, nr_events);
+		show_counter_map(counter_map, nr_events);
+		exit(EXIT_FAILURE);
+	}
+
+	free(counter_map);
+	return 1;
+}
+
+
+static void synthetic_tests(void)
+{
+	u32 masks[MAX_EVENTS];
+	size_t expect[MAX_EVENTS];
+	u32 all = (1U << SYNTH_COUNTERS) - 1;
+	clock_t start;
+	int i, nr_tests, nr_bound;
+
+	/*
+	 * Every event allows any counter but the last one needs counter 0:
+	 * backtracking explores (n-1)! placements before moving the first
+	 * event away from counter 0.
+	 */
+	for (i = 0; i < SYNTH_COUNTERS; ++i) {
+		masks[i] = all;
+		expect[i] = i + 1;
+	}
+	masks[SYNTH_COUNTERS - 1] = 1;
+	expect[SYNTH_COUNTERS - 1] = 0;
+	do_synthetic_test(masks, SYNTH_COUNTERS, expect);
+
+	/* pigeonhole: n events on n - 1 counters can't be bound */
+	for (i = 0; i < SYNTH_COUNTERS; ++i)
+		masks[i] = all >> 1;
+	if (do_synthetic_test(masks, SYNTH_COUNTERS, NULL)) {
+		printf("Pigeonhole synthetic events bound\n");
+		exit(EXIT_FAILURE);
+	}
+
+	/* three events on two counters among events which could be bound */
+	for (i = 0; i < SYNTH_COUNTERS; ++i)
+		masks[i] = 1U << i;
+	masks[3] = masks[7] = masks[11] = 0x3;
+	masks[5] = 0;
+	if (do_synthetic_test(masks, 12, NULL)) {
+		printf("Three events on two counters bound\n");
+		exit(EXIT_FAILURE);
+	}
+
+	/* random small sets, checked against backtracking */
+	srand(1);
+	for (nr_tests = 0; nr_tests < 2000; ++nr_tests) {
+		int nr_events = 1 + rand() % 8;
+		int bound;
+
+		for (i = 0; i < nr_events; ++i)
+			masks[i] = rand() % 10 ? rand() & 0xff : 0;
+		bound = reference_binding(masks, nr_events, 0, 0, expect);
+		if (do_synthetic_test(masks, nr_events, bound ? expect : NULL)
+		    != bound) {
+			printf("Allocation disagrees with backtracking\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	/* random large sets with overlapping constraints, timed */
+	start = clock();
+	nr_bound = 0;
+	for (nr_tests = 0; nr_tests < 500; ++nr_tests) {
+		for (i = 0; i < SYNTH_COUNTERS; ++i) {
+			int j;
+			masks[i] = 0;
+			for (j = 0; j < 3; ++j)
+				masks[i] |= 1U << (rand() % SYNTH_COUNTERS);
+		}
+		nr_bound += do_synthetic_test(masks, SYNTH_COUNTERS, NULL);
+	}
+	printf("%d sets of %d synthetic events, %d bound: %.3f ms each\n",
+	       nr_tests, SYNTH_COUNTERS, nr_bound,
+	       (clock() - start) * 1000.0 / CLOCKS_PER_SEC / nr_tests);
+}
+
+
 int main(void)
 {
 	struct allocated_counter const * it;
@@ -213,5 +424,7 @@ int main(void)
 	for (it = tests; it->cpu_type != CPU_NO_GOOD; ++it)
 		do_test(it);
 
+	synthetic_tests();
+
 	return 0;
 }
@@ -0,0 +1,312 @@
+/**
+ * @file events_db_tests.c
+ *
+ * @remark Copyright 2013 OProfile authors
+ * @remark Read the file COPYING
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <ftw.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <utime.h>
+
+#include "op_events.h"
+#include "op_events_db.h"
+#include "op_cpu_type.h"
+
+/* the cpu whose description files are rewritten by the stale test */
+#define STALE_CPU CPU_ATHLON
+#define STALE_EVENT(name) \
+	"event:0xfe counters:0,1,2,3 um:zero minimum:500 name:" name \
+	" : stale database test\n"
+
+static char test_dir[] = "events-db-test-XXXXXX";
+
+static void fail(char const * cpu_name, char const * msg)
+{
+	fprintf(stderr, "events_db_tests: %s: %s\n", cpu_name, msg);
+	exit(EXIT_FAILURE);
+}
+
+
+static char const * str(char const * s)
+{
+	return s ? s : "(null)";
+}
+
+
+/* dump the loaded events in a form comparable between two loads */
+static FILE * dump_events(op_cpu cpu_type)
+{
+	struct list_head * pos;
+	FILE * fp = tmpfile();
+	u32 i;
+
+	if (!fp) {
+		perror("tmpfile");
+		exit(EXIT_FAILURE);
+	}
+
+	list_for_each(pos, op_events(cpu_type)) {
+		struct op_event * event =
+			list_entry(pos, struct op_event, event_next);
+		struct op_unit_mask * um = event->unit;
+
+		fprintf(fp, "%s %x %x %d %d %s %s\n", event->name, event->val,
+		        event->counter_mask, event->min_count, event->filter,
+		        str(event->ext), str(event->desc));
+		fprintf(fp, " %s %u %d %x %d\n", um->name, um->num,
+		        um->unit_type_mask, um->default_mask, um->used);
+		for (i = 0; i < um->num; ++i)
+			fprintf(fp, "  %x %x %s\n", um->um[i].extra,
+			        um->um[i].value, um->um[i].desc);
+
+		if (find_event_by_name(event->name, 0, 0) == NULL)
+			fail(op_get_cpu_name(cpu_type), "event not found by name");
+	}
+
+	op_free_events();
+	rewind(fp);
+	return fp;
+}
+
+
+static int same_file(FILE * a, FILE * b)
+{
+	int ca, cb;
+
+	do {
+		ca = getc(a);
+		cb = getc(b);
+	} while (ca == cb && ca != EOF);
+
+	fclose(a);
+	fclose(b);
+	return ca == cb;
+}
+
+
+static void make_dirs(char * path)
+{
+	char * p;
+
+	for (p = strchr(path + 1, '/'); p; p = strchr(p + 1, '/')) {
+		*p = '\0';
+		mkdir(path, 0755);
+		*p = '/';
+	}
+}
+
+
+static void write_garbage(char const * filename)
+{
+	FILE * fp = fopen(filename, "w");
+	if (!fp || fputs(OP_EVENTS_DB_MAGIC "garbage", fp) < 0 || fclose(fp)) {
+		perror(filename);
+		exit(EXIT_FAILURE);
+	}
+}
+
+
+/* copy src to dst then append extra if not NULL */
+static void copy_file(char const * src, char const * dst, char const * extra)
+{
+	FILE * in = fopen(src, "r");
+	FILE * out = fopen(dst, "w");
+	int c;
+
+	if (!in || !out) {
+		perror(in ? dst : src);
+		exit(EXIT_FAILURE);
+	}
+	while ((c = getc(in)) != EOF)
+		putc(c, out);
+	if (extra)
+		fputs(extra, out);
+	fclose(in);
+	if (ferror(out) || fclose(out)) {
+		perror(dst);
+		exit(EXIT_FAILURE);
+	}
+}
+
+
+static void set_mtime(char const * filename, time_t mtime)
+{
+	struct utimbuf times;
+
+	times.actime = times.modtime = mtime;
+	if (utime(filename, &times)) {
+		perror(filename);
+		exit(EXIT_FAILURE);
+	}
+}
+
+
+static int has_event(char const * name)
+{
+	int found;
+
+	op_events(STALE_CPU);
+	found = find_event_by_name(name, 0, 0) != NULL;
+	op_free_events();
+	return found;
+}
+
+
+/**
+ * A database is stale once one of its description files changes, it is
+ * checked with the file size and its mtime, which has a one second
+ * resolution: each rewrite below changes only one of them. The events
+ * directory is read once per process so this runs in its own process with
+ * a copy of the description files.
+ */
+static void test_stale(void)
+{
+	char const * cpu_name = op_get_cpu_name(STALE_CPU);
+	char src_dir[PATH_MAX];
+	char dir[PATH_MAX];
+	char events[PATH_MAX];
+	char db_file[PATH_MAX];
+	struct stat st;
+
+	snprintf(src_dir, sizeof(src_dir), "%s/events/%s", OPROFILE_SRCDIR,
+	         cpu_name);
+	snprintf(dir, sizeof(dir), "%s/events", test_dir);
+	setenv("OPROFILE_EVENTS_DIR", dir, 1);
+	snprintf(dir, sizeof(dir), "%s/stale-db", test_dir);
+	setenv("OPROFILE_EVENTS_DB_DIR", dir, 1);
+
+	snprintf(dir, sizeof(dir), "%s/events/%s/unit_masks", test_dir,
+	         cpu_name);
+	make_dirs(dir);
+	snprintf(src_dir + strlen(src_dir), sizeof(src_dir) - strlen(src_dir),
+	         "/unit_masks");
+	copy_file(src_dir, dir, NULL);
+	strcpy(strrchr(src_dir, '/'), "/events");
+	snprintf(events, sizeof(events), "%s/events/%s/events", test_dir,
+	         cpu_name);
+	copy_file(src_dir, events, NULL);
+
+	snprintf(db_file, sizeof(db_file), "%s/stale-db/%s/%s", test_dir,
+	         cpu_name, OP_EVENTS_DB_NAME);
+	make_dirs(db_file);
+	if (op_events_compile(cpu_name, db_file))
+		fail(cpu_name, "can't compile events");
+
+	/* a new event in the same second */
+	if (stat(events, &st)) {
+		perror(events);
+		exit(EXIT_FAILURE);
+	}
+	copy_file(src_dir, events, STALE_EVENT("STALE_TEST_A"));
+	set_mtime(events, st.st_mtime);
+	if (!has_event("STALE_TEST_A"))
+		fail(cpu_name, "database with a stale size not ignored");
+
+	if (op_events_compile(cpu_name, db_file))
+		fail(cpu_name, "can't compile events");
+	if (!has_event("STALE_TEST_A"))
+		fail(cpu_name, "recompiled database events differ");
+
+	/* a renamed event of the same size in a later second */
+	copy_file(src_dir, events, STALE_EVENT("STALE_TEST_B"));
+	set_mtime(events, st.st_mtime + 2);
+	if (!has_event("STALE_TEST_B") || has_event("STALE_TEST_A"))
+		fail(cpu_name, "database with a stale mtime not ignored");
+}
+
+
+static int remove_entry(char const * path,
+                        struct stat const * st __attribute__((unused)),
+                        int flag __attribute__((unused)),
+                        struct FTW * ftw __attribute__((unused)))
+{
+	return remove(path);
+}
+
+
+static void remove_test_dir(void)
+{
+	nftw(test_dir, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+
+int main(void)
+{
+	char db_dir[sizeof(test_dir) + 8];
+	op_cpu cpu_type;
+	int status;
+	pid_t pid;
+
+	if (!mkdtemp(test_dir)) {
+		perror("mkdtemp");
+		return EXIT_FAILURE;
+	}
+
+	pid = fork();
+	if (pid == -1) {
+		perror("fork");
+		remove_test_dir();
+		return EXIT_FAILURE;
+	}
+	if (!pid) {
+		test_stale();
+		_exit(EXIT_SUCCESS);
+	}
+	if (waitpid(pid, &status, 0) == -1 || !WIFEXITED(status) ||
+	    WEXITSTATUS(status)) {
+		remove_test_dir();
+		return EXIT_FAILURE;
+	}
+
+	/* from here fail() exits through the cleanup */
+	atexit(remove_test_dir);
+
+	setenv("OPROFILE_EVENTS_DIR", OPROFILE_SRCDIR "/events", 1);
+	snprintf(db_dir, sizeof(db_dir), "%s/db", test_dir);
+	setenv("OPROFILE_EVENTS_DB_DIR", db_dir, 1);
+
+	for (cpu_type = CPU_NO_GOOD + 1; cpu_type < MAX_CPU_TYPE; ++cpu_type) {
+		char const * cpu_name = op_get_cpu_name(cpu_type);
+		char db_file[4096];
+		struct op_events_db db;
+		FILE * text;
+
+		if (cpu_type == CPU_TIMER_INT)
+			continue;
+
+		snprintf(db_file, sizeof(db_file), "%s/%s/%s", db_dir,
+		         cpu_name, OP_EVENTS_DB_NAME);
+		make_dirs(db_file);
+
+		text = dump_events(cpu_type);
+
+		if (op_events_compile(cpu_name, db_file))
+			fail(cpu_name, "can't compile events");
+		if (op_events_db_open(&db, db_file))
+			fail(cpu_name, "compiled database is invalid");
+		op_events_db_close(&db);
+
+		if (!same_file(text, dump_events(cpu_type)))
+			fail(cpu_name, "database events differ from text events");
+
+		/* an invalid database must fall back to the text files */
+		text = dump_events(cpu_type);
+		write_garbage(db_file);
+		if (!same_file(text, dump_events(cpu_type)))
+			fail(cpu_name, "bad database not ignored");
+
+		unlink(db_file);
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,125 @@
+/**
+ * @file jit_map_tests.c
+ *
+ * @remark Copyright 2013 OProfile authors
+ * @remark Read the file COPYING
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "op_jit_map.h"
+
+static struct op_jit_map_entry const entries[] = {
+	{ 0x1000, 0x40, "LFoo;bar()V" },
+	{ 0x1040, 0x10, "stub" },
+	{ 0x2000, 0x100, "LFoo;baz(I)I" },
+};
+
+#define NR_ENTRIES (sizeof(entries) / sizeof(entries[0]))
+
+
+static void fail(char const * msg)
+{
+	fprintf(stderr, "jit_map_tests: %s\n", msg);
+	exit(EXIT_FAILURE);
+}
+
+
+static void check_valid(char const * filename)
+{
+	struct op_jit_map map;
+	struct op_jit_map_symbol const * sym;
+	u32 i;
+
+	if (op_jit_map_write(filename, entries, NR_ENTRIES))
+		fail("can't write a map");
+	if (op_jit_map_open(&map, filename))
+		fail("can't open a valid map");
+
+	for (i = 0; i < NR_ENTRIES; ++i) {
+		sym = op_jit_map_get_symbol(&map, i);
+		if (!sym || sym->vma != entries[i].vma ||
+		    sym->size != entries[i].size)
+			fail("bad symbol");
+		if (strcmp(op_jit_map_string(&map, sym->name),
+			   entries[i].name))
+			fail("bad symbol name");
+	}
+
+	if (op_jit_map_get_symbol(&map, NR_ENTRIES))
+		fail("symbol index out of range accepted");
+	if (op_jit_map_string(&map, map.header->strings_size))
+		fail("string offset out of range accepted");
+
+	op_jit_map_close(&map);
+
+	if (op_jit_map_write(filename, entries, 0) ||
+	    op_jit_map_open(&map, filename) ||
+	    op_jit_map_get_symbol(&map, 0))
+		fail("bad empty map");
+	op_jit_map_close(&map);
+}
+
+
+/* patch the map file at offset and check it is rejected */
+static void check_invalid(char const * filename, size_t offset,
+                          void const * data, size_t size, char const * msg)
+{
+	struct op_jit_map map;
+	FILE * fp;
+
+	if (op_jit_map_write(filename, entries, NR_ENTRIES))
+		fail("can't write a map");
+	fp = fopen(filename, "r+b");
+	if (!fp || fseek(fp, offset, SEEK_SET) ||
+	    fwrite(data, size, 1, fp) != 1 || fclose(fp))
+		fail("can't patch a map");
+
+	if (!op_jit_map_open(&map, filename) || errno != EINVAL)
+		fail(msg);
+}
+
+
+int main(void)
+{
+	char filename[] = "/tmp/jit_map_testsXXXXXX";
+	struct op_jit_map_entry overlapping[2];
+	struct op_jit_map_symbol const * sym = 0;
+	size_t syms = sizeof(struct op_jit_map_header);
+	u32 nr = 1000;
+	u64 vma = 0x1020;
+	u32 name = 0xffff;
+	char c = 'x';
+	int fd;
+
+	fd = mkstemp(filename);
+	if (fd < 0) {
+		perror("mkstemp");
+		return EXIT_FAILURE;
+	}
+	close(fd);
+
+	check_valid(filename);
+
+	check_invalid(filename, 0, &c, 1, "bad magic accepted");
+	check_invalid(filename, offsetof(struct op_jit_map_header, nr_symbols),
+	              &nr, sizeof(nr), "symbols overflow accepted");
+	check_invalid(filename, syms + sizeof(*sym) + offsetof(
+	              struct op_jit_map_symbol, vma), &vma, sizeof(vma),
+	              "overlapping symbols accepted");
+	check_invalid(filename, syms + offsetof(struct op_jit_map_symbol,
+	              name), &name, sizeof(name), "bad name accepted");
+
+	overlapping[0] = entries[0];
+	overlapping[1] = entries[0];
+	overlapping[1].vma += 4;
+	if (!op_jit_map_write(filename, overlapping, 2) || errno != EINVAL)
+		fail("overlapping entries written");
+
+	unlink(filename);
+	return EXIT_SUCCESS;
+}
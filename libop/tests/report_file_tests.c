@@ -0,0 +1,189 @@
+/**
+ * @file report_file_tests.c
+ *
+ * @remark Copyright 2013 OProfile authors
+ * @remark Read the file COPYING
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "op_report_file.h"
+
+#define NR_CLASSES 2
+
+static char const strings[] = "main\0/bin/app\0foo\0";
+
+struct test_report {
+	struct op_report_header header;
+	u64 totals[NR_CLASSES];
+	struct op_report_symbol main_sym;
+	u64 main_counts[NR_CLASSES];
+	struct op_report_symbol foo_sym;
+	u64 foo_counts[NR_CLASSES];
+	struct op_report_arc arc;
+	u64 arc_counts[NR_CLASSES];
+	char strings[sizeof(strings)];
+};
+
+
+static void fill_report(struct test_report * r)
+{
+	memset(r, 0, sizeof(*r));
+	memcpy(r->header.magic, OP_REPORT_MAGIC, sizeof(r->header.magic));
+	r->header.version = OP_REPORT_VERSION;
+	r->header.nr_classes = NR_CLASSES;
+	r->header.nr_symbols = 2;
+	r->header.nr_listed = 1;
+	r->header.nr_arcs = 1;
+	r->header.totals_offset = offsetof(struct test_report, totals);
+	r->header.symbols_offset = offsetof(struct test_report, main_sym);
+	r->header.arcs_offset = offsetof(struct test_report, arc);
+	r->header.strings_offset = offsetof(struct test_report, strings);
+	r->header.strings_size = sizeof(strings);
+
+	r->totals[0] = 100;
+	r->totals[1] = 10;
+
+	r->main_sym.vma = 0x1000;
+	r->main_sym.size = 0x20;
+	r->main_sym.name = 0;
+	r->main_sym.image = 5;
+	r->main_sym.app = 5;
+	r->main_sym.source_file = OP_REPORT_NO_STRING;
+	r->main_counts[0] = 60;
+	r->main_counts[1] = 3;
+
+	r->foo_sym.vma = 0x2000;
+	r->foo_sym.name = 14;
+	r->foo_sym.image = 5;
+	r->foo_sym.app = 5;
+	r->foo_sym.source_file = OP_REPORT_NO_STRING;
+
+	r->arc.caller = 1;
+	r->arc.callee = 0;
+	r->arc_counts[0] = 7;
+
+	memcpy(r->strings, strings, sizeof(strings));
+}
+
+
+static void write_report(char const * filename, void const * data,
+                         size_t size)
+{
+	FILE * fp = fopen(filename, "wb");
+	if (!fp || fwrite(data, size, 1, fp) != 1 || fclose(fp)) {
+		perror(filename);
+		exit(EXIT_FAILURE);
+	}
+}
+
+
+static void fail(char const * msg)
+{
+	fprintf(stderr, "report_file_tests: %s\n", msg);
+	exit(EXIT_FAILURE);
+}
+
+
+static void check_valid(char const * filename)
+{
+	struct op_report report;
+	struct op_report_symbol const * sym;
+	struct op_report_arc const * arc;
+
+	if (op_report_open(&report, filename))
+		fail("can't open a valid report");
+
+	if (op_report_totals(&report)[0] != 100 ||
+	    op_report_totals(&report)[1] != 10)
+		fail("bad totals");
+
+	sym = op_report_get_symbol(&report, 0);
+	if (!sym || sym->vma != 0x1000 || sym->size != 0x20 ||
+	    op_report_symbol_counts(sym)[0] != 60 ||
+	    op_report_symbol_counts(sym)[1] != 3)
+		fail("bad listed symbol");
+	if (strcmp(op_report_string(&report, sym->name), "main") ||
+	    strcmp(op_report_string(&report, sym->image), "/bin/app"))
+		fail("bad listed symbol strings");
+
+	sym = op_report_get_symbol(&report, 1);
+	if (!sym || strcmp(op_report_string(&report, sym->name), "foo") ||
+	    op_report_symbol_counts(sym)[0] != 0)
+		fail("bad arc only symbol");
+
+	if (op_report_get_symbol(&report, 2))
+		fail("symbol index out of range accepted");
+
+	arc = op_report_get_arc(&report, 0);
+	if (!arc || arc->caller != 1 || arc->callee != 0 ||
+	    op_report_arc_counts(arc)[0] != 7)
+		fail("bad arc");
+
+	if (op_report_get_arc(&report, 1))
+		fail("arc index out of range accepted");
+
+	if (op_report_string(&report, sizeof(strings)))
+		fail("string offset out of range accepted");
+
+	op_report_close(&report);
+}
+
+
+static void check_invalid(char const * filename, struct test_report * r,
+                          size_t size, char const * msg)
+{
+	struct op_report report;
+
+	write_report(filename, r, size);
+	if (!op_report_open(&report, filename) || errno != EINVAL)
+		fail(msg);
+	fill_report(r);
+}
+
+
+int main(void)
+{
+	char filename[] = "/tmp/report_file_testsXXXXXX";
+	struct test_report r;
+	int fd;
+
+	fd = mkstemp(filename);
+	if (fd < 0) {
+		perror("mkstemp");
+		return EXIT_FAILURE;
+	}
+	close(fd);
+
+	fill_report(&r);
+	write_report(filename, &r, sizeof(r));
+	check_valid(filename);
+
+	r.header.magic[0] = 'X';
+	check_invalid(filename, &r, sizeof(r), "bad magic accepted");
+
+	r.header.version = OP_REPORT_VERSION + 1;
+	check_invalid(filename, &r, sizeof(r), "bad version accepted");
+
+	check_invalid(filename, &r, sizeof(r) - 8, "truncated file accepted");
+
+	r.header.nr_symbols = 1000;
+	check_invalid(filename, &r, sizeof(r), "symbols overflow accepted");
+
+	r.header.arcs_offset += 4;
+	check_invalid(filename, &r, sizeof(r), "unaligned arcs accepted");
+
+	r.strings[sizeof(strings) - 1] = 'x';
+	check_invalid(filename, &r, sizeof(r), "unterminated strings accepted");
+
+	r.header.nr_listed = 3;
+	check_invalid(filename, &r, sizeof(r), "bad nr_listed accepted");
+
+	unlink(filename);
+	return EXIT_SUCCESS;
+}
@@ -52,7 +52,9 @@
 
 #include "config.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <errno.h>
+#include <pthread.h>
 #include <string.h>
 #include <stdint.h>
 #include <limits.h>
@@ -116,13 +118,397 @@ static int define_bfd_vars(void)
  * Define the version of the opagent library.
  */
 #define OP_MAJOR_VERSION 1
-#define OP_MINOR_VERSION 0
+#define OP_MINOR_VERSION 1
 
+/* the tests build the agent with a directory of their own */
+#ifndef AGENT_DIR
 #define AGENT_DIR OP_SESSION_DIR_DEFAULT "jitdump"
+#endif
 
 #define MSG_MAXLEN 20
 
-op_agent_t op_open_agent(void)
+/*
+ * A buffered agent stages the records of each thread in a ring owned by
+ * that thread, a flusher thread appends them to the dump file. Records
+ * are numbered when staged so the flusher writes them in the order they
+ * were staged across threads; the dump file format is unchanged. Writing
+ * a record takes no lock shared with other threads and no system call,
+ * it becomes visible in the dump file within FLUSH_DELAY_MS. A write
+ * error of the flusher is reported by the next call on the agent.
+ */
+
+/* size of the ring of each thread, a power of two */
+#define RING_SIZE (64 * 1024)
+/* larger records are staged out of the ring */
+#define MAX_RING_RECORD (RING_SIZE / 4)
+/* time the flusher waits for more records once woken */
+#define FLUSH_DELAY_MS 10
+
+struct record_ring {
+	struct record_ring * next;
+	char * data;
+	/* advanced by the owner thread */
+	volatile uint64_t head;
+	/* advanced by the flusher */
+	volatile uint64_t tail;
+	/* the owner thread exited */
+	volatile int dead;
+};
+
+/* header of a record staged in a ring, followed by the record unless
+ * the record is staged out of the ring */
+struct staged_record {
+	uint64_t seq;
+	uint64_t size;
+	char * indirect;
+};
+
+#define STAGED_HEADER_SIZE ((sizeof(struct staged_record) + 7) & ~7)
+
+struct op_agent {
+	FILE * dumpfile;
+	int buffered;
+	/* the rest is used by buffered agents only */
+	pthread_key_t ring_key;
+	/* protects rings and the flusher state below */
+	pthread_mutex_t lock;
+	/* signaled to wake up the flusher */
+	pthread_cond_t wakeup;
+	/* broadcast when the flusher freed room in the rings */
+	pthread_cond_t drained;
+	struct record_ring * rings;
+	/* number of the next record staged */
+	volatile uint64_t next_seq;
+	/* number of the next record to write */
+	uint64_t flushed_seq;
+	volatile int flusher_idle;
+	/* the flusher failed to write, nothing is written after */
+	volatile int write_error;
+	/* threads waiting for room in their ring */
+	int waiters;
+	int closing;
+	pthread_t flusher;
+};
+
+/* a record being written, to the dump file or to the ring of a thread */
+struct record_writer {
+	struct op_agent * agent;
+	struct record_ring * ring;
+	uint64_t start;
+	uint64_t pos;
+	struct staged_record header;
+	int error;
+};
+
+
+static void ring_put(struct record_ring * ring, uint64_t pos,
+		     void const * data, size_t size)
+{
+	size_t offset = pos & (RING_SIZE - 1);
+	size_t first = size < RING_SIZE - offset ? size : RING_SIZE - offset;
+
+	memcpy(ring->data + offset, data, first);
+	memcpy(ring->data, (char const *)data + first, size - first);
+}
+
+
+static void ring_get(struct record_ring const * ring, uint64_t pos,
+		     void * data, size_t size)
+{
+	size_t offset = pos & (RING_SIZE - 1);
+	size_t first = size < RING_SIZE - offset ? size : RING_SIZE - offset;
+
+	memcpy(data, ring->data + offset, first);
+	memcpy((char *)data + first, ring->data, size - first);
+}
+
+
+static void ring_key_destructor(void * ring)
+{
+	((struct record_ring *)ring)->dead = 1;
+}
+
+
+/* return the ring of the calling thread, creating it if needed */
+static struct record_ring * thread_ring(struct op_agent * agent)
+{
+	struct record_ring * ring = pthread_getspecific(agent->ring_key);
+
+	if (ring)
+		return ring;
+	ring = calloc(1, sizeof(struct record_ring));
+	if (!ring)
+		return NULL;
+	ring->data = malloc(RING_SIZE);
+	if (!ring->data) {
+		free(ring);
+		return NULL;
+	}
+	pthread_mutex_lock(&agent->lock);
+	ring->next = agent->rings;
+	agent->rings = ring;
+	pthread_mutex_unlock(&agent->lock);
+	pthread_setspecific(agent->ring_key, ring);
+	return ring;
+}
+
+
+/*
+ * Append the records staged in the rings to the dump file in the order
+ * they were numbered, up to the first record not yet published by its
+ * thread. Called with agent->lock held.
+ */
+static void drain_rings(struct op_agent * agent)
+{
+	struct record_ring * ring, ** prev;
+	struct staged_record header;
+	char buf[4096];
+	uint64_t pos, size, len;
+
+	for (;;) {
+		for (ring = agent->rings; ring; ring = ring->next) {
+			if (ring->tail == ring->head)
+				continue;
+			__sync_synchronize();
+			ring_get(ring, ring->tail, &header,
+				 sizeof(struct staged_record));
+			if (header.seq == agent->flushed_seq)
+				break;
+		}
+		if (!ring)
+			break;
+
+		/* after a write error the records are only consumed */
+		if (header.indirect) {
+			if (!agent->write_error &&
+			    !fwrite_unlocked(header.indirect, header.size, 1,
+					     agent->dumpfile))
+				agent->write_error = 1;
+			free(header.indirect);
+			size = 0;
+		} else {
+			pos = ring->tail + STAGED_HEADER_SIZE;
+			for (size = 0; size < header.size; size += len) {
+				len = header.size - size;
+				if (len > sizeof(buf))
+					len = sizeof(buf);
+				if (agent->write_error)
+					continue;
+				ring_get(ring, pos + size, buf, len);
+				if (!fwrite_unlocked(buf, len, 1,
+						     agent->dumpfile))
+					agent->write_error = 1;
+			}
+		}
+		__sync_synchronize();
+		ring->tail += STAGED_HEADER_SIZE + size;
+		agent->flushed_seq++;
+	}
+
+	/* the rings of exited threads are freed once empty */
+	prev = &agent->rings;
+	while ((ring = *prev)) {
+		if (ring->dead && ring->tail == ring->head) {
+			*prev = ring->next;
+			free(ring->data);
+			free(ring);
+		} else {
+			prev = &ring->next;
+		}
+	}
+}
+
+
+static void * flusher_main(void * arg)
+{
+	struct op_agent * agent = arg;
+	struct timespec delay;
+
+	delay.tv_sec = 0;
+	delay.tv_nsec = FLUSH_DELAY_MS * 1000000L;
+
+	pthread_mutex_lock(&agent->lock);
+	for (;;) {
+		agent->flusher_idle = 1;
+		__sync_synchronize();
+		while (!agent->closing && agent->flushed_seq == agent->next_seq)
+			pthread_cond_wait(&agent->wakeup, &agent->lock);
+		agent->flusher_idle = 0;
+
+		/* batch the records staged meanwhile in one write */
+		if (!agent->closing && !agent->waiters) {
+			pthread_mutex_unlock(&agent->lock);
+			nanosleep(&delay, NULL);
+			pthread_mutex_lock(&agent->lock);
+		}
+
+		drain_rings(agent);
+		/* wait for the records numbered but not yet published, their
+		 * thread sees flusher_idle once it published them and wakes
+		 * us up */
+		while (agent->flushed_seq != agent->next_seq) {
+			agent->flusher_idle = 1;
+			__sync_synchronize();
+			drain_rings(agent);
+			if (agent->flushed_seq == agent->next_seq)
+				break;
+			pthread_cond_wait(&agent->wakeup, &agent->lock);
+		}
+		agent->flusher_idle = 0;
+		if (!agent->write_error && fflush_unlocked(agent->dumpfile))
+			agent->write_error = 1;
+		pthread_cond_broadcast(&agent->drained);
+
+		if (agent->closing)
+			break;
+	}
+	pthread_mutex_unlock(&agent->lock);
+	return NULL;
+}
+
+
+static int start_flusher(struct op_agent * agent)
+{
+	if (pthread_key_create(&agent->ring_key, ring_key_destructor))
+		return -1;
+	pthread_mutex_init(&agent->lock, NULL);
+	pthread_cond_init(&agent->wakeup, NULL);
+	pthread_cond_init(&agent->drained, NULL);
+	if (pthread_create(&agent->flusher, NULL, flusher_main, agent)) {
+		pthread_key_delete(agent->ring_key);
+		return -1;
+	}
+	return 0;
+}
+
+
+static void stop_flusher(struct op_agent * agent)
+{
+	struct record_ring * ring, * next;
+
+	pthread_mutex_lock(&agent->lock);
+	agent->closing = 1;
+	pthread_cond_signal(&agent->wakeup);
+	pthread_mutex_unlock(&agent->lock);
+	pthread_join(agent->flusher, NULL);
+
+	pthread_key_delete(agent->ring_key);
+	for (ring = agent->rings; ring; ring = next) {
+		next = ring->next;
+		free(ring->data);
+		free(ring);
+	}
+	pthread_cond_destroy(&agent->drained);
+	pthread_cond_destroy(&agent->wakeup);
+	pthread_mutex_destroy(&agent->lock);
+}
+
+
+/*
+ * Start writing a record of size bytes. Records of a synchronous agent
+ * are written with the dump file locked so they are not interleaved with
+ * records of other threads.
+ */
+static int record_begin(struct record_writer * w, struct op_agent * agent,
+			size_t size)
+{
+	struct record_ring * ring;
+	uint64_t room;
+
+	memset(w, 0, sizeof(*w));
+	w->agent = agent;
+	if (!agent->buffered) {
+		flockfile(agent->dumpfile);
+		return 0;
+	}
+
+	if (agent->write_error) {
+		errno = EIO;
+		return -1;
+	}
+	ring = thread_ring(agent);
+	if (!ring) {
+		errno = ENOMEM;
+		return -1;
+	}
+	w->ring = ring;
+	w->header.size = size;
+	if (size > MAX_RING_RECORD) {
+		w->header.indirect = malloc(size);
+		if (!w->header.indirect) {
+			errno = ENOMEM;
+			return -1;
+		}
+		room = STAGED_HEADER_SIZE;
+	} else {
+		room = STAGED_HEADER_SIZE + size;
+	}
+
+	if (ring->head - ring->tail + room > RING_SIZE) {
+		pthread_mutex_lock(&agent->lock);
+		agent->waiters++;
+		while (ring->head - ring->tail + room > RING_SIZE) {
+			pthread_cond_signal(&agent->wakeup);
+			pthread_cond_wait(&agent->drained, &agent->lock);
+		}
+		agent->waiters--;
+		pthread_mutex_unlock(&agent->lock);
+	}
+	__sync_synchronize();
+	w->start = ring->head;
+	w->pos = w->start + STAGED_HEADER_SIZE;
+	return 0;
+}
+
+
+static void record_write(struct record_writer * w, void const * data,
+			 size_t size)
+{
+	if (!w->agent->buffered) {
+		if (!w->error && !fwrite_unlocked(data, size, 1,
+						  w->agent->dumpfile))
+			w->error = 1;
+		return;
+	}
+	if (w->header.indirect)
+		memcpy(w->header.indirect + (w->pos - w->start -
+					     STAGED_HEADER_SIZE), data, size);
+	else
+		ring_put(w->ring, w->pos, data, size);
+	w->pos += size;
+}
+
+
+/* Finish writing a record, it is numbered and published to the flusher */
+static int record_end(struct record_writer * w)
+{
+	struct op_agent * agent = w->agent;
+	struct record_ring * ring = w->ring;
+
+	if (!agent->buffered) {
+		/* Always flush to ensure conversion code to elf will see
+		 * data as soon as possible */
+		fflush_unlocked(agent->dumpfile);
+		funlockfile(agent->dumpfile);
+		return w->error ? -1 : 0;
+	}
+
+	w->header.seq = __sync_fetch_and_add(&agent->next_seq, 1);
+	ring_put(ring, w->start, &w->header, sizeof(struct staged_record));
+	__sync_synchronize();
+	ring->head = w->header.indirect ? w->start + STAGED_HEADER_SIZE :
+		w->pos;
+	__sync_synchronize();
+	if (agent->flusher_idle) {
+		pthread_mutex_lock(&agent->lock);
+		pthread_cond_signal(&agent->wakeup);
+		pthread_mutex_unlock(&agent->lock);
+	}
+	return 0;
+}
+
+
+static op_agent_t open_agent(int buffered)
 {
 	char pad_bytes[7] = {0, 0, 0, 0, 0, 0, 0};
 	int pad_cnt;
@@ -134,6 +520,7 @@ op_agent_t op_open_agent(void)
 	int fd;
 	struct timeval tv;
 	FILE * dumpfile = NULL;
+	struct op_agent * agent;
 
 	rc = stat(AGENT_DIR, &dirstat);
 	if (rc || !S_ISDIR(dirstat.st_mode)) {
@@ -190,7 +577,34 @@ op_agent_t op_open_agent(void)
 		return NULL;
 	}
 	fflush(dumpfile);
-	return (op_agent_t)dumpfile;
+
+	agent = calloc(1, sizeof(struct op_agent));
+	if (!agent) {
+		fclose(dumpfile);
+		errno = ENOMEM;
+		return NULL;
+	}
+	agent->dumpfile = dumpfile;
+	agent->buffered = buffered;
+	if (buffered && start_flusher(agent)) {
+		fprintf(stderr, "libopagent: cannot start flusher thread\n");
+		fclose(dumpfile);
+		free(agent);
+		return NULL;
+	}
+	return (op_agent_t)agent;
+}
+
+
+op_agent_t op_open_agent(void)
+{
+	return open_agent(0);
+}
+
+
+op_agent_t op_open_agent_buffered(void)
+{
+	return open_agent(1);
 }
 
 
@@ -198,11 +612,16 @@ int op_close_agent(op_agent_t hdl)
 {
 	struct jr_code_close rec;
 	struct timeval tv;
-	FILE * dumpfile = (FILE *) hdl;
-	if (!dumpfile) {
+	struct op_agent * agent = (struct op_agent *) hdl;
+	int write_error = 0;
+	if (!agent) {
 		errno = EINVAL;
 		return -1;
 	}
+	if (agent->buffered) {
+		stop_flusher(agent);
+		write_error = agent->write_error;
+	}
 	rec.id = JIT_CODE_CLOSE;
 	rec.total_size = sizeof(rec);
 	if (gettimeofday(&tv, NULL)) {
@@ -211,25 +630,54 @@ int op_close_agent(op_agent_t hdl)
 	}
 	rec.timestamp = tv.tv_sec;
 
-	if (!fwrite(&rec, sizeof(rec), 1, dumpfile))
+	if (!fwrite(&rec, sizeof(rec), 1, agent->dumpfile))
+		return -1;
+	fclose(agent->dumpfile);
+	free(agent);
+	if (write_error) {
+		errno = EIO;
 		return -1;
-	fclose(dumpfile);
-	dumpfile = NULL;
+	}
 	return 0;
 }
 
 
+uint64_t op_get_timestamp(void)
+{
+	struct timeval tv;
+
+	if (gettimeofday(&tv, NULL)) {
+		fprintf(stderr, "gettimeofday failed\n");
+		return 0;
+	}
+	return tv.tv_sec;
+}
+
+
 int op_write_native_code(op_agent_t hdl, char const * symbol_name,
 	uint64_t vma, void const * code, unsigned int const size)
+{
+	uint64_t timestamp = op_get_timestamp();
+
+	if (!timestamp)
+		return -1;
+	return op_write_native_code_at(hdl, symbol_name, vma, code, size,
+				       timestamp);
+}
+
+
+int op_write_native_code_at(op_agent_t hdl, char const * symbol_name,
+	uint64_t vma, void const * code, unsigned int const size,
+	uint64_t timestamp)
 {
 	struct jr_code_load rec;
-	struct timeval tv;
 	size_t sz_symb_name;
 	char pad_bytes[7] = { 0, 0, 0, 0, 0, 0, 0 };
 	size_t padding_count;
-	FILE * dumpfile = (FILE *) hdl;
+	struct op_agent * agent = (struct op_agent *) hdl;
+	struct record_writer writer;
 
-	if (!dumpfile) {
+	if (!agent) {
 		errno = EINVAL;
 		fprintf(stderr, "Invalid hdl argument\n");
 		return -1;
@@ -245,51 +693,50 @@ int op_write_native_code(op_agent_t hdl, char const * symbol_name,
 	/* calculate amount of padding '\0' */
 	padding_count = PADDING_8ALIGNED(rec.total_size);
 	rec.total_size += padding_count;
-	if (gettimeofday(&tv, NULL)) {
-		fprintf(stderr, "gettimeofday failed\n");
-		return -1;
-	}
-
-	rec.timestamp = tv.tv_sec;
+	rec.timestamp = timestamp;
 
-	/* locking makes sure that we continuously write this record, if
-	 * we are called within a multi-threaded context */
-	flockfile(dumpfile);
 	/* Write record, symbol name, code (optionally), and (if necessary)
 	 * additonal padding \0 bytes.
 	 */
-	if (fwrite_unlocked(&rec, sizeof(rec), 1, dumpfile) &&
-	    fwrite_unlocked(symbol_name, sz_symb_name, 1, dumpfile)) {
-		if (code)
-			fwrite_unlocked(code, size, 1, dumpfile);
-		if (padding_count)
-			fwrite_unlocked(pad_bytes, padding_count, 1, dumpfile);
-		/* Always flush to ensure conversion code to elf will see
-		 * data as soon as possible */
-		fflush_unlocked(dumpfile);
-		funlockfile(dumpfile);
-		return 0;
-	}
-	fflush_unlocked(dumpfile);
-	funlockfile(dumpfile);
-	return -1;
+	if (record_begin(&writer, agent, rec.total_size))
+		return -1;
+	record_write(&writer, &rec, sizeof(rec));
+	record_write(&writer, symbol_name, sz_symb_name);
+	if (code)
+		record_write(&writer, code, size);
+	if (padding_count)
+		record_write(&writer, pad_bytes, padding_count);
+	return record_end(&writer);
 }
 
 
 int op_write_debug_line_info(op_agent_t hdl, void const * code,
 			     size_t nr_entry,
 			     struct debug_line_info const * compile_map)
+{
+	uint64_t timestamp = op_get_timestamp();
+
+	if (!timestamp)
+		return -1;
+	return op_write_debug_line_info_at(hdl, code, nr_entry, compile_map,
+					   timestamp);
+}
+
+
+int op_write_debug_line_info_at(op_agent_t hdl, void const * code,
+				size_t nr_entry,
+				struct debug_line_info const * compile_map,
+				uint64_t timestamp)
 {
 	struct jr_code_debug_info rec;
-	long cur_pos, last_pos;
-	struct timeval tv;
 	size_t i;
 	size_t padding_count;
+	size_t total_size;
 	char padd_bytes[7] = {0, 0, 0, 0, 0, 0, 0};
-	int rc = -1;
-	FILE * dumpfile = (FILE *) hdl;
+	struct op_agent * agent = (struct op_agent *) hdl;
+	struct record_writer writer;
 
-	if (!dumpfile) {
+	if (!agent) {
 		errno = EINVAL;
 		fprintf(stderr, "Invalid hdl argument\n");
 		return -1;
@@ -301,64 +748,53 @@ int op_write_debug_line_info(op_agent_t hdl, void const * code,
 
 	rec.id = JIT_CODE_DEBUG_INFO;
 	rec.code_addr = (uint64_t)(uintptr_t)code;
-	/* will be fixed after writing debug line info */
-	rec.total_size = 0;
 	rec.nr_entry = nr_entry;
-	if (gettimeofday(&tv, NULL)) {
-		fprintf(stderr, "gettimeofday failed\n");
+	rec.timestamp = timestamp;
+
+	total_size = sizeof(rec);
+	for (i = 0; i < nr_entry; ++i) {
+		total_size += sizeof(compile_map[i].vma) +
+			sizeof(compile_map[i].lineno) +
+			strlen(compile_map[i].filename) + 1;
+	}
+	padding_count = PADDING_8ALIGNED(total_size);
+	rec.total_size = total_size + padding_count;
+
+	if (record_begin(&writer, agent, rec.total_size))
 		return -1;
+	record_write(&writer, &rec, sizeof(rec));
+	for (i = 0; i < nr_entry; ++i) {
+		record_write(&writer, &compile_map[i].vma,
+			     sizeof(compile_map[i].vma));
+		record_write(&writer, &compile_map[i].lineno,
+			     sizeof(compile_map[i].lineno));
+		record_write(&writer, compile_map[i].filename,
+			     strlen(compile_map[i].filename) + 1);
 	}
+	if (padding_count)
+		record_write(&writer, padd_bytes, padding_count);
+	return record_end(&writer);
+}
 
-	rec.timestamp = tv.tv_sec;
 
-	flockfile(dumpfile);
+int op_unload_native_code(op_agent_t hdl, uint64_t vma)
+{
+	uint64_t timestamp = op_get_timestamp();
 
-	if ((cur_pos = ftell(dumpfile)) == -1l)
-		goto error;
-	if (!fwrite_unlocked(&rec, sizeof(rec), 1, dumpfile))
-		goto error;
-	for (i = 0; i < nr_entry; ++i) {
-		if (!fwrite_unlocked(&compile_map[i].vma,
-				     sizeof(compile_map[i].vma), 1,
-				     dumpfile) ||
-		    !fwrite_unlocked(&compile_map[i].lineno,
-				     sizeof(compile_map[i].lineno), 1,
-				     dumpfile) ||
-		    !fwrite_unlocked(compile_map[i].filename,
-				     strlen(compile_map[i].filename) + 1, 1,
-				     dumpfile))
-			goto error;
-	}
-
-	if ((last_pos = ftell(dumpfile)) == -1l)
-		goto error;
-	rec.total_size = last_pos - cur_pos;
-	padding_count = PADDING_8ALIGNED(rec.total_size);
-	rec.total_size += padding_count;
-	if (padding_count && !fwrite(padd_bytes, padding_count, 1, dumpfile))
-		goto error;
-	if (fseek(dumpfile, cur_pos, SEEK_SET) == -1l)
-		goto error;
-	if (!fwrite_unlocked(&rec, sizeof(rec), 1, dumpfile))
-		goto error;
-	if (fseek(dumpfile, last_pos + padding_count, SEEK_SET) == -1)
-		goto error;
-
-	rc = 0;
-error:
-	fflush_unlocked(dumpfile);
-	funlockfile(dumpfile);
-	return rc;
+	if (!timestamp)
+		return -1;
+	return op_unload_native_code_at(hdl, vma, timestamp);
 }
 
 
-int op_unload_native_code(op_agent_t hdl, uint64_t vma)
+int op_unload_native_code_at(op_agent_t hdl, uint64_t vma,
+			     uint64_t timestamp)
 {
 	struct jr_code_unload rec;
-	struct timeval tv;
-	FILE * dumpfile = (FILE *) hdl;
+	struct op_agent * agent = (struct op_agent *) hdl;
+	struct record_writer writer;
 
-	if (!dumpfile) {
+	if (!agent) {
 		errno = EINVAL;
 		fprintf(stderr, "Invalid hdl argument\n");
 		return -1;
@@ -367,16 +803,12 @@ int op_unload_native_code(op_agent_t hdl, uint64_t vma)
 	rec.id = JIT_CODE_UNLOAD;
 	rec.vma = vma;
 	rec.total_size = sizeof(rec);
-	if (gettimeofday(&tv, NULL)) {
-		fprintf(stderr, "gettimeofday failed\n");
-		return -1;
-	}
-	rec.timestamp = tv.tv_sec;
+	rec.timestamp = timestamp;
 
-	if (!fwrite(&rec, sizeof(rec), 1, dumpfile))
+	if (record_begin(&writer, agent, rec.total_size))
 		return -1;
-	fflush(dumpfile);
-	return 0;
+	record_write(&writer, &rec, sizeof(rec));
+	return record_end(&writer);
 }
 
 int op_major_version(void)
@@ -53,6 +53,22 @@ typedef void * op_agent_t;
  **/
 op_agent_t op_open_agent(void);
 
+/**
+ * Like op_open_agent(), but the records written through the returned
+ * handle are buffered per thread and appended to the JIT dump file by a
+ * background thread, in the order they were written.  Writing a record
+ * does not serialize the calling threads nor block on the file; it
+ * reaches the JIT dump file after a short delay, and at the latest when
+ * op_close_agent() returns.  Use it for virtual machines compiling code
+ * from several threads at a high rate.  If appending records to the JIT
+ * dump file fails, the following calls on the handle, op_close_agent()
+ * included, return -1 with errno set to EIO.
+ *
+ * Returns a valid op_agent_t handle or NULL.  If NULL is returned, errno
+ * is set to indicate the nature of the error.
+ **/
+op_agent_t op_open_agent_buffered(void);
+
 /**
  * Frees all resources and closes open file handles.
  *
@@ -123,6 +139,38 @@ int op_write_debug_line_info(op_agent_t hdl, void const * code,
  **/
 int op_unload_native_code(op_agent_t hdl, uint64_t vma);
 
+/**
+ * Returns the timestamp the functions above give the records they write
+ * now, or 0 on error.
+ *
+ * An agent which reports code events after they happened, from another
+ * thread for instance, takes the timestamp when the event happens and
+ * passes it to the _at variants below: opjitconv relies on the timestamps
+ * to tell which code was live when code addresses are reused.
+ **/
+uint64_t op_get_timestamp(void);
+
+/**
+ * Like op_write_native_code(), with the timestamp of the record.
+ **/
+int op_write_native_code_at(op_agent_t hdl, char const * symbol_name,
+			    uint64_t vma, void const * code,
+			    const unsigned int code_size, uint64_t timestamp);
+
+/**
+ * Like op_write_debug_line_info(), with the timestamp of the record.
+ **/
+int op_write_debug_line_info_at(op_agent_t hdl, void const * code,
+				size_t nr_entry,
+				struct debug_line_info const * compile_map,
+				uint64_t timestamp);
+
+/**
+ * Like op_unload_native_code(), with the timestamp of the record.
+ **/
+int op_unload_native_code_at(op_agent_t hdl, uint64_t vma,
+			     uint64_t timestamp);
+
 /**
  * Returns the major version number of the libopagent library that will be used.
  **/
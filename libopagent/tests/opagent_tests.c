@@ -0,0 +1,336 @@
+/**
+ * @file opagent_tests.c
+ * Write JIT dump records through a buffered agent from several threads
+ * and check the dump file
+ *
+ * The agent is built with AGENT_DIR set to a directory of the build tree.
+ *
+ * @remark Copyright 2013 OProfile authors
+ * @remark Read the file COPYING
+ */
+
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "opagent.h"
+#include "jitdump.h"
+
+#define NR_THREADS 4
+/* enough for the records of a thread to wrap around its ring */
+#define NR_RECORDS 4000
+/* staged out of the ring */
+#define BIG_CODE_SIZE (40 * 1024)
+/* the thread writing a big record */
+#define BIG_THREAD 1
+#define BIG_RECORD 100
+
+static op_agent_t agent;
+static unsigned char big_code[BIG_CODE_SIZE];
+static int nr_error;
+
+
+static void fail(char const * what)
+{
+	fprintf(stderr, "%s\n", what);
+	++nr_error;
+}
+
+
+static uint64_t record_vma(int thread, int i)
+{
+	return ((uint64_t)(thread + 1) << 32) | (i * 16);
+}
+
+
+static void record_name(char * name, size_t size, int thread, int i)
+{
+	snprintf(name, size, "thread%d_method%d", thread, i);
+}
+
+
+static void * writer_thread(void * arg)
+{
+	int thread = (int)(long)arg;
+	char name[64];
+	int i;
+
+	for (i = 0; i < NR_RECORDS; ++i) {
+		uint64_t vma = record_vma(thread, i);
+		int big = thread == BIG_THREAD && i == BIG_RECORD;
+
+		record_name(name, sizeof(name), thread, i);
+		if (op_write_native_code_at(agent, name, vma,
+					    big ? big_code : NULL,
+					    big ? BIG_CODE_SIZE : 0, i + 1)) {
+			perror("op_write_native_code_at");
+			return (void *)1;
+		}
+		/* every other method is unloaded right away */
+		if (i & 1 && op_unload_native_code_at(agent, vma, i + 1)) {
+			perror("op_unload_native_code_at");
+			return (void *)1;
+		}
+	}
+
+	return NULL;
+}
+
+
+static char * read_file(char const * filename, size_t * size)
+{
+	struct stat st;
+	char * data;
+	FILE * fp;
+
+	fp = fopen(filename, "r");
+	if (!fp || fstat(fileno(fp), &st)) {
+		perror(filename);
+		exit(EXIT_FAILURE);
+	}
+	data = malloc(st.st_size);
+	if (!data || fread(data, st.st_size, 1, fp) != 1) {
+		perror(filename);
+		exit(EXIT_FAILURE);
+	}
+	fclose(fp);
+	*size = st.st_size;
+	return data;
+}
+
+
+/**
+ * The records of each thread must be in the dump in the order they were
+ * written, each complete, the close record last.
+ */
+static void check_dump(char const * filename)
+{
+	int next[NR_THREADS] = { 0 };
+	int unloaded[NR_THREADS] = { 0 };
+	char name[64];
+	size_t size, offset;
+	char * data;
+	struct jitheader const * header;
+	int closed = 0;
+	int i;
+
+	data = read_file(filename, &size);
+	header = (struct jitheader const *)data;
+	if (size < sizeof(*header) || header->magic != JITHEADER_MAGIC ||
+	    header->version != JITHEADER_VERSION ||
+	    header->totalsize > size) {
+		fail("bad dump header");
+		free(data);
+		return;
+	}
+
+	for (offset = header->totalsize; offset < size;) {
+		struct jr_prefix const * prefix =
+			(struct jr_prefix const *)(data + offset);
+		int thread;
+
+		if (closed || offset + sizeof(*prefix) > size ||
+		    prefix->total_size < sizeof(*prefix) ||
+		    prefix->total_size & 7 ||
+		    offset + prefix->total_size > size) {
+			fail("truncated or misaligned record");
+			break;
+		}
+
+		if (prefix->id == JIT_CODE_LOAD) {
+			struct jr_code_load const * rec =
+				(struct jr_code_load const *)prefix;
+			char const * rec_name = (char const *)(rec + 1);
+
+			thread = (int)(rec->vma >> 32) - 1;
+			if (thread < 0 || thread >= NR_THREADS ||
+			    (next[thread] && !unloaded[thread]) ||
+			    rec->vma != record_vma(thread, next[thread]) ||
+			    rec->timestamp != (uint64_t)next[thread] + 1) {
+				fail("code load record out of order");
+				break;
+			}
+			record_name(name, sizeof(name), thread, next[thread]);
+			if (strcmp(rec_name, name)) {
+				fail("bad code load record name");
+				break;
+			}
+			if (thread == BIG_THREAD && next[thread] == BIG_RECORD &&
+			    (rec->code_size != BIG_CODE_SIZE ||
+			     memcmp(rec_name + strlen(name) + 1, big_code,
+				    BIG_CODE_SIZE))) {
+				fail("bad big record code");
+				break;
+			}
+			unloaded[thread] = !(next[thread] & 1);
+			++next[thread];
+		} else if (prefix->id == JIT_CODE_UNLOAD) {
+			struct jr_code_unload const * rec =
+				(struct jr_code_unload const *)prefix;
+
+			thread = (int)(rec->vma >> 32) - 1;
+			if (thread < 0 || thread >= NR_THREADS ||
+			    unloaded[thread] || !next[thread] ||
+			    rec->vma != record_vma(thread, next[thread] - 1)) {
+				fail("code unload record out of order");
+				break;
+			}
+			unloaded[thread] = 1;
+		} else if (prefix->id == JIT_CODE_CLOSE) {
+			closed = 1;
+		} else {
+			fail("unexpected record");
+			break;
+		}
+		offset += prefix->total_size;
+	}
+
+	for (i = 0; i < NR_THREADS; ++i) {
+		if (next[i] != NR_RECORDS)
+			fail("missing records");
+	}
+	if (!closed)
+		fail("missing close record");
+
+	free(data);
+}
+
+
+static void test_threads(void)
+{
+	pthread_t threads[NR_THREADS];
+	char filename[PATH_MAX];
+	void * rc;
+	int i;
+
+	for (i = 0; i < BIG_CODE_SIZE; ++i)
+		big_code[i] = i * 7;
+
+	agent = op_open_agent_buffered();
+	if (!agent) {
+		perror("op_open_agent_buffered");
+		exit(EXIT_FAILURE);
+	}
+
+	for (i = 0; i < NR_THREADS; ++i) {
+		if (pthread_create(&threads[i], NULL, writer_thread,
+				   (void *)(long)i)) {
+			perror("pthread_create");
+			exit(EXIT_FAILURE);
+		}
+	}
+	for (i = 0; i < NR_THREADS; ++i) {
+		pthread_join(threads[i], &rc);
+		if (rc)
+			fail("writer thread failed");
+	}
+
+	if (op_close_agent(agent))
+		fail("op_close_agent failed");
+
+	snprintf(filename, sizeof(filename), "%s/%d.dump", AGENT_DIR,
+		 getpid());
+	check_dump(filename);
+	unlink(filename);
+}
+
+
+/**
+ * A write error of the flusher fails the calls made after it, the dump
+ * file size is limited in a child to get one.
+ */
+static int write_error_child(void)
+{
+	struct timespec delay = { 0, 1000000 };
+	struct rlimit limit;
+	char name[64];
+	int i;
+
+	agent = op_open_agent_buffered();
+	if (!agent) {
+		perror("op_open_agent_buffered");
+		return EXIT_FAILURE;
+	}
+
+	signal(SIGXFSZ, SIG_IGN);
+	limit.rlim_cur = limit.rlim_max = 4096;
+	if (setrlimit(RLIMIT_FSIZE, &limit)) {
+		perror("setrlimit");
+		return EXIT_FAILURE;
+	}
+
+	/* a few seconds at most for the flusher to fail */
+	for (i = 0; i < 5000; ++i) {
+		record_name(name, sizeof(name), 0, i);
+		if (op_write_native_code_at(agent, name, record_vma(0, i),
+					    NULL, 0, i + 1))
+			break;
+		nanosleep(&delay, NULL);
+	}
+	if (i == 5000) {
+		fprintf(stderr, "write error not reported\n");
+		return EXIT_FAILURE;
+	}
+	if (errno != EIO) {
+		perror("unexpected error");
+		return EXIT_FAILURE;
+	}
+	if (!op_unload_native_code_at(agent, record_vma(0, 0), 1)) {
+		fprintf(stderr, "write error not latched\n");
+		return EXIT_FAILURE;
+	}
+	if (!op_close_agent(agent)) {
+		fprintf(stderr, "op_close_agent succeeded after an error\n");
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+
+static void test_write_error(void)
+{
+	char filename[PATH_MAX];
+	int status;
+	pid_t pid;
+
+	pid = fork();
+	if (pid == -1) {
+		perror("fork");
+		exit(EXIT_FAILURE);
+	}
+	if (!pid)
+		_exit(write_error_child());
+
+	if (waitpid(pid, &status, 0) == -1 || !WIFEXITED(status) ||
+	    WEXITSTATUS(status))
+		fail("write error test failed");
+
+	snprintf(filename, sizeof(filename), "%s/%d.dump", AGENT_DIR, pid);
+	unlink(filename);
+}
+
+
+int main(void)
+{
+	if (mkdir(AGENT_DIR, 0755) && errno != EEXIST) {
+		perror(AGENT_DIR);
+		return EXIT_FAILURE;
+	}
+
+	test_threads();
+	test_write_error();
+
+	rmdir(AGENT_DIR);
+	return nr_error ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -30,6 +30,7 @@
 #include "operf_process_info.h"
 #include "op_libiberty.h"
 #include "operf_stats.h"
+#include "operf_jit.h"
 
 
 using namespace std;
@@ -40,6 +41,8 @@ volatile bool quit;
 volatile bool read_quit;
 int sample_reads;
 int num_mmap_pages;
+int max_mmap_pages;
+unsigned int wakeup_watermark;
 unsigned int pagesize;
 verbose vrecord("record");
 verbose vconvert("convert");
@@ -155,7 +158,7 @@ try_again:
 }  // end anonymous namespace
 
 operf_counter::operf_counter(operf_event_t & evt,  bool enable_on_exec, bool do_cg,
-                             bool separate_cpu)
+                             bool separate_cpu, bool sample_time)
 {
 	memset(&attr, 0, sizeof(attr));
 	attr.size = sizeof(attr);
@@ -164,6 +167,8 @@ operf_counter::operf_counter(operf_event_t & evt,  bool enable_on_exec, bool do_
 		attr.sample_type |= PERF_SAMPLE_CALLCHAIN;
 	if (separate_cpu)
 		attr.sample_type |= PERF_SAMPLE_CPU;
+	if (sample_time)
+		attr.sample_type |= PERF_SAMPLE_TIME;
 	attr.type = PERF_TYPE_RAW;
 #if defined(__i386__) || defined(__x86_64__)
 	if (evt.evt_code & EXTRA_PEBS) {
@@ -181,6 +186,10 @@ operf_counter::operf_counter(operf_event_t & evt,  bool enable_on_exec, bool do_
 	attr.exclude_kernel = evt.no_kernel;
 	attr.exclude_hv = evt.no_hv;
 	attr.read_format = PERF_FORMAT_ID;
+	if (wakeup_watermark) {
+		attr.watermark = 1;
+		attr.wakeup_watermark = wakeup_watermark;
+	}
 	event_name = evt.name;
 	fd = id = -1;
 }
@@ -240,7 +249,7 @@ operf_record::~operf_record()
 	close(output_fd);
 	for (int i = 0; i < samples_array.size(); i++) {
 		struct mmap_data *md = &samples_array[i];
-		munmap(md->base, (num_mmap_pages + 1) * pagesize);
+		munmap(md->base, ((size_t)num_mmap_pages + 1) * pagesize);
 	}
 	samples_array.clear();
 	evts.clear();
@@ -249,7 +258,7 @@ operf_record::~operf_record()
 
 operf_record::operf_record(int out_fd, bool sys_wide, pid_t the_pid, bool pid_running,
                            vector<operf_event_t> & events, vmlinux_info_t vi, bool do_cg,
-bool separate_by_cpu, bool out_fd_is_file)
+bool separate_by_cpu, bool out_fd_is_file, bool timestamps)
 {
 	int flags = O_CREAT|O_RDWR|O_TRUNC;
 	struct sigaction sa;
@@ -262,6 +271,7 @@ bool separate_by_cpu, bool out_fd_is_file)
 	system_wide = sys_wide;
 	callgraph = do_cg;
 	separate_cpu = separate_by_cpu;
+	sample_time = timestamps;
 	total_bytes_recorded = 0;
 	poll_count = 0;
 	evts = events;
@@ -386,7 +396,7 @@ int operf_record::prepareToRecord(int cpu, int fd)
 {
 	struct mmap_data md;;
 	md.prev = 0;
-	md.mask = num_mmap_pages * pagesize - 1;
+	md.mask = (u64)num_mmap_pages * pagesize - 1;
 
 	fcntl(fd, F_SETFL, O_NONBLOCK);
 
@@ -394,7 +404,7 @@ int operf_record::prepareToRecord(int cpu, int fd)
 	poll_data[cpu].events = POLLIN;
 	poll_count++;
 
-	md.base = mmap(NULL, (num_mmap_pages + 1) * pagesize,
+	md.base = mmap(NULL, ((size_t)num_mmap_pages + 1) * pagesize,
 			PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
 	if (md.base == MAP_FAILED) {
 		if (errno == EPERM) {
@@ -448,7 +458,9 @@ void operf_record::setup()
 		fclose(fp);
 	}
 	pagesize = sysconf(_SC_PAGE_SIZE);
-	num_mmap_pages = (512 * 1024)/pagesize;
+	// normally sized by op_size_ring_buffers()
+	if (!num_mmap_pages)
+		num_mmap_pages = (512 * 1024)/pagesize;
 	num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
 	if (!num_cpus)
 		throw runtime_error("Number of online CPUs is zero; cannot continue");;
@@ -507,7 +519,8 @@ void operf_record::setup()
 			evts[event].counter = event;
 			perfCounters[cpu].push_back(operf_counter(evts[event],
 			                                          (!pid_started && !system_wide),
-			                                          callgraph, separate_cpu));
+			                                          callgraph, separate_cpu,
+			                                          sample_time));
 			if ((rc = perfCounters[cpu][event].perf_event_open(pid, real_cpu, event, this)) < 0) {
 				err_msg = "Internal Error.  Perf event setup failed.";
 				goto error;
@@ -542,7 +555,7 @@ error:
 	poll_data = NULL;
 	for (int i = 0; i < samples_array.size(); i++) {
 		struct mmap_data *md = &samples_array[i];
-		munmap(md->base, (num_mmap_pages + 1) * pagesize);
+		munmap(md->base, ((size_t)num_mmap_pages + 1) * pagesize);
 	}
 	samples_array.clear();
 	if (dir)
@@ -861,9 +874,11 @@ int operf_read::convertPerfData(void)
 
 	first_time_processing = false;
 	op_reprocess_unresolved_events(opHeader.h_attrs[0].attr.sample_type);
+	operf_jit_write_maps();
 
 	op_release_resources();
-	operf_print_stats(operf_options::session_dir, start_time_human_readable, throttled);
+	operf_print_stats(operf_options::session_dir, start_time_human_readable, throttled,
+	                  num_mmap_pages, max_mmap_pages);
 
 	char * cbuf;
 	cbuf = (char *)xmalloc(operf_options::session_dir.length() + 5);
@@ -56,7 +56,7 @@ op_perf_event_open(struct perf_event_attr * attr,
 class operf_counter {
 public:
 	operf_counter(operf_event_t & evt, bool enable_on_exec, bool callgraph,
-	              bool separate_by_cpu);
+	              bool separate_by_cpu, bool sample_time);
 	~operf_counter();
 	int perf_event_open(pid_t ppid, int cpu, unsigned counter, operf_record * pr);
 	const struct perf_event_attr * the_attr(void) const { return &attr; }
@@ -77,10 +77,12 @@ public:
 	/* For system-wide profiling, set sys_wide=true, the_pid=-1, and pid_running=false.
 	 * For single app profiling, set sys_wide=false, the_pid=<processID-to-profile>,
 	 * and pid_running=true if profiling an already active process; otherwise false.
+	 * Set sample_time=true to record the time of each sample.
 	 */
 	operf_record(int output_fd, bool sys_wide, pid_t the_pid, bool pid_running,
 	             std::vector<operf_event_t> & evts, OP_perf_utils::vmlinux_info_t vi,
-	             bool callgraph, bool separate_by_cpu, bool output_fd_is_file);
+	             bool callgraph, bool separate_by_cpu, bool output_fd_is_file,
+	             bool sample_time);
 	~operf_record();
 	void recordPerfData(void);
 	int out_fd(void) const { return output_fd; }
@@ -106,6 +108,7 @@ private:
 	bool system_wide;
 	bool callgraph;
 	bool separate_cpu;
+	bool sample_time;
 	std::vector< std::vector<operf_counter> > perfCounters;
 	int total_bytes_recorded;
 	int poll_count;
@@ -0,0 +1,484 @@
+/**
+ * @file libperf_events/operf_jit.cpp
+ * Attribution of anonymous samples to JIT compiled code while operf
+ * converts its profile data
+ *
+ * @remark Copyright 2013 OProfile authors
+ * @remark Read the file COPYING
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "operf_jit.h"
+#include "operf_mangling.h"
+#include "operf_sfile.h"
+#include "op_jit_map.h"
+#include "jitdump.h"
+#include "cverb.h"
+
+extern verbose vconvert;
+
+using namespace std;
+
+namespace {
+
+/// unload time of code which was never unloaded
+u64 const never_unloaded = ~0ULL;
+
+/// a code load of the jitdump file, times are in seconds
+struct jit_code {
+	vma_t start;
+	vma_t end;
+	u64 load_time;
+	u64 unload_time;
+	string name;
+	unsigned long samples;
+};
+
+struct jit_process {
+	jit_process() : parsed(0), broken(false), last_scan(0),
+		index_dirty(false), last_start(0), last_end(0) {}
+
+	string dumpfile;
+	/// bytes of the dumpfile parsed so far, complete records only
+	off_t parsed;
+	/// the dumpfile is not a jitdump or is corrupted
+	bool broken;
+	/// time of the last read of the dumpfile
+	time_t last_scan;
+	/// code loads in the dumpfile order
+	vector<jit_code> codes;
+	/// code currently loaded at a given vma, index in codes
+	map<vma_t, size_t> live;
+	/// indexes in codes sorted by start address
+	vector<size_t> by_start;
+	/// max_end[i] is the max end of codes[by_start[0..i]]
+	vector<vma_t> max_end;
+	bool index_dirty;
+	/// JIT symbol maps to write
+	set<string> map_files;
+	/// anonymous region of the last sample, its map file is known
+	vma_t last_start;
+	vma_t last_end;
+	string last_app;
+};
+
+bool jit_enabled;
+string jitdump_dir;
+/// CLOCK_REALTIME - CLOCK_MONOTONIC in nanoseconds
+long long clock_offset;
+map<pid_t, jit_process> processes;
+
+
+/**
+ * Read the records added to the dumpfile since the last scan. An
+ * incomplete record, still being written, is parsed by the next scan.
+ */
+void scan_dumpfile(jit_process & proc)
+{
+	proc.last_scan = time(NULL);
+	if (proc.broken)
+		return;
+
+	int fd = open(proc.dumpfile.c_str(), O_RDONLY);
+	if (fd < 0)
+		return;
+
+	struct stat st;
+	if (fstat(fd, &st) || st.st_size <= proc.parsed) {
+		close(fd);
+		return;
+	}
+
+	size_t const size = st.st_size;
+	void * base = mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED) {
+		cverb << vconvert << "operf_jit: cannot mmap "
+		      << proc.dumpfile << endl;
+		return;
+	}
+
+	char const * data = static_cast<char const *>(base);
+	size_t pos = proc.parsed;
+
+	if (pos == 0) {
+		if (size < sizeof(struct jitheader))
+			goto out;
+		struct jitheader const * header =
+			reinterpret_cast<struct jitheader const *>(data);
+		if (header->magic != JITHEADER_MAGIC ||
+		    header->version != JITHEADER_VERSION ||
+		    header->totalsize < sizeof(struct jitheader)) {
+			cerr << "operf: " << proc.dumpfile
+			     << " is not a jitdump file of a supported version"
+			     << endl;
+			proc.broken = true;
+			goto out;
+		}
+		if (header->totalsize > size)
+			goto out;
+		pos = header->totalsize;
+	}
+
+	while (pos + sizeof(struct jr_prefix) <= size) {
+		struct jr_prefix const * prefix =
+			reinterpret_cast<struct jr_prefix const *>(data + pos);
+		if (prefix->total_size < sizeof(struct jr_prefix)) {
+			cerr << "operf: corrupted record in " << proc.dumpfile
+			     << endl;
+			proc.broken = true;
+			break;
+		}
+		if (pos + prefix->total_size > size)
+			break;
+
+		if (prefix->id == JIT_CODE_LOAD &&
+		    prefix->total_size > sizeof(struct jr_code_load)) {
+			struct jr_code_load const * rec =
+				reinterpret_cast<struct jr_code_load const *>(prefix);
+			char const * name = reinterpret_cast<char const *>(rec + 1);
+			size_t max_len = rec->total_size - sizeof(*rec);
+
+			jit_code code;
+			code.start = rec->vma;
+			code.end = rec->vma + rec->code_size;
+			code.load_time = rec->timestamp;
+			code.unload_time = never_unloaded;
+			code.name.assign(name, strnlen(name, max_len));
+			code.samples = 0;
+
+			// code reloaded without an unload replaces the old one
+			map<vma_t, size_t>::iterator it = proc.live.find(rec->vma);
+			if (it != proc.live.end())
+				proc.codes[it->second].unload_time = rec->timestamp;
+			proc.live[rec->vma] = proc.codes.size();
+			proc.codes.push_back(code);
+			proc.index_dirty = true;
+		} else if (prefix->id == JIT_CODE_UNLOAD &&
+		           prefix->total_size >= sizeof(struct jr_code_unload)) {
+			struct jr_code_unload const * rec =
+				reinterpret_cast<struct jr_code_unload const *>(prefix);
+			map<vma_t, size_t>::iterator it = proc.live.find(rec->vma);
+			if (it != proc.live.end()) {
+				proc.codes[it->second].unload_time = rec->timestamp;
+				proc.live.erase(it);
+			}
+		}
+		// JIT_CODE_CLOSE and JIT_CODE_DEBUG_INFO carry no symbol
+
+		pos += prefix->total_size;
+	}
+
+	proc.parsed = pos;
+out:
+	munmap(base, size);
+}
+
+
+struct less_start {
+	less_start(vector<jit_code> const & c) : codes(c) {}
+	bool operator()(size_t lhs, size_t rhs) const {
+		return codes[lhs].start < codes[rhs].start;
+	}
+	vector<jit_code> const & codes;
+};
+
+
+struct less_pc {
+	less_pc(vector<jit_code> const & c) : codes(c) {}
+	bool operator()(vma_t pc, size_t idx) const {
+		return pc < codes[idx].start;
+	}
+	vector<jit_code> const & codes;
+};
+
+
+void build_index(jit_process & proc)
+{
+	proc.by_start.resize(proc.codes.size());
+	for (size_t i = 0; i < proc.codes.size(); ++i)
+		proc.by_start[i] = i;
+	stable_sort(proc.by_start.begin(), proc.by_start.end(),
+	            less_start(proc.codes));
+
+	proc.max_end.resize(proc.by_start.size());
+	vma_t max_end = 0;
+	for (size_t i = 0; i < proc.by_start.size(); ++i) {
+		max_end = max(max_end, proc.codes[proc.by_start[i]].end);
+		proc.max_end[i] = max_end;
+	}
+	proc.index_dirty = false;
+}
+
+
+/**
+ * How well code matches a sample at time (in seconds, 0 if unknown): code
+ * loaded at the sample time is best, then code loaded before it. Without
+ * a sample time, code never unloaded is preferred.
+ */
+int match_rank(jit_code const & code, u64 time)
+{
+	if (!time)
+		return code.unload_time == never_unloaded ? 1 : 0;
+	if (code.load_time <= time && time <= code.unload_time)
+		return 2;
+	if (code.load_time <= time)
+		return 1;
+	return 0;
+}
+
+
+/// return the index in proc.codes of the code best matching pc, -1 if none
+long find_code(jit_process & proc, vma_t pc, u64 time, int & rank)
+{
+	if (proc.index_dirty)
+		build_index(proc);
+
+	long best = -1;
+	rank = -1;
+
+	vector<size_t>::const_iterator it =
+		upper_bound(proc.by_start.begin(), proc.by_start.end(), pc,
+		            less_pc(proc.codes));
+	for (size_t i = it - proc.by_start.begin(); i > 0; --i) {
+		if (proc.max_end[i - 1] <= pc)
+			break;
+		size_t const idx = proc.by_start[i - 1];
+		jit_code const & code = proc.codes[idx];
+		if (code.end <= pc)
+			continue;
+		int const r = match_rank(code, time);
+		// on equal rank the later record wins
+		if (r > rank || (r == rank && long(idx) > best)) {
+			rank = r;
+			best = idx;
+		}
+	}
+
+	return best;
+}
+
+
+
+/// remember the JIT symbol map to write for the samples of sf
+void add_map_file(jit_process & proc, struct operf_sfile const * sf)
+{
+	if (!proc.map_files.empty() && sf->start_addr == proc.last_start &&
+	    sf->end_addr == proc.last_end && proc.last_app == sf->app_filename)
+		return;
+
+	proc.last_start = sf->start_addr;
+	proc.last_end = sf->end_addr;
+	proc.last_app = sf->app_filename;
+
+	char * name = operf_get_jit_map_name(sf);
+	if (name) {
+		proc.map_files.insert(name);
+		free(name);
+	}
+}
+
+
+/// a part of a code claimed by the symbol map
+struct map_piece {
+	vma_t end;
+	size_t code;
+};
+
+
+struct more_samples {
+	more_samples(vector<jit_code> const & c) : codes(c) {}
+	bool operator()(size_t lhs, size_t rhs) const {
+		if (codes[lhs].samples != codes[rhs].samples)
+			return codes[lhs].samples > codes[rhs].samples;
+		return lhs > rhs;
+	}
+	vector<jit_code> const & codes;
+};
+
+
+/**
+ * Map sampled code to non overlapping symbols. Code at the same address
+ * loaded at different times can overlap, the code with more samples
+ * claims the addresses first and others keep the uncovered parts only.
+ */
+void build_symbols(jit_process const & proc,
+                   vector<struct op_jit_map_entry> & entries)
+{
+	vector<size_t> sampled;
+	for (size_t i = 0; i < proc.codes.size(); ++i) {
+		if (proc.codes[i].samples)
+			sampled.push_back(i);
+	}
+	sort(sampled.begin(), sampled.end(), more_samples(proc.codes));
+
+	// start address -> claimed piece
+	map<vma_t, map_piece> claimed;
+	for (size_t i = 0; i < sampled.size(); ++i) {
+		jit_code const & code = proc.codes[sampled[i]];
+		vector<pair<vma_t, vma_t> > gaps;
+		vma_t start = code.start;
+
+		map<vma_t, map_piece>::const_iterator it =
+			claimed.upper_bound(start);
+		if (it != claimed.begin()) {
+			map<vma_t, map_piece>::const_iterator prev = it;
+			--prev;
+			start = max(start, prev->second.end);
+		}
+		for (; start < code.end; ++it) {
+			vma_t const end = it == claimed.end() ?
+				code.end : min(code.end, it->first);
+			if (start < end)
+				gaps.push_back(make_pair(start, end));
+			if (it == claimed.end())
+				break;
+			start = max(start, it->second.end);
+		}
+
+		for (size_t j = 0; j < gaps.size(); ++j) {
+			map_piece piece = { gaps[j].second, sampled[i] };
+			claimed[gaps[j].first] = piece;
+		}
+	}
+
+	map<vma_t, map_piece>::const_iterator it;
+	for (it = claimed.begin(); it != claimed.end(); ++it) {
+		struct op_jit_map_entry entry;
+		entry.vma = it->first;
+		entry.size = it->second.end - it->first;
+		entry.name = proc.codes[it->second.code].name.c_str();
+		entries.push_back(entry);
+	}
+}
+
+
+/**
+ * Remove the dumpfile of a process which exited, with the ownership
+ * policy of opjitconv --delete-jitdumps.
+ */
+void remove_dumpfile(pid_t pid, jit_process const & proc)
+{
+	struct stat st;
+
+	if (stat(proc.dumpfile.c_str(), &st) || st.st_uid != geteuid())
+		return;
+	if (kill(pid, 0) == 0 || errno != ESRCH)
+		return;
+	if (unlink(proc.dumpfile.c_str()))
+		cverb << vconvert << "operf_jit: cannot remove "
+		      << proc.dumpfile << endl;
+}
+
+}  // anonymous namespace
+
+
+void operf_jit_init(char const * dir)
+{
+	struct timespec real, mono;
+
+	jitdump_dir = dir;
+	jit_enabled = true;
+
+	// perf_events timestamps are close to CLOCK_MONOTONIC while jitdump
+	// records use the wall clock seconds, this is only an approximation
+	// but jitdump times have a one second resolution anyway.
+	if (!clock_gettime(CLOCK_REALTIME, &real) &&
+	    !clock_gettime(CLOCK_MONOTONIC, &mono)) {
+		clock_offset = (real.tv_sec - mono.tv_sec) * 1000000000LL +
+			(real.tv_nsec - mono.tv_nsec);
+	}
+}
+
+
+bool operf_jit_enabled(void)
+{
+	return jit_enabled;
+}
+
+
+void operf_jit_log_sample(struct operf_sfile const * sf, vma_t pc,
+                          u64 sample_time)
+{
+	if (!jit_enabled || !sf->is_anon || strcmp(sf->image_name, "anon"))
+		return;
+
+	map<pid_t, jit_process>::iterator it = processes.find(sf->tgid);
+	if (it == processes.end()) {
+		ostringstream dumpfile;
+		dumpfile << jitdump_dir << sf->tgid << ".dump";
+		it = processes.insert(make_pair(sf->tgid, jit_process())).first;
+		it->second.dumpfile = dumpfile.str();
+		scan_dumpfile(it->second);
+	}
+	jit_process & proc = it->second;
+
+	u64 const seconds = sample_time ?
+		(sample_time + clock_offset) / 1000000000ULL : 0;
+
+	int rank;
+	long idx = find_code(proc, pc, seconds, rank);
+	// no code loaded at the sample time: the agent may have written it
+	// since we last read the dumpfile
+	if ((idx < 0 || (seconds && rank < 2)) &&
+	    proc.last_scan != time(NULL)) {
+		scan_dumpfile(proc);
+		idx = find_code(proc, pc, seconds, rank);
+	}
+	if (idx < 0)
+		return;
+
+	++proc.codes[idx].samples;
+	add_map_file(proc, sf);
+}
+
+
+void operf_jit_write_maps(void)
+{
+	if (!jit_enabled)
+		return;
+
+	map<pid_t, jit_process>::const_iterator it;
+	for (it = processes.begin(); it != processes.end(); ++it) {
+		jit_process const & proc = it->second;
+		if (proc.map_files.empty())
+			continue;
+
+		vector<struct op_jit_map_entry> entries;
+		build_symbols(proc, entries);
+
+		set<string>::const_iterator file;
+		for (file = proc.map_files.begin();
+		     file != proc.map_files.end(); ++file) {
+			cverb << vconvert << "operf_jit: writing " << entries.size()
+			      << " symbols to " << *file << endl;
+			if (op_jit_map_write(file->c_str(), entries.empty() ?
+			                     0 : &entries[0], entries.size())) {
+				cerr << "operf: cannot write JIT symbols to "
+				     << *file << ": " << strerror(errno) << endl;
+			}
+		}
+	}
+
+	for (it = processes.begin(); it != processes.end(); ++it)
+		remove_dumpfile(it->first, it->second);
+	processes.clear();
+}
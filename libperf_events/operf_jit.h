@@ -0,0 +1,50 @@
+/**
+ * @file libperf_events/operf_jit.h
+ * Attribution of anonymous samples to JIT compiled code while operf
+ * converts its profile data
+ *
+ * @remark Copyright 2013 OProfile authors
+ * @remark Read the file COPYING
+ */
+
+#ifndef OPERF_JIT_H
+#define OPERF_JIT_H
+
+#include "op_types.h"
+
+struct operf_sfile;
+
+/**
+ * operf_jit_init - enable JIT symbol attribution
+ * @param jitdump_dir  directory where JIT agents write their <pid>.dump
+ *
+ * Until this is called the other operf_jit_* functions do nothing.
+ */
+void operf_jit_init(char const * jitdump_dir);
+
+/** true if operf_jit_init() was called */
+bool operf_jit_enabled(void);
+
+/**
+ * operf_jit_log_sample - account a sample in an anonymous region
+ * @param sf  the anonymous sfile the sample was logged in
+ * @param pc  the sampled address
+ * @param sample_time  perf_events time of the sample, 0 if unknown
+ *
+ * The jitdump file of the process is read incrementally, only the records
+ * written since the last lookup are parsed. Samples outside of any JIT
+ * compiled code are ignored.
+ */
+void operf_jit_log_sample(struct operf_sfile const * sf, vma_t pc,
+                          u64 sample_time);
+
+/**
+ * operf_jit_write_maps - write the JIT symbol maps
+ *
+ * For each process with samples in JIT compiled code, write the
+ * <tgid>.jitmap symbol map (see op_jit_map.h) next to its anonymous sample
+ * files, then remove the jitdump files of processes which exited.
+ */
+void operf_jit_write_maps(void);
+
+#endif /* OPERF_JIT_H */
@@ -22,6 +22,7 @@
 #include "op_file.h"
 #include "op_sample_file.h"
 #include "op_mangle.h"
+#include "op_jit_map.h"
 #include "op_events.h"
 #include "op_libiberty.h"
 #include "cverb.h"
@@ -106,6 +107,27 @@ mangle_filename(struct operf_sfile * last, struct operf_sfile const * sf, int co
 	return mangled;
 }
 
+char * operf_get_jit_map_name(struct operf_sfile const * sf)
+{
+	char * mangled = mangle_filename(NULL, sf, 0, 0);
+	char * anon = NULL;
+	char * p;
+
+	// the sample files are in {anon:anon}/<tgid>.<start>.<end>/
+	for (p = mangled; (p = strstr(p, "{anon:")); ++p)
+		anon = p;
+	if (!anon || !(p = strchr(anon, '/'))) {
+		free(mangled);
+		return NULL;
+	}
+
+	char * name = (char *)xmalloc(p + 1 - mangled + 32);
+	sprintf(name, "%.*s%u%s", (int)(p + 1 - mangled), mangled,
+	        (unsigned int)sf->tgid, OP_JIT_MAP_SUFFIX);
+	free(mangled);
+	return name;
+}
+
 static void fill_header(struct opd_header * header, unsigned long counter,
                         vma_t anon_start, vma_t cg_to_anon_start,
                         int is_kernel, int cg_to_is_kernel,
@@ -32,5 +32,13 @@ struct operf_sfile;
 int operf_open_sample_file(odb_t *file, struct operf_sfile *last,
                          struct operf_sfile * sf, int counter, int cg);
 
+/*
+ * operf_get_jit_map_name - name of the JIT symbol map of an anon sfile
+ * @param sf  the anonymous operf_sfile
+ *
+ * Return the <tgid>.jitmap filename in the {anon:anon} directory of the
+ * sample files of sf, to be freed by the caller, or NULL on failure.
+ */
+char * operf_get_jit_map_name(struct operf_sfile const * sf);
 
 #endif /* OPERF_MANGLING_H_ */
@@ -11,6 +11,7 @@
  */
 
 #include <stdio.h>
+#include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -24,7 +25,8 @@ unsigned long operf_stats[OPERF_MAX_STATS];
  * operf_print_stats - print out latest statistics to operf.log
  */
 using namespace std;
-void operf_print_stats(string sessiondir, char * starttime, bool throttled)
+void operf_print_stats(string sessiondir, char * starttime, bool throttled,
+                       int ring_pages, int max_ring_pages)
 {
 	string operf_log (sessiondir);
 	int total_lost_samples = 0;
@@ -58,11 +60,20 @@ void operf_print_stats(string sessiondir, char * starttime, bool throttled)
 	       operf_stats[OPERF_LOST_INVALID_HYPERV_ADDR]);
 	fprintf(fp, "Nr. samples lost reported by perf_events kernel: %lu\n",
 	       operf_stats[OPERF_RECORD_LOST_SAMPLE]);
+	if (ring_pages)
+		fprintf(fp, "Nr. ring buffer pages per CPU: %d\n", ring_pages);
 
 	if (operf_stats[OPERF_RECORD_LOST_SAMPLE]) {
 		fprintf(stderr, "\n\n * * * ATTENTION: The kernel lost %lu samples. * * *\n",
 		        operf_stats[OPERF_RECORD_LOST_SAMPLE]);
 		fprintf(stderr, "Decrease the sampling rate to eliminate (or reduce) lost samples.\n");
+		unsigned long max_kb = (unsigned long)max_ring_pages * sysconf(_SC_PAGE_SIZE) / 1024;
+		if (ring_pages && ring_pages < max_ring_pages)
+			fprintf(stderr, "The next run in this session directory will use larger buffers,\n"
+			        "up to %lu KB per CPU.\n", max_kb);
+		else if (ring_pages)
+			fprintf(stderr, "The buffers are already at their limit of %lu KB per CPU.\n",
+			        max_kb);
 	} else if (throttled) {
 		fprintf(stderr, "* * * * WARNING: Profiling rate was throttled back by the kernel * * * *\n");
 		fprintf(stderr, "The number of samples actually recorded is less than expected, but is\n");
@@ -83,3 +94,40 @@ void operf_print_stats(string sessiondir, char * starttime, bool throttled)
 	fflush(fp);
 	fclose(fp);
 }
+
+
+/*
+ * operf.log is appended to by every run, the values of the last run are
+ * the last ones found. A run which logged no ring buffer size is ignored.
+ */
+bool operf_get_ring_history(string sessiondir, unsigned long & samples,
+                            unsigned long & lost, int & ring_pages)
+{
+	string operf_log(sessiondir);
+	unsigned long cur_samples = 0, cur_lost = 0;
+	char line[256];
+	bool found = false;
+
+	operf_log.append("/samples/operf.log");
+	FILE * fp = fopen(operf_log.c_str(), "r");
+	if (!fp)
+		return false;
+
+	while (fgets(line, sizeof(line), fp)) {
+		int pages;
+		if (sscanf(line, "Nr. non-backtrace samples: %lu", &cur_samples) == 1)
+			continue;
+		if (sscanf(line, "Nr. samples lost reported by perf_events kernel: %lu",
+		           &cur_lost) == 1)
+			continue;
+		if (sscanf(line, "Nr. ring buffer pages per CPU: %d", &pages) == 1) {
+			samples = cur_samples;
+			lost = cur_lost;
+			ring_pages = pages;
+			found = true;
+		}
+	}
+
+	fclose(fp);
+	return found;
+}
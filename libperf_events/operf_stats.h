@@ -38,6 +38,19 @@ enum {	OPERF_SAMPLES, /**< nr. samples */
 */
 #define OPERF_WARN_LOST_SAMPLES_THRESHOLD   0.0001
 
-void operf_print_stats(std::string sampledir, char * starttime, bool throttled);
+void operf_print_stats(std::string sampledir, char * starttime, bool throttled,
+                       int ring_pages, int max_ring_pages);
+
+/**
+ * operf_get_ring_history - look up the last run logged in operf.log
+ * @param sessiondir  the session directory
+ * @param samples  set to the nr. of samples of the last run
+ * @param lost  set to the nr. of samples lost by perf_events in the last run
+ * @param ring_pages  set to the ring buffer pages per CPU of the last run
+ *
+ * Return false if no run logged its ring buffer size.
+ */
+bool operf_get_ring_history(std::string sessiondir, unsigned long & samples,
+                            unsigned long & lost, int & ring_pages);
 
 #endif /* OPERF_STATS_H */
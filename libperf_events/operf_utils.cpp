@@ -32,7 +32,9 @@
 #include "file_manip.h"
 #include "operf_kernel.h"
 #include "operf_sfile.h"
+#include "operf_jit.h"
 #include "op_fileio.h"
+#include "op_cpufreq.h"
 #include "op_libiberty.h"
 #include "operf_stats.h"
 
@@ -43,6 +45,9 @@ extern volatile bool read_quit;
 extern operf_read operfRead;
 extern int sample_reads;
 extern unsigned int pagesize;
+extern int num_mmap_pages;
+extern int max_mmap_pages;
+extern unsigned int wakeup_watermark;
 extern char * app_name;
 extern pid_t app_PID;
 extern verbose vrecord;
@@ -692,6 +697,12 @@ static void __handle_sample_event(event_t * event, u64 sample_type)
 		array++;
 	}
 
+	data.time = 0;
+	if (sample_type & PERF_SAMPLE_TIME) {
+		data.time = *array;
+		array++;
+	}
+
 	data.id = ~0ULL;
 	if (sample_type & PERF_SAMPLE_ID) {
 		data.id = *array;
@@ -839,6 +850,8 @@ static void __handle_sample_event(event_t * event, u64 sample_type)
 	if (found_trans && trans.current) {
 		/* log the sample or arc */
 		operf_sfile_log_sample(&trans);
+		if (trans.is_anon && operf_jit_enabled())
+			operf_jit_log_sample(trans.current, data.ip, data.time);
 
 		update_trans_last(&trans);
 		if (sample_type & PERF_SAMPLE_CALLCHAIN)
@@ -1421,3 +1434,130 @@ int OP_perf_utils::op_get_next_online_cpu(DIR * dir, struct dirent *entry)
 	else
 		return cpu_num;
 }
+
+/* Ring buffers are sized to hold RING_SECONDS of samples at the highest
+ * rate the events can fire, bounded per CPU and for all CPUs together.
+ * Samples lost by the previous run can grow them past these bounds, but
+ * never past the hard ones.
+ */
+#define RING_SECONDS 0.25
+#define RING_CALLCHAIN_DEPTH 16
+#define RING_MIN_BYTES (64 * 1024)
+#define RING_MAX_BYTES (32 * 1024 * 1024)
+#define RING_MAX_TOTAL_BYTES (256 * 1024 * 1024)
+#define RING_HARD_MAX_BYTES (128 * 1024 * 1024)
+#define RING_HARD_MAX_TOTAL_BYTES (1024 * 1024 * 1024)
+
+static unsigned long _round_down_pow2(unsigned long val)
+{
+	unsigned long pow2 = 1;
+	while (pow2 * 2 <= val)
+		pow2 *= 2;
+	return pow2;
+}
+
+void OP_perf_utils::op_size_ring_buffers(vector<operf_event_t> const & evts,
+                                         bool callgraph, bool separate_cpu,
+                                         bool sample_time)
+{
+	unsigned long prev_samples, prev_lost;
+	int prev_pages;
+	bool lost_before = false;
+
+	pagesize = sysconf(_SC_PAGE_SIZE);
+	long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (num_cpus < 1)
+		num_cpus = 1;
+
+	// An event can't count faster than the cycles, except a few uncore ones
+	double mhz = op_cpu_frequency();
+	if (mhz <= 0)
+		mhz = 3000;
+	double rate = 0;
+	for (size_t i = 0; i < evts.size(); i++) {
+		if (evts[i].count)
+			rate += mhz * 1000000 / evts[i].count;
+	}
+
+	// header, then PERF_SAMPLE_IP, TID and ID
+	size_t sample_size = sizeof(struct perf_event_header) + 3 * sizeof(u64);
+	if (separate_cpu)
+		sample_size += sizeof(u64);
+	if (sample_time)
+		sample_size += sizeof(u64);
+	if (callgraph)
+		sample_size += (1 + RING_CALLCHAIN_DEPTH) * sizeof(u64);
+
+	double bytes = rate * sample_size * RING_SECONDS;
+	unsigned long max_bytes = RING_MAX_TOTAL_BYTES / num_cpus;
+	if (max_bytes > RING_MAX_BYTES)
+		max_bytes = RING_MAX_BYTES;
+	if (max_bytes < RING_MIN_BYTES)
+		max_bytes = RING_MIN_BYTES;
+	unsigned long hard_max_bytes = RING_HARD_MAX_TOTAL_BYTES / num_cpus;
+	if (hard_max_bytes > RING_HARD_MAX_BYTES)
+		hard_max_bytes = RING_HARD_MAX_BYTES;
+	if (hard_max_bytes < RING_MIN_BYTES)
+		hard_max_bytes = RING_MIN_BYTES;
+	unsigned long hard_max_pages = _round_down_pow2(hard_max_bytes / pagesize);
+	if (bytes < RING_MIN_BYTES)
+		bytes = RING_MIN_BYTES;
+	if (bytes > max_bytes)
+		bytes = max_bytes;
+
+	// round up, the data area must be a power of two pages
+	unsigned long pages = (unsigned long)((bytes + pagesize - 1) / pagesize);
+	if (_round_down_pow2(pages) != pages)
+		pages = _round_down_pow2(pages) * 2;
+
+	if (operf_get_ring_history(operf_options::session_dir, prev_samples,
+	                           prev_lost, prev_pages) && prev_pages > 0) {
+		// operf.log is not to be trusted with the size of a mapping,
+		// and the data area must be a power of two pages
+		if ((unsigned long)prev_pages > hard_max_pages)
+			prev_pages = hard_max_pages;
+		prev_pages = _round_down_pow2(prev_pages);
+		if (prev_lost) {
+			// grow harder when more than 1% was lost
+			unsigned long grown = prev_pages *
+				(prev_lost * 100 > prev_samples + prev_lost ? 4 : 2);
+			if (grown > pages)
+				pages = grown;
+			lost_before = true;
+		} else if ((unsigned long)prev_pages > pages &&
+		           (unsigned long)prev_pages <= pages * 4) {
+			// a similar run was fine with it, don't shrink back
+			pages = prev_pages;
+		}
+		cverb << vrecord << "Previous run: " << prev_lost << " samples lost of "
+		      << prev_samples + prev_lost << " with " << prev_pages
+		      << " pages per CPU" << endl;
+	}
+
+	if (pages > max_bytes / pagesize && !lost_before)
+		pages = _round_down_pow2(max_bytes / pagesize);
+
+	/* Without CAP_IPC_LOCK the kernel refuses to lock more than
+	 * perf_event_mlock_kb per CPU, the control page included.
+	 */
+	if (my_uid != 0) {
+		int mlock_kb = op_read_int_from_file("/proc/sys/kernel/perf_event_mlock_kb", 0);
+		if (mlock_kb > 0) {
+			unsigned long limit = (unsigned long)mlock_kb * 1024 / pagesize;
+			if (limit > 1 && hard_max_pages > limit - 1)
+				hard_max_pages = _round_down_pow2(limit - 1);
+		}
+	}
+
+	if (pages > hard_max_pages)
+		pages = hard_max_pages;
+
+	num_mmap_pages = pages;
+	max_mmap_pages = hard_max_pages;
+	// wake the recorder before the ring is full, earlier if it couldn't keep up
+	wakeup_watermark = (pages * pagesize) / (lost_before ? 8 : 4);
+
+	cverb << vrecord << "Ring buffer of " << num_mmap_pages << " pages per CPU, wakeup at "
+	      << wakeup_watermark << " bytes for an estimated " << (unsigned long)rate
+	      << " samples/sec per CPU" << endl;
+}
@@ -27,7 +27,6 @@
 namespace operf_options {
 extern bool system_wide;
 extern int pid;
-extern int mmap_pages_mult;
 extern std::string session_dir;
 extern bool separate_cpu;
 extern bool separate_thread;
@@ -77,6 +76,17 @@ int op_get_next_online_cpu(DIR * dir, struct dirent *entry);
 bool op_convert_event_vals(std::vector<operf_event_t> * evt_vec);
 void op_reprocess_unresolved_events(u64 sample_type);
 void op_release_resources(void);
+/**
+ * op_size_ring_buffers - size the per-CPU ring buffers of operf_record
+ *
+ * Size them from the highest sample rate the events can reach, the size of
+ * a sample and the number of CPUs, then adjust to the samples lost by the
+ * last run in the session directory, within hard per-CPU and total limits.
+ * Also sets the wakeup watermark.
+ * Must be called before operf_record::setup().
+ */
+void op_size_ring_buffers(std::vector<operf_event_t> const & evts, bool callgraph,
+                          bool separate_cpu, bool sample_time);
 }
 
 // The rmb() macros were borrowed from perf.h in the kernel tree
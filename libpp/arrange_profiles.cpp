@@ -14,7 +14,13 @@
 #include <iostream>
 #include <iterator>
 #include <map>
+#include <new>
 #include <set>
+#include <stdexcept>
+#include <vector>
+
+#include <pthread.h>
+#include <unistd.h>
 
 #include "string_manip.h"
 #include "op_header.h"
@@ -540,6 +546,21 @@ add_to_profile_sample_files(profile_sample_files & sample_files,
 }
 
 
+/// the parse_filename() result of each sample filename
+typedef map<string, parsed_filename const *> parsed_index;
+
+
+parsed_filename const &
+get_parsed(parsed_index const & index, string const & filename)
+{
+	parsed_index::const_iterator it = index.find(filename);
+	if (it == index.end())
+		throw op_fatal_error("get_parsed(): unknown sample file " +
+		                     filename);
+	return *it->second;
+}
+
+
 /**
  * we need to fix cg filename: a callgraph filename can occur before the binary
  * non callgraph samples filename occur so we must search.
@@ -547,14 +568,14 @@ add_to_profile_sample_files(profile_sample_files & sample_files,
 profile_sample_files &
 find_profile_sample_files(list<profile_sample_files> & files,
 			  parsed_filename const & parsed,
-			  extra_images const & extra)
+			  parsed_index const & index)
 {
 	list<profile_sample_files>::iterator it;
 	list<profile_sample_files>::iterator const end = files.end();
 	for (it = files.begin(); it != end; ++it) {
 		if (!it->sample_filename.empty()) {
-			parsed_filename psample_filename =
-			  parse_filename(it->sample_filename, extra);
+			parsed_filename const & psample_filename =
+			  get_parsed(index, it->sample_filename);
 			if (psample_filename.lib_image == parsed.lib_image &&
 			    psample_filename.image == parsed.image &&
 			    psample_filename.profile_spec_equal(parsed))
@@ -564,8 +585,8 @@ find_profile_sample_files(list<profile_sample_files> & files,
 		list<string>::const_iterator cit;
 		list<string>::const_iterator const cend = it->cg_files.end();
 		for (cit = it->cg_files.begin(); cit != cend; ++cit) {
-			parsed_filename pcg_filename =
-				parse_filename(*cit, extra);
+			parsed_filename const & pcg_filename =
+				get_parsed(index, *cit);
 			if (pcg_filename.lib_image == parsed.lib_image &&
 			    pcg_filename.image == parsed.image &&
 			    pcg_filename.profile_spec_equal(parsed))
@@ -586,11 +607,11 @@ find_profile_sample_files(list<profile_sample_files> & files,
  */
 void
 add_to_profile_set(profile_set & set, parsed_filename const & parsed,
-		   bool merge_by_lib, extra_images const & extra)
+		   bool merge_by_lib, parsed_index const & index)
 {
 	if (parsed.image == parsed.lib_image && !merge_by_lib) {
 		profile_sample_files & sample_files =
-			find_profile_sample_files(set.files, parsed, extra);
+			find_profile_sample_files(set.files, parsed, index);
 		add_to_profile_sample_files(sample_files, parsed);
 		return;
 	}
@@ -603,7 +624,7 @@ add_to_profile_set(profile_set & set, parsed_filename const & parsed,
 				parsed.jit_dumpfile_exists == false) {
 			profile_sample_files & sample_files =
 				find_profile_sample_files(it->files, parsed,
-							  extra);
+							  index);
 			add_to_profile_sample_files(sample_files, parsed);
 			return;
 		}
@@ -612,7 +633,7 @@ add_to_profile_set(profile_set & set, parsed_filename const & parsed,
 	profile_dep_set depset;
 	depset.lib_image = parsed.lib_image;
 	profile_sample_files & sample_files =
-		find_profile_sample_files(depset.files, parsed, extra);
+		find_profile_sample_files(depset.files, parsed, index);
 	add_to_profile_sample_files(sample_files, parsed);
 	set.deps.push_back(depset);
 }
@@ -624,24 +645,156 @@ add_to_profile_set(profile_set & set, parsed_filename const & parsed,
  * finding which sample file list it needs to go on.
  */
 void add_profile(profile_class & pclass, parsed_filename const & parsed,
-		 bool merge_by_lib, extra_images const & extra)
+		 bool merge_by_lib, parsed_index const & index)
 {
 	list<profile_set>::iterator it = pclass.profiles.begin();
 	list<profile_set>::iterator const end = pclass.profiles.end();
 
 	for (; it != end; ++it) {
 		if (it->image == parsed.image) {
-			add_to_profile_set(*it, parsed, merge_by_lib, extra);
+			add_to_profile_set(*it, parsed, merge_by_lib, index);
 			return;
 		}
 	}
 
 	profile_set set;
 	set.image = parsed.image;
-	add_to_profile_set(set, parsed, merge_by_lib, extra);
+	add_to_profile_set(set, parsed, merge_by_lib, index);
 	pclass.profiles.push_back(set);
 }
 
+
+/**
+ * What parse_filename() threw in a parsing thread, to be thrown again by
+ * the calling thread. C++98 can't carry the exception itself across
+ * threads, so its type is reduced to what the callers catch.
+ */
+struct parse_error {
+	enum error_type { none, invalid, no_memory, runtime };
+
+	parse_error() : type(none) {}
+
+	/// throw the exception recorded, if any
+	void rethrow() const;
+
+	error_type type;
+	string message;
+};
+
+
+void parse_error::rethrow() const
+{
+	switch (type) {
+	case none:
+		break;
+	case invalid:
+		throw invalid_argument(message);
+	case no_memory:
+		throw bad_alloc();
+	case runtime:
+		throw op_runtime_error(message);
+	}
+}
+
+
+/// a slice of the sample filenames parsed by one thread
+struct parse_job {
+	vector<string const *> const * filenames;
+	vector<parsed_filename> * parsed;
+	/// what parse_filename() threw for each filename
+	vector<parse_error> * errors;
+	extra_images const * extra;
+	size_t begin;
+	size_t end;
+};
+
+
+/// an exception must not escape a thread, each is recorded in job.errors
+void * parse_thread(void * arg)
+{
+	parse_job const & job = *static_cast<parse_job const *>(arg);
+
+	for (size_t i = job.begin; i < job.end; ++i) {
+		parse_error & error = (*job.errors)[i];
+		try {
+			(*job.parsed)[i] =
+				parse_filename(*(*job.filenames)[i], *job.extra);
+		} catch (invalid_argument const & e) {
+			error.type = parse_error::invalid;
+			error.message = e.what();
+		} catch (bad_alloc const &) {
+			error.type = parse_error::no_memory;
+		} catch (exception const & e) {
+			error.type = parse_error::runtime;
+			error.message = e.what();
+		} catch (...) {
+			error.type = parse_error::runtime;
+			error.message = "unexpected error parsing " +
+				*(*job.filenames)[i];
+		}
+	}
+
+	return 0;
+}
+
+
+/// minimal number of filenames worth a parsing thread
+size_t const parse_chunk = 1024;
+
+
+/**
+ * parse_filename() all files, using several threads for long lists. On
+ * error throw, on the calling thread, an exception like the one
+ * parse_filename() gave for the first bad filename in files order, as a
+ * sequential parse would.
+ */
+void parse_filenames(vector<parsed_filename> & parsed,
+                     list<string> const & files, extra_images const & extra)
+{
+	vector<string const *> filenames;
+	list<string>::const_iterator it;
+	for (it = files.begin(); it != files.end(); ++it)
+		filenames.push_back(&*it);
+
+	parsed.resize(filenames.size());
+	vector<parse_error> errors(filenames.size());
+
+	long const nr_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t nr_threads = min(size_t(nr_cpus < 1 ? 1 : nr_cpus),
+	                        filenames.size() / parse_chunk + 1);
+
+	vector<parse_job> jobs(nr_threads);
+	size_t const slice = filenames.size() / nr_threads + 1;
+	for (size_t i = 0; i < nr_threads; ++i) {
+		jobs[i].filenames = &filenames;
+		jobs[i].parsed = &parsed;
+		jobs[i].errors = &errors;
+		jobs[i].extra = &extra;
+		jobs[i].begin = min(i * slice, filenames.size());
+		jobs[i].end = min(jobs[i].begin + slice, filenames.size());
+	}
+
+	// the calling thread takes the first slice, and the slices of
+	// threads we failed to create
+	vector<pthread_t> threads;
+	for (size_t i = 1; i < nr_threads; ++i) {
+		pthread_t thread;
+		if (pthread_create(&thread, 0, parse_thread, &jobs[i]))
+			break;
+		threads.push_back(thread);
+	}
+
+	parse_thread(&jobs[0]);
+	for (size_t i = threads.size() + 1; i < nr_threads; ++i)
+		parse_thread(&jobs[i]);
+
+	for (size_t i = 0; i < threads.size(); ++i)
+		pthread_join(threads[i], 0);
+
+	for (size_t i = 0; i < errors.size(); ++i)
+		errors[i].rethrow();
+}
+
 }  // anon namespace
 
 
@@ -651,11 +804,15 @@ arrange_profiles(list<string> const & files, merge_option const & merge_by,
 {
 	set<profile_class> temp_classes;
 
-	list<string>::const_iterator it = files.begin();
-	list<string>::const_iterator const end = files.end();
+	vector<parsed_filename> all_parsed;
+	parse_filenames(all_parsed, files, extra);
 
-	for (; it != end; ++it) {
-		parsed_filename parsed = parse_filename(*it, extra);
+	parsed_index index;
+	for (size_t i = 0; i < all_parsed.size(); ++i)
+		index[all_parsed[i].filename] = &all_parsed[i];
+
+	for (size_t i = 0; i < all_parsed.size(); ++i) {
+		parsed_filename parsed = all_parsed[i];
 
 		if (parsed.lib_image.empty())
 			parsed.lib_image = parsed.image;
@@ -669,7 +826,7 @@ arrange_profiles(list<string> const & files, merge_option const & merge_by,
 
 		profile_class & pclass =
 			find_class(temp_classes, parsed, merge_by);
-		add_profile(pclass, parsed, merge_by.lib, extra);
+		add_profile(pclass, parsed, merge_by.lib, index);
 	}
 
 	profile_classes classes;
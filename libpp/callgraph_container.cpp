@@ -283,59 +283,132 @@ accumulate_callee(call_data::const_iterator & it, call_data::const_iterator end,
 } // anonymous namespace
 
 
+arc_recorder::symbol_id arc_recorder::get_id(symbol_entry const & sym)
+{
+	ids_t::iterator it = ids.find(sym);
+	if (it != ids.end())
+		return it->second;
+
+	symbol_id const id = symbols.size();
+	it = ids.insert(ids_t::value_type(sym, id)).first;
+	symbols.push_back(&it->first);
+	return id;
+}
+
+
 void arc_recorder::
 add(symbol_entry const & caller, symbol_entry const * callee,
     count_array_t const & arc_count)
 {
-	cg_data & data = sym_map[caller];
+	symbol_id const caller_id = get_id(caller);
 
-	// If we have a callee, add it to the caller's list, then
-	// add the caller to the callee's list.
+	// If we have a callee, record the arc, it will be added to the
+	// caller's callees and to the callee's callers by process()
 	if (callee) {
-		data.callees[*callee] += arc_count;
+		arc a;
+		a.caller = caller_id;
+		a.callee = get_id(*callee);
+		for (size_t pclass = 0; pclass < arc_count.size(); ++pclass) {
+			a.pclass = pclass;
+			a.count = arc_count[pclass];
+			if (a.count)
+				arcs.push_back(a);
+		}
+	}
+}
 
-		cg_data & callee_data = sym_map[*callee];
 
-		callee_data.callers[caller] += arc_count;
+void arc_recorder::reduce_arcs()
+{
+	sort(arcs.begin(), arcs.end());
+
+	vector<arc>::iterator out = arcs.begin();
+	vector<arc>::const_iterator it = arcs.begin();
+	vector<arc>::const_iterator const end = arcs.end();
+	for (; it != end; ++it) {
+		if (out != arcs.begin() && !((out - 1)->operator<(*it)))
+			(out - 1)->count += it->count;
+		else
+			*out++ = *it;
 	}
+
+	arcs.erase(out, arcs.end());
 }
 
 
-void arc_recorder::process_children(cg_symbol & sym, double threshold)
+void arc_recorder::build_adjacency(adjacency & adj, bool by_caller) const
 {
-	// generate the synthetic self entry for the symbol
-	symbol_entry self = sym;
+	// counting sort of the arcs by caller or callee, it's stable so
+	// arcs stay sorted by their other end
+	adj.first.assign(symbols.size() + 1, 0);
+	for (size_t i = 0; i < arcs.size(); ++i) {
+		symbol_id id = by_caller ? arcs[i].caller : arcs[i].callee;
+		++adj.first[id + 1];
+	}
 
-	self.name = symbol_names.create(symbol_names.demangle(self.name)
-	                                + " [self]");
+	for (size_t i = 1; i < adj.first.size(); ++i)
+		adj.first[i] += adj.first[i - 1];
 
-	sym.total_callee_count += self.sample.counts;
-	sym.callees.push_back(self);
+	vector<size_t> pos(adj.first.begin(), adj.first.end() - 1);
+	adj.order.resize(arcs.size());
+	for (size_t i = 0; i < arcs.size(); ++i) {
+		symbol_id id = by_caller ? arcs[i].caller : arcs[i].callee;
+		adj.order[pos[id]++] = i;
+	}
+}
 
-	sort(sym.callers.begin(), sym.callers.end(), compare_arc_count);
-	sort(sym.callees.begin(), sym.callees.end(), compare_arc_count_reverse);
 
-	// FIXME: this relies on sort always being sample count
+count_array_t arc_recorder::
+get_children(children & result, adjacency const & adj, symbol_id id,
+             bool by_caller) const
+{
+	count_array_t total;
+
+	result.clear();
+	for (size_t i = adj.first[id]; i != adj.first[id + 1]; ++i) {
+		arc const & a = arcs[adj.order[i]];
+		symbol_id const other = by_caller ? a.callee : a.caller;
+
+		// arcs of a pair of symbols for different profile classes
+		// are consecutive
+		if (result.empty() || result.back().id != other) {
+			result.push_back(child());
+			result.back().id = other;
+		}
 
-	cg_symbol::children::iterator cit = sym.callers.begin();
-	cg_symbol::children::iterator cend = sym.callers.end();
+		result.back().counts[a.pclass] += a.count;
+		total[a.pclass] += a.count;
+	}
+
+	return total;
+}
 
-	while (cit != cend && op_ratio(cit->sample.counts[0],
-	       sym.total_caller_count[0]) < threshold)
-		++cit;
 
-	if (cit != cend)
-		sym.callers.erase(sym.callers.begin(), cit);
+void arc_recorder::
+select_children(cg_symbol::children & result, children const & from,
+                count_array_t const & total, double threshold,
+                bool keep_all) const
+{
+	children::const_iterator it = from.begin();
+	children::const_iterator const end = from.end();
 
-	cit = sym.callees.begin();
-	cend = sym.callees.end();
+	if (keep_all) {
+		for (; it != end; ++it) {
+			if (op_ratio(it->counts[0], total[0]) >= threshold)
+				break;
+		}
+		// none above the threshold, they are all kept
+		keep_all = it == end;
+		it = from.begin();
+	}
 
-	while (cit != cend && op_ratio(cit->sample.counts[0],
-	       sym.total_callee_count[0]) >= threshold)
-		++cit;
+	for (; it != end; ++it) {
+		if (!keep_all && op_ratio(it->counts[0], total[0]) < threshold)
+			continue;
 
-	if (cit != cend)
-		sym.callees.erase(cit, sym.callees.end());
+		result.push_back(*symbols[it->id]);
+		result.back().sample.counts = it->counts;
+	}
 }
 
 
@@ -343,46 +416,65 @@ void arc_recorder::
 process(count_array_t total, double threshold,
         string_filter const & sym_filter)
 {
-	map_t::const_iterator it;
-	map_t::const_iterator end = sym_map.end();
+	reduce_arcs();
 
-	for (it = sym_map.begin(); it != end; ++it) {
-		cg_symbol sym((*it).first);
-		cg_data const & data = (*it).second;
+	adjacency callers;
+	adjacency callees;
+	build_adjacency(callers, false);
+	build_adjacency(callees, true);
+
+	children sym_children;
+
+	ids_t::const_iterator it;
+	ids_t::const_iterator const end = ids.end();
+
+	for (it = ids.begin(); it != end; ++it) {
+		symbol_entry const & entry = it->first;
+		symbol_id const id = it->second;
 
 		// threshold out the main symbol if needed
-		if (op_ratio(sym.sample.counts[0], total[0]) < threshold)
+		if (op_ratio(entry.sample.counts[0], total[0]) < threshold)
 			continue;
 
 		// FIXME: slow?
-		if (!sym_filter.match(symbol_names.demangle(sym.name)))
+		if (!sym_filter.match(symbol_names.demangle(entry.name)))
 			continue;
 
-		cg_data::children::const_iterator cit;
-		cg_data::children::const_iterator cend = data.callers.end();
-
-		for (cit = data.callers.begin(); cit != cend; ++cit) {
-			symbol_entry csym = cit->first;
-			csym.sample.counts = cit->second;
-			sym.callers.push_back(csym);
-			sym.total_caller_count += cit->second;
-		}
-
-		cend = data.callees.end();
-
-		for (cit = data.callees.begin(); cit != cend; ++cit) {
-			symbol_entry csym = cit->first;
-			csym.sample.counts = cit->second;
-			sym.callees.push_back(csym);
-			sym.total_callee_count += cit->second;
-		}
-
-		process_children(sym, threshold);
-
 		// insert sym into cg_syms_objs
 		// then store pointer to sym in cg_syms
-		cg_syms.push_back(&(*cg_syms_objs.insert(cg_syms_objs.end(), sym)));
+		cg_symbol & sym =
+			*cg_syms_objs.insert(cg_syms_objs.end(), entry);
+		cg_syms.push_back(&sym);
+
+		sym.total_caller_count = get_children(sym_children, callers,
+		                                      id, false);
+		select_children(sym.callers, sym_children,
+		                sym.total_caller_count, threshold, true);
+
+		sym.total_callee_count = get_children(sym_children, callees,
+		                                      id, true);
+		// the synthetic self entry for the symbol is a callee too
+		sym.total_callee_count += entry.sample.counts;
+		select_children(sym.callees, sym_children,
+		                sym.total_callee_count, threshold, false);
+
+		if (op_ratio(entry.sample.counts[0],
+		             sym.total_callee_count[0]) >= threshold) {
+			symbol_entry self = entry;
+			self.name = symbol_names.create(
+				symbol_names.demangle(self.name) + " [self]");
+			self.self_arc = true;
+			sym.callees.push_back(self);
+		}
+
+		// FIXME: this relies on sort always being sample count
+		sort(sym.callers.begin(), sym.callers.end(), compare_arc_count);
+		sort(sym.callees.begin(), sym.callees.end(),
+		     compare_arc_count_reverse);
 	}
+
+	// arcs are no longer needed
+	vector<arc>().swap(arcs);
 }
 
 
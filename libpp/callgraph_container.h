@@ -12,6 +12,7 @@
 #ifndef CALLGRAPH_CONTAINER_H
 #define CALLGRAPH_CONTAINER_H
 
+#include <map>
 #include <set>
 #include <vector>
 #include <string>
@@ -20,6 +21,7 @@
 #include "symbol_functors.h"
 #include "string_filter.h"
 #include "locate_images.h"
+#include "op_types.h"
 
 class profile_container;
 class inverted_profile;
@@ -63,32 +65,79 @@ public:
 	             string_filter const & filter);
 
 private:
+	/// dense id of a symbol, index into symbols
+	typedef u32 symbol_id;
+
 	/**
-	 * Internal structure used during collation. We use a map to
-	 * allow quick lookup of children (we'll do this several times
-	 * if we have more than one profile class). Each child maps from
-	 * the symbol to the relevant arc data.
+	 * Arc data for one profile class. All arcs are stored unsorted in a
+	 * vector by add() and reduced by process() through a sort then a
+	 * merge of identical {caller, callee, pclass}.
 	 */
-	struct cg_data {
-		cg_data() {}
+	struct arc {
+		symbol_id caller;
+		symbol_id callee;
+		u32 pclass;
+		count_type count;
+
+		bool operator<(arc const & rhs) const {
+			if (caller != rhs.caller)
+				return caller < rhs.caller;
+			if (callee != rhs.callee)
+				return callee < rhs.callee;
+			return pclass < rhs.pclass;
+		}
+	};
 
-		typedef std::map<symbol_entry, count_array_t, less_symbol> children;
+	/**
+	 * Compressed sparse row view of the reduced arcs: the arcs of the
+	 * symbol id are arcs[order[first[id]]] to arcs[order[first[id + 1]]],
+	 * sorted by the other end of the arc.
+	 */
+	struct adjacency {
+		std::vector<size_t> first;
+		std::vector<size_t> order;
+	};
 
-		/// callers of this symbol
-		children callers;
-		/// callees of this symbol
-		children callees;
+	/// a caller or callee of a symbol during process()
+	struct child {
+		symbol_id id;
+		count_array_t counts;
 	};
 
+	typedef std::vector<child> children;
+
+	/// return the id of sym, allocating a new one if needed
+	symbol_id get_id(symbol_entry const & sym);
+
+	/// sort then merge arcs with identical caller, callee and pclass
+	void reduce_arcs();
+
+	/// build the adjacency of reduced arcs indexed by caller or callee
+	void build_adjacency(adjacency & adj, bool by_caller) const;
+
+	/// gather the callers or callees of symbol id, return their total
+	count_array_t get_children(children & result, adjacency const & adj,
+	                           symbol_id id, bool by_caller) const;
+
 	/**
-	 * Sort and threshold callers and callees.
+	 * Threshold children then append the remaining ones to result. If
+	 * keep_all is true and no child reaches the threshold, none is
+	 * thresholded out: this is how callers are handled.
 	 */
-	void process_children(cg_symbol & sym, double threshold);
+	void select_children(cg_symbol::children & result,
+	                     children const & from, count_array_t const & total,
+	                     double threshold, bool keep_all) const;
+
+	typedef std::map<symbol_entry, symbol_id, less_symbol> ids_t;
+
+	/// all the symbols (used during processing) and their id
+	ids_t ids;
 
-	typedef std::map<symbol_entry, cg_data, less_symbol> map_t;
+	/// symbols indexed by their id, point to the ids key
+	std::vector<symbol_entry const *> symbols;
 
-	/// all the symbols (used during processing)
-	map_t sym_map;
+	/// all arcs (used during processing)
+	std::vector<arc> arcs;
 
 	/// symbol objects pointed to by pointers in vector cg_syms
 	cg_collection_objs cg_syms_objs;
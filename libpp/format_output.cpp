@@ -19,6 +19,7 @@
 #include <iomanip>
 #include <iostream>
 #include <cmath>
+#include <cstring>
 
 #include "string_manip.h"
 #include "string_filter.h"
@@ -31,6 +32,7 @@
 #include "xml_output.h"
 #include "xml_utils.h"
 #include "cverb.h"
+#include "op_report_file.h"
 
 using namespace std;
 
@@ -546,6 +548,211 @@ void cg_formatter::output(ostream & out, symbol_collection const & syms)
 }
 
 
+namespace {
+
+/// accumulate the records of a binary report before writing it
+class report_builder {
+public:
+	report_builder(size_t nr, extra_images const & images)
+		: nr_classes(nr), extra(images) {}
+
+	/// return the index of symb, adding it if needed with counts
+	u32 add_symbol(symbol_entry const & symb, count_array_t const & counts);
+
+	/// add an arc, the first time an arc is seen its counts are kept
+	void add_arc(u32 caller, u32 callee, count_array_t const & counts);
+
+	void write(ostream & out, count_array_t const & totals,
+	           size_t nr_listed) const;
+
+private:
+	/// offset of str in the string table
+	u32 add_string(string const & str);
+
+	void write_counts(ostream & out, count_array_t const & counts) const;
+
+	typedef pair<pair<image_name_id, image_name_id>,
+	             pair<symbol_name_id, bfd_vma> > symbol_key;
+
+	size_t nr_classes;
+	extra_images const & extra;
+
+	map<symbol_key, u32> symbol_index;
+	vector<op_report_symbol> symbols;
+	vector<count_array_t> symbol_counts;
+
+	map<pair<u32, u32>, count_array_t> arcs;
+
+	map<string, u32> string_offset;
+	string strings;
+};
+
+
+u32 report_builder::add_string(string const & str)
+{
+	map<string, u32>::const_iterator it = string_offset.find(str);
+	if (it != string_offset.end())
+		return it->second;
+
+	u32 const offset = strings.size();
+	strings.append(str.c_str(), str.size() + 1);
+	string_offset[str] = offset;
+	return offset;
+}
+
+
+u32 report_builder::
+add_symbol(symbol_entry const & symb, count_array_t const & counts)
+{
+	symbol_key key(make_pair(symb.image_name, symb.app_name),
+	               make_pair(symb.name, symb.sample.vma));
+
+	map<symbol_key, u32>::const_iterator it = symbol_index.find(key);
+	if (it != symbol_index.end())
+		return it->second;
+
+	op_report_symbol rec;
+	memset(&rec, 0, sizeof(rec));
+	rec.vma = symb.sample.vma;
+	rec.size = symb.size;
+	rec.name = add_string(symbol_names.demangle(symb.name));
+	rec.image = add_string(get_image_name(symb.image_name,
+		image_name_storage::int_real_filename, extra));
+	rec.app = add_string(get_image_name(symb.app_name,
+		image_name_storage::int_real_filename, extra));
+	rec.source_file = OP_REPORT_NO_STRING;
+	if (symb.sample.file_loc.linenr) {
+		rec.source_file = add_string(
+			debug_names.name(symb.sample.file_loc.filename));
+		rec.source_line = symb.sample.file_loc.linenr;
+	}
+
+	u32 const index = symbols.size();
+	symbols.push_back(rec);
+	symbol_counts.push_back(counts);
+	symbol_index[key] = index;
+	return index;
+}
+
+
+void report_builder::
+add_arc(u32 caller, u32 callee, count_array_t const & counts)
+{
+	// an arc is seen from its caller and from its callee
+	arcs.insert(make_pair(make_pair(caller, callee), counts));
+}
+
+
+void report_builder::
+write_counts(ostream & out, count_array_t const & counts) const
+{
+	for (size_t i = 0; i < nr_classes; ++i) {
+		u64 const count = counts[i];
+		out.write(reinterpret_cast<char const *>(&count), sizeof(count));
+	}
+}
+
+
+void report_builder::
+write(ostream & out, count_array_t const & totals, size_t nr_listed) const
+{
+	size_t const counts_size = nr_classes * sizeof(u64);
+
+	op_report_header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, OP_REPORT_MAGIC, sizeof(header.magic));
+	header.version = OP_REPORT_VERSION;
+	header.nr_classes = nr_classes;
+	header.nr_symbols = symbols.size();
+	header.nr_listed = nr_listed;
+	header.nr_arcs = arcs.size();
+	// every record size is a multiple of 8 so no padding is needed
+	header.totals_offset = sizeof(header);
+	header.symbols_offset = header.totals_offset + counts_size;
+	header.arcs_offset = header.symbols_offset +
+		symbols.size() * (sizeof(op_report_symbol) + counts_size);
+	header.strings_offset = header.arcs_offset +
+		arcs.size() * (sizeof(op_report_arc) + counts_size);
+	header.strings_size = strings.size();
+
+	out.write(reinterpret_cast<char const *>(&header), sizeof(header));
+	write_counts(out, totals);
+
+	for (size_t i = 0; i < symbols.size(); ++i) {
+		out.write(reinterpret_cast<char const *>(&symbols[i]),
+		          sizeof(symbols[i]));
+		write_counts(out, symbol_counts[i]);
+	}
+
+	map<pair<u32, u32>, count_array_t>::const_iterator it;
+	for (it = arcs.begin(); it != arcs.end(); ++it) {
+		op_report_arc arc;
+		arc.caller = it->first.first;
+		arc.callee = it->first.second;
+		out.write(reinterpret_cast<char const *>(&arc), sizeof(arc));
+		write_counts(out, it->second);
+	}
+
+	out.write(strings.data(), strings.size());
+}
+
+} // anonymous namespace
+
+
+binary_formatter::binary_formatter(profile_container const & profile)
+	:
+	formatter(profile.extra_found_images),
+	callgraph(false)
+{
+	counts.total = profile.samples_count();
+}
+
+
+binary_formatter::binary_formatter(callgraph_container const & profile)
+	:
+	formatter(profile.extra_found_images),
+	callgraph(true)
+{
+	counts.total = profile.samples_count();
+}
+
+
+void binary_formatter::output(ostream & out, symbol_collection const & syms)
+{
+	report_builder report(nr_classes, extra_found_images);
+
+	// listed symbols first so their index is their rank in the report
+	symbol_collection::const_iterator it;
+	symbol_collection::const_iterator const end = syms.end();
+	for (it = syms.begin(); it != end; ++it)
+		report.add_symbol(**it, (*it)->sample.counts);
+
+	// callers and callees not in the report are added with no samples
+	count_array_t const no_counts;
+
+	for (it = syms.begin(); callgraph && it != end; ++it) {
+		cg_symbol const * sym = dynamic_cast<cg_symbol const *>(*it);
+		u32 const index = report.add_symbol(*sym, sym->sample.counts);
+		cg_symbol::children::const_iterator cit;
+
+		for (cit = sym->callers.begin(); cit != sym->callers.end(); ++cit) {
+			u32 const caller = report.add_symbol(*cit, no_counts);
+			report.add_arc(caller, index, cit->sample.counts);
+		}
+
+		for (cit = sym->callees.begin(); cit != sym->callees.end(); ++cit) {
+			// the self arc is recorded as an arc to the symbol
+			u32 callee = index;
+			if (!cit->self_arc)
+				callee = report.add_symbol(*cit, no_counts);
+			report.add_arc(index, callee, cit->sample.counts);
+		}
+	}
+
+	report.write(out, counts.total, syms.size());
+}
+
+
 diff_formatter::diff_formatter(diff_container const & profile,
 			       extra_images const & extra)
 	:
@@ -566,8 +773,6 @@ void diff_formatter::output(ostream & out, diff_collection const & syms)
 }
 
 // local variables used in generation of XML
-// buffer details for output later
-ostringstream bytes_out;
 
 // module+symbol table for detecting duplicate symbols
 map<string, size_t> symbol_data_table;
@@ -588,19 +793,31 @@ size_t xml_get_symbol_index(string const & name)
 }
 
 
+/// profile classes lo-hi of symb having detail data
+struct detail_range {
+	symbol_entry const * symb;
+	size_t lo;
+	size_t hi;
+};
+
 class symbol_details_t {
 public:
 	symbol_details_t() { size = index = 0; id = -1; }
 	int id;
 	size_t size;
 	size_t index;
-	string details;
+	/// the detail data are regenerated from these ranges when the
+	/// detail table is output rather than buffered
+	vector<detail_range> ranges;
 };
 
 typedef growable_vector<symbol_details_t> symbol_details_array_t;
 symbol_details_array_t symbol_details;
 size_t detail_table_index = 0;
 
+/// symbols to output in the bytes table, with their symbol table id
+vector<pair<symbol_entry const *, size_t> > symbol_bytes;
+
 xml_formatter::
 xml_formatter(profile_container const * p,
 	      symbol_collection & s, extra_images const & extra,
@@ -633,13 +850,18 @@ void xml_formatter::output(ostream & out)
 	if (need_details) {
 		out << open_element(DETAIL_TABLE);
 		for (size_t i = 0; i < symbol_details.size(); ++i) {
-			int id = symbol_details[i].id;
+			symbol_details_t const & sd = symbol_details[i];
 
-			if (id >= 0) {
+			if (sd.id >= 0) {
 				out << open_element(SYMBOL_DETAILS, true);
-				out << init_attr(TABLE_ID, (size_t)id);
+				out << init_attr(TABLE_ID, (size_t)sd.id);
 				out << close_element(NONE, true);
-				out << symbol_details[i].details;
+				size_t detail_index = 0;
+				for (size_t j = 0; j < sd.ranges.size(); ++j) {
+					detail_range const & r = sd.ranges[j];
+					output_symbol_details(out, r.symb,
+						detail_index, r.lo, r.hi);
+				}
 				out << close_element(SYMBOL_DETAILS);
 			}
 		}
@@ -647,7 +869,7 @@ void xml_formatter::output(ostream & out)
 
 		// output bytesTable
 		out << open_element(BYTES_TABLE);
-		out << bytes_out.str();
+		output_bytes_table(out);
 		out << close_element(BYTES_TABLE);
 	}
 
@@ -692,8 +914,24 @@ xml_formatter::get_bfd_object(symbol_entry const * symb, op_bfd * & abfd) const
 	return true;
 }
 
+void xml_formatter::output_bytes_table(ostream & out)
+{
+	op_bfd * abfd = NULL;
+
+	for (size_t i = 0; i < symbol_bytes.size(); ++i) {
+		symbol_entry const * symb = symbol_bytes[i].first;
+		get_bfd_object(symb, abfd);
+		if (abfd && abfd->symbol_has_contents(symb->sym_index)) {
+			xml_support->output_symbol_bytes(out, symb,
+				symbol_bytes[i].second, *abfd);
+		}
+	}
+
+	delete abfd;
+}
+
 void xml_formatter::
-output_the_symbol_data(ostream & out, symbol_entry const * symb, op_bfd * & abfd)
+output_the_symbol_data(ostream & out, symbol_entry const * symb)
 {
 	string const name = symbol_names.name(symb->name);
 	assert(name.size() > 0);
@@ -721,11 +959,10 @@ output_the_symbol_data(ostream & out, symbol_entry const * symb, op_bfd * & abfd
 		if (name.size() > 0 && name[0] != '?') {
 			output_attribute(out, datum, ff_vma, STARTING_ADDR);
 
-			if (need_details) {
-				get_bfd_object(symb, abfd);
-				if (abfd && abfd->symbol_has_contents(symb->sym_index))
-					xml_support->output_symbol_bytes(bytes_out, symb, sd_it->second, *abfd);
-			}
+			// bytes are output in the bytes table, after the
+			// detail table
+			if (need_details)
+				symbol_bytes.push_back(make_pair(symb, sd_it->second));
 		}
 		out << close_element();
 
@@ -735,7 +972,7 @@ output_the_symbol_data(ostream & out, symbol_entry const * symb, op_bfd * & abfd
 }
 
 void xml_formatter::output_cg_children(ostream & out, 
-	cg_symbol::children const cg_symb, op_bfd * & abfd)
+	cg_symbol::children const cg_symb)
 {
 	cg_symbol::children::const_iterator cit;
 	cg_symbol::children::const_iterator cend = cg_symb.end();
@@ -749,14 +986,13 @@ void xml_formatter::output_cg_children(ostream & out,
 
 		if (sd_it != symbol_data_table.end()) {
 			symbol_entry const * child = &(*cit);
-			output_the_symbol_data(out, child, abfd);
+			output_the_symbol_data(out, child);
 		}
 	}
 }
 
 void xml_formatter::output_symbol_data(ostream & out)
 {
-	op_bfd * abfd = NULL;
 	sym_iterator it = symbols.begin();
 	sym_iterator end = symbols.end();
 
@@ -764,29 +1000,46 @@ void xml_formatter::output_symbol_data(ostream & out)
 	for ( ; it != end; ++it) {
 		symbol_entry const * symb = *it;
 		cg_symbol const * cg_symb = dynamic_cast<cg_symbol const *>(symb);
-		output_the_symbol_data(out, symb, abfd);
+		output_the_symbol_data(out, symb);
 		if (cg_symb) {
 			/* make sure callers/callees are included in SYMBOL_TABLE */
-			output_cg_children(out, cg_symb->callers, abfd);
-			output_cg_children(out, cg_symb->callees, abfd);
+			output_cg_children(out, cg_symb->callers);
+			output_cg_children(out, cg_symb->callees);
 		}
 	}
 	out << close_element(SYMBOL_TABLE);
+}
 
-	delete abfd;
+size_t xml_formatter::
+count_symbol_details(symbol_entry const * symb, size_t lo, size_t hi) const
+{
+	if (!has_sample_counts(symb->sample.counts, lo, hi))
+		return 0;
+
+	sample_container::samples_iterator it = profile->begin(symb);
+	sample_container::samples_iterator end = profile->end(symb);
+
+	size_t nr_details = 0;
+	for (; it != end; ++it) {
+		for (size_t p = lo; p <= hi; ++p) {
+			if (it->second.counts[p] != 0)
+				++nr_details;
+		}
+	}
+
+	return nr_details;
 }
 
-string  xml_formatter::
-output_symbol_details(symbol_entry const * symb,
+void xml_formatter::
+output_symbol_details(ostream & str, symbol_entry const * symb,
     size_t & detail_index, size_t const lo, size_t const hi)
 {
 	if (!has_sample_counts(symb->sample.counts, lo, hi))
-		return "";
+		return;
 
 	sample_container::samples_iterator it = profile->begin(symb);
 	sample_container::samples_iterator end = profile->end(symb);
 
-	ostringstream str;
 	for (; it != end; ++it) {
 		counts_t c;
 
@@ -829,7 +1082,6 @@ output_symbol_details(symbol_entry const * symb,
 			str << close_element(DETAIL_DATA);
 		}
 	}
-	return str.str();
 }
 
 void xml_formatter::
@@ -869,20 +1121,16 @@ output_symbol(ostream & out,
 	out << init_attr(ID_REF, indx);
 
 	if (need_details) {
-		ostringstream details;
 		symbol_details_t & sd = symbol_details[indx];
 		size_t const detail_lo = sd.index;
 
-		string detail_str = output_symbol_details(symb, sd.index, lo, hi);
+		sd.index += count_symbol_details(symb, lo, hi);
 
-		if (detail_str.size() > 0) {
+		if (sd.index > detail_lo) {
 			if (sd.id < 0)
 				sd.id = indx;
-			details << detail_str;
-		}
-
-		if (sd.index > detail_lo) {
-			sd.details = sd.details + details.str();
+			detail_range const range = { symb, lo, hi };
+			sd.ranges.push_back(range);
 			out << init_attr(DETAIL_LO, detail_lo);
 			out << init_attr(DETAIL_HI, sd.index-1);
 		}
@@ -214,6 +214,26 @@ public:
 	void output(std::ostream & out, symbol_collection const & syms);
 };
 
+/**
+ * class to output the compact binary report described in op_report_file.h,
+ * meant for programs which would otherwise parse the XML output
+ */
+class binary_formatter : public formatter {
+public:
+	/// build a ready to use formatter
+	binary_formatter(profile_container const & profile);
+	/// build a formatter which also outputs the call graph arcs
+	binary_formatter(callgraph_container const & profile);
+
+	/// output the report for syms, in this order, to out
+	void output(std::ostream & out, symbol_collection const & syms);
+
+private:
+	/// true if syms are cg_symbol
+	bool callgraph;
+};
+
+
 /// class to output a columned format symbols plus diff values
 class diff_formatter : public formatter {
 public:
@@ -251,9 +271,14 @@ public:
 		symbol_entry const * symb, size_t lo, size_t hi,
 		bool is_module);
 
+	/// return the number of DetailData output_symbol_details() outputs
+	size_t count_symbol_details(symbol_entry const * symb,
+		size_t lo, size_t hi) const;
+
 	/// output details for the symbol
-	std::string output_symbol_details(symbol_entry const * symb,
-		size_t & detail_index, size_t const lo, size_t const hi);
+	void output_symbol_details(std::ostream & out,
+		symbol_entry const * symb, size_t & detail_index,
+		size_t const lo, size_t const hi);
 
 	/// set the output_details boolean
 	void show_details(bool);
@@ -290,10 +315,13 @@ private:
 	bool get_bfd_object(symbol_entry const * symb, op_bfd * & abfd) const;
 
 	void output_the_symbol_data(std::ostream & out,
-		symbol_entry const * symb, op_bfd * & abfd);
+		symbol_entry const * symb);
 
 	void output_cg_children(std::ostream & out,
-		cg_symbol::children const cg_symb, op_bfd * & abfd);
+		cg_symbol::children const cg_symb);
+
+	/// output the bytes of the symbols seen by output_the_symbol_data()
+	void output_bytes_table(std::ostream & out);
 };
 
 // callgraph XML output version
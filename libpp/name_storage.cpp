@@ -9,6 +9,12 @@
  * @author John Levon
  */
 
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <fstream>
+
 #include "name_storage.h"
 #include "demangle_symbol.h"
 #include "file_manip.h"
@@ -71,6 +77,17 @@ string const & image_name_storage::get_name(image_name_id id,
 }
 
 
+void image_name_storage::set_real_name(image_name_id id,
+                                       string const & real_name,
+                                       extra_images const & extra) const
+{
+	stored_filename const & n = get(id);
+	n.real_filename = real_name;
+	n.real_base_filename = op_basename(real_name);
+	n.extra_images_uid = extra.get_uid();
+}
+
+
 string const & debug_name_storage::basename(debug_name_id id) const
 {
 	stored_name const & n = get(id);
@@ -87,7 +104,13 @@ string const & symbol_name_storage::demangle(symbol_name_id id) const
 		return n.name_processed;
 
 	if (n.name[0] != '?') {
-		n.name_processed = demangle_symbol(n.name);
+		demangle_cache_t::const_iterator it = demangle_cache.find(n.name);
+		if (it != demangle_cache.end() && !it->second.empty()) {
+			n.name_processed = it->second;
+		} else {
+			n.name_processed = demangle_symbol(n.name);
+			demangle_cache[n.name] = n.name_processed;
+		}
 		return n.name_processed;
 	}
 
@@ -100,3 +123,101 @@ string const & symbol_name_storage::demangle(symbol_name_id id) const
 	n.name_processed += ltrim(n.name, "?");
 	return n.name_processed;
 }
+
+
+void symbol_name_storage::demangle(vector<symbol_name_id> const & ids) const
+{
+	vector<string const *> names;
+	vector<stored_name const *> stored;
+
+	for (size_t i = 0; i < ids.size(); ++i) {
+		stored_name const & n = get(ids[i]);
+		if (!n.name_processed.empty() || n.name.empty() ||
+		    n.name[0] == '?')
+			continue;
+
+		demangle_cache_t::const_iterator it = demangle_cache.find(n.name);
+		if (it != demangle_cache.end()) {
+			n.name_processed = it->second;
+		} else {
+			// the demangled name is empty until set below, so
+			// a duplicate id is caught by the cache lookup
+			demangle_cache[n.name];
+			names.push_back(&n.name);
+			stored.push_back(&n);
+		}
+	}
+
+	if (names.empty())
+		return;
+
+	long const nr_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+	vector<string> result;
+	demangle_symbols(result, names, nr_cpus < 1 ? 1 : nr_cpus);
+
+	for (size_t i = 0; i < result.size(); ++i) {
+		stored[i]->name_processed = result[i];
+		demangle_cache[*names[i]] = result[i];
+	}
+}
+
+
+namespace {
+
+string const demangle_cache_magic = "oprofile demangle cache 1";
+
+}
+
+
+void symbol_name_storage::load_demangle_cache(string const & filename) const
+{
+	ifstream in(filename.c_str());
+	if (!in)
+		return;
+
+	string line;
+	if (!getline(in, line) || line != demangle_cache_magic ||
+	    !getline(in, line) || line != demangle_setup())
+		return;
+
+	// one "mangled\tdemangled" line per name
+	while (getline(in, line)) {
+		string::size_type pos = line.find('\t');
+		if (pos == string::npos || pos == 0)
+			continue;
+		demangle_cache[line.substr(0, pos)] = line.substr(pos + 1);
+	}
+}
+
+
+void symbol_name_storage::save_demangle_cache(string const & filename) const
+{
+	string const temp = filename + ".tmp";
+
+	{
+	ofstream out(temp.c_str(), ios::trunc);
+	if (!out)
+		throw op_runtime_error("can't create " + temp, errno);
+
+	out << demangle_cache_magic << '\n' << demangle_setup() << '\n';
+
+	demangle_cache_t::const_iterator it = demangle_cache.begin();
+	for (; it != demangle_cache.end(); ++it) {
+		// a name which was being demangled when an exception occurred
+		if (it->second.empty())
+			continue;
+		out << it->first << '\t' << it->second << '\n';
+	}
+
+	if (!out.flush())
+		throw op_runtime_error("can't write " + temp, errno);
+	}
+
+	// concurrent opreport runs each replace the whole file
+	if (rename(temp.c_str(), filename.c_str())) {
+		int const err = errno;
+		unlink(temp.c_str());
+		throw op_runtime_error("can't rename " + temp, err);
+	}
+}
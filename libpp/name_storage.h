@@ -13,6 +13,8 @@
 #define NAME_STORAGE_H
 
 #include <string>
+#include <vector>
+#include <map>
 
 #include "unique_storage.h"
 
@@ -117,6 +119,18 @@ struct image_name_storage : filename_storage<image_name_tag> {
 
 	/// return the basename name for the given ID
 	std::string const & basename(image_name_id) const;
+
+	/**
+	 * @param id  the image name id
+	 * @param real_name  the int_real_filename name of this image
+	 * @param extra  extra locations where the image can be found
+	 *
+	 * Record the real name of an image, as get_name() would have found
+	 * it through extra. Used when the real name is already known, for
+	 * a snapshot, rather than looking for the image again.
+	 */
+	void set_real_name(image_name_id id, std::string const & real_name,
+	                   extra_images const & extra) const;
 };
 
 
@@ -128,6 +142,33 @@ typedef name_storage<symbol_name_tag>::id_value symbol_name_id;
 struct symbol_name_storage : name_storage<symbol_name_tag> {
 	/// return the demangled name for the given ID
 	std::string const & demangle(symbol_name_id id) const;
+
+	/**
+	 * @param ids  the symbols about to be output
+	 *
+	 * Demangle all ids ahead of output, concurrently, so later calls to
+	 * demangle(id) only return the stored name. Names found in the
+	 * demangle cache are not demangled again.
+	 */
+	void demangle(std::vector<symbol_name_id> const & ids) const;
+
+	/**
+	 * Load the demangled names saved by save_demangle_cache() in
+	 * filename. A missing file or one written with another demangling
+	 * setup is ignored.
+	 */
+	void load_demangle_cache(std::string const & filename) const;
+
+	/**
+	 * Save the names of the loaded cache plus all names demangled
+	 * since to filename, replacing it atomically.
+	 */
+	void save_demangle_cache(std::string const & filename) const;
+
+private:
+	typedef std::map<std::string, std::string> demangle_cache_t;
+	/// demangled name of each mangled name seen so far
+	mutable demangle_cache_t demangle_cache;
 };
 
 
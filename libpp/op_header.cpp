@@ -28,6 +28,7 @@
 #include "odb.h"
 #include "op_cpu_type.h"
 #include "op_file.h"
+#include "op_jit_map.h"
 #include "op_header.h"
 #include "op_events.h"
 #include "string_manip.h"
@@ -71,18 +72,20 @@ set<string> warned_files;
 
 }
 
-bool is_jit_sample(string const & filename)
+static bool has_suffix(string const & filename, string const & suf)
 {
-	// suffix for JIT sample files (see FIXME in check_mtime() below)
-	string suf = ".jo";
-	
 	string::size_type pos;
 	pos = filename.rfind(suf);
+	return pos != string::npos && pos == filename.size() - suf.size();
+}
+
+
+bool is_jit_sample(string const & filename)
+{
+	// suffixes for JIT sample files (see FIXME in check_mtime() below)
 	// for JIT sample files do not output the warning to stderr.
-	if (pos != string::npos && pos == filename.size() - suf.size())
-		return true;
-	else
-		return false;
+	return has_suffix(filename, ".jo") ||
+		has_suffix(filename, OP_JIT_MAP_SUFFIX);
 }
 
 void check_mtime(string const & file, opd_header const & header)
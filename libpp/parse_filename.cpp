@@ -18,6 +18,7 @@
 #include "file_manip.h"
 #include "string_manip.h"
 #include "locate_images.h"
+#include "op_jit_map.h"
 
 using namespace std;
 
@@ -26,32 +27,34 @@ namespace {
 // PP:3.19 event_name.count.unitmask.tgid.tid.cpu
 parsed_filename parse_event_spec(string const & event_spec)
 {
-	typedef vector<string> parts_type;
-	typedef parts_type::size_type size_type;
+	size_t const nr_parts = 6;
 
-	size_type const nr_parts = 6;
-
-	parts_type parts = separate_token(event_spec, '.');
-
-	if (parts.size() != nr_parts) {
-		throw invalid_argument("parse_event_spec(): bad event specification: " + event_spec);
-	}
-
-	for (size_type i = 0; i < nr_parts ; ++i) {
-		if (parts[i].empty()) {
+	// assign each part in place rather than going through a
+	// vector of temporary strings, this is called for every sample file
+	parsed_filename result;
+	string * const parts[nr_parts] = {
+		&result.event, &result.count, &result.unitmask,
+		&result.tgid, &result.tid, &result.cpu
+	};
+
+	string::size_type start = 0;
+	for (size_t i = 0; i < nr_parts; ++i) {
+		string::size_type end = event_spec.find('.', start);
+		bool const last = i == nr_parts - 1;
+		if (last && end == string::npos)
+			end = event_spec.size();
+		else if (last)
+			end = string::npos;
+
+		if (end == string::npos || end == start) {
 			throw invalid_argument("parse_event_spec(): bad event specification: " + event_spec);
 		}
-	}
 
-	parsed_filename result;
+		parts[i]->assign(event_spec, start, end - start);
+		start = end + 1;
+	}
 
-	size_type i = 0;
-	result.event = parts[i++];
-	result.count = parts[i++];
-	result.unitmask = parts[i++];
-	result.tgid = parts[i++];
-	result.tid = parts[i++];
-	result.cpu = parts[i++];
+	result.jit_dumpfile_exists = false;
 
 	return result;
 }
@@ -186,6 +189,11 @@ parsed_filename parse_filename(string const & filename,
 						       filename_spec);
 			}
 			string jitdump = filename_spec.substr(0, pos) + ".jo";
+			// without one, operf --jit-symbols may have written
+			// the symbols of the JIT code
+			if (stat(jitdump.c_str(), &st))
+				jitdump = filename_spec.substr(0, pos) +
+					OP_JIT_MAP_SUFFIX;
 			// if a jitdump file exists, we point to this file
 			if (!stat(jitdump.c_str(), &st)) {
 				// later code assumes an optional prefix path
@@ -230,7 +238,7 @@ parsed_filename parse_filename(string const & filename,
 	return result;
 }
 
-bool parsed_filename::profile_spec_equal(parsed_filename const & parsed)
+bool parsed_filename::profile_spec_equal(parsed_filename const & parsed) const
 {
 	return 	event == parsed.event &&
 		count == parsed.count &&
@@ -33,7 +33,7 @@ struct parsed_filename
 	std::string cpu;
 
 	/// return true if the profile specification are identical.
-	bool profile_spec_equal(parsed_filename const & parsed);
+	bool profile_spec_equal(parsed_filename const & parsed) const;
 
 	/**
 	 * the original sample filename from which the
@@ -57,7 +57,8 @@ std::ostream & operator<<(std::ostream &, parsed_filename const &);
  * and can be empty on successfull call. All other error are fatal.
  * Filenames are encoded as according to PP:3.19 to PP:3.25
  *
- * all errors throw an std::invalid_argument exception
+ * all errors throw an std::invalid_argument exception. parse_filename()
+ * does not modify any shared state so it can be called concurrently.
  */
 parsed_filename parse_filename(std::string const & filename,
 			       extra_images const & extra_found_images);
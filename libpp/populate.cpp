@@ -52,6 +52,45 @@ populate_from_files(profile_t & profile, op_bfd const & abfd,
 	return found;
 }
 
+
+/**
+ * All the profiles loaded for one inverted profile, one for each image_set
+ * holding samples. Used to restrict the symbols read by op_bfd to the
+ * sections holding samples.
+ */
+class image_profiles : public offset_filter, noncopyable {
+public:
+	~image_profiles() {
+		for (size_t i = 0; i < profiles.size(); ++i)
+			delete profiles[i].profile;
+	}
+
+	struct entry {
+		profile_t * profile;
+		string const * app_image;
+		size_t pclass;
+	};
+
+	/// take ownership of profile
+	void add(profile_t * profile, string const & app_image, size_t pclass) {
+		entry e;
+		e.profile = profile;
+		e.app_image = &app_image;
+		e.pclass = pclass;
+		profiles.push_back(e);
+	}
+
+	bool match(unsigned long long start, unsigned long long end) const {
+		for (size_t i = 0; i < profiles.size(); ++i) {
+			if (profiles[i].profile->has_samples(start, end))
+				return true;
+		}
+		return false;
+	}
+
+	vector<entry> profiles;
+};
+
 }  // anon namespace
 
 
@@ -66,17 +105,21 @@ populate_for_image(profile_container & samples, inverted_profile const & ip,
 	}
 
 	bool ok = ip.error == image_ok;
+	// Without vma level details we only need the symbols of sections
+	// holding samples, defer reading them until all samples are loaded.
+	// With details sym_index is used later to read the symbol contents
+	// through a fresh op_bfd so we need the whole symbol table.
+	bool const defer_symbols = !samples.record_details();
 	op_bfd abfd(ip.image, symbol_filter,
-		    samples.extra_found_images, ok);
+		    samples.extra_found_images, ok, defer_symbols);
 	if (!ok && ip.error == image_ok)
 		ip.error = image_format_failure;
 
 	if (ip.error == image_format_failure)
 		report_image_error(ip, false, samples.extra_found_images);
 
-	opd_header header;
+	image_profiles profiles;
 
-	bool found = false;
 	for (size_t i = 0; i < ip.groups.size(); ++i) {
 		list<image_set>::const_iterator it
 			= ip.groups[i].begin();
@@ -88,15 +131,26 @@ populate_for_image(profile_container & samples, inverted_profile const & ip,
 		// changes, and the .add() would mis-attribute
 		// to the wrong app_image otherwise
 		for (; it != end; ++it) {
-			profile_t profile;
-			if (populate_from_files(profile, abfd, it->files)) {
-				header = profile.get_header();
-				samples.add(profile, abfd, it->app_image, i);
-				found = true;
-			}
+			profile_t * profile = new profile_t;
+			if (populate_from_files(*profile, abfd, it->files))
+				profiles.add(profile, it->app_image, i);
+			else
+				delete profile;
 		}
 	}
 
+	abfd.load_symbols(profiles);
+
+	opd_header header;
+
+	bool found = false;
+	for (size_t i = 0; i < profiles.profiles.size(); ++i) {
+		image_profiles::entry const & e = profiles.profiles[i];
+		header = e.profile->get_header();
+		samples.add(*e.profile, abfd, *e.app_image, e.pclass);
+		found = true;
+	}
+
 	if (found == true && ip.error == image_ok) {
 		image_error error;
 		string filename =
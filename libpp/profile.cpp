@@ -17,6 +17,7 @@
 #include <string>
 #include <sstream>
 #include <cstring>
+#include <algorithm>
 
 #include <cerrno>
 
@@ -31,6 +32,37 @@
 
 using namespace std;
 
+namespace {
+
+typedef pair<odb_key_t, count_type> sample_t;
+
+
+bool less_sample(sample_t const & lhs, sample_t const & rhs)
+{
+	return lhs.first < rhs.first;
+}
+
+
+bool less_sample_key(sample_t const & lhs, odb_key_t rhs)
+{
+	return lhs.first < rhs;
+}
+
+
+/// current position in one of the sorted sequences of a k-way merge
+struct merge_cursor {
+	vector<sample_t>::const_iterator it;
+	vector<sample_t>::const_iterator end;
+
+	/// reversed so the heap top is the smallest key
+	bool operator<(merge_cursor const & rhs) const {
+		return rhs.it->first < it->first;
+	}
+};
+
+}  // anon namespace
+
+
 profile_t::profile_t()
 	: start_offset(0)
 {
@@ -109,22 +141,69 @@ void profile_t::add_sample_file(string const & filename)
 	odb_node_nr_t node_nr, pos;
 	odb_node_t * node = odb_get_iterator(&samples_db, &node_nr);
 
-	for (pos = 0; pos < node_nr; ++pos) {
-		ordered_samples_t::iterator it = 
-		    ordered_samples.find(node[pos].key);
-		if (it != ordered_samples.end()) {
-			it->second += node[pos].value;
-		} else {
-			ordered_samples_t::value_type
-				val(node[pos].key, node[pos].value);
-			ordered_samples.insert(val);
-		}
-	}
+	// sort this file alone, merging all of them is done in one pass
+	// when samples are first accessed
+	pending_samples.push_back(ordered_samples_t());
+	ordered_samples_t & samples = pending_samples.back();
+	samples.reserve(node_nr);
+
+	for (pos = 0; pos < node_nr; ++pos)
+		samples.push_back(make_pair(node[pos].key, node[pos].value));
+
+	sort(samples.begin(), samples.end(), less_sample);
 
 	odb_close(&samples_db);
 }
 
 
+void profile_t::merge_samples() const
+{
+	if (pending_samples.empty())
+		return;
+
+	if (!ordered_samples.empty()) {
+		pending_samples.push_back(ordered_samples_t());
+		pending_samples.back().swap(ordered_samples);
+	}
+
+	vector<merge_cursor> heap;
+	size_t nr_samples = 0;
+
+	list<ordered_samples_t>::const_iterator it = pending_samples.begin();
+	for (; it != pending_samples.end(); ++it) {
+		if (it->empty())
+			continue;
+		merge_cursor cursor;
+		cursor.it = it->begin();
+		cursor.end = it->end();
+		heap.push_back(cursor);
+		nr_samples += it->size();
+	}
+
+	make_heap(heap.begin(), heap.end());
+
+	ordered_samples.reserve(nr_samples);
+
+	while (!heap.empty()) {
+		pop_heap(heap.begin(), heap.end());
+		merge_cursor & cursor = heap.back();
+
+		if (!ordered_samples.empty() &&
+		    ordered_samples.back().first == cursor.it->first)
+			ordered_samples.back().second += cursor.it->second;
+		else
+			ordered_samples.push_back(*cursor.it);
+
+		if (++cursor.it == cursor.end)
+			heap.pop_back();
+		else
+			push_heap(heap.begin(), heap.end());
+	}
+
+	pending_samples.clear();
+}
+
+
 void profile_t::set_offset(op_bfd const & abfd)
 {
 	// if no bfd file has been located for this samples file, we can't
@@ -146,6 +225,8 @@ void profile_t::set_offset(op_bfd const & abfd)
 profile_t::iterator_pair
 profile_t::samples_range(odb_key_t start, odb_key_t end) const
 {
+	merge_samples();
+
 	// Check the start position isn't before start_offset:
 	// this avoids wrapping/underflowing start/end.
 	// This can happen on e.g. ARM kernels, where .init is
@@ -167,18 +248,41 @@ profile_t::samples_range(odb_key_t start, odb_key_t end) const
 			"oprofile-list@lists.sourceforge.net");
 	}
 
-	ordered_samples_t::const_iterator first = 
-		ordered_samples.lower_bound(start);
-	ordered_samples_t::const_iterator last =
-		ordered_samples.lower_bound(end);
+	ordered_samples_t const & samples = ordered_samples;
+	ordered_samples_t::const_iterator first = lower_bound(
+		samples.begin(), samples.end(), start, less_sample_key);
+	ordered_samples_t::const_iterator last = lower_bound(
+		first, samples.end(), end, less_sample_key);
 
 	return make_pair(const_iterator(first, start_offset),
 		const_iterator(last, start_offset));
 }
 
 
+size_t profile_t::nr_samples() const
+{
+	merge_samples();
+
+	return ordered_samples.size();
+}
+
+
+bool profile_t::has_samples(odb_key_t start, odb_key_t end) const
+{
+	if (end <= start_offset)
+		return false;
+	if (start < start_offset)
+		start = start_offset;
+
+	iterator_pair p_it = samples_range(start, end);
+	return p_it.first != p_it.second;
+}
+
+
 profile_t::iterator_pair profile_t::samples_range() const
 {
+	merge_samples();
+
 	ordered_samples_t::const_iterator first = ordered_samples.begin();
 	ordered_samples_t::const_iterator last = ordered_samples.end();
 
@@ -14,7 +14,9 @@
 #define PROFILE_H
 
 #include <string>
-#include <map>
+#include <list>
+#include <vector>
+#include <utility>
 #include <iterator>
 
 #include "odb.h"
@@ -93,6 +95,18 @@ public:
 	/// return a pair of iterator for all samples
 	iterator_pair samples_range() const;
 
+	/**
+	 * @param start  start offset
+	 * @param end  end offset
+	 *
+	 * return true if at least one sample lies in [start, end), unlike
+	 * samples_range() start can be before the profile start offset
+	 */
+	bool has_samples(odb_key_t start, odb_key_t end) const;
+
+	/// return the number of distinct sample offsets
+	size_t nr_samples() const;
+
 private:
 	/// helper for sample_count() and add_sample_file(). All error launch
 	/// an exception.
@@ -103,15 +117,23 @@ private:
 	scoped_ptr<opd_header> file_header;
 
 	/// storage type for samples sorted by eip
-	typedef std::map<odb_key_t, count_type> ordered_samples_t;
+	typedef std::vector<std::pair<odb_key_t, count_type> >
+		ordered_samples_t;
+
+	/// merge pending_samples into ordered_samples
+	void merge_samples() const;
 
 	/**
 	 * Samples are stored in hash table, iterating over hash table don't
 	 * provide any ordering, the above count() interface rely on samples
-	 * ordered by eip. This map is only a temporary storage where samples
-	 * are ordered by eip.
+	 * ordered by eip. This vector is only a temporary storage where
+	 * samples are ordered by eip. It's filled lazily on first access by
+	 * a k-way merge of all pending_samples.
 	 */
-	ordered_samples_t ordered_samples;
+	mutable ordered_samples_t ordered_samples;
+
+	/// samples files read but not yet merged, each one ordered by eip
+	mutable std::list<ordered_samples_t> pending_samples;
 
 	/**
 	 * For certain profiles, such as kernel/modules, and anon
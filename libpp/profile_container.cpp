@@ -46,6 +46,28 @@ struct filename_by_samples {
 	double percent;
 };
 
+/// return the index of the symbol which can contain offset,
+/// abfd.syms.size() if none
+symbol_index_t
+find_symbol_index(op_bfd const & abfd, unsigned long long offset)
+{
+	// symbols are sorted by increasing start offset and do not overlap,
+	// look for the last one starting at or before offset
+	symbol_index_t first = 0;
+	symbol_index_t last = abfd.syms.size();
+	while (first < last) {
+		symbol_index_t const mid = first + (last - first) / 2;
+		unsigned long long start = 0, end = 0;
+		abfd.get_symbol_range(mid, start, end);
+		if (start <= offset)
+			first = mid + 1;
+		else
+			last = mid;
+	}
+
+	return first ? first - 1 : abfd.syms.size();
+}
+
 }  // anon namespace
 
 
@@ -74,63 +96,128 @@ void profile_container::add(profile_t const & profile,
                             op_bfd const & abfd, string const & app_name,
                             size_t pclass)
 {
-	string const image_name = abfd.get_filename();
-	opd_header header = profile.get_header();
+	// Walking the symbol table costs a samples_range() lookup for each
+	// symbol even if most of them own no samples. For huge binaries with
+	// sparse samples walk the samples instead and binary search the
+	// owning symbol of each of them.
+	if (abfd.syms.size() > profile.nr_samples())
+		add_by_samples(profile, abfd, app_name, pclass);
+	else
+		add_by_symbols(profile, abfd, app_name, pclass);
+}
 
-	for (symbol_index_t i = 0; i < abfd.syms.size(); ++i) {
 
+void profile_container::add_by_symbols(profile_t const & profile,
+                                       op_bfd const & abfd,
+                                       string const & app_name, size_t pclass)
+{
+	for (symbol_index_t i = 0; i < abfd.syms.size(); ++i) {
 		unsigned long long start = 0, end = 0;
-		symbol_entry symb_entry;
 
 		abfd.get_symbol_range(i, start, end);
 
 		profile_t::iterator_pair p_it =
 			profile.samples_range(start, end);
-		count_type count = accumulate(p_it.first, p_it.second, 0ull);
 
-		// skip entries with no samples
-		if (count == 0)
-			continue;
+		add_symbol(profile, abfd, app_name, pclass, i, start, end, p_it);
+	}
+}
 
-		symb_entry.sample.counts[pclass] = count;
-		total_count[pclass] += count;
 
-		symb_entry.size = end - start;
+void profile_container::add_by_samples(profile_t const & profile,
+                                       op_bfd const & abfd,
+                                       string const & app_name, size_t pclass)
+{
+	profile_t::iterator_pair const all = profile.samples_range();
 
-		symb_entry.name = symbol_names.create(abfd.syms[i].name());
-		symb_entry.sym_index = i;
-		symb_entry.vma_adj = abfd.get_vma_adj();
+	profile_t::const_iterator it = all.first;
+	while (it != all.second) {
+		symbol_index_t const i = find_symbol_index(abfd, it.vma());
+		if (i == abfd.syms.size()) {
+			++it;
+			continue;
+		}
 
-		symb_entry.sample.file_loc.linenr = 0;
-		if (debug_info) {
-			string filename;
-			if (abfd.get_linenr(i, start, filename,
-				symb_entry.sample.file_loc.linenr)) {
-				symb_entry.sample.file_loc.filename =
-					debug_names.create(filename);
-			}
+		unsigned long long start = 0, end = 0;
+		abfd.get_symbol_range(i, start, end);
+		// sample between two symbols
+		if (it.vma() >= end) {
+			++it;
+			continue;
 		}
 
-		symb_entry.image_name = image_names.create(image_name);
-		symb_entry.app_name = image_names.create(app_name);
-
-		symb_entry.sample.vma = abfd.syms[i].vma();
-		if ((header.spu_profile == cell_spu_profile) &&
-		    header.embedded_offset) {
-			symb_entry.spu_offset = header.embedded_offset;
-			symb_entry.embedding_filename =
-				image_names.create(abfd.get_embedding_filename());
-		} else {
-			symb_entry.spu_offset = 0;
+		profile_t::iterator_pair p_it =
+			profile.samples_range(start, end);
+
+		// samples_range() can refuse a symbol starting before the
+		// profile start offset, add_by_symbols() skips it too.
+		if (p_it.first == p_it.second) {
+			++it;
+			continue;
 		}
-		symbol_entry const * symbol = symbols->insert(symb_entry);
 
-		if (need_details)
-			add_samples(abfd, i, p_it, symbol, pclass, start);
+		add_symbol(profile, abfd, app_name, pclass, i, start, end, p_it);
+
+		it = p_it.second;
 	}
 }
 
 
+void profile_container::add_symbol(profile_t const & profile,
+                                   op_bfd const & abfd,
+                                   string const & app_name, size_t pclass,
+                                   symbol_index_t i,
+                                   unsigned long long start,
+                                   unsigned long long end,
+                                   profile_t::iterator_pair const & p_it)
+{
+	count_type count = accumulate(p_it.first, p_it.second, 0ull);
+
+	// skip entries with no samples
+	if (count == 0)
+		return;
+
+	opd_header const & header = profile.get_header();
+	symbol_entry symb_entry;
+
+	symb_entry.sample.counts[pclass] = count;
+	total_count[pclass] += count;
+
+	symb_entry.size = end - start;
+
+	symb_entry.name = symbol_names.create(abfd.syms[i].name());
+	symb_entry.sym_index = i;
+	symb_entry.vma_adj = abfd.get_vma_adj();
+
+	symb_entry.sample.file_loc.linenr = 0;
+	if (debug_info) {
+		string filename;
+		if (abfd.get_linenr(i, start, filename,
+			symb_entry.sample.file_loc.linenr)) {
+			symb_entry.sample.file_loc.filename =
+				debug_names.create(filename);
+		}
+	}
+
+	symb_entry.image_name = image_names.create(abfd.get_filename());
+	symb_entry.app_name = image_names.create(app_name);
+
+	symb_entry.sample.vma = abfd.syms[i].vma();
+	if ((header.spu_profile == cell_spu_profile) &&
+	    header.embedded_offset) {
+		symb_entry.spu_offset = header.embedded_offset;
+		symb_entry.embedding_filename =
+			image_names.create(abfd.get_embedding_filename());
+	} else {
+		symb_entry.spu_offset = 0;
+	}
+	symbol_entry const * symbol = symbols->insert(symb_entry);
+
+	if (need_details)
+		add_samples(abfd, i, p_it, symbol, pclass, start);
+}
+
+
 void
 profile_container::add_samples(op_bfd const & abfd, symbol_index_t sym_index,
                                profile_t::iterator_pair const & p_it,
@@ -162,6 +249,20 @@ profile_container::add_samples(op_bfd const & abfd, symbol_index_t sym_index,
 }
 
 
+symbol_entry const * profile_container::insert(symbol_entry const & symbol)
+{
+	total_count += symbol.sample.counts;
+	return symbols->insert(symbol);
+}
+
+
+void profile_container::insert(symbol_entry const * symbol,
+                               sample_entry const & sample)
+{
+	samples->insert(symbol, sample);
+}
+
+
 symbol_collection const
 profile_container::select_symbols(symbol_choice & choice) const
 {
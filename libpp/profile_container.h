@@ -114,6 +114,20 @@ public:
 	/// Like select_symbols for filename without allowing sort by vma.
 	std::vector<debug_name_id> const select_filename(double threshold) const;
 
+	/// return true if samples are recorded at vma level, not only
+	/// at symbol level
+	bool record_details() const { return need_details; }
+
+	/// return true if debug information is recorded
+	bool record_debug_info() const { return debug_info; }
+
+	/// insert a symbol read back by load_snapshot(), its samples count
+	/// is accumulated in the total count
+	symbol_entry const * insert(symbol_entry const & symbol);
+
+	/// insert a sample of symbol read back by load_snapshot()
+	void insert(symbol_entry const * symbol, sample_entry const & sample);
+
 	/// return the total number of samples
 	count_array_t samples_count() const;
 
@@ -141,6 +155,21 @@ public:
 	sample_container::samples_iterator end(symbol_entry const *) const;
 
 private:
+	/// helper for add(), walk the symbol table looking for samples
+	void add_by_symbols(profile_t const & profile, op_bfd const & abfd,
+	                    std::string const & app_name, size_t pclass);
+
+	/// helper for add(), walk the samples looking for their symbol
+	void add_by_samples(profile_t const & profile, op_bfd const & abfd,
+	                    std::string const & app_name, size_t pclass);
+
+	/// record symbol i and its samples p_it if any
+	void add_symbol(profile_t const & profile, op_bfd const & abfd,
+	                std::string const & app_name, size_t pclass,
+	                symbol_index_t i, unsigned long long start,
+	                unsigned long long end,
+	                profile_t::iterator_pair const & p_it);
+
 	/// helper for add()
 	void add_samples(op_bfd const & abfd, symbol_index_t sym_index,
 	                 profile_t::iterator_pair const &,
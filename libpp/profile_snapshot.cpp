@@ -0,0 +1,533 @@
+/**
+ * @file profile_snapshot.cpp
+ * Save and reload a populated profile_container
+ *
+ * @remark Copyright 2013 OProfile authors
+ * @remark Read the file COPYING
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <vector>
+
+#include "op_exception.h"
+#include "op_types.h"
+#include "arrange_profiles.h"
+#include "profile_container.h"
+#include "profile_snapshot.h"
+
+using namespace std;
+
+/*
+ * A snapshot is a sequence of native endian u32, u64 and strings (an u32
+ * length followed by the bytes), in this order:
+ *
+ * header: magic, version, flags, nr_classes, string table offset (u64)
+ * classes: cpuinfo, event, axis, count, then for each class its name,
+ *   longname, event, count, unitmask, tgid, tid and cpu
+ * images: count, then for each image its filename and real filename
+ * symbols: count, then for each symbol its image, app name, name,
+ *   debug filename, line number, vma, size, sym_index, spu_offset,
+ *   embedding filename, vma_adj and nr_classes counts
+ * samples: count, then for each sample its symbol, debug filename, line
+ *   number, vma and nr_classes counts
+ * string table: count, strings
+ *
+ * The string table is only known once every record has been written so
+ * it comes last, the header giving its offset.
+ * Names are stored as an index in the string table, images as an index
+ * in the image table and unset ids as no_index. There is no alignment
+ * so the reader doesn't care about the layout of the struct it fills.
+ */
+
+namespace {
+
+char const magic[8] = { 'O', 'P', 'S', 'N', 'A', 'P', 'S', 'H' };
+u32 const snapshot_version = 1;
+u32 const no_index = ~u32(0);
+
+enum snapshot_flags {
+	sf_debug_info = 1,
+	sf_details = 2,
+	sf_multiple_apps = 4
+};
+
+
+/// unique strings of a snapshot being written
+class string_table {
+public:
+	u32 index(string const & str) {
+		map<string, u32>::const_iterator it = ids.find(str);
+		if (it != ids.end())
+			return it->second;
+		u32 const id = strings.size();
+		ids[str] = id;
+		strings.push_back(str);
+		return id;
+	}
+
+	vector<string> const & get() const { return strings; }
+
+private:
+	map<string, u32> ids;
+	vector<string> strings;
+};
+
+
+class snapshot_writer {
+public:
+	snapshot_writer(string const & filename)
+		: out(filename.c_str(), ios::out | ios::binary) {
+		if (!out)
+			throw op_runtime_error("can't create " + filename);
+	}
+
+	void put(u32 val) { out.write((char const *)&val, sizeof(val)); }
+	void put64(u64 val) { out.write((char const *)&val, sizeof(val)); }
+
+	void put(string const & str) {
+		put(u32(str.size()));
+		out.write(str.data(), str.size());
+	}
+
+	void put(count_array_t const & counts, size_t nr_classes) {
+		for (size_t i = 0; i < nr_classes; ++i)
+			put64(counts[i]);
+	}
+
+	void put(char const * bytes, size_t size) { out.write(bytes, size); }
+
+	u64 tell() { return out.tellp(); }
+	void seek(u64 pos) { out.seekp(pos); }
+
+	void close(string const & filename) {
+		out.close();
+		if (!out.good())
+			throw op_runtime_error("error writing " + filename);
+	}
+
+private:
+	ofstream out;
+};
+
+
+/// sequential reader of a mmap'ed snapshot
+class snapshot_reader : noncopyable {
+public:
+	snapshot_reader(string const & filename);
+	~snapshot_reader();
+
+	u32 get();
+	u64 get64();
+	string const get_string();
+	/// read an index, checking it is below max (or no_index if optional)
+	u32 get_index(size_t max, bool optional = false);
+	/// read an element count, see check_count()
+	size_t get_count(size_t min_size);
+	/// check count elements of at least min_size bytes fit in the rest
+	void check_count(size_t count, size_t min_size) const;
+	void get(count_array_t & counts, size_t nr_classes);
+
+	char const * get_bytes(size_t size);
+
+	size_t tell() const { return pos; }
+	void seek(u64 offset);
+
+private:
+	string filename;
+	char const * base;
+	size_t size;
+	size_t pos;
+};
+
+
+snapshot_reader::snapshot_reader(string const & file)
+	: filename(file), base(0), size(0), pos(0)
+{
+	int fd = open(filename.c_str(), O_RDONLY);
+	if (fd < 0)
+		throw op_runtime_error("can't open " + filename, errno);
+
+	struct stat st;
+	if (fstat(fd, &st) < 0) {
+		int err = errno;
+		close(fd);
+		throw op_runtime_error("can't stat " + filename, err);
+	}
+
+	size = st.st_size;
+	if (size) {
+		void * addr = mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (addr == MAP_FAILED) {
+			int err = errno;
+			close(fd);
+			throw op_runtime_error("can't mmap " + filename, err);
+		}
+		base = static_cast<char const *>(addr);
+	}
+
+	close(fd);
+}
+
+
+snapshot_reader::~snapshot_reader()
+{
+	if (base)
+		munmap(const_cast<char *>(base), size);
+}
+
+
+char const * snapshot_reader::get_bytes(size_t count)
+{
+	if (count > size - pos)
+		throw op_runtime_error(filename + ": truncated snapshot");
+	char const * ptr = base + pos;
+	pos += count;
+	return ptr;
+}
+
+
+void snapshot_reader::seek(u64 offset)
+{
+	if (offset > size)
+		throw op_runtime_error(filename + ": corrupted snapshot");
+	pos = offset;
+}
+
+
+u32 snapshot_reader::get()
+{
+	u32 val;
+	memcpy(&val, get_bytes(sizeof(val)), sizeof(val));
+	return val;
+}
+
+
+u64 snapshot_reader::get64()
+{
+	u64 val;
+	memcpy(&val, get_bytes(sizeof(val)), sizeof(val));
+	return val;
+}
+
+
+string const snapshot_reader::get_string()
+{
+	u32 const len = get();
+	return string(get_bytes(len), len);
+}
+
+
+u32 snapshot_reader::get_index(size_t max, bool optional)
+{
+	u32 const index = get();
+	if (optional && index == no_index)
+		return index;
+	if (index >= max)
+		throw op_runtime_error(filename + ": corrupted snapshot");
+	return index;
+}
+
+
+size_t snapshot_reader::get_count(size_t min_size)
+{
+	size_t const count = get();
+	check_count(count, min_size);
+	return count;
+}
+
+
+void snapshot_reader::check_count(size_t count, size_t min_size) const
+{
+	// a corrupted count must not turn into a huge allocation
+	if (count > (size - pos) / min_size)
+		throw op_runtime_error(filename + ": truncated snapshot");
+}
+
+
+void snapshot_reader::get(count_array_t & counts, size_t nr_classes)
+{
+	for (size_t i = 0; i < nr_classes; ++i) {
+		count_type const count = get64();
+		// keep the sparse array sparse
+		if (count)
+			counts[i] = count;
+	}
+}
+
+
+void put_template(snapshot_writer & out, string_table & strings,
+                  profile_template const & ptemplate)
+{
+	out.put(strings.index(ptemplate.event));
+	out.put(strings.index(ptemplate.count));
+	out.put(strings.index(ptemplate.unitmask));
+	out.put(strings.index(ptemplate.tgid));
+	out.put(strings.index(ptemplate.tid));
+	out.put(strings.index(ptemplate.cpu));
+}
+
+
+u32 debug_index(string_table & strings, debug_name_id id)
+{
+	return id.set() ? strings.index(debug_names.name(id)) : no_index;
+}
+
+
+typedef map<image_name_id, u32> image_index_t;
+
+u32 image_index(image_index_t & images, image_name_id id)
+{
+	if (!id.set())
+		return no_index;
+
+	image_index_t::const_iterator it = images.find(id);
+	if (it != images.end())
+		return it->second;
+
+	u32 const index = images.size();
+	images[id] = index;
+	return index;
+}
+
+
+/// read the images, symbols and samples into samples
+void read_records(snapshot_reader & in, profile_container & samples,
+                  vector<string> const & strings, size_t nr_classes)
+{
+	size_t const nr_strings = strings.size();
+	size_t const counts_size = nr_classes * sizeof(u64);
+
+	vector<image_name_id> images(in.get_count(2 * sizeof(u32)));
+	for (size_t i = 0; i < images.size(); ++i) {
+		u32 const name = in.get_index(nr_strings);
+		u32 const real_name = in.get_index(nr_strings);
+		images[i] = image_names.create(strings[name]);
+		image_names.set_real_name(images[i], strings[real_name],
+		                          samples.extra_found_images);
+	}
+
+	size_t const nr_images = images.size();
+
+	vector<symbol_entry const *> symbols(
+		in.get_count(6 * sizeof(u32) + 5 * sizeof(u64) + counts_size));
+	for (size_t i = 0; i < symbols.size(); ++i) {
+		symbol_entry symb;
+		symb.image_name = images[in.get_index(nr_images)];
+		symb.app_name = images[in.get_index(nr_images)];
+		symb.name = symbol_names.create(strings[in.get_index(nr_strings)]);
+		u32 const debug_name = in.get_index(nr_strings, true);
+		if (debug_name != no_index) {
+			symb.sample.file_loc.filename =
+				debug_names.create(strings[debug_name]);
+		}
+		symb.sample.file_loc.linenr = in.get();
+		symb.sample.vma = in.get64();
+		symb.size = in.get64();
+		symb.sym_index = in.get64();
+		symb.spu_offset = in.get64();
+		u32 const embedding = in.get_index(nr_images, true);
+		if (embedding != no_index)
+			symb.embedding_filename = images[embedding];
+		symb.vma_adj = in.get64();
+		in.get(symb.sample.counts, nr_classes);
+
+		symbols[i] = samples.insert(symb);
+	}
+
+	size_t const nr_samples =
+		in.get_count(3 * sizeof(u32) + sizeof(u64) + counts_size);
+	for (size_t i = 0; i < nr_samples; ++i) {
+		u32 const symbol = in.get_index(symbols.size());
+		sample_entry sample;
+		u32 const debug_name = in.get_index(nr_strings, true);
+		if (debug_name != no_index) {
+			sample.file_loc.filename =
+				debug_names.create(strings[debug_name]);
+		}
+		sample.file_loc.linenr = in.get();
+		sample.vma = in.get64();
+		in.get(sample.counts, nr_classes);
+
+		samples.insert(symbols[symbol], sample);
+	}
+}
+
+}  // anonymous namespace
+
+
+void save_snapshot(string const & filename, profile_container const & samples,
+                   profile_classes const & classes, bool multiple_apps)
+{
+	size_t const nr_classes = classes.v.size();
+	string_table strings;
+	image_index_t images;
+
+	u32 flags = 0;
+	if (samples.record_debug_info())
+		flags |= sf_debug_info;
+	if (samples.record_details())
+		flags |= sf_details;
+	if (multiple_apps)
+		flags |= sf_multiple_apps;
+
+	snapshot_writer out(filename);
+	out.put(magic, sizeof(magic));
+	out.put(snapshot_version);
+	out.put(flags);
+	out.put(u32(nr_classes));
+	u64 const table_offset_pos = out.tell();
+	out.put64(0);
+
+	out.put(strings.index(classes.cpuinfo));
+	out.put(strings.index(classes.event));
+	out.put(u32(classes.axis));
+	out.put(u32(nr_classes));
+	for (size_t i = 0; i < nr_classes; ++i) {
+		out.put(strings.index(classes.v[i].name));
+		out.put(strings.index(classes.v[i].longname));
+		put_template(out, strings, classes.v[i].ptemplate);
+	}
+
+	map<symbol_entry const *, u32> symbol_index;
+	vector<symbol_entry const *> symbols;
+
+	symbol_container::symbols_t::iterator sit = samples.begin_symbol();
+	symbol_container::symbols_t::iterator const send = samples.end_symbol();
+	for (; sit != send; ++sit) {
+		symbol_index[&*sit] = symbols.size();
+		symbols.push_back(&*sit);
+		image_index(images, sit->image_name);
+		image_index(images, sit->app_name);
+		image_index(images, sit->embedding_filename);
+	}
+
+	vector<image_name_id> image_ids(images.size());
+	image_index_t::const_iterator iit = images.begin();
+	for (; iit != images.end(); ++iit)
+		image_ids[iit->second] = iit->first;
+
+	out.put(u32(image_ids.size()));
+	for (size_t i = 0; i < image_ids.size(); ++i) {
+		image_name_id const id = image_ids[i];
+		out.put(strings.index(image_names.name(id)));
+		out.put(strings.index(image_names.get_name(id,
+			image_name_storage::int_real_filename,
+			samples.extra_found_images)));
+	}
+
+	out.put(u32(symbols.size()));
+	for (size_t i = 0; i < symbols.size(); ++i) {
+		symbol_entry const & symb = *symbols[i];
+		out.put(image_index(images, symb.image_name));
+		out.put(image_index(images, symb.app_name));
+		out.put(strings.index(symbol_names.name(symb.name)));
+		out.put(debug_index(strings, symb.sample.file_loc.filename));
+		out.put(u32(symb.sample.file_loc.linenr));
+		out.put64(symb.sample.vma);
+		out.put64(symb.size);
+		out.put64(symb.sym_index);
+		out.put64(symb.spu_offset);
+		out.put(image_index(images, symb.embedding_filename));
+		out.put64(symb.vma_adj);
+		out.put(symb.sample.counts, nr_classes);
+	}
+
+	sample_container::samples_iterator it = samples.begin();
+	sample_container::samples_iterator const end = samples.end();
+
+	out.put(u32(distance(it, end)));
+	for (; it != end; ++it) {
+		sample_entry const & sample = it->second;
+		out.put(symbol_index[it->first.first]);
+		out.put(debug_index(strings, sample.file_loc.filename));
+		out.put(u32(sample.file_loc.linenr));
+		out.put64(sample.vma);
+		out.put(sample.counts, nr_classes);
+	}
+
+	u64 const table_offset = out.tell();
+	vector<string> const & table = strings.get();
+	out.put(u32(table.size()));
+	for (size_t i = 0; i < table.size(); ++i)
+		out.put(table[i]);
+
+	out.seek(table_offset_pos);
+	out.put64(table_offset);
+
+	out.close(filename);
+}
+
+
+profile_container * load_snapshot(string const & filename,
+                                  profile_classes & classes,
+                                  bool & multiple_apps)
+{
+	snapshot_reader in(filename);
+
+	if (memcmp(in.get_bytes(sizeof(magic)), magic, sizeof(magic)) ||
+	    in.get() != snapshot_version) {
+		throw op_runtime_error(filename + " is not a snapshot "
+		                       "written by this version of opreport");
+	}
+
+	u32 const flags = in.get();
+	size_t const nr_classes = in.get();
+	u64 const table_offset = in.get64();
+	size_t const body = in.tell();
+
+	in.seek(table_offset);
+	vector<string> strings(in.get_count(sizeof(u32)));
+	for (size_t i = 0; i < strings.size(); ++i)
+		strings[i] = in.get_string();
+
+	size_t const nr_strings = strings.size();
+
+	in.seek(body);
+
+	classes = profile_classes();
+	classes.cpuinfo = strings[in.get_index(nr_strings)];
+	classes.event = strings[in.get_index(nr_strings)];
+	u32 const axis = in.get();
+	if (axis > AXIS_MAX || in.get() != nr_classes)
+		throw op_runtime_error(filename + ": corrupted snapshot");
+	classes.axis = axis_types(axis);
+	// a class is 8 string indexes
+	in.check_count(nr_classes, 8 * sizeof(u32));
+	classes.v.resize(nr_classes);
+	for (size_t i = 0; i < nr_classes; ++i) {
+		profile_class & pclass = classes.v[i];
+		pclass.name = strings[in.get_index(nr_strings)];
+		pclass.longname = strings[in.get_index(nr_strings)];
+		pclass.ptemplate.event = strings[in.get_index(nr_strings)];
+		pclass.ptemplate.count = strings[in.get_index(nr_strings)];
+		pclass.ptemplate.unitmask = strings[in.get_index(nr_strings)];
+		pclass.ptemplate.tgid = strings[in.get_index(nr_strings)];
+		pclass.ptemplate.tid = strings[in.get_index(nr_strings)];
+		pclass.ptemplate.cpu = strings[in.get_index(nr_strings)];
+	}
+
+	multiple_apps = flags & sf_multiple_apps;
+
+	profile_container * samples = new profile_container(
+		flags & sf_debug_info, flags & sf_details, extra_images());
+
+	try {
+		read_records(in, *samples, strings, nr_classes);
+	} catch (...) {
+		delete samples;
+		throw;
+	}
+
+	return samples;
+}
+
@@ -0,0 +1,47 @@
+/**
+ * @file profile_snapshot.h
+ * Save and reload a populated profile_container
+ *
+ * @remark Copyright 2013 OProfile authors
+ * @remark Read the file COPYING
+ */
+
+#ifndef PROFILE_SNAPSHOT_H
+#define PROFILE_SNAPSHOT_H
+
+#include <string>
+
+class profile_container;
+class profile_classes;
+
+/**
+ * save_snapshot - write a populated profile_container to a file
+ * @param filename  the snapshot filename
+ * @param samples  the populated container
+ * @param classes  the profile classes samples was populated from
+ * @param multiple_apps  true if samples come from more than one application
+ *
+ * The snapshot holds the symbols and samples of the container, the names
+ * they refer to and the description of the profile classes, that is all
+ * what is needed to output a report without reading any sample file or
+ * binary image. Throws op_runtime_error on failure.
+ */
+void save_snapshot(std::string const & filename,
+                   profile_container const & samples,
+                   profile_classes const & classes, bool multiple_apps);
+
+/**
+ * load_snapshot - read back a snapshot written by save_snapshot()
+ * @param filename  the snapshot filename
+ * @param classes  filled with the saved profile classes
+ * @param multiple_apps  set to the saved multiple_apps
+ *
+ * Return a newly allocated profile_container. The profiles of each
+ * class are not saved so classes.v[].profiles are left empty. Throws
+ * op_runtime_error if filename isn't a snapshot written by this version.
+ */
+profile_container * load_snapshot(std::string const & filename,
+                                  profile_classes & classes,
+                                  bool & multiple_apps);
+
+#endif /* !PROFILE_SNAPSHOT_H */
@@ -16,6 +16,7 @@
 #include <dirent.h>
 
 #include "file_manip.h"
+#include "dir_walk.h"
 #include "op_config.h"
 #include "profile_spec.h"
 #include "string_manip.h"
@@ -535,16 +536,16 @@ list<string> profile_spec::generate_file_list(bool exclude_dependent,
 
 		base_dir = op_realpath(base_dir);
 
-		list<string> files;
-		create_file_list(files, base_dir, "*", true);
+		vector<string> files;
+		walk_file_tree(files, base_dir);
 
 		if (!files.empty()) {
 			found_file = true;
 			warn_if_kern_buffs_overflow(base_dir + "/");
 		}
 
-		list<string>::const_iterator it = files.begin();
-		list<string>::const_iterator fend = files.end();
+		vector<string>::const_iterator it = files.begin();
+		vector<string>::const_iterator fend = files.end();
 		for (; it != fend; ++it) {
 			if (valid_candidate(base_dir, *it, *this,
 			    exclude_dependent, exclude_cg)) {
@@ -62,7 +62,7 @@ struct sample_entry {
 /// associate a symbol with a file location, samples count and vma address
 class symbol_entry {
 public:
-	symbol_entry() : size(0) {}
+	symbol_entry() : size(0), self_arc(false) {}
 	virtual ~symbol_entry() {}
 
 	/// which image this symbol belongs to
@@ -79,6 +79,8 @@ public:
 	symbol_name_id name;
 	/// symbol size as calculated by op_bfd, start of symbol is sample.vma
 	size_t size;
+	/// true for the synthetic "[self]" callee of a call graph symbol
+	bool self_arc;
 
 	/**
 	 * @param fl  input hint
@@ -125,6 +125,47 @@ bool symbol_compare::operator()(symbol_entry const & lhs,
 }
 
 
+/// a symbol and its position in the container being sorted
+typedef pair<symbol_entry const *, size_t> ranked_symbol;
+
+
+/**
+ * Break ties of symbol_compare with the initial position of symbols, so
+ * a partial selection gives the same order as stable_sort()
+ */
+struct ranked_compare {
+	ranked_compare(symbol_compare const & cmp) : compare(cmp) {}
+
+	bool operator()(ranked_symbol const & lhs,
+	                ranked_symbol const & rhs) const {
+		if (compare(*lhs.first, *rhs.first))
+			return true;
+		if (compare(*rhs.first, *lhs.first))
+			return false;
+		return lhs.second < rhs.second;
+	}
+
+	symbol_compare compare;
+};
+
+
+/// complete the user sort order with the default one
+vector<sort_options::sort_order>
+complete_order(vector<sort_options::sort_order> const & options)
+{
+	vector<sort_options::sort_order> sort_option(options);
+	for (sort_options::sort_order cur = sort_options::first;
+	     cur != sort_options::last;
+	     cur = sort_options::sort_order(cur + 1)) {
+		if (find(sort_option.begin(), sort_option.end(), cur) ==
+		    sort_option.end())
+			sort_option.push_back(cur);
+	}
+
+	return sort_option;
+}
+
+
 } // anonymous namespace
 
 
@@ -133,12 +174,7 @@ sort(symbol_collection & syms, bool reverse_sort, bool lf) const
 {
 	long_filenames = lf;
 
-	vector<sort_order> sort_option(options);
-	for (sort_order cur = first; cur != last; cur = sort_order(cur + 1)) {
-		if (find(sort_option.begin(), sort_option.end(), cur) ==
-		    sort_option.end())
-			sort_option.push_back(cur);
-	}
+	vector<sort_order> sort_option = complete_order(options);
 
 	stable_sort(syms.begin(), syms.end(),
 	            symbol_compare(sort_option, reverse_sort));
@@ -146,16 +182,48 @@ sort(symbol_collection & syms, bool reverse_sort, bool lf) const
 
 
 void sort_options::
-sort(diff_collection & syms, bool reverse_sort, bool lf) const
+sort(symbol_collection & syms, bool reverse_sort, bool lf,
+     size_t limit) const
 {
+	if (limit >= syms.size()) {
+		sort(syms, reverse_sort, lf);
+		return;
+	}
+
 	long_filenames = lf;
 
-	vector<sort_order> sort_option(options);
-	for (sort_order cur = first; cur != last; cur = sort_order(cur + 1)) {
-		if (find(sort_option.begin(), sort_option.end(), cur) ==
-		    sort_option.end())
-			sort_option.push_back(cur);
+	vector<sort_order> sort_option = complete_order(options);
+	ranked_compare compare(symbol_compare(sort_option, reverse_sort));
+
+	// a heap of the limit first symbols seen so far, the last of them
+	// on top, the rest of syms is not copied
+	vector<ranked_symbol> heap;
+	heap.reserve(limit);
+	for (size_t i = 0; i < syms.size(); ++i) {
+		ranked_symbol const ranked(syms[i], i);
+		if (heap.size() < limit) {
+			heap.push_back(ranked);
+			push_heap(heap.begin(), heap.end(), compare);
+		} else if (limit && compare(ranked, heap.front())) {
+			pop_heap(heap.begin(), heap.end(), compare);
+			heap.back() = ranked;
+			push_heap(heap.begin(), heap.end(), compare);
+		}
 	}
+	sort_heap(heap.begin(), heap.end(), compare);
+
+	syms.resize(limit);
+	for (size_t i = 0; i < limit; ++i)
+		syms[i] = heap[i].first;
+}
+
+
+void sort_options::
+sort(diff_collection & syms, bool reverse_sort, bool lf) const
+{
+	long_filenames = lf;
+
+	vector<sort_order> sort_option = complete_order(options);
 
 	stable_sort(syms.begin(), syms.end(),
 	            symbol_compare(sort_option, reverse_sort));
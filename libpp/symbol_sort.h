@@ -41,6 +41,14 @@ struct sort_options {
 	void sort(symbol_collection & syms, bool reverse_sort,
 	          bool long_filenames) const;
 
+	/**
+	 * Keep only the limit first symbols of the given container, sorted
+	 * by the given criteria. The result is identical to sort() followed
+	 * by a truncation but only the kept symbols are fully sorted.
+	 */
+	void sort(symbol_collection & syms, bool reverse_sort,
+	          bool long_filenames, size_t limit) const;
+
 	/**
 	 * Sort the given container by the given criteria.
 	 */
@@ -0,0 +1,112 @@
+/**
+ * @file callgraph_tests.cpp
+ *
+ * @remark Copyright 2013 OProfile authors
+ * @remark Read the file COPYING
+ */
+
+#include <stdlib.h>
+
+#include <iostream>
+#include <string>
+
+#include "callgraph_container.h"
+#include "name_storage.h"
+#include "string_filter.h"
+
+using namespace std;
+
+static symbol_entry make_symbol(string const & name, count_type count)
+{
+	symbol_entry sym;
+	sym.name = symbol_names.create(name);
+	sym.sample.counts[0] = count;
+	sym.sample.vma = 0;
+	sym.sym_index = 0;
+	sym.spu_offset = 0;
+	sym.vma_adj = 0;
+	return sym;
+}
+
+
+static void add_arc(arc_recorder & recorder, symbol_entry const & caller,
+                    symbol_entry const & callee, count_type count)
+{
+	count_array_t arc_count;
+	arc_count[0] = count;
+	recorder.add(caller, &callee, arc_count);
+}
+
+
+static cg_symbol const & find_symbol(arc_recorder const & recorder,
+                                     string const & name)
+{
+	symbol_collection const & syms = recorder.get_symbols();
+	for (size_t i = 0; i < syms.size(); ++i) {
+		if (symbol_names.demangle(syms[i]->name) == name)
+			return static_cast<cg_symbol const &>(*syms[i]);
+	}
+
+	cerr << name << " not found in the callgraph" << endl;
+	exit(EXIT_FAILURE);
+}
+
+
+static void check_children(string const & what,
+                           cg_symbol::children const & children,
+                           size_t expected)
+{
+	if (children.size() != expected) {
+		cerr << what << ": " << children.size() << " children, "
+		     << expected << " expected" << endl;
+		exit(EXIT_FAILURE);
+	}
+}
+
+
+int main()
+{
+	arc_recorder recorder;
+	count_array_t nil;
+	count_array_t total;
+
+	// all callers of "all" are below the threshold, they are all kept
+	symbol_entry all = make_symbol("all", 100);
+	recorder.add(all, 0, all.sample.counts);
+	for (int i = 0; i < 4; ++i) {
+		symbol_entry caller = make_symbol(string("all_caller") +
+		                                  char('0' + i), 0);
+		recorder.add(caller, 0, nil);
+		add_arc(recorder, caller, all, 10);
+	}
+
+	// only one caller of "some" reaches the threshold
+	symbol_entry some = make_symbol("some", 100);
+	recorder.add(some, 0, some.sample.counts);
+	symbol_entry big = make_symbol("some_big", 0);
+	recorder.add(big, 0, nil);
+	add_arc(recorder, big, some, 50);
+	for (int i = 0; i < 2; ++i) {
+		symbol_entry caller = make_symbol(string("some_caller") +
+		                                  char('0' + i), 0);
+		recorder.add(caller, 0, nil);
+		add_arc(recorder, caller, some, 5);
+	}
+
+	// callees below the threshold are always dropped, only [self] stays
+	symbol_entry callee = make_symbol("some_callee", 0);
+	add_arc(recorder, some, callee, 1);
+
+	total[0] = 200;
+	recorder.process(total, 0.3, string_filter());
+
+	check_children("all callers", find_symbol(recorder, "all").callers, 4);
+	check_children("some callers", find_symbol(recorder, "some").callers, 1);
+	check_children("some callees", find_symbol(recorder, "some").callees, 1);
+	if (!find_symbol(recorder, "some").callees[0].self_arc) {
+		cerr << "some callees: the [self] callee is not flagged" << endl;
+		exit(EXIT_FAILURE);
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -9,12 +9,17 @@
  */
 
 #include <cstdlib>
+#include <algorithm>
+#include <sstream>
+
+#include <pthread.h>
 
 #include "config.h"
 
 #include "demangle_symbol.h"
 #include "demangle_java_symbol.h"
 #include "op_regex.h"
+#include "op_file.h"
 
 // from libiberty
 /*@{\name demangle option parameter */
@@ -33,11 +38,24 @@ namespace options {
 	extern demangle_type demangle;
 }
 
-string const demangle_symbol(string const & name)
+namespace {
+
+/// the smart demangling patterns shared by demangle_symbol() callers
+regular_expression_replace const & smart_patterns()
 {
-	if (options::demangle == dmt_none)
-		return name;
+	static bool init = false;
+	static regular_expression_replace regex;
+	if (init == false) {
+		setup_regex(regex, OP_DATADIR "/stl.pat");
+		init = true;
+	}
+	return regex;
+}
 
+
+string const do_demangle(string const & name,
+                         regular_expression_replace const * smart)
+{
 	// Do not try to strip leading underscore, as this leads to many
 	// C++ demangling failures. However we strip off a leading '.'
         // as generated on PPC64
@@ -54,17 +72,120 @@ string const demangle_symbol(string const & name)
 	string result(unmangled);
 	free(unmangled);
 
-	if (options::demangle == dmt_smart) {
-		static bool init = false;
-		static regular_expression_replace regex;
-		if (init == false) {
-			setup_regex(regex, OP_DATADIR "/stl.pat");
-			init = true;
-		}
+	if (smart) {
 		// we don't protect against exception here, pattern must be
 		// right and user can easily work-around by using -d
-		regex.execute(result);
+		smart->execute(result);
 	}
 
 	return result;
 }
+
+
+/// a slice of the names demangled by one thread
+struct demangle_job {
+	vector<string const *> const * names;
+	vector<string> * result;
+	size_t begin;
+	size_t end;
+};
+
+
+void * demangle_thread(void * arg)
+{
+	demangle_job const & job = *static_cast<demangle_job const *>(arg);
+
+	// glibc serializes regexec() calls on a given regex_t, so each
+	// thread compiles its own copy of the patterns
+	regular_expression_replace regex;
+	regular_expression_replace const * smart = 0;
+	if (options::demangle == dmt_smart) {
+		setup_regex(regex, OP_DATADIR "/stl.pat");
+		smart = &regex;
+	}
+
+	for (size_t i = job.begin; i < job.end; ++i)
+		(*job.result)[i] = do_demangle(*(*job.names)[i], smart);
+
+	return 0;
+}
+
+}  // anonymous namespace
+
+
+string const demangle_symbol(string const & name)
+{
+	if (options::demangle == dmt_none)
+		return name;
+
+	if (options::demangle == dmt_smart)
+		return do_demangle(name, &smart_patterns());
+
+	return do_demangle(name, 0);
+}
+
+
+void demangle_symbols(vector<string> & result,
+                      vector<string const *> const & names,
+                      size_t nr_threads)
+{
+	result.resize(names.size());
+
+	if (options::demangle == dmt_none) {
+		for (size_t i = 0; i < names.size(); ++i)
+			result[i] = *names[i];
+		return;
+	}
+
+	// a bad pattern file throws here rather than in a thread
+	if (options::demangle == dmt_smart)
+		smart_patterns();
+
+	nr_threads = max(min(nr_threads, names.size() / 256), size_t(1));
+
+	vector<demangle_job> jobs(nr_threads);
+	size_t const slice = names.size() / nr_threads + 1;
+	for (size_t i = 0; i < nr_threads; ++i) {
+		jobs[i].names = &names;
+		jobs[i].result = &result;
+		jobs[i].begin = min(i * slice, names.size());
+		jobs[i].end = min(jobs[i].begin + slice, names.size());
+	}
+
+	// the calling thread handles the slices of threads we fail to create
+	vector<pthread_t> threads;
+	for (size_t i = 1; i < nr_threads; ++i) {
+		pthread_t thread;
+		if (pthread_create(&thread, 0, demangle_thread, &jobs[i]))
+			break;
+		threads.push_back(thread);
+	}
+
+	for (size_t i = 0; i < jobs[0].end; ++i)
+		result[i] = demangle_symbol(*names[i]);
+	for (size_t i = threads.size() + 1; i < nr_threads; ++i) {
+		for (size_t j = jobs[i].begin; j < jobs[i].end; ++j)
+			result[j] = demangle_symbol(*names[j]);
+	}
+
+	for (size_t i = 0; i < threads.size(); ++i)
+		pthread_join(threads[i], 0);
+}
+
+
+string const demangle_setup()
+{
+	switch (options::demangle) {
+	case dmt_none:
+		return "none";
+	case dmt_normal:
+		return "normal";
+	case dmt_smart:
+		break;
+	}
+
+	// the smart output depends on the installed patterns
+	ostringstream out;
+	out << "smart " << op_get_mtime(OP_DATADIR "/stl.pat");
+	return out.str();
+}
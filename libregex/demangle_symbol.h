@@ -12,6 +12,7 @@
 #define DEMANGLE_SYMBOL_H
 
 #include <string>
+#include <vector>
 
 /// demangle type: specify what demangling we use
 enum demangle_type {
@@ -37,4 +38,23 @@ enum demangle_type {
  */
 std::string const demangle_symbol(std::string const & name);
 
+/**
+ * demangle_symbols - demangle a set of symbols concurrently
+ * @param result  demangle_symbol(*names[i]) is stored in result[i]
+ * @param names  the mangled symbol names
+ * @param nr_threads  maximum number of threads to use
+ *
+ * Each thread works on its own copy of the smart demangling patterns,
+ * as a compiled regular expression can't be matched concurrently.
+ */
+void demangle_symbols(std::vector<std::string> & result,
+                      std::vector<std::string const *> const & names,
+                      size_t nr_threads);
+
+/**
+ * Return a description of the demangling in use, two demangled names
+ * are identical if they were built with the same demangle_setup().
+ */
+std::string const demangle_setup();
+
 #endif // DEMANGLE_SYMBOL_H
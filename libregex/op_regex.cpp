@@ -11,6 +11,7 @@
  */
 
 #include <cerrno>
+#include <cstring>
 
 #include <iostream>
 #include <fstream>
@@ -68,6 +69,111 @@ size_t subexpr_index(char ch)
 	return size_t(-1);
 }
 
+/// skip the bracket expression starting at pattern[i], return the index
+/// of its closing ']' or string::npos if it is not closed
+size_t skip_bracket(string const & pattern, size_t i)
+{
+	++i;
+	if (i < pattern.length() && pattern[i] == '^')
+		++i;
+	// a leading ']' is part of the list
+	if (i < pattern.length() && pattern[i] == ']')
+		++i;
+
+	for (; i < pattern.length(); ++i) {
+		if (pattern[i] == ']')
+			return i;
+		// [:class:], [.coll.] and [=equiv=] can contain a ']'
+		if (pattern[i] == '[' && i + 1 < pattern.length() &&
+		    (pattern[i + 1] == ':' || pattern[i + 1] == '.' ||
+		     pattern[i + 1] == '=')) {
+			char const close[] = { pattern[i + 1], ']', 0 };
+			i = pattern.find(close, i + 2);
+			if (i == string::npos)
+				return i;
+			++i;
+		}
+	}
+
+	return string::npos;
+}
+
+
+/**
+ * Return the longest string any match of the POSIX extended pattern must
+ * contain, or an empty string if we can't tell. Only top level atoms are
+ * looked at, everything else only ends the current literal.
+ */
+string required_literal(string const & pattern)
+{
+	string longest;
+	string current;
+	size_t depth = 0;
+
+	for (size_t i = 0; i < pattern.length(); ++i) {
+		char ch = pattern[i];
+		bool literal = false;
+
+		if (ch == '(') {
+			++depth;
+		} else if (ch == ')') {
+			if (depth)
+				--depth;
+		} else if (ch == '|') {
+			// an alternative at top level, nothing is required
+			if (!depth)
+				return string();
+		} else if (ch == '[') {
+			i = skip_bracket(pattern, i);
+			if (i == string::npos)
+				return string();
+		} else if (ch == '{') {
+			i = pattern.find('}', i);
+			if (i == string::npos)
+				return string();
+		} else if (ch == '\\') {
+			// \< \b \w or a back-reference are not literals
+			if (i + 1 < pattern.length() &&
+			    strchr(".[]()*+?{}|^$\\/", pattern[i + 1])) {
+				ch = pattern[++i];
+				literal = !depth;
+			} else {
+				++i;
+			}
+		} else if (!strchr(".*+?^$", ch)) {
+			literal = !depth;
+		}
+
+		if (!literal) {
+			if (current.length() > longest.length())
+				longest = current;
+			current.erase();
+			continue;
+		}
+
+		char const next = i + 1 < pattern.length() ? pattern[i + 1] : 0;
+		if (next == '*' || next == '?' || next == '{') {
+			// this char can be absent from the match
+			if (current.length() > longest.length())
+				longest = current;
+			current.erase();
+		} else if (next == '+') {
+			// required once, the repeat ends the literal
+			current += ch;
+			if (current.length() > longest.length())
+				longest = current;
+			current.erase();
+		} else {
+			current += ch;
+		}
+	}
+
+	if (current.length() > longest.length())
+		longest = current;
+
+	return longest;
+}
+
 }  // anonymous namespace
 
 
@@ -107,7 +213,8 @@ void regular_expression_replace::add_pattern(string const & pattern,
 
 	regex_t regexp;
 	op_regcomp(regexp, expanded_pattern);
-	replace_t regex = { regexp, replace };
+	replace_t regex = { regexp, replace,
+	                    required_literal(expanded_pattern) };
 	regex_replace.push_back(regex);
 }
 
@@ -189,6 +296,11 @@ bool regular_expression_replace::do_execute(string & str,
 {
 	bool changed = false;
 
+	// most rules can't match most names, find() is much cheaper than
+	// regexec() to tell it
+	if (str.find(regexp.literal) == string::npos)
+		return false;
+
 	regmatch_t match[max_match];
 	for (size_t iter = 0;
 	     op_regexec(regexp.regexp, str, match, max_match) && iter < limit;
@@ -87,6 +87,8 @@ private:
 		regex_t regexp;
 		// replace the matched part with this string
 		std::string replace;
+		// a string any match contains, possibly empty
+		std::string literal;
 	};
 
 	// helper to execute
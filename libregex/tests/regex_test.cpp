@@ -8,6 +8,10 @@
  * when no argument is provided "mangled-name" is used,
  * see it for the input file format
  *
+ * $ regex_test --benchmark [count]
+ * rewrites count times (default 1000) the names of "mangled-name" and
+ * reports the throughput of regular_expression_replace::execute()
+ *
  * @remark Copyright 2003 OProfile authors
  * @remark Read the file COPYING
  *
@@ -20,8 +24,11 @@
 
 #include <iostream>
 #include <fstream>
+#include <vector>
 
 #include <cstdlib>
+#include <cstring>
+#include <ctime>
 
 using namespace std;
 
@@ -62,10 +69,55 @@ static void do_test(istream& fin)
 		cerr << "input file ill formed\n";
 }
 
+static void do_benchmark(istream & fin, size_t count)
+{
+	regular_expression_replace rep;
+
+	setup_regex(rep, "../stl.pat");
+
+	// test lines only, the expected results are not needed
+	vector<string> names;
+	string line;
+	bool first = true;
+	while (getline(fin, line)) {
+		line = trim(line);
+		if (line.length() == 0 || line[0] == '#')
+			continue;
+		if (first)
+			names.push_back(line);
+		first = !first;
+	}
+
+	clock_t const start = clock();
+	for (size_t i = 0; i < count; ++i) {
+		for (size_t j = 0; j < names.size(); ++j) {
+			string str(names[j]);
+			rep.execute(str);
+		}
+	}
+	double const elapsed = double(clock() - start) / CLOCKS_PER_SEC;
+
+	size_t const total = count * names.size();
+	cout << total << " names rewritten in " << elapsed << " s";
+	if (elapsed > 0)
+		cout << ", " << size_t(total / elapsed) << " names/s";
+	cout << endl;
+}
+
+
 int main(int argc, char * argv[])
 {
 	try {
-		if (argc > 1) {
+		if (argc > 1 && !strcmp(argv[1], "--benchmark")) {
+			size_t count = argc > 2 ? atoi(argv[2]) : 1000;
+			ifstream fin("mangled-name");
+			if (!fin) {
+				cerr << "Unable to open input test "
+				     << "\"mangled_name\"\n" << endl;
+				exit(EXIT_FAILURE);
+			}
+			do_benchmark(fin, count);
+		} else if (argc > 1) {
 			for (int i = 1; i < argc; ++i) {
 				ifstream fin(argv[i]);
 				do_test(fin);
@@ -0,0 +1,202 @@
+/**
+ * @file dir_walk.cpp
+ * Multi-threaded recursive directory listing
+ *
+ * @remark Copyright 2013 OProfile authors
+ * @remark Read the file COPYING
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <iostream>
+
+#include "dir_walk.h"
+
+using namespace std;
+
+namespace {
+
+/// shared between the walker threads, protected by lock
+struct walk_state {
+	pthread_mutex_t lock;
+	/// signaled when pending grows or the walk is finished
+	pthread_cond_t cond;
+	/// directories not yet read
+	vector<string> pending;
+	/// number of threads currently reading a directory
+	size_t busy;
+	vector<string> files;
+	/// entries which couldn't be stat'ed, reported once the walk is done
+	vector<string> errors;
+};
+
+
+bool is_dot_or_dotdot(char const * name)
+{
+	return name[0] == '.' &&
+		(name[1] == '\0' || (name[1] == '.' && name[2] == '\0'));
+}
+
+
+/**
+ * Read one directory, appending its sub-directories to dirs, its other
+ * entries to files and a message for entries which can't be stat'ed to
+ * errors. Return false if dir can't be read.
+ */
+bool read_directory(string const & dir, vector<string> & dirs,
+                    vector<string> & files, vector<string> & errors)
+{
+	int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+	if (fd < 0)
+		return false;
+
+	DIR * d = fdopendir(fd);
+	if (!d) {
+		close(fd);
+		return false;
+	}
+
+	struct dirent * ent;
+	while ((ent = readdir(d)) != 0) {
+		if (is_dot_or_dotdot(ent->d_name))
+			continue;
+
+		bool is_dir = ent->d_type == DT_DIR;
+
+		// symlinks are followed like create_file_list() does
+		if (ent->d_type != DT_DIR && ent->d_type != DT_REG) {
+			struct stat st;
+			if (fstatat(fd, ent->d_name, &st, 0)) {
+				int const err = errno;
+				// dangling symlink -- silently ignore
+				if (fstatat(fd, ent->d_name, &st,
+				            AT_SYMLINK_NOFOLLOW) ||
+				    !S_ISLNK(st.st_mode)) {
+					errors.push_back("stat failed for " + dir +
+					                 '/' + ent->d_name + " (" +
+					                 strerror(err) + ")");
+				}
+				continue;
+			}
+			is_dir = S_ISDIR(st.st_mode);
+		}
+
+		string name = dir + '/' + ent->d_name;
+		if (is_dir)
+			dirs.push_back(name);
+		else
+			files.push_back(name);
+	}
+
+	closedir(d);
+	return true;
+}
+
+
+void * walk_thread(void * arg)
+{
+	walk_state & state = *static_cast<walk_state *>(arg);
+	vector<string> dirs;
+	vector<string> files;
+	vector<string> errors;
+
+	pthread_mutex_lock(&state.lock);
+
+	for (;;) {
+		while (state.pending.empty() && state.busy)
+			pthread_cond_wait(&state.cond, &state.lock);
+
+		// nothing left and nobody can add more
+		if (state.pending.empty())
+			break;
+
+		string const dir = state.pending.back();
+		state.pending.pop_back();
+		++state.busy;
+		pthread_mutex_unlock(&state.lock);
+
+		read_directory(dir, dirs, files, errors);
+
+		pthread_mutex_lock(&state.lock);
+		--state.busy;
+		state.pending.insert(state.pending.end(),
+		                     dirs.begin(), dirs.end());
+		state.files.insert(state.files.end(),
+		                   files.begin(), files.end());
+		state.errors.insert(state.errors.end(),
+		                    errors.begin(), errors.end());
+		dirs.clear();
+		files.clear();
+		errors.clear();
+		pthread_cond_broadcast(&state.cond);
+	}
+
+	pthread_mutex_unlock(&state.lock);
+	return 0;
+}
+
+}  // anonymous namespace
+
+
+size_t nr_worker_threads()
+{
+	long const nr_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+	// threads mostly sleep on directory reads, over NFS especially, so
+	// use more than one per cpu
+	if (nr_cpus < 1)
+		return 4;
+	return min(nr_cpus * 2, 16L);
+}
+
+
+bool walk_file_tree(vector<string> & files, string const & base_dir,
+                    size_t nr_threads)
+{
+	walk_state state;
+	state.busy = 0;
+
+	if (!read_directory(base_dir, state.pending, state.files,
+	                    state.errors))
+		return false;
+
+	if (!nr_threads)
+		nr_threads = nr_worker_threads();
+
+	pthread_mutex_init(&state.lock, 0);
+	pthread_cond_init(&state.cond, 0);
+
+	// the calling thread is one of the walkers
+	vector<pthread_t> threads;
+	for (size_t i = 1; i < nr_threads && !state.pending.empty(); ++i) {
+		pthread_t thread;
+		if (pthread_create(&thread, 0, walk_thread, &state))
+			break;
+		threads.push_back(thread);
+	}
+
+	walk_thread(&state);
+
+	for (size_t i = 0; i < threads.size(); ++i)
+		pthread_join(threads[i], 0);
+
+	pthread_cond_destroy(&state.cond);
+	pthread_mutex_destroy(&state.lock);
+
+	// from this thread only, messages of the walkers can't interleave
+	sort(state.errors.begin(), state.errors.end());
+	for (size_t i = 0; i < state.errors.size(); ++i)
+		cerr << state.errors[i] << endl;
+
+	sort(state.files.begin(), state.files.end());
+	files.swap(state.files);
+	return true;
+}
@@ -0,0 +1,38 @@
+/**
+ * @file dir_walk.h
+ * Multi-threaded recursive directory listing
+ *
+ * @remark Copyright 2013 OProfile authors
+ * @remark Read the file COPYING
+ */
+
+#ifndef DIR_WALK_H
+#define DIR_WALK_H
+
+#include <string>
+#include <vector>
+
+/**
+ * Return the number of threads worth using for work which mostly waits
+ * on the filesystem, derived from the number of online cpus.
+ */
+size_t nr_worker_threads();
+
+/**
+ * walk_file_tree - list all files below a directory
+ * @param files  where to store the result
+ * @param base_dir  directory from where lookup start
+ * @param nr_threads  number of threads reading directories, 0 to use
+ *  nr_worker_threads()
+ *
+ * Sub-directories are read concurrently, using the d_type of each entry
+ * to avoid a stat() when the filesystem provides it. The result is the
+ * list create_file_list(files, base_dir, "*", true) would give, sorted
+ * so it does not depend on the thread scheduling. Entries which can't be
+ * stat'ed, dangling symlinks apart, are reported on cerr after the walk.
+ * Return false if base_dir can't be read.
+ */
+bool walk_file_tree(std::vector<std::string> & files,
+                    std::string const & base_dir, size_t nr_threads = 0);
+
+#endif /* !DIR_WALK_H */
@@ -26,6 +26,7 @@
 #include <sstream>
 
 #include "op_bfd.h"
+#include "op_jit_map.h"
 #include "locate_images.h"
 #include "string_filter.h"
 #include "stream_util.h"
@@ -52,6 +53,14 @@ struct remove_filter {
 };
 
 
+bool has_suffix(string const & name, string const & suffix)
+{
+	return name.size() >= suffix.size() &&
+		!name.compare(name.size() - suffix.size(), suffix.size(),
+			      suffix);
+}
+
+
 } // namespace anon
 
 
@@ -81,6 +90,7 @@ op_bfd_symbol::op_bfd_symbol(bfd_vma vma, size_t size, string const & name)
 	: bfd_symbol(0), symb_value(vma),
 	  section_filepos(0), section_vma(0),
 	  symb_size(size), symb_name(name),
+	  symb_hidden(false), symb_weak(false),
 	  symb_artificial(true)
 {
 }
@@ -98,13 +108,16 @@ unsigned long op_bfd_symbol::symbol_endpos(void) const
 
 
 op_bfd::op_bfd(string const & fname, string_filter const & symbol_filter,
-	       extra_images const & extra_images, bool & ok)
+	       extra_images const & extra_images, bool & ok,
+	       bool defer_symbols)
 	:
 	filename(fname),
 	archive_path(extra_images.get_archive_path()),
 	extra_found_images(extra_images),
 	file_size(-1),
-	anon_obj(false)
+	last_section_filepos(0),
+	anon_obj(false),
+	jit_map(false)
 {
 	int fd;
 	struct stat st;
@@ -113,7 +126,6 @@ op_bfd::op_bfd(string const & fname, string_filter const & symbol_filter,
 	// O(N) behavior when we will filter vector element below
 	symbols_found_t symbols;
 	asection const * sect;
-	string suf = ".jo";
 
 	image_error img_ok;
 	string const image_path =
@@ -127,6 +139,17 @@ op_bfd::op_bfd(string const & fname, string_filter const & symbol_filter,
 		goto out_fail;
 	}
 
+	// symbols of JIT code written by operf, there is no bfd
+	if (has_suffix(filename, OP_JIT_MAP_SUFFIX)) {
+		if (!get_jit_map_symbols(image_path, symbols)) {
+			ok = false;
+			goto out_fail;
+		}
+		anon_obj = true;
+		jit_map = true;
+		goto out;
+	}
+
 	fd = open(image_path.c_str(), O_RDONLY);
 	if (fd == -1) {
 		cverb << vbfd << "open failed for " << image_path << endl;
@@ -150,9 +173,7 @@ op_bfd::op_bfd(string const & fname, string_filter const & symbol_filter,
 		goto out_fail;
 	}
 
-	string::size_type pos;
-	pos = filename.rfind(suf);
-	if (pos != string::npos && pos == filename.size() - suf.size())
+	if (has_suffix(filename, ".jo"))
 		anon_obj = true;
 
 
@@ -167,16 +188,23 @@ op_bfd::op_bfd(string const & fname, string_filter const & symbol_filter,
 			}
 
 			filepos_map[sect->name] = sect->filepos;
+			if ((unsigned long)sect->filepos > last_section_filepos)
+				last_section_filepos = sect->filepos;
 
 			if (sect->vma == 0 && strcmp(sect->name, ".text"))
 				filtered_section.push_back(sect);
 		}
 	}
 
-	get_symbols(symbols);
+	if (defer_symbols) {
+		deferred_filter.reset(new string_filter(symbol_filter));
+		return;
+	}
+
+	get_symbols(symbols, 0);
 
 out:
-	add_symbols(symbols, symbol_filter);
+	add_symbols(symbols, symbol_filter, false);
 	return;
 out_fail:
 	ibfd.close();
@@ -205,8 +233,67 @@ unsigned long op_bfd::get_start_offset(bfd_vma vma) const
 }
 
 
-void op_bfd::get_symbols(op_bfd::symbols_found_t & symbols)
+void op_bfd::load_symbols(offset_filter const & filter)
 {
+	if (!deferred_filter.get())
+		return;
+
+	symbols_found_t symbols;
+	bool const partial = get_symbols(symbols, &filter);
+	add_symbols(symbols, *deferred_filter, partial);
+
+	deferred_filter.reset();
+}
+
+
+bool op_bfd::section_has_samples(asection const * sect,
+                                 offset_filter const & sample_filter) const
+{
+	// use the same offsets as get_symbol_range()
+	unsigned long long start = anon_obj ? sect->vma : sect->filepos;
+	unsigned long long end = start + sect->size;
+
+	// the last symbol of the file extends up to the file end, see
+	// symbol_size()
+	if ((unsigned long)sect->filepos >= last_section_filepos)
+		end = start + file_size;
+
+	return sample_filter.match(start, end);
+}
+
+
+bool op_bfd::symbol_has_samples(asymbol const * sym,
+                                offset_filter const & sample_filter,
+                                sampled_sections_t & sampled,
+                                asymbol const * & last_skipped) const
+{
+	sampled_sections_t::iterator it = sampled.find(sym->section);
+	if (it == sampled.end()) {
+		bool const has_samples =
+			section_has_samples(sym->section, sample_filter);
+		it = sampled.insert(make_pair(sym->section, has_samples)).first;
+	}
+
+	if (it->second)
+		return true;
+
+	if (!last_skipped ||
+	    sym->value + sym->section->filepos >
+	    last_skipped->value + last_skipped->section->filepos)
+		last_skipped = sym;
+
+	return false;
+}
+
+
+bool op_bfd::get_symbols(op_bfd::symbols_found_t & symbols,
+                         offset_filter const * sample_filter)
+{
+	// sections holding samples, only used if sample_filter is set
+	sampled_sections_t sampled_sections;
+	// the skipped symbol with the greatest filepos
+	asymbol const * last_skipped = 0;
+
 	ibfd.get_symbols();
 
 	// On separate debug file systems, the main bfd has no symbols,
@@ -229,6 +316,9 @@ void op_bfd::get_symbols(op_bfd::symbols_found_t & symbols)
 		if (find(filtered_section.begin(), filtered_section.end(),
 			 ibfd.syms[i]->section) != filtered_section.end())
 			continue;
+		if (sample_filter && !symbol_has_samples(ibfd.syms[i],
+		      *sample_filter, sampled_sections, last_skipped))
+			continue;
 		symbols.push_back(op_bfd_symbol(ibfd.syms[i]));
 	}
 
@@ -243,6 +333,9 @@ void op_bfd::get_symbols(op_bfd::symbols_found_t & symbols)
 		u32 filepos = filepos_map[dbfd.syms[i]->section->name];
 		if (filepos != 0)
 			dbfd.syms[i]->section->filepos = filepos;
+		if (sample_filter && !symbol_has_samples(dbfd.syms[i],
+		      *sample_filter, sampled_sections, last_skipped))
+			continue;
 		symbols.push_back(op_bfd_symbol(dbfd.syms[i]));
 	}
 
@@ -267,6 +360,13 @@ void op_bfd::get_symbols(op_bfd::symbols_found_t & symbols)
 		}
 	}
 
+	// The last symbol extends up to the end of file, if a section
+	// after it has been skipped its size is bounded by its section
+	// like it would have been without skipping.
+	scoped_ptr<op_bfd_symbol> skipped_next;
+	if (last_skipped)
+		skipped_next.reset(new op_bfd_symbol(last_skipped));
+
 	// now we can calculate the symbol size, we can't first include/exclude
 	// symbols because the size of symbol is calculated from the difference
 	// between the vma of a symbol and the next one.
@@ -276,16 +376,43 @@ void op_bfd::get_symbols(op_bfd::symbols_found_t & symbols)
 		++temp;
 		if (temp != symbols.end())
 			next = &*temp;
+		else if (skipped_next.get() &&
+		         it->filepos() < skipped_next->filepos())
+			next = skipped_next.get();
 		it->size(symbol_size(*it, next));
 	}
+
+	return last_skipped != 0;
+}
+
+
+bool op_bfd::get_jit_map_symbols(string const & path,
+                                 symbols_found_t & symbols)
+{
+	struct op_jit_map map;
+
+	if (op_jit_map_open(&map, path.c_str())) {
+		cverb << vbfd << "op_jit_map_open failed for " << path << endl;
+		return false;
+	}
+
+	for (u32 i = 0; i < map.header->nr_symbols; ++i) {
+		struct op_jit_map_symbol const * sym =
+			op_jit_map_get_symbol(&map, i);
+		symbols.push_back(op_bfd_symbol(sym->vma, sym->size,
+		                  op_jit_map_string(&map, sym->name)));
+	}
+
+	op_jit_map_close(&map);
+	return true;
 }
 
 
 void op_bfd::add_symbols(op_bfd::symbols_found_t & symbols,
-                         string_filter const & symbol_filter)
+                         string_filter const & symbol_filter, bool partial)
 {
 	// images with no symbols debug info available get a placeholder symbol
-	if (symbols.empty())
+	if (symbols.empty() && !partial)
 		symbols.push_back(create_artificial_symbol());
 
 	cverb << vbfd << "number of symbols before filtering "
@@ -304,6 +431,10 @@ void op_bfd::add_symbols(op_bfd::symbols_found_t & symbols,
 
 bfd_vma op_bfd::offset_to_pc(bfd_vma offset) const
 {
+	// JIT symbol maps use the sampled pc
+	if (jit_map)
+		return offset;
+
 	asection const * sect = ibfd.abfd->sections;
 
 	for (; sect; sect = sect->next) {
@@ -333,6 +464,10 @@ get_symbol_contents(symbol_index_t sym_index, unsigned char * contents) const
 	op_bfd_symbol const & bfd_sym = syms[sym_index];
 	size_t size = bfd_sym.size();
 
+	// JIT symbol maps carry no code
+	if (!bfd_sym.symbol())
+		return false;
+
 	if (!bfd_get_section_contents(ibfd.abfd, bfd_sym.symbol()->section, 
 				 contents, 
 				 static_cast<file_ptr>(bfd_sym.value()), size)) {
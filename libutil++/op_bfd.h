@@ -33,6 +33,19 @@ class extra_images;
 /// all symbol vector indexing uses this type
 typedef size_t symbol_index_t;
 
+/**
+ * Used to restrict the symbols loaded by op_bfd to the sections holding
+ * samples, see op_bfd::load_symbols()
+ */
+class offset_filter {
+public:
+	virtual ~offset_filter() {}
+
+	/// return true if at least one sample lies in [start, end)
+	virtual bool match(unsigned long long start,
+	                   unsigned long long end) const = 0;
+};
+
 /**
  * A symbol description from a bfd point of view. This duplicate
  * information pointed by an asymbol, we need this duplication in case
@@ -104,11 +117,13 @@ public:
 	 * @param ok in-out parameter: on in, if not set, don't
 	 * open the bfd (because it's not there or whatever). On out,
 	 * it's set to false if the bfd couldn't be loaded.
+	 * @param defer_symbols if true, symbols are not read until
+	 * load_symbols() is called
 	 */
 	op_bfd(std::string const & filename,
 	       string_filter const & symbol_filter,
 	       extra_images const & extra_images,
-	       bool & ok);
+	       bool & ok, bool defer_symbols = false);
 
 	/**
 	 * This constructor is used when processing an SPU profile
@@ -125,6 +140,18 @@ public:
 	/// close an opened bfd image and free all related resources
 	~op_bfd();
 
+	/**
+	 * @param filter  offset ranges holding samples
+	 *
+	 * Read the symbols deferred by the ctor, only for the code sections
+	 * which contain at least one sample according to filter. Symbols
+	 * found in these sections are identical to the ones read by a non
+	 * deferred op_bfd, but their index differ so sym_index of symbols
+	 * can't be shared between both objects. Do nothing if the symbols
+	 * are already read.
+	 */
+	void load_symbols(offset_filter const & filter);
+
 	/**
 	 * @param sym_idx index of the symbol
 	 * @param offset fentry number
@@ -210,7 +237,8 @@ public:
 	bool get_symbol_contents(symbol_index_t sym_index,
 		unsigned char * contents) const;
 
-	bool valid() const { return ibfd.valid(); }
+	/// true if the symbols were read, from a bfd or a JIT symbol map
+	bool valid() const { return ibfd.valid() || jit_map; }
 
 	bfd_vma get_vma_adj(void) const { return vma_adj; }
 
@@ -226,8 +254,37 @@ private:
 	 * The symbols are filtered through
 	 * the interesting_symbol() predicate and sorted
 	 * with op_bfd_symbol::operator<() comparator.
+	 *
+	 * If sample_filter is non NULL, symbols of the sections
+	 * without samples are skipped. Return true if some symbols
+	 * have been skipped this way.
 	 */
-	void get_symbols(symbols_found_t & symbols);
+	bool get_symbols(symbols_found_t & symbols,
+	                 offset_filter const * sample_filter);
+
+	/**
+	 * Read the symbols of the JIT symbol map path, see op_jit_map.h.
+	 * Return false if it can't be read.
+	 */
+	bool get_jit_map_symbols(std::string const & path,
+	                         symbols_found_t & symbols);
+
+	/// return true if the section sect holds samples
+	bool section_has_samples(asection const * sect,
+	                         offset_filter const & sample_filter) const;
+
+	/// cache of section_has_samples() results
+	typedef std::map<asection const *, bool> sampled_sections_t;
+
+	/**
+	 * Return true if the section of sym holds samples. Results are
+	 * cached in sampled, last_skipped is updated to the skipped
+	 * symbol with the greatest filepos.
+	 */
+	bool symbol_has_samples(asymbol const * sym,
+	                        offset_filter const & sample_filter,
+	                        sampled_sections_t & sampled,
+	                        asymbol const * & last_skipped) const;
 
 	/**
 	 * Helper function for get_symbols.
@@ -239,10 +296,12 @@ private:
 
 	/**
 	 * Add the symbols in the binary, applying filtering,
-	 * and handling artificial symbols.
+	 * and handling artificial symbols. partial is true if
+	 * get_symbols() skipped some sections.
 	 */
 	void add_symbols(symbols_found_t & symbols,
-	                 string_filter const & symbol_filter);
+	                 string_filter const & symbol_filter,
+	                 bool partial);
 
 	/**
 	 * symbol_size - return the size of a symbol
@@ -272,6 +331,12 @@ private:
 	/// file size in bytes
 	off_t file_size;
 
+	/// symbol filter kept until load_symbols() if symbols are deferred
+	scoped_ptr<string_filter> deferred_filter;
+
+	/// the greatest filepos of all code sections
+	unsigned long last_section_filepos;
+
 	/// corresponding debug file name
 	mutable std::string debug_filename;
 
@@ -302,6 +367,9 @@ private:
 
 	bool anon_obj;
 
+	/// symbols come from a JIT symbol map rather than a bfd
+	bool jit_map;
+
 	/**
 	 * If a runtime binary is prelinked, then its p_vaddr field in the
 	 * first PT_LOAD segment will give the address where the binary will
@@ -45,8 +45,10 @@ op_bfd::op_bfd(uint64_t spu_offset, string const & fname,
 	archive_path(extra_images.get_archive_path()),
 	extra_found_images(extra_images),
 	file_size(-1),
+	last_section_filepos(0),
 	embedding_filename(fname),
-	anon_obj(false)
+	anon_obj(false),
+	jit_map(false)
 {
 	int fd;
 	struct stat st;
@@ -166,7 +168,7 @@ find_sec_code:
 		}
 	}
 
-	get_symbols(symbols);
+	get_symbols(symbols, 0);
 
 	/* In some cases the SPU library code generates code stubs on the stack. */
 	/* The kernel module remaps those addresses so add an entry to catch/report them. */
@@ -174,7 +176,7 @@ find_sec_code:
 			  "__send_to_ppe(stack)"));
 
 out:
-	add_symbols(symbols, symbol_filter);
+	add_symbols(symbols, symbol_filter, false);
 	return;
 out_fail:
 	ibfd.close();
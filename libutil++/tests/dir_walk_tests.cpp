@@ -0,0 +1,136 @@
+/**
+ * @file dir_walk_tests.cpp
+ *
+ * @remark Copyright 2013 OProfile authors
+ * @remark Read the file COPYING
+ */
+
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <string>
+#include <iostream>
+#include <vector>
+
+#include "dir_walk.h"
+
+using namespace std;
+
+/// the test tree, directories end with '/', symlinks are "name>target"
+static char const * const tree[] = {
+	"a",
+	"sub/",
+	"sub/b",
+	"sub/deeper/",
+	"sub/deeper/c",
+	"sub/deeper/d",
+	"empty/",
+	"link>a",
+	"dangling>does_not_exist",
+	0
+};
+
+/// what walk_file_tree() must find, sorted
+static char const * const expected[] = {
+	"a",
+	"link",
+	"sub/b",
+	"sub/deeper/c",
+	"sub/deeper/d",
+	0
+};
+
+
+static void fail(string const & msg)
+{
+	cerr << msg << endl;
+	exit(EXIT_FAILURE);
+}
+
+
+static void create_tree(string const & root)
+{
+	for (size_t i = 0; tree[i]; ++i) {
+		string const entry = tree[i];
+		string::size_type const link = entry.find('>');
+		string const path = root + '/' + entry.substr(0, link);
+		int err;
+
+		if (link != string::npos) {
+			err = symlink(entry.substr(link + 1).c_str(),
+			              path.c_str());
+		} else if (entry[entry.size() - 1] == '/') {
+			err = mkdir(path.c_str(), 0700);
+		} else {
+			int fd = open(path.c_str(), O_CREAT | O_WRONLY, 0600);
+			err = fd < 0;
+			if (fd >= 0)
+				close(fd);
+		}
+
+		if (err)
+			fail("can't create " + path);
+	}
+}
+
+
+static void remove_tree(string const & root)
+{
+	// children come after their directory in tree
+	size_t nr = 0;
+	while (tree[nr])
+		++nr;
+
+	while (nr--) {
+		string const entry = tree[nr];
+		string const path = root + '/' + entry.substr(0, entry.find('>'));
+		if (entry[entry.size() - 1] == '/')
+			rmdir(path.c_str());
+		else
+			unlink(path.c_str());
+	}
+
+	rmdir(root.c_str());
+}
+
+
+static void walk_file_tree_tests(string const & root)
+{
+	vector<string> expect;
+	for (size_t i = 0; expected[i]; ++i)
+		expect.push_back(root + '/' + expected[i]);
+
+	for (size_t nr_threads = 1; nr_threads <= 8; nr_threads *= 2) {
+		vector<string> result;
+		if (!walk_file_tree(result, root, nr_threads))
+			fail("walk_file_tree() fail");
+		if (result != expect) {
+			cerr << "walk_file_tree() with " << nr_threads
+			     << " threads found:\n";
+			for (size_t i = 0; i < result.size(); ++i)
+				cerr << result[i] << endl;
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	vector<string> result;
+	if (walk_file_tree(result, root + "/does_not_exist"))
+		fail("walk_file_tree() succeeded on a missing directory");
+}
+
+
+int main()
+{
+	char dir[] = "/tmp/dir_walk_tests.XXXXXX";
+	if (!mkdtemp(dir))
+		fail("mkdtemp() fail");
+
+	string const root = dir;
+	create_tree(root);
+	walk_file_tree_tests(root);
+	remove_tree(root);
+
+	return EXIT_SUCCESS;
+}
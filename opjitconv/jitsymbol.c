@@ -85,29 +85,6 @@ static int cmp_address(void const * a, void const * b)
 }
 
 
-/* resort address_ascending array */
-static void resort_address(void)
-{
-	u32 i;
-
-	qsort(entries_address_ascending, entry_count,
-	      sizeof(struct jitentry *), cmp_address);
-
-	// lower entry_count if entries are invalidated
-	for (i = 0; i < entry_count; ++i) {
-		if (entries_address_ascending[i]->vma)
-			break;
-	}
-
-	if (i) {
-		entry_count -= i;
-		memmove(&entries_address_ascending[0],
-			&entries_address_ascending[i],
-			sizeof(struct jitentry *) * entry_count);
-	}
-}
-
-
 /* Copy address_ascending array to entries_symbols_ascending and resort it.  */
 static void resort_symbol(void)
 {
@@ -126,30 +103,6 @@ void create_arrays(void)
 }
 
 
-/* add a new create jitentry to the array. mallocs new arrays if space is
- * needed */
-static void insert_entry(struct jitentry * entry)
-{
-	if (entry_count == max_entry_count) {
-		if (max_entry_count < UINT32_MAX - 18)
-			max_entry_count += 18;
-		else if (max_entry_count < UINT32_MAX)
-			max_entry_count += 1;
-		else {
-			fprintf(stderr, "Amount of JIT dump file entries is too large.\n");
-			exit(EXIT_FAILURE);
-		}
-		entries_symbols_ascending = (struct jitentry **)
-			xrealloc(entries_symbols_ascending,
-				 sizeof(struct jitentry *) * max_entry_count);
-		entries_address_ascending = (struct jitentry **)
-			xrealloc(entries_address_ascending,
-				 sizeof(struct jitentry *) * max_entry_count);
-	}
-	entries_address_ascending[entry_count++] = entry;
-}
-
-
 /* add a suffix to the name to differenciate it */
 static char * replacement_name(char * s, int i)
 {
@@ -167,9 +120,7 @@ static char * replacement_name(char * s, int i)
 
 
 /*
- * Mark the entry so it is not included in the ELF file. We do this by
- * writing a 0 address as magic vma and sorting
- * it out later
+ * Mark the entry so it is not included in the ELF file.
  */
 static void invalidate_entry(struct jitentry * e)
 {
@@ -180,316 +131,362 @@ static void invalidate_entry(struct jitentry * e)
 
 
 /*
- * Invalidate all symbols that are not alive at sampling start time.
+ * Remove all symbols that are not alive at sampling start time from the
+ * address array, keeping it sorted.
  */
 static void invalidate_earlybirds(unsigned long long start_time)
 {
-	u32 i;
-	int flag;
+	u32 i, j;
 	struct jitentry * a;
 
-	flag = 0;
-	for (i = 0; i < entry_count; i++) {
+	for (i = j = 0; i < entry_count; i++) {
 		a = entries_address_ascending[i];
-		if (a->life_end < start_time) {
+		if (a->life_end < start_time)
 			invalidate_entry(a);
-			flag = 1;
-		}
-	}
-	if (flag) {
-		resort_address();
-		resort_symbol();
+		else
+			entries_address_ascending[j++] = a;
 	}
+	entry_count = j;
 }
 
 
-/* select the symbol with the longest life time in the index range */
-static int select_one(int start_idx, int end_idx)
+/*
+ * Overlapping code regions are resolved by giving each address to the
+ * entry with the longest lifetime covering it, ties go to the entry first
+ * in address order. E.g.:
+ *
+ *  sym1 (lives longest):      |---|
+ *  sym2:                  |------------|
+ *  result:                |--|---|-----|
+ *                       sym2#0 sym1%nn sym2#1
+ *
+ * An entry losing part of its range is split into the parts it keeps, the
+ * part after k lost regions is named name#k. Only a part starting at the
+ * entry start keeps the code, we don't know whether another part begins
+ * at an opcode. A part which overlapped other entries gets a %nn suffix:
+ * its lifetime in percent of the time spanned by it and these entries.
+ * Zero sized entries lying inside another entry are dropped.
+ *
+ * The parts are computed in a single sweep over the entries sorted by
+ * address, keeping the entries live at the sweep point in heaps, so this
+ * is O(n log n) however the entries overlap.
+ */
+
+#define NO_ENTRY UINT32_MAX
+
+/* a part of an entry found by the sweep */
+struct part {
+	/* index of the entry in entries_address_ascending */
+	u32 owner;
+	unsigned long long start;
+	unsigned long long end;
+	/* non zero if other entries overlap this part */
+	int overlapped;
+	/* life time spanned by the owner and the entries overlapping it */
+	unsigned long long min_life_start;
+	unsigned long long max_life_end;
+	/* the jitentry of the part and its new name, if any */
+	struct jitentry * entry;
+	char * name;
+};
+
+/* a heap node, the node with the greatest key is at the top, ties go to
+ * the lowest index into entries_address_ascending */
+struct heap_node {
+	unsigned long long key;
+	u32 idx;
+};
+
+struct entry_heap {
+	struct heap_node * nodes;
+	u32 size;
+};
+
+
+static unsigned long long entry_end(u32 i)
 {
-	int i;
-	int candidate = OP_JIT_CONV_FAIL;
-	unsigned long long lifetime = 0;
-	unsigned long long x;
-	struct jitentry const * e;
+	struct jitentry const * e = entries_address_ascending[i];
+	return e->vma + e->code_size;
+}
 
-	for (i = start_idx; i <= end_idx; i++) {
-		e = entries_address_ascending[i];
-		x = e->life_end - e->life_start;
-		if (candidate == -1 || x > lifetime) {
-			candidate = i;
-			lifetime = x;
-		}
+
+static int above(struct heap_node const * a, struct heap_node const * b)
+{
+	if (a->key != b->key)
+		return a->key > b->key;
+	return a->idx < b->idx;
+}
+
+
+static void heap_init(struct entry_heap * h)
+{
+	h->nodes = xmalloc(sizeof(struct heap_node) * (entry_count + 1));
+	h->size = 0;
+}
+
+
+static void heap_push(struct entry_heap * h, unsigned long long key, u32 i)
+{
+	struct heap_node node;
+	u32 pos = h->size++;
+	u32 parent;
+
+	node.key = key;
+	node.idx = i;
+	while (pos) {
+		parent = (pos - 1) / 2;
+		if (!above(&node, &h->nodes[parent]))
+			break;
+		h->nodes[pos] = h->nodes[parent];
+		pos = parent;
 	}
-	return candidate;
+	h->nodes[pos] = node;
 }
 
 
-/*
- * We decided to keep one entry in favor of the other. Instead of dropping
- * the overlapping entry we split or truncate it to not overlap any more.
- *
- * Looking on the address regions, we may have the following situation:
- *
- *  split:     |------------|
- *  keep:          |---|
- *
- * The split entry may be splitted in a left part and a right part. E.g.:
- *
- *  split0/1:  |--|     |---|
- *  keep:          |---|
- *
- * However, both parts may or may not exist.
- */
-static void split_entry(struct jitentry * split, struct jitentry const * keep)
+static void heap_pop(struct entry_heap * h)
 {
-	unsigned long long start_addr_keep = keep->vma;
-	unsigned long long end_addr_keep = keep->vma + keep->code_size;
-	unsigned long long end_addr_split = split->vma + split->code_size;
-	unsigned long long start_addr_split = split->vma;
-
-	// do we need a right part?
-	if (end_addr_split > end_addr_keep) {
-		struct jitentry * new_entry =
-			xcalloc(1, sizeof(struct jitentry));
-		char * s = NULL;
-		
-		/* Check for max. length to avoid possible integer overflow. */
-		if (strlen(split->symbol_name) > SIZE_MAX - 3) {
-			fprintf(stderr, "Length of symbol name is too large.\n");
-			exit(EXIT_FAILURE);
-		} else {
-			s = xmalloc(strlen(split->symbol_name) + 3);
-			strcpy(s, split->symbol_name);
-			strcat(s, "#1");
-		}
-		
-		new_entry->vma = end_addr_keep;
-		new_entry->code_size = end_addr_split - end_addr_keep;
-		new_entry->symbol_name = s;
-		new_entry->sym_name_malloced = 1;
-		new_entry->life_start = split->life_start;
-		new_entry->life_end = split->life_end;
-		// the right part does not have an associated code, because we
-		// don't know whether the split part begins at an opcode
-		new_entry->code = NULL;
-		verbprintf(debug, "split right (new) name=%s, start=%llx,"
-			   " end=%llx\n", new_entry->symbol_name,
-			   new_entry->vma,
-			   new_entry->vma + new_entry->code_size);
-		insert_entry(new_entry);
+	struct heap_node last = h->nodes[--h->size];
+	u32 pos = 0;
+	u32 child;
+
+	while ((child = 2 * pos + 1) < h->size) {
+		if (child + 1 < h->size &&
+		    above(&h->nodes[child + 1], &h->nodes[child]))
+			child++;
+		if (!above(&h->nodes[child], &last))
+			break;
+		h->nodes[pos] = h->nodes[child];
+		pos = child;
 	}
-	// do we need a left part?
-	if (start_addr_split < start_addr_keep) {
-		char * s = NULL;
-		
-		/* Check for max. length to avoid possible integer overflow. */
-		if (strlen(split->symbol_name) > SIZE_MAX - 3) {
-			fprintf(stderr, "Length of symbol name is too large.\n");
-			exit(EXIT_FAILURE);
-		} else {
-			s = xmalloc(strlen(split->symbol_name) + 3);
-			strcpy(s, split->symbol_name);
-			strcat(s, "#0");
-		}
-		
-		split->code_size = start_addr_keep - start_addr_split;
-		if (split->sym_name_malloced)
-			free(split->symbol_name);
-		split->symbol_name = s;
-		split->sym_name_malloced = 1;
-		verbprintf(debug, "split left name=%s, start=%llx, end=%llx\n",
-			   split->symbol_name, split->vma,
-			   split->vma + split->code_size);
-	} else {
-		invalidate_entry(split);
+	h->nodes[pos] = last;
+}
+
+
+/* return the top entry live at addr, entries ending before addr are
+ * removed lazily from the top */
+static u32 heap_top(struct entry_heap * h, unsigned long long addr)
+{
+	while (h->size) {
+		if (entry_end(h->nodes[0].idx) > addr)
+			return h->nodes[0].idx;
+		heap_pop(h);
 	}
+	return NO_ENTRY;
+}
+
+
+static int cmp_end_address(void const * a, void const * b)
+{
+	unsigned long long ea = *(unsigned long long const *)a;
+	unsigned long long eb = *(unsigned long long const *)b;
+	if (ea < eb)
+		return -1;
+	if (ea == eb)
+		return 0;
+	return 1;
+}
+
+
+/* fold entry i into the life time spanned by part p */
+static void add_life(struct part * p, u32 i)
+{
+	struct jitentry const * e = entries_address_ascending[i];
+
+	if (e->life_start < p->min_life_start)
+		p->min_life_start = e->life_start;
+	if (e->life_end > p->max_life_end)
+		p->max_life_end = e->life_end;
 }
 
 
 /*
- * Scans through the index range and splits/truncates entries that overlap
- * with the one indexed by keep_idx. Returns the total lifetime of the symbols
- * found to overlap.
- * Returns ULONG_MAX on error.
+ * Sweep through the entries of non zero size, filling parts with the
+ * maximal address ranges owned by a single entry, in address order.
+ * parts must have room for 2 * entry_count parts. Return the number of
+ * parts.
  */
-static unsigned long long eliminate_overlaps(int start_idx, int end_idx,
-					 int keep_idx)
+static u32 sweep_parts(struct part * parts)
 {
-	unsigned long long retval;
-	struct jitentry const * keep = entries_address_ascending[keep_idx];
-	struct jitentry * e;
-	unsigned long long start_addr_keep = keep->vma;
-	unsigned long long end_addr_keep = keep->vma + keep->code_size;
-	unsigned long long start_addr_entry, end_addr_entry;
-	int i;
-	unsigned long long min_start = keep->life_start;
-	unsigned long long max_end = keep->life_end;
-
-	for (i = start_idx; i <= end_idx; i++) {
-		if (i == keep_idx)
-			continue;
-		e = entries_address_ascending[i];
-		start_addr_entry = e->vma;
-		end_addr_entry = e->vma + e->code_size;
-		if (debug) {
-			if (!(start_addr_entry <= end_addr_entry)) {
-				verbprintf(debug, "assert failed:"
-					   " start_addr_entry <="
-					   " end_addr_entry\n");
-				retval = ULONG_MAX;
-				goto out;
-			}
-			if (!(start_addr_keep <= end_addr_keep)) {
-				verbprintf(debug, "assert failed: "
-					   "start_addr_keep <="
-					   " end_addr_keep\n");
-				retval = ULONG_MAX;
-				goto out;
+	struct entry_heap live, life_starts, life_ends;
+	unsigned long long * ends;
+	unsigned long long addr = 0;
+	struct part * cur = NULL;
+	struct jitentry const * e;
+	u32 nr_parts = 0, nr_ends = 0, nr_ended = 0, nr_started = 0;
+	u32 owner = NO_ENTRY;
+	u32 i, j, first;
+
+	heap_init(&live);
+	heap_init(&life_starts);
+	heap_init(&life_ends);
+
+	/* entries live at addr are the ones started minus the ones ended */
+	ends = xmalloc(sizeof(unsigned long long) * (entry_count + 1));
+	for (i = 0; i < entry_count; i++) {
+		if (entries_address_ascending[i]->code_size)
+			ends[nr_ends++] = entry_end(i);
+	}
+	qsort(ends, nr_ends, sizeof(unsigned long long), cmp_end_address);
+
+	i = 0;
+	for (;;) {
+		while (i < entry_count && !entries_address_ascending[i]->code_size)
+			i++;
+		if (i == entry_count && owner == NO_ENTRY)
+			break;
+
+		/* the owner can only change where an entry starts or where
+		 * the owner ends */
+		if (i < entry_count)
+			addr = entries_address_ascending[i]->vma;
+		if (owner != NO_ENTRY &&
+		    (i == entry_count || entry_end(owner) < addr))
+			addr = entry_end(owner);
+
+		first = i;
+		while (i < entry_count &&
+		       entries_address_ascending[i]->vma == addr) {
+			e = entries_address_ascending[i];
+			if (e->code_size) {
+				heap_push(&live, e->life_end - e->life_start, i);
+				/* earliest life start at the top */
+				heap_push(&life_starts, ~e->life_start, i);
+				heap_push(&life_ends, e->life_end, i);
+				nr_started++;
 			}
+			i++;
 		}
-		if (start_addr_entry < end_addr_keep &&
-		    end_addr_entry > start_addr_keep) {
-			if (e->life_start < min_start)
-				min_start = e->life_start;
-			if (e->life_end > max_end)
-				max_end = e->life_end;
-			split_entry(e, keep);
+		while (nr_ended < nr_ends && ends[nr_ended] <= addr)
+			nr_ended++;
+
+		if (heap_top(&live, addr) != owner) {
+			if (cur)
+				cur->end = addr;
+			cur = NULL;
+			owner = heap_top(&live, addr);
+			if (owner == NO_ENTRY)
+				continue;
+			cur = &parts[nr_parts++];
+			memset(cur, 0, sizeof(*cur));
+			cur->owner = owner;
+			cur->start = addr;
+			cur->overlapped = nr_started - nr_ended > 1;
+			cur->min_life_start = entries_address_ascending[
+				heap_top(&life_starts, addr)]->life_start;
+			cur->max_life_end = entries_address_ascending[
+				heap_top(&life_ends, addr)]->life_end;
+		} else if (cur) {
+			for (j = first; j < i; j++) {
+				if (!entries_address_ascending[j]->code_size)
+					continue;
+				cur->overlapped = 1;
+				add_life(cur, j);
+			}
 		}
 	}
-	retval = max_end - min_start;
-out:
-	return retval;
+
+	free(ends);
+	free(live.nodes);
+	free(life_starts.nodes);
+	free(life_ends.nodes);
+	return nr_parts;
 }
 
 
-/*
- * Within the index range (into the array entries_address_ascending), find the
- * symbol with the maximal lifetime and split/truncate all symbols that overlap
- * with it (i.e. that there won't be any overlaps anymore).
- */
-static int handle_overlap_region(int start_idx, int end_idx)
+/* return the new name of part p of entry e, NULL if it keeps its name */
+static char * part_name(struct jitentry const * e, struct part const * p,
+			int whole, u32 k)
 {
-	int rc = OP_JIT_CONV_OK;
-	int idx;
-	struct jitentry * e;
-	int cnt;
+	unsigned long long lifetime = e->life_end - e->life_start;
+	unsigned long long totaltime = p->max_life_end - p->min_life_start;
+	size_t len, used;
 	char * name;
-	int i, j;
-	unsigned long long totaltime;
 
-	if (debug) {
-		for (i = start_idx; i <= end_idx; i++) {
-			e = entries_address_ascending[i];
-			verbprintf(debug, "overlap idx=%i, name=%s, "
-				   "start=%llx, end=%llx, life_start=%lli, "
-				   "life_end=%lli, lifetime=%lli\n",
-				   i, e->symbol_name, e->vma,
-				   e->vma + e->code_size, e->life_start,
-				   e->life_end, e->life_end - e->life_start);
-		}
+	if (whole && !p->overlapped)
+		return NULL;
+
+	/* room for "#k" and "%nn" */
+	len = strlen(e->symbol_name) + 2 * 24;
+	name = xmalloc(len);
+	if (whole)
+		strcpy(name, e->symbol_name);
+	else
+		snprintf(name, len, "%s#%u", e->symbol_name, k);
+	if (p->overlapped) {
+		used = strlen(name);
+		snprintf(name + used, len - used, "%%%llu",
+			 totaltime ? lifetime * 100 / totaltime : 100ULL);
 	}
-	idx = select_one(start_idx, end_idx);
-	totaltime = eliminate_overlaps(start_idx, end_idx, idx);
-	if (totaltime == ULONG_MAX) {
-		rc = OP_JIT_CONV_FAIL;
-		goto out;
-	}
-	e = entries_address_ascending[idx];
-
-	cnt = 1;
-	j = (e->life_end - e->life_start) * 100 / totaltime;
-	while ((j = j/10))
-		cnt++;
-
-	// Mark symbol name with a %% to indicate the overlap.
-	cnt += strlen(e->symbol_name) + 2 + 1;
-	name = xmalloc(cnt);
-	snprintf(name, cnt, "%s%%%llu", e->symbol_name,
-		 (e->life_end - e->life_start) * 100 / totaltime);
-	if (e->sym_name_malloced)
-		free(e->symbol_name);
-	e->symbol_name = name;
-	e->sym_name_malloced = 1;
-	verbprintf(debug, "selected idx=%i, name=%s\n", idx, e->symbol_name);
-out:
-	return rc;
+	return name;
 }
 
 
 /*
- * one scan through the symbols to find overlaps.
- * return 1 if an overlap is found. this is repeated until no more overlap 
- * is there.
- * Process: There may be more than two overlapping symbols with each other.
- * The index range of symbols found to overlap are passed to
- * handle_overlap_region.
+ * Create the jitentry of each part. The part starting at its entry start
+ * reuses the entry, others are new entries added to jitentry_list so they
+ * are freed with it. Names are changed last as the parts of an entry are
+ * named after it. Return the number of parts not identical to their entry.
  */
-static int scan_overlaps(void)
+static u32 create_part_entries(struct part * parts, u32 nr_parts)
 {
-	int i, j;
-	unsigned long long end_addr, end_addr2;
-	struct jitentry const * a;
-	int flag = 0;
-	// entry_count can be incremented by split_entry() during the loop,
-	// save the inital value as loop count
-	int loop_count = entry_count;
-
-	verbprintf(debug,"count=%i, scan overlaps...\n", entry_count);
-	i = 0;
-	end_addr = 0;
-	for (j = 1; j < loop_count; j++) {
-		/**
-		 * Take a symbol [i] and look for the next symbol(s) [j] that are overlapping
-		 * symbol [i]. If a symbol [j] is found that is not overlapping symbol [i] the
-		 * symbols [i]..[j-1] are handled to be not overlapping anymore.
-		 * See descriptions of handle_overlap_region() and eliminate_overlaps() for
-		 * further details of this handling.
-		 * E.g. possible cases to be handled could be:
-		 *
-		 *   sym1 |-----------|
-		 *   sym2     |---|
-		 *
-		 *   sym1 |--------|
-		 *   sym2     |--------|
-		 *
-		 *   sym1 |--------|
-		 *   sym2     |-------|
-		 *   sym3        |---------|
-		 *
-		 * But in the following case
-		 *
-		 *   sym1 |--------|
-		 *   sym2      |-------------|
-		 *   sym3              |----------|
-		 *
-		 * sym3 would not overlap with sym1. Therefore handle_overlap_regio() would
-		 * only be called for sym1 up to sym2.
-		 */
-		a = entries_address_ascending[j - 1];
-		end_addr2 = a->vma + a->code_size;
-		if (end_addr2 > end_addr)
-			end_addr = end_addr2;
-		a = entries_address_ascending[j];
-		if (end_addr <= a->vma) {
-			if (i != j - 1) {
-				if (handle_overlap_region(i, j - 1) ==
-				    OP_JIT_CONV_FAIL) {
-					flag = OP_JIT_CONV_FAIL;
-					goto out;
-				}
-				flag = 1;
-			}
-			i = j;
+	u32 * next_k = xmalloc(sizeof(u32) * (entry_count + 1));
+	struct jitentry * e;
+	struct jitentry * new_entry;
+	struct part * p;
+	int whole;
+	u32 i, k, nr_changed = 0;
+
+	for (i = 0; i < entry_count; i++)
+		next_k[i] = NO_ENTRY;
+
+	for (i = 0; i < nr_parts; i++) {
+		p = &parts[i];
+		e = entries_address_ascending[p->owner];
+		whole = p->start == e->vma &&
+			p->end == e->vma + e->code_size;
+		if (next_k[p->owner] == NO_ENTRY)
+			k = p->start == e->vma ? 0 : 1;
+		else
+			k = next_k[p->owner];
+		next_k[p->owner] = k + 1;
+
+		p->name = part_name(e, p, whole, k);
+		if (p->name)
+			nr_changed++;
+		if (p->start == e->vma) {
+			p->entry = e;
+			continue;
 		}
+
+		new_entry = xcalloc(1, sizeof(struct jitentry));
+		new_entry->vma = p->start;
+		new_entry->code = NULL;
+		new_entry->symbol_name = p->name;
+		new_entry->sym_name_malloced = 1;
+		new_entry->life_start = e->life_start;
+		new_entry->life_end = e->life_end;
+		new_entry->next = jitentry_list;
+		jitentry_list = new_entry;
+		p->entry = new_entry;
+		p->name = NULL;
 	}
-	if (i != j - 1) {
-		if (handle_overlap_region(i, j - 1) == OP_JIT_CONV_FAIL)
-			flag = OP_JIT_CONV_FAIL;
-		else
-			flag = 1;
+
+	for (i = 0; i < nr_parts; i++) {
+		p = &parts[i];
+		p->entry->code_size = p->end - p->start;
+		if (p->name) {
+			if (p->entry->sym_name_malloced)
+				free(p->entry->symbol_name);
+			p->entry->symbol_name = p->name;
+			p->entry->sym_name_malloced = 1;
+		}
+		verbprintf(debug, "part name=%s, start=%llx, end=%llx\n",
+			   p->entry->symbol_name, p->start, p->end);
 	}
-out:
-	return flag;
+
+	free(next_k);
+	return nr_changed;
 }
 
 
@@ -497,21 +494,59 @@ out:
  * one */
 int resolve_overlaps(unsigned long long start_time)
 {
-	int rc = OP_JIT_CONV_OK;
-	int cnt = 0;
+	struct part * parts;
+	struct jitentry ** entries;
+	struct jitentry * e;
+	unsigned long long max_end = 0, max_end_before = 0, vma = 0;
+	u32 nr_parts, nr_entries, i, j;
 
 	invalidate_earlybirds(start_time);
-	while ((rc = scan_overlaps()) && rc != OP_JIT_CONV_FAIL) {
-		resort_address();
-		if (cnt == 0) {
-			verbprintf(debug, "WARNING: overlaps detected. "
-				   "Removing overlapping JIT methods\n");
+	if (!entry_count)
+		goto out;
+
+	parts = xmalloc(sizeof(struct part) * 2 * entry_count);
+	nr_parts = sweep_parts(parts);
+	if (create_part_entries(parts, nr_parts)) {
+		verbprintf(debug, "WARNING: overlaps detected. "
+			   "Removing overlapping JIT methods\n");
+	}
+
+	/* merge the parts with the zero sized entries not inside another
+	 * entry, both in address order */
+	entries = xmalloc(sizeof(struct jitentry *) *
+			  (nr_parts + entry_count));
+	nr_entries = 0;
+	for (i = j = 0; i < entry_count; i++) {
+		e = entries_address_ascending[i];
+		if (i == 0 || e->vma != vma) {
+			vma = e->vma;
+			max_end_before = max_end;
 		}
-		cnt++;
+		if (e->code_size) {
+			if (e->vma + e->code_size > max_end)
+				max_end = e->vma + e->code_size;
+			continue;
+		}
+		if (max_end_before > e->vma) {
+			invalidate_entry(e);
+			continue;
+		}
+		while (j < nr_parts && parts[j].start < e->vma)
+			entries[nr_entries++] = parts[j++].entry;
+		entries[nr_entries++] = e;
 	}
-	if (cnt > 0 && rc != OP_JIT_CONV_FAIL)
-		resort_symbol();
-	return rc;
+	while (j < nr_parts)
+		entries[nr_entries++] = parts[j++].entry;
+
+	free(parts);
+	free(entries_address_ascending);
+	entries_address_ascending = entries;
+	max_entry_count = entry_count = nr_entries;
+	entries_symbols_ascending = xrealloc(entries_symbols_ascending,
+		sizeof(struct jitentry *) * (max_entry_count + 1));
+out:
+	resort_symbol();
+	return OP_JIT_CONV_OK;
 }
 
 
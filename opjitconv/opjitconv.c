@@ -15,6 +15,7 @@
  */
 
 #include "opjitconv.h"
+#include "jitdump.h"
 #include "opd_printf.h"
 #include "op_file.h"
 #include "op_libiberty.h"
@@ -25,11 +26,14 @@
 #include <fcntl.h>
 #include <limits.h>
 #include <pwd.h>
+#include <setjmp.h>
+#include <signal.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <sys/prctl.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <wait.h>
@@ -54,7 +58,11 @@ char const * dump_bfd_target_name;
 /* user information for special user 'oprofile' */
 struct passwd * pw_oprofile;
 
-char sys_cmd_buffer[PATH_MAX + 1];
+/* SIGBUS while reading a mapped dump file jumps here */
+static sigjmp_buf dumpfile_truncated;
+
+/* directory of the per dump file conversion state, NULL if not available */
+static char const * dump_state_dir;
 
 /* the bfd handle of the ELF file we write */
 bfd * cur_bfd;
@@ -83,9 +91,52 @@ LIST_HEAD(jitdump_deletion_candidates);
  *      2. Find all JIT dump files
  *      3. For each JIT dump file:
  *        3.1 Find matching anon samples dir (from list retrieved in step 1)
- *        3.2 mmap the JIT dump file
- *        3.3 Call op_jit_convert to create ELF file if necessary
+ *        3.2 mmap the JIT dump file read-only, in place
+ *        3.3 Call op_jit_convert to create ELF file if necessary, in the
+ *            temporary directory, then rename it into the samples dir
+ *      Dump files are independent, step 3 runs in up to one worker process
+ *      per online cpu.
+ */
+
+/* Identity of a dump file and of the ELF file converted from it. The
+ * offset of the end of the records converted is recorded alongside so a
+ * later run only scans the records appended since.
+ */
+struct dump_state {
+	unsigned long long dev;
+	unsigned long long ino;
+	/* header timestamp, tells a dump from the one of a reused pid */
+	unsigned long long timestamp;
+	unsigned long long offset;
+	unsigned long long jo_ino;
+	unsigned long long jo_mtime;
+};
+
+/* worker process exit status for OP_JIT_CONV_FAIL */
+#define WORKER_FAIL 255
+
+/* pids of the running worker processes */
+static pid_t * worker_pids;
+static long nr_worker_pids;
+/* in a worker process, the pid of the process which forked it */
+static pid_t worker_parent;
+/* the signals terminating the main process along with its workers */
+static int const worker_kill_signals[] = { SIGHUP, SIGINT, SIGTERM };
+
+/* In a worker, get SIGKILL when the main process dies: operf kills
+ * opjitconv with SIGKILL when it takes too long, which leaves no chance to
+ * kill the workers. The kernel clears the parent death signal when the
+ * effective ids change, so this is called again after each change. The
+ * main process may be gone before the signal is armed, exit then.
  */
+static void watch_parent(void)
+{
+	if (!worker_parent)
+		return;
+	prctl(PR_SET_PDEATHSIG, SIGKILL);
+	if (getppid() != worker_parent)
+		_exit(WORKER_FAIL);
+}
 
 /* Callback function used for get_matching_pathnames() call to obtain
  * matching path names.
@@ -116,13 +167,17 @@ static void delete_path_names_list(struct list_head * list)
 	}
 }
 
+/* The dump file is mapped in place while its JVM may still append to it.
+ * The length seen by fstat() is the snapshot we convert; a record written
+ * past it is left for the next run.
+ */
 static int mmap_jitdump(char const * dumpfile,
 	struct op_jitdump_info * file_info)
 {
 	int rc = OP_JIT_CONV_OK;
 	int dumpfd;
 
-	dumpfd = open(dumpfile, O_RDONLY);
+	dumpfd = open(dumpfile, O_RDONLY | O_NOFOLLOW);
 	if (dumpfd < 0) {
 		if (errno == ENOENT)
 			rc = OP_JIT_CONV_NO_DUMPFILE;
@@ -134,7 +189,7 @@ static int mmap_jitdump(char const * dumpfile,
 	if (rc < 0) {
 		perror("opjitconv:fstat on dumpfile");
 		rc = OP_JIT_CONV_FAIL;
-		goto out;
+		goto close;
 	}
 	file_info->dmp_file = mmap(0, file_info->dmp_file_stat.st_size,
 				   PROT_READ, MAP_PRIVATE, dumpfd, 0);
@@ -142,10 +197,198 @@ static int mmap_jitdump(char const * dumpfile,
 		perror("opjitconv:mmap\n");
 		rc = OP_JIT_CONV_FAIL;
 	}
+close:
+	close(dumpfd);
 out:
 	return rc;
 }
 
+/* A dump file is truncated under us if its pid is reused by a new JVM,
+ * reading the mapping past the new end then raises SIGBUS.
+ */
+static void dumpfile_sigbus(int signo __attribute__((unused)))
+{
+	siglongjmp(dumpfile_truncated, 1);
+}
+
+/* Remove the temporary working directory and the files created in it.
+ */
+static int remove_tmp_dir(char const * dirname)
+{
+	DIR * dir;
+	struct dirent * dirent;
+	char path[PATH_MAX];
+	int rc = 0;
+
+	dir = opendir(dirname);
+	if (!dir)
+		return errno == ENOENT ? 0 : -1;
+
+	while ((dirent = readdir(dir))) {
+		if (!strcmp(dirent->d_name, ".") || !strcmp(dirent->d_name, ".."))
+			continue;
+		snprintf(path, PATH_MAX, "%s/%s", dirname, dirent->d_name);
+		if (unlink(path) != 0)
+			rc = -1;
+	}
+	closedir(dir);
+
+	if (rmdir(dirname) != 0)
+		rc = -1;
+	return rc;
+}
+
+/* Scan the records of a mapped dump file from state->offset, setting
+ * state->timestamp and moving state->offset to the end of the last
+ * complete record stamped no later than end_time. Return -1 if the dump
+ * file is not valid or is shorter than state->offset, i.e. it is not the
+ * dump file state was made from.
+ */
+static int scan_dumpfile(struct op_jitdump_info const * file_info,
+			 unsigned long long end_time,
+			 struct dump_state * state, int * code_records)
+{
+	char const * start = file_info->dmp_file;
+	size_t size = file_info->dmp_file_stat.st_size;
+	struct sigaction sa, old_sa;
+	int rc = 0;
+
+	if (size < sizeof(struct jitheader) || state->offset > size)
+		return -1;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = dumpfile_sigbus;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGBUS, &sa, &old_sa);
+	if (sigsetjmp(dumpfile_truncated, 1)) {
+		rc = -1;
+	} else {
+		state->timestamp =
+			((struct jitheader const *)start)->timestamp;
+		state->offset = scan_records(start, start + size,
+					     state->offset, end_time,
+					     code_records);
+		if (!state->offset)
+			rc = -1;
+	}
+	sigaction(SIGBUS, &old_sa, NULL);
+	return rc;
+}
+
+static void dump_state_filename(char * buf, size_t len, char const * proc_id,
+				char const * suffix)
+{
+	snprintf(buf, len, "%s/%s.state%s", dump_state_dir, proc_id, suffix);
+}
+
+static int read_dump_state(char const * proc_id, struct dump_state * state)
+{
+	char filename[PATH_MAX];
+	FILE * fp;
+	int rc;
+
+	if (!dump_state_dir)
+		return -1;
+	dump_state_filename(filename, PATH_MAX, proc_id, "");
+	fp = fopen(filename, "r");
+	if (!fp)
+		return -1;
+	rc = fscanf(fp, "%llu %llu %llu %llu %llu %llu", &state->dev,
+		    &state->ino, &state->timestamp, &state->offset,
+		    &state->jo_ino, &state->jo_mtime) == 6 ? 0 : -1;
+	fclose(fp);
+	return rc;
+}
+
+/* The state is written to a temporary file renamed over the state file,
+ * a failure only costs a full conversion next time.
+ */
+static void write_dump_state(char const * proc_id,
+			     struct dump_state const * state)
+{
+	char filename[PATH_MAX];
+	char tmp_filename[PATH_MAX];
+	FILE * fp;
+
+	if (!dump_state_dir)
+		return;
+	dump_state_filename(filename, PATH_MAX, proc_id, "");
+	dump_state_filename(tmp_filename, PATH_MAX, proc_id, ".tmp");
+	fp = fopen(tmp_filename, "w");
+	if (!fp)
+		goto fail;
+	fprintf(fp, "%llu %llu %llu %llu %llu %llu\n", state->dev,
+		state->ino, state->timestamp, state->offset,
+		state->jo_ino, state->jo_mtime);
+	if (fclose(fp) != 0 || rename(tmp_filename, filename) != 0) {
+		unlink(tmp_filename);
+		goto fail;
+	}
+	return;
+fail:
+	verbprintf(debug, "opjitconv: cannot write %s (%s)\n", filename,
+		   strerror(errno));
+}
+
+static void init_dump_state(struct dump_state * state,
+			    struct op_jitdump_info const * file_info,
+			    struct stat const * jo_stat)
+{
+	state->dev = file_info->dmp_file_stat.st_dev;
+	state->ino = file_info->dmp_file_stat.st_ino;
+	state->timestamp = 0;
+	state->offset = 0;
+	state->jo_ino = jo_stat->st_ino;
+	state->jo_mtime = jo_stat->st_mtime;
+}
+
+/* Record the state of a dump file just converted to elf_file for end_time */
+static void save_dump_state(char const * proc_id,
+			    struct op_jitdump_info const * file_info,
+			    unsigned long long end_time,
+			    char const * elf_file)
+{
+	struct dump_state state;
+	struct stat jo_stat;
+	int code_records;
+
+	if (!dump_state_dir || stat(elf_file, &jo_stat) != 0)
+		return;
+	init_dump_state(&state, file_info, &jo_stat);
+	if (scan_dumpfile(file_info, end_time, &state, &code_records) == 0)
+		write_dump_state(proc_id, &state);
+}
+
+/* Return non zero if the ELF file is up to date with the dump file
+ * according to the state recorded by the run which converted it: the
+ * records appended since, up to end_time, do not load or unload any
+ * code. Return 0 if the dump file must be converted, -1 if there is no
+ * usable state.
+ */
+static int dump_state_up_to_date(char const * proc_id,
+				 struct op_jitdump_info const * file_info,
+				 unsigned long long end_time,
+				 struct stat const * jo_stat)
+{
+	struct dump_state saved, state;
+	int code_records;
+
+	if (read_dump_state(proc_id, &saved) != 0)
+		return -1;
+	init_dump_state(&state, file_info, jo_stat);
+	if (saved.dev != state.dev || saved.ino != state.ino ||
+	    saved.jo_ino != state.jo_ino || saved.jo_mtime != state.jo_mtime)
+		return -1;
+
+	state.offset = saved.offset;
+	if (scan_dumpfile(file_info, end_time, &state, &code_records) != 0 ||
+	    state.timestamp != saved.timestamp || code_records)
+		return 0;
+	if (state.offset != saved.offset)
+		write_dump_state(proc_id, &state);
+	return 1;
+}
+
 static char const * find_anon_dir_match(struct list_head * anon_dirs,
 					char const * proc_id)
 {
@@ -190,50 +433,28 @@ out:
 	return rc;
 }
 
-/* Copies the given file to the temporary working directory and sets ownership
- * to 'oprofile:oprofile'.
+/* Moves the created ELF file located in the temporary working directory to
+ * the final destination (i.e. given ELF file name) and sets ownership to the
+ * current user. The temporary directory is on the same file system as the
+ * samples directory, so the ELF file is replaced atomically: a reader sees
+ * either the old or the new one.
  */
-int copy_dumpfile(char const * dumpfile, char * tmp_dumpfile)
-{
-	int rc = OP_JIT_CONV_OK;
-
-	sprintf(sys_cmd_buffer, "/bin/cp -p %s %s", dumpfile, tmp_dumpfile);
-
-	if (system(sys_cmd_buffer) != 0) {
-		printf("opjitconv: Calling system() to copy files failed.\n");
-		rc = OP_JIT_CONV_FAIL;
-		goto out;
-	}
-
-	if (change_owner(tmp_dumpfile) != 0) {
-		printf("opjitconv: Changing ownership of temporary dump file failed.\n");
-		rc = OP_JIT_CONV_FAIL;
-		goto out;
-	}
-	
-out:
-	return rc;
-}
-
-/* Copies the created ELF file located in the temporary working directory to the
- * final destination (i.e. given ELF file name) and sets ownership to the
- * current user.
- */
-int copy_elffile(char * elf_file, char * tmp_elffile)
+static int install_elffile(char const * elf_file, char const * tmp_elffile)
 {
 	int rc = OP_JIT_CONV_OK;
+	struct stat st;
 	int fd;
 
-	sprintf(sys_cmd_buffer, "/bin/cp -p %s %s", tmp_elffile, elf_file);
-	if (system(sys_cmd_buffer) != 0) {
-		printf("opjitconv: Calling system() to copy files failed.\n");
+	/* the ELF file was written as the special user, don't follow links */
+	fd = open(tmp_elffile, O_RDONLY | O_NOFOLLOW);
+	if (fd < 0) {
+		printf("opjitconv: File cannot be opened for changing ownership.\n");
 		rc = OP_JIT_CONV_FAIL;
 		goto out;
 	}
-
-	fd = open(elf_file, 0);
-	if (fd < 0) {
-		printf("opjitconv: File cannot be opened for changing ownership.\n");
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+		printf("opjitconv: %s is not a regular file.\n", tmp_elffile);
+		close(fd);
 		rc = OP_JIT_CONV_FAIL;
 		goto out;
 	}
@@ -244,7 +465,13 @@ int copy_elffile(char * elf_file, char * tmp_elffile)
 		goto out;
 	}
 	close(fd);
-	
+
+	if (rename(tmp_elffile, elf_file) != 0) {
+		printf("opjitconv: Renaming %s to %s failed (%s).\n",
+		       tmp_elffile, elf_file, strerror(errno));
+		rc = OP_JIT_CONV_FAIL;
+	}
+
 out:
 	return rc;
 }
@@ -271,10 +498,9 @@ static int process_jit_dumpfile(char const * dmp_pathname,
 	char * proc_id = NULL;
 	char const * anon_dir;
 	char const * dumpfilename = rindex(dmp_pathname, '/');
-	/* temporary copy of dump file created for conversion step */
-	char * tmp_dumpfile;
 	/* temporary ELF file created during conversion step */
 	char * tmp_elffile;
+	struct sigaction sa, old_sa;
 	
 	verbprintf(debug, "Processing dumpfile %s\n", dmp_pathname);
 	
@@ -294,7 +520,6 @@ static int process_jit_dumpfile(char const * dmp_pathname,
 	}
 	
 	if (dumpfilename) {
-		size_t tmp_conv_dir_length = strlen(tmp_conv_dir);
 		char const * dot_dump = rindex(++dumpfilename, '.');
 		if (!dot_dump)
 			goto chk_proc_id;
@@ -304,12 +529,6 @@ static int process_jit_dumpfile(char const * dmp_pathname,
 		proc_id[proc_id_length] = '\0';
 		verbprintf(debug, "Found JIT dumpfile for process %s\n",
 			   proc_id);
-
-		tmp_dumpfile = xmalloc(tmp_conv_dir_length + 1 + strlen(dumpfilename) + 1);
-		strncpy(tmp_dumpfile, tmp_conv_dir, tmp_conv_dir_length);
-		tmp_dumpfile[tmp_conv_dir_length] = '\0';
-		strcat(tmp_dumpfile, "/");
-		strcat(tmp_dumpfile, dumpfilename);
 	}
 chk_proc_id:
 	if (!proc_id) {
@@ -333,10 +552,7 @@ chk_proc_id:
 		goto free_res1;
 	}
 	
-	if (copy_dumpfile(dmp_pathname, tmp_dumpfile) != OP_JIT_CONV_OK)
-		goto free_res1;
-	
-	if ((rc = mmap_jitdump(tmp_dumpfile, &dmp_info)) == OP_JIT_CONV_OK) {
+	if ((rc = mmap_jitdump(dmp_pathname, &dmp_info)) == OP_JIT_CONV_OK) {
 		char * anon_path_seg = rindex(anon_dir, '/');
 		if (!anon_path_seg) {
 			printf("opjitconv: Bad path for anon sample: %s\n",
@@ -366,11 +582,24 @@ chk_proc_id:
 		if (jofd < 0)
 			goto create_elf;
 		rc = fstat(jofd, &file_stat);
+		close(jofd);
 		if (rc < 0) {
 			perror("opjitconv:fstat on .jo file");
 			rc = OP_JIT_CONV_FAIL;
 			goto free_res3;
 		}
+
+		switch (dump_state_up_to_date(proc_id, &dmp_info, end_time,
+					      &file_stat)) {
+		case 1:
+			rc = OP_JIT_CONV_ALREADY_DONE;
+			goto free_res3;
+		case 0:
+			rc = OP_JIT_CONV_OK;
+			goto create_elf;
+		}
+
+		/* No state for this dump file, fall back to comparing times */
 		if (dmp_info.dmp_file_stat.st_mtime >
 		    dmp_info.dmp_file_stat.st_ctime)
 			dumpfile_modtime = dmp_info.dmp_file_stat.st_mtime;
@@ -396,27 +625,49 @@ chk_proc_id:
 			rc = OP_JIT_CONV_FAIL;
 			goto free_res3;
 		}
+		watch_parent();
 		/* Set eUID of the special user 'oprofile'. */
 		if (!non_root && seteuid(pw_oprofile->pw_uid) != 0) {
 			perror("opjitconv: seteuid to special user failed");
 			rc = OP_JIT_CONV_FAIL;
 			goto free_res3;
 		}
+		watch_parent();
 		/* Convert the dump file as the special user 'oprofile'. */
-		rc = op_jit_convert(dmp_info, tmp_elffile, start_time, end_time);
+		memset(&sa, 0, sizeof(sa));
+		sa.sa_handler = dumpfile_sigbus;
+		sigemptyset(&sa.sa_mask);
+		sigaction(SIGBUS, &sa, &old_sa);
+		if (sigsetjmp(dumpfile_truncated, 1)) {
+			/* the records parsed so far are leaked, this only
+			 * happens on pid reuse */
+			printf("opjitconv: %s was truncated during conversion.\n",
+			       dmp_pathname);
+			rc = OP_JIT_CONV_DUMPFILE_TRUNCATED;
+		} else {
+			rc = op_jit_convert(dmp_info, tmp_elffile, start_time,
+					    end_time);
+		}
+		sigaction(SIGBUS, &old_sa, NULL);
 		/* Set eUID back to the original user. */
 		if (!non_root && seteuid(getuid()) != 0) {
 			perror("opjitconv: seteuid to original user failed");
 			rc = OP_JIT_CONV_FAIL;
 			goto free_res3;
 		}
+		watch_parent();
 		/* Set eGID back to the original user. */
 		if (!non_root && setegid(getgid()) != 0) {
 			perror("opjitconv: setegid to original user failed");
 			rc = OP_JIT_CONV_FAIL;
 			goto free_res3;
 		}
-		rc = copy_elffile(elf_file, tmp_elffile);
+		watch_parent();
+		if (rc == OP_JIT_CONV_OK)
+			rc = install_elffile(elf_file, tmp_elffile);
+		if (rc == OP_JIT_CONV_OK)
+			save_dump_state(proc_id, &dmp_info, end_time,
+					elf_file);
 	free_res3:
 		free(elf_file);
 		free(tmp_elffile);
@@ -425,7 +676,6 @@ chk_proc_id:
 	}
 free_res1:
 	free(proc_id);
-	free(tmp_dumpfile);
 out:
 	return rc;
 }
@@ -533,13 +783,177 @@ static void _add_jitdumps_to_deletion_list(void * all_jitdumps, char const * jit
 	}
 }
 
+/* The main process is terminated, kill its workers along */
+static void kill_workers(int sig)
+{
+	long i;
+
+	for (i = 0; i < nr_worker_pids; i++)
+		kill(worker_pids[i], SIGKILL);
+	signal(sig, SIG_DFL);
+	raise(sig);
+}
+
+static void block_worker_kill_signals(int how)
+{
+	sigset_t set;
+	size_t i;
+
+	sigemptyset(&set);
+	for (i = 0; i < sizeof(worker_kill_signals) / sizeof(int); i++)
+		sigaddset(&set, worker_kill_signals[i]);
+	sigprocmask(how, &set, NULL);
+}
+
+static void set_worker_kill_handler(void (*handler)(int))
+{
+	struct sigaction sa;
+	size_t i;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = handler;
+	sigemptyset(&sa.sa_mask);
+	for (i = 0; i < sizeof(worker_kill_signals) / sizeof(int); i++)
+		sigaction(worker_kill_signals[i], &sa, NULL);
+}
+
+/* Fork a worker process, the signals killing the workers are blocked
+ * while the list of workers is updated. Return the fork() result.
+ */
+static pid_t fork_worker(void)
+{
+	pid_t parent = getpid();
+	pid_t pid;
+
+	fflush(stdout);
+	block_worker_kill_signals(SIG_BLOCK);
+	pid = fork();
+	if (pid == 0) {
+		nr_worker_pids = 0;
+		set_worker_kill_handler(SIG_DFL);
+		worker_parent = parent;
+		watch_parent();
+	} else if (pid > 0) {
+		worker_pids[nr_worker_pids++] = pid;
+	}
+	block_worker_kill_signals(SIG_UNBLOCK);
+	return pid;
+}
+
+/* Wait for a worker process and return its conversion result */
+static int wait_worker(void)
+{
+	int status;
+	pid_t pid;
+	long i;
+
+	while ((pid = wait(&status)) < 0) {
+		if (errno != EINTR)
+			return OP_JIT_CONV_FAIL;
+	}
+	block_worker_kill_signals(SIG_BLOCK);
+	for (i = 0; i < nr_worker_pids; i++) {
+		if (worker_pids[i] == pid) {
+			worker_pids[i] = worker_pids[--nr_worker_pids];
+			break;
+		}
+	}
+	block_worker_kill_signals(SIG_UNBLOCK);
+	if (!WIFEXITED(status) || WEXITSTATUS(status) == WORKER_FAIL)
+		return OP_JIT_CONV_FAIL;
+	return WEXITSTATUS(status);
+}
+
+/* Convert the dump files of the jd_fnames list, removing them from the
+ * list. The conversion keeps its data in globals and switches the
+ * effective user id of the whole process, so dump files are converted in
+ * forked worker processes rather than threads, at most one per online
+ * cpu. The workers are killed along with the main process. Return
+ * OP_JIT_CONV_FAIL if any conversion failed, else the result of the last
+ * conversion finished.
+ */
+static int convert_dumpfiles(struct list_head * jd_fnames,
+			     char const * jitdump_dir,
+			     struct list_head * anon_dnames,
+			     unsigned long long start_time,
+			     unsigned long long end_time,
+			     char * tmp_conv_dir)
+{
+	struct list_head * pos1, * pos2;
+	char jitdumpfile[PATH_MAX + 1];
+	long max_workers = sysconf(_SC_NPROCESSORS_ONLN);
+	long nr_workers = 0;
+	int rc = OP_JIT_CONV_OK;
+	int worker_rc;
+	pid_t pid;
+
+	if (max_workers > 1) {
+		worker_pids = xmalloc(max_workers * sizeof(pid_t));
+		set_worker_kill_handler(kill_workers);
+	}
+
+	/* get_matching_pathnames returns only filename segment when
+	 * NO_RECURSION is passed, so below, we add back the JIT
+	 * dump directory path to the name.
+	 */
+	list_for_each_safe(pos1, pos2, jd_fnames) {
+		struct pathname * dmpfile =
+			list_entry(pos1, struct pathname, neighbor);
+		strncpy(jitdumpfile, jitdump_dir, PATH_MAX);
+		strncat(jitdumpfile, dmpfile->name, PATH_MAX);
+		delete_pathname(dmpfile);
+
+		if (nr_workers && nr_workers >= max_workers) {
+			worker_rc = wait_worker();
+			nr_workers--;
+			if (rc != OP_JIT_CONV_FAIL)
+				rc = worker_rc;
+		}
+		if (rc == OP_JIT_CONV_FAIL)
+			break;
+
+		pid = -1;
+		if (max_workers > 1 && pos2 != jd_fnames)
+			pid = fork_worker();
+		if (pid > 0) {
+			nr_workers++;
+			continue;
+		}
+
+		worker_rc = process_jit_dumpfile(jitdumpfile, anon_dnames,
+						 start_time, end_time,
+						 tmp_conv_dir);
+		if (worker_rc == OP_JIT_CONV_FAIL)
+			verbprintf(debug, "JIT convert error %d\n", worker_rc);
+		if (pid == 0) {
+			fflush(stdout);
+			_exit(worker_rc == OP_JIT_CONV_FAIL ?
+			      WORKER_FAIL : worker_rc);
+		}
+		if (rc != OP_JIT_CONV_FAIL)
+			rc = worker_rc;
+	}
+
+	while (nr_workers--) {
+		worker_rc = wait_worker();
+		if (rc != OP_JIT_CONV_FAIL)
+			rc = worker_rc;
+	}
+
+	if (max_workers > 1) {
+		set_worker_kill_handler(SIG_DFL);
+		free(worker_pids);
+		worker_pids = NULL;
+	}
+	return rc;
+}
+
 static int op_process_jit_dumpfiles(char const * session_dir,
 	unsigned long long start_time, unsigned long long end_time)
 {
-	struct list_head * pos1, * pos2;
 	int rc = OP_JIT_CONV_OK;
-	char jitdumpfile[PATH_MAX + 1];
 	char oprofile_tmp_template[PATH_MAX + 1];
+	static char dump_state_path[PATH_MAX + 1];
 	char const * jitdump_dir = "/var/lib/oprofile/jitdump/";
 
 	LIST_HEAD(jd_fnames);
@@ -551,16 +965,18 @@ static int op_process_jit_dumpfiles(char const * session_dir,
 	/* temporary working directory for dump file conversion step */
 	char * tmp_conv_dir = NULL;
 
+	/* The temporary directory is in the session directory, on the same
+	 * file system as the samples, so ELF files can be renamed into place.
+	 */
 	if (non_root)
 		sprintf(oprofile_tmp_template, "%s/tmp", session_dir);
 	else
-		strcpy(oprofile_tmp_template, "/tmp/oprofile.XXXXXX");
+		sprintf(oprofile_tmp_template, "%s/tmp.XXXXXX", session_dir);
 
 	/* Create a temporary working directory used for the conversion step.
 	 */
 	if (non_root) {
-		sprintf(sys_cmd_buffer, "/bin/rm -rf %s", oprofile_tmp_template);
-		if (system(sys_cmd_buffer) != 0) {
+		if (remove_tmp_dir(oprofile_tmp_template) != 0) {
 			printf("opjitconv: Removing temporary working directory %s failed.\n",
 			       oprofile_tmp_template);
 			rc = OP_JIT_CONV_TMPDIR_NOT_REMOVED;
@@ -648,31 +1064,23 @@ static int op_process_jit_dumpfiles(char const * session_dir,
 	 */
 	filter_anon_samples_list(&anon_dnames);
 
-	/* get_matching_pathnames returns only filename segment when
-	 * NO_RECURSION is passed, so below, we add back the JIT
-	 * dump directory path to the name.
+	/* The conversion state of each dump file is kept in the session
+	 * directory, conversion works without it.
 	 */
-	list_for_each_safe(pos1, pos2, &jd_fnames) {
-		struct pathname * dmpfile =
-			list_entry(pos1, struct pathname, neighbor);
-		strncpy(jitdumpfile, jitdump_dir, PATH_MAX);
-		strncat(jitdumpfile, dmpfile->name, PATH_MAX);
-		rc = process_jit_dumpfile(jitdumpfile, &anon_dnames,
-					  start_time, end_time, tmp_conv_dir);
-		if (rc == OP_JIT_CONV_FAIL) {
-			verbprintf(debug, "JIT convert error %d\n", rc);
-			goto rm_tmp;
-		}
-		delete_pathname(dmpfile);
-	}
+	sprintf(dump_state_path, "%s/jitdump_state", session_dir);
+	if (!mkdir(dump_state_path, S_IRWXU) || errno == EEXIST)
+		dump_state_dir = dump_state_path;
+
+	rc = convert_dumpfiles(&jd_fnames, jitdump_dir, &anon_dnames,
+			       start_time, end_time, tmp_conv_dir);
+	delete_path_names_list(&jd_fnames);
 	delete_path_names_list(&anon_dnames);
 	
 rm_tmp:
 	/* Delete temporary working directory with all its files
-	 * (i.e. dump and ELF file).
+	 * (i.e. ELF files left by a failed conversion).
 	 */
-	sprintf(sys_cmd_buffer, "/bin/rm -rf '%s'", tmp_conv_dir);
-	if (system(sys_cmd_buffer) != 0) {
+	if (remove_tmp_dir(tmp_conv_dir) != 0) {
 		printf("opjitconv: Removing temporary working directory failed.\n");
 		rc = OP_JIT_CONV_TMPDIR_NOT_REMOVED;
 	}
@@ -25,6 +25,7 @@
 #define OP_JIT_CONV_NO_JIT_RECS_IN_DUMPFILE 4
 #define OP_JIT_CONV_ALREADY_DONE 5
 #define OP_JIT_CONV_TMPDIR_NOT_REMOVED 6
+#define OP_JIT_CONV_DUMPFILE_TRUNCATED 7
 
 #include "config.h"
 #include <stddef.h>
@@ -97,6 +98,8 @@ void disambiguate_symbol_names(void);
 /* parse_dump.c */
 int parse_all(void const * start, void const * end,
 	      unsigned long long end_time);
+size_t scan_records(void const * start, void const * end, size_t offset,
+		    unsigned long long end_time, int * code_records);
 
 /* conversion.c */
 int op_jit_convert(struct op_jitdump_info file_info, char const * elffile,
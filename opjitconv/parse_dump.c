@@ -141,9 +141,11 @@ static int parse_entries(void const * ptr, void const * end,
 	struct jr_prefix const * rec = ptr;
 
 	while ((void *)rec + sizeof(struct jr_prefix) < end) {
+		/* the dump may be mapped while its last record is still
+		 * being written, convert up to the last complete record */
 		if (((void *) rec + rec->total_size) > end) {
-			verbprintf(debug, "record past end of file\n");
-			rc = OP_JIT_CONV_FAIL;
+			verbprintf(debug, "incomplete record at end of file, "
+				   "ignored\n");
 			break;
 		}
 
@@ -245,3 +247,43 @@ int parse_all(void const * start, void const * end,
 	else
 		return OP_JIT_CONV_FAIL;
 }
+
+
+/* Return the offset of the end of the last complete record of the
+ * memory mapped jitdump file stamped no later than end_time, scanning from
+ * offset, the end of a record returned by an earlier call or 0 to start
+ * with the header. The records after end_time are not in the ELF file
+ * converted for end_time, the scan stops before them so that a later run
+ * sees them. Set *code_records if any record scanned loads or unloads
+ * code, return 0 if the header is not valid.
+ */
+size_t scan_records(void const * start, void const * end, size_t offset,
+		    unsigned long long end_time, int * code_records)
+{
+	char const * ptr = start;
+	struct jr_prefix const * rec;
+
+	*code_records = 0;
+	if (offset == 0) {
+		if (parse_header(&ptr, end))
+			return 0;
+	} else {
+		ptr += offset;
+	}
+
+	rec = (void const *)ptr;
+	while ((void const *)rec + sizeof(struct jr_prefix) <= end) {
+		if (rec->total_size == 0 ||
+		    ((void const *)rec + rec->total_size) > end)
+			break;
+		/* all records have a timestamp following the prefix */
+		if (rec->total_size >= sizeof(struct jr_code_close) &&
+		    ((struct jr_code_close const *)rec)->timestamp > end_time)
+			break;
+		if (rec->id != JIT_CODE_CLOSE)
+			*code_records = 1;
+		rec = (void const *)rec + rec->total_size;
+	}
+
+	return (char const *)rec - (char const *)start;
+}
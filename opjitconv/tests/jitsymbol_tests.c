@@ -0,0 +1,437 @@
+/**
+ * @file jitsymbol_tests.c
+ * Overlap resolution of jitted code entries, and conversion of a synthetic
+ * dump of recompiled methods
+ *
+ * Set OPJITCONV_BENCHMARK in the environment to also time the conversion
+ * of a dump of a million records.
+ *
+ * @remark Copyright 2012 OProfile authors
+ * @remark Read the file COPYING
+ */
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "opjitconv.h"
+#include "jitdump.h"
+#include "op_libiberty.h"
+
+/* opjitconv.c globals used by the code under test */
+struct jitentry * jitentry_list;
+struct jitentry_debug_line * jitentry_debug_line_list;
+asymbol ** syms;
+enum bfd_architecture dump_bfd_arch;
+int dump_bfd_mach;
+char const * dump_bfd_target_name;
+bfd * cur_bfd;
+u32 entry_count;
+u32 max_entry_count;
+struct jitentry ** entries_symbols_ascending;
+struct jitentry ** entries_address_ascending;
+int debug;
+
+#define NR_RANDOM_TESTS 5000
+#define RANDOM_SPACE 256
+#define MAX_RANDOM_ENTRIES 12
+
+/* synthetic dumps: methods compiled in a code cache wrapping around */
+#define NR_DUMP_RECORDS 20000
+#define DUMP_CODE_CACHE_SIZE (1024 * 1024)
+#define NR_BENCH_RECORDS 1000000
+#define BENCH_CODE_CACHE_SIZE (16 * 1024 * 1024)
+#define CODE_CACHE_BASE 0x10000000ULL
+
+struct test_entry {
+	char const * name;
+	unsigned long long vma;
+	int code_size;
+	unsigned long long life_start;
+	unsigned long long life_end;
+};
+
+struct expected_entry {
+	char const * name;
+	unsigned long long vma;
+	int code_size;
+};
+
+struct overlap_test {
+	char const * title;
+	unsigned long long start_time;
+	struct test_entry entries[4];
+	struct expected_entry expected[4];
+};
+
+static struct overlap_test const overlap_tests[] = {
+	{ "disjoint", 0,
+	  { { "a", 0x1000, 0x100, 0, 10 },
+	    { "b", 0x1100, 0x100, 0, 20 },
+	    { NULL, 0, 0, 0, 0 } },
+	  { { "a", 0x1000, 0x100 },
+	    { "b", 0x1100, 0x100 },
+	    { NULL, 0, 0 } } },
+	{ "inner short lived", 0,
+	  { { "a", 0x1000, 0x100, 0, 100 },
+	    { "b", 0x1040, 0x40, 0, 10 },
+	    { NULL, 0, 0, 0, 0 } },
+	  { { "a%100", 0x1000, 0x100 },
+	    { NULL, 0, 0 } } },
+	{ "inner long lived", 0,
+	  { { "a", 0x1000, 0x100, 0, 10 },
+	    { "b", 0x1040, 0x40, 0, 100 },
+	    { NULL, 0, 0, 0, 0 } },
+	  { { "a#0", 0x1000, 0x40 },
+	    { "b%100", 0x1040, 0x40 },
+	    { "a#1", 0x1080, 0x80 },
+	    { NULL, 0, 0 } } },
+	{ "tail overlap", 0,
+	  { { "a", 0x1000, 0x100, 50, 100 },
+	    { "b", 0x1080, 0x100, 0, 100 },
+	    { NULL, 0, 0, 0, 0 } },
+	  { { "a#0", 0x1000, 0x80 },
+	    { "b%100", 0x1080, 0x100 },
+	    { NULL, 0, 0 } } },
+	{ "equal lifetimes", 0,
+	  { { "a", 0x1000, 0x100, 0, 40 },
+	    { "b", 0x1080, 0x100, 10, 50 },
+	    { NULL, 0, 0, 0, 0 } },
+	  { { "a%80", 0x1000, 0x100 },
+	    { "b#1", 0x1100, 0x80 },
+	    { NULL, 0, 0 } } },
+	{ "early bird", 20,
+	  { { "a", 0x1000, 0x100, 0, 10 },
+	    { "b", 0x1080, 0x100, 15, 50 },
+	    { NULL, 0, 0, 0, 0 } },
+	  { { "b", 0x1080, 0x100 },
+	    { NULL, 0, 0 } } },
+	{ "zero sized", 0,
+	  { { "a", 0x1000, 0x100, 0, 10 },
+	    { "b", 0x1080, 0, 0, 50 },
+	    { "c", 0x1100, 0, 0, 50 },
+	    { NULL, 0, 0, 0, 0 } },
+	  { { "a", 0x1000, 0x100 },
+	    { "c", 0x1100, 0 },
+	    { NULL, 0, 0 } } },
+};
+
+
+static void fail(char const * title, char const * msg)
+{
+	fprintf(stderr, "jitsymbol_tests: %s: %s\n", title, msg);
+	exit(EXIT_FAILURE);
+}
+
+
+static void add_entry(char const * name, unsigned long long vma,
+		      int code_size, unsigned long long life_start,
+		      unsigned long long life_end)
+{
+	struct jitentry * e = xcalloc(1, sizeof(struct jitentry));
+
+	e->symbol_name = xstrdup(name);
+	e->sym_name_malloced = 1;
+	e->vma = vma;
+	e->code_size = code_size;
+	e->life_start = life_start;
+	e->life_end = life_end;
+	e->next = jitentry_list;
+	jitentry_list = e;
+}
+
+
+static void free_entries(void)
+{
+	struct jitentry * e, * next;
+
+	for (e = jitentry_list; e; e = next) {
+		next = e->next;
+		if (e->sym_name_malloced)
+			free(e->symbol_name);
+		free(e);
+	}
+	jitentry_list = NULL;
+	free(entries_symbols_ascending);
+	free(entries_address_ascending);
+	entries_symbols_ascending = entries_address_ascending = NULL;
+	entry_count = max_entry_count = 0;
+}
+
+
+/* check the resolved entries are sorted, don't overlap and that both
+ * arrays hold the same entries */
+static void check_arrays(char const * title)
+{
+	struct jitentry const * e;
+	unsigned long long end = 0;
+	u32 i;
+
+	for (i = 0; i < entry_count; i++) {
+		e = entries_address_ascending[i];
+		if (e->vma < end)
+			fail(title, "overlapping entries left");
+		end = e->vma + e->code_size;
+		if (i && strcmp(entries_symbols_ascending[i - 1]->symbol_name,
+				entries_symbols_ascending[i]->symbol_name) > 0)
+			fail(title, "symbols not sorted");
+	}
+}
+
+
+static void check_overlap_tests(void)
+{
+	size_t i, j;
+	struct overlap_test const * t;
+	struct jitentry const * e;
+
+	for (i = 0; i < sizeof(overlap_tests) / sizeof(overlap_tests[0]); i++) {
+		t = &overlap_tests[i];
+		for (j = 0; t->entries[j].name; j++) {
+			add_entry(t->entries[j].name, t->entries[j].vma,
+				  t->entries[j].code_size,
+				  t->entries[j].life_start,
+				  t->entries[j].life_end);
+		}
+		create_arrays();
+		if (resolve_overlaps(t->start_time) != OP_JIT_CONV_OK)
+			fail(t->title, "resolve_overlaps() failed");
+		check_arrays(t->title);
+
+		for (j = 0; t->expected[j].name; j++) {
+			if (j >= entry_count)
+				fail(t->title, "missing entry");
+			e = entries_address_ascending[j];
+			if (strcmp(e->symbol_name, t->expected[j].name) ||
+			    e->vma != t->expected[j].vma ||
+			    e->code_size != t->expected[j].code_size) {
+				fprintf(stderr, "got %s %llx %x\n",
+					e->symbol_name, e->vma, e->code_size);
+				fail(t->title, "unexpected entry");
+			}
+		}
+		if (j != entry_count)
+			fail(t->title, "unexpected extra entry");
+		free_entries();
+	}
+}
+
+
+/*
+ * Random entries in a small address space, each address must end up in
+ * a part of the longest lived entry covering it, ties going to the lowest
+ * address.
+ */
+static void check_random_tests(void)
+{
+	struct test_entry entries[MAX_RANDOM_ENTRIES];
+	char names[MAX_RANDOM_ENTRIES][8];
+	int owner[RANDOM_SPACE];
+	int nr_entries, test, i, j;
+	unsigned long long x, lifetime, best_lifetime;
+	struct jitentry const * e;
+	char const * name;
+
+	srand(42);
+	for (test = 0; test < NR_RANDOM_TESTS; test++) {
+		nr_entries = 1 + rand() % MAX_RANDOM_ENTRIES;
+		for (i = 0; i < nr_entries; i++) {
+			/* distinct addresses so ties have a defined winner */
+			do {
+				entries[i].vma = rand() % (RANDOM_SPACE - 64);
+				for (j = 0; j < i; j++) {
+					if (entries[j].vma == entries[i].vma)
+						break;
+				}
+			} while (j < i);
+			entries[i].code_size = 1 + rand() % 64;
+			entries[i].life_start = rand() % 8;
+			entries[i].life_end = entries[i].life_start + rand() % 8;
+			sprintf(names[i], "s%d", i);
+			entries[i].name = names[i];
+			add_entry(entries[i].name, entries[i].vma,
+				  entries[i].code_size, entries[i].life_start,
+				  entries[i].life_end);
+		}
+
+		for (x = 0; x < RANDOM_SPACE; x++) {
+			owner[x] = -1;
+			best_lifetime = 0;
+			for (i = 0; i < nr_entries; i++) {
+				if (x < entries[i].vma ||
+				    x >= entries[i].vma + entries[i].code_size)
+					continue;
+				lifetime = entries[i].life_end -
+					entries[i].life_start;
+				if (owner[x] == -1 || lifetime > best_lifetime ||
+				    (lifetime == best_lifetime &&
+				     entries[i].vma < entries[owner[x]].vma)) {
+					owner[x] = i;
+					best_lifetime = lifetime;
+				}
+			}
+		}
+
+		create_arrays();
+		resolve_overlaps(0);
+		check_arrays("random");
+
+		for (j = 0; j < (int)entry_count; j++) {
+			e = entries_address_ascending[j];
+			if (!e->code_size)
+				fail("random", "empty part");
+			for (x = e->vma; x < e->vma + e->code_size; x++) {
+				if (owner[x] == -1)
+					fail("random", "part outside entries");
+				name = entries[owner[x]].name;
+				if (strncmp(e->symbol_name, name, strlen(name)) ||
+				    isalnum((unsigned char)e->symbol_name[strlen(name)]))
+					fail("random", "address given to wrong entry");
+				owner[x] = -2;
+			}
+		}
+		for (x = 0; x < RANDOM_SPACE; x++) {
+			if (owner[x] >= 0)
+				fail("random", "address lost");
+		}
+		free_entries();
+	}
+}
+
+
+/* append a code load record without code to the dump at buf */
+static size_t write_code_load(char * buf, char const * name,
+			      unsigned long long vma, int code_size,
+			      unsigned long long timestamp)
+{
+	struct jr_code_load rec;
+	size_t name_size = strlen(name) + 1;
+	size_t size = sizeof(rec) + name_size;
+
+	size += PADDING_8ALIGNED(size);
+	memset(&rec, 0, sizeof(rec));
+	rec.id = JIT_CODE_LOAD;
+	rec.total_size = size;
+	rec.timestamp = timestamp;
+	rec.vma = vma;
+	rec.code_addr = 0;
+	rec.code_size = code_size;
+	memcpy(buf, &rec, sizeof(rec));
+	memset(buf + sizeof(rec), 0, size - sizeof(rec));
+	memcpy(buf + sizeof(rec), name, name_size);
+	return size;
+}
+
+
+/*
+ * A JVM recompiling methods for a long time: code is allocated
+ * sequentially in its code cache, wrapping around to overwrite older code
+ * at a slightly different offset each time. If covered is not NULL, the
+ * bytes of the code cache holding code are marked in it.
+ */
+static void convert_dump(char const * title, int nr_records,
+			 unsigned long cache_size, char * covered)
+{
+	char const * target = "elf64-x86-64";
+	size_t header_size = sizeof(struct jitheader) + strlen(target) + 1;
+	size_t max_size, size;
+	struct jitheader header;
+	char name[32];
+	char * dump;
+	clock_t start;
+	double seconds;
+	unsigned long cursor = 0;
+	u32 nr_entries;
+	int i, code_size;
+
+	header_size += PADDING_8ALIGNED(header_size);
+	max_size = header_size +
+		nr_records * (sizeof(struct jr_code_load) + 32);
+	dump = xmalloc(max_size);
+
+	memset(&header, 0, sizeof(header));
+	header.magic = JITHEADER_MAGIC;
+	header.version = JITHEADER_VERSION;
+	header.totalsize = header_size;
+	memset(dump, 0, header_size);
+	memcpy(dump, &header, sizeof(header));
+	strcpy(dump + sizeof(header), target);
+	size = header_size;
+
+	srand(1);
+	for (i = 0; i < nr_records; i++) {
+		sprintf(name, "method%d", rand() % (nr_records / 4));
+		code_size = 64 + rand() % 4096;
+		if (cursor + code_size > cache_size)
+			cursor = rand() % 4096;
+		size += write_code_load(dump + size, name,
+					CODE_CACHE_BASE + cursor, code_size, i);
+		if (covered)
+			memset(covered + cursor, 1, code_size);
+		cursor += code_size;
+	}
+
+	start = clock();
+	if (parse_all(dump, dump + size, nr_records) != OP_JIT_CONV_OK)
+		fail(title, "parse_all() failed");
+	create_arrays();
+	nr_entries = entry_count;
+	if (resolve_overlaps(0) != OP_JIT_CONV_OK)
+		fail(title, "resolve_overlaps() failed");
+	disambiguate_symbol_names();
+	seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+	check_arrays(title);
+
+	if (!covered) {
+		printf("jitsymbol_tests: %u code records resolved to %u "
+		       "symbols in %.2f s\n", nr_entries, entry_count, seconds);
+	}
+
+	free(dump);
+}
+
+
+/* every byte holding code must be owned by exactly one resolved entry */
+static void check_dump(void)
+{
+	char * covered = xcalloc(DUMP_CODE_CACHE_SIZE + 4096, 1);
+	struct jitentry const * e;
+	unsigned long long x;
+	u32 i;
+
+	convert_dump("dump", NR_DUMP_RECORDS, DUMP_CODE_CACHE_SIZE, covered);
+
+	for (i = 0; i < entry_count; i++) {
+		e = entries_address_ascending[i];
+		for (x = e->vma; x < e->vma + e->code_size; x++) {
+			if (x < CODE_CACHE_BASE ||
+			    x >= CODE_CACHE_BASE + DUMP_CODE_CACHE_SIZE + 4096 ||
+			    covered[x - CODE_CACHE_BASE] != 1)
+				fail("dump", "address owned by no or two records");
+			covered[x - CODE_CACHE_BASE] = 2;
+		}
+	}
+	for (x = 0; x < DUMP_CODE_CACHE_SIZE + 4096; x++) {
+		if (covered[x] == 1)
+			fail("dump", "address lost");
+	}
+
+	free_entries();
+	free(covered);
+}
+
+
+int main(void)
+{
+	check_overlap_tests();
+	check_random_tests();
+	check_dump();
+	if (getenv("OPJITCONV_BENCHMARK")) {
+		convert_dump("benchmark", NR_BENCH_RECORDS,
+			     BENCH_CODE_CACHE_SIZE, NULL);
+		free_entries();
+	}
+	return EXIT_SUCCESS;
+}
@@ -39,6 +39,7 @@
 #include "string_manip.h"
 #include "cverb.h"
 #include "operf_counter.h"
+#include "operf_jit.h"
 #include "op_cpu_type.h"
 #include "op_cpufreq.h"
 #include "op_events.h"
@@ -98,12 +99,12 @@ bool system_wide;
 bool append;
 int pid;
 bool callgraph;
-int mmap_pages_mult;
 string session_dir;
 string vmlinux;
 bool separate_cpu;
 bool separate_thread;
 bool post_conversion;
+bool jit_symbols;
 vector<string> evts;
 }
 
@@ -123,13 +124,14 @@ struct option long_options [] =
  {"separate-cpu", no_argument, NULL, 'c'},
  {"separate-thread", no_argument, NULL, 't'},
  {"lazy-conversion", no_argument, NULL, 'l'},
+ {"jit-symbols", no_argument, NULL, 'j'},
  {"help", no_argument, NULL, 'h'},
  {"version", no_argument, NULL, 'v'},
  {"usage", no_argument, NULL, 'u'},
  {NULL, 9, NULL, 0}
 };
 
-const char * short_options = "V:d:k:gsap:e:ctlhuv";
+const char * short_options = "V:d:k:gsap:e:ctljhuv";
 
 vector<string> verbose_string;
 
@@ -328,7 +330,8 @@ int start_profiling(void)
 			operf_record operfRecord(outfd, operf_options::system_wide, app_PID,
 			                         (operf_options::pid == app_PID), events, vi,
 			                         operf_options::callgraph,
-			                         operf_options::separate_cpu, operf_options::post_conversion);
+			                         operf_options::separate_cpu, operf_options::post_conversion,
+			                         operf_options::jit_symbols);
 			if (operfRecord.get_valid() == false) {
 				/* If valid is false, it means that one of the "known" errors has
 				 * occurred:
@@ -563,6 +566,10 @@ static end_code_t _run(void)
 		_exit(EXIT_FAILURE);
 	}
 
+	OP_perf_utils::op_size_ring_buffers(events, operf_options::callgraph,
+	                                    operf_options::separate_cpu,
+	                                    operf_options::jit_symbols);
+
 	if (start_profiling() < 0) {
 		return PERF_RECORD_ERROR;
 	}
@@ -889,6 +896,8 @@ static void convert_sample_data(void)
 		inputfname = "";
 	}
 	operfRead.init(inputfd, inputfname, current_sampledir, cpu_type, events, operf_options::system_wide);
+	if (operf_options::jit_symbols)
+		operf_jit_init(OP_SESSION_DIR_DEFAULT "jitdump/");
 	if ((rc = operfRead.readPerfHeader()) < 0) {
 		if (rc != OP_PERF_HANDLED_ERROR)
 			cerr << "Error: Cannot create read header info for sample data " << endl;
@@ -907,6 +916,9 @@ static void convert_sample_data(void)
 			goto out;
 		}
 	}
+	// JIT symbols were written while converting the samples
+	if (operf_options::jit_symbols)
+		goto out;
 	_set_signals_for_convert();
 	cverb << vdebug << "Calling _do_jitdump_convert" << endl;
 	_do_jitdump_convert();
@@ -1633,6 +1645,9 @@ static int _process_operf_and_app_args(int argc, char * const argv[])
 		case 'l':
 			operf_options::post_conversion = true;
 			break;
+		case 'j':
+			operf_options::jit_symbols = true;
+			break;
 		case 'h':
 			__print_usage_and_exit(NULL);
 			break;
@@ -17,15 +17,18 @@
 #include <numeric>
 
 #include "op_exception.h"
+#include "utility.h"
 #include "stream_util.h"
 #include "string_manip.h"
 #include "file_manip.h"
 #include "opreport_options.h"
+#include "opreport_server.h"
 #include "op_header.h"
 #include "profile.h"
 #include "populate.h"
 #include "arrange_profiles.h"
 #include "profile_container.h"
+#include "profile_snapshot.h"
 #include "callgraph_container.h"
 #include "diff_container.h"
 #include "symbol_sort.h"
@@ -201,7 +204,7 @@ summary_container(vector<profile_class> const & pclasses)
 
 void output_header()
 {
-	if (!options::show_header)
+	if (!options::show_header || options::binary)
 		return;
 
 	cout << classes.cpuinfo << endl;
@@ -366,13 +369,74 @@ format_flags get_format_flags(column_flags const & cf)
 }
 
 
+/// demangle at once the names of symbols and of their callers and callees
+void demangle_names(symbol_collection const & symbols)
+{
+	vector<symbol_name_id> ids;
+
+	symbol_collection::const_iterator it;
+	for (it = symbols.begin(); it != symbols.end(); ++it) {
+		ids.push_back((*it)->name);
+
+		cg_symbol const * cg_symb = dynamic_cast<cg_symbol const *>(*it);
+		if (!cg_symb)
+			continue;
+
+		cg_symbol::children::const_iterator cit;
+		for (cit = cg_symb->callers.begin();
+		     cit != cg_symb->callers.end(); ++cit)
+			ids.push_back(cit->name);
+		for (cit = cg_symb->callees.begin();
+		     cit != cg_symb->callees.end(); ++cit)
+			ids.push_back(cit->name);
+	}
+
+	symbol_names.demangle(ids);
+}
+
+
+/**
+ * sort symbols, keeping only the first --limit ones if requested, and
+ * demangle the names which will be output
+ */
+void sort_symbols(symbol_collection & symbols)
+{
+	vector<sort_options::sort_order> const & order =
+		options::sort_by.options;
+	// sorting by symbol compares all the demangled names, else only the
+	// symbols left by --limit need to be demangled
+	bool const by_name = find(order.begin(), order.end(),
+	                          sort_options::symbol) != order.end();
+
+	if (by_name)
+		demangle_names(symbols);
+
+	if (options::limit) {
+		options::sort_by.sort(symbols, options::reverse_sort,
+		                      options::long_filenames, options::limit);
+	} else {
+		options::sort_by.sort(symbols, options::reverse_sort,
+		                      options::long_filenames);
+	}
+
+	if (!by_name)
+		demangle_names(symbols);
+}
+
+
 void output_symbols(profile_container const & pc, bool multiple_apps)
 {
 	profile_container::symbol_choice choice;
 	choice.threshold = options::threshold;
 	symbol_collection symbols = pc.select_symbols(choice);
-	options::sort_by.sort(symbols, options::reverse_sort,
-	                      options::long_filenames);
+	sort_symbols(symbols);
+	if (options::binary) {
+		format_output::binary_formatter out(pc);
+		out.set_nr_classes(nr_classes);
+		out.output(cout, symbols);
+		return;
+	}
+
 	format_output::formatter * out;
 	format_output::xml_formatter * xml_out = 0;
 	format_output::opreport_formatter * text_out = 0;
@@ -408,6 +472,7 @@ void output_symbols(profile_container const & pc, bool multiple_apps)
 		xml_out->output(cout);
 	} else {
 		text_out->output(cout, symbols);
+		delete text_out;
 	}
 }
 
@@ -440,6 +505,8 @@ void output_diff_symbols(profile_container const & pc1,
 
 	options::sort_by.sort(symbols, options::reverse_sort,
 	                      options::long_filenames);
+	if (options::limit && size_t(options::limit) < symbols.size())
+		symbols.erase(symbols.begin() + options::limit, symbols.end());
 
 	out.output(cout, symbols);
 }
@@ -451,8 +518,14 @@ void output_cg_symbols(callgraph_container const & cg, bool multiple_apps)
 
 	symbol_collection symbols = cg.get_symbols();
 
-	options::sort_by.sort(symbols, options::reverse_sort,
-	                      options::long_filenames);
+	sort_symbols(symbols);
+
+	if (options::binary) {
+		format_output::binary_formatter out(cg);
+		out.set_nr_classes(nr_classes);
+		out.output(cout, symbols);
+		return;
+	}
 
 	format_output::formatter * out;
 	format_output::xml_cg_formatter * xml_out = 0;
@@ -488,8 +561,322 @@ void output_cg_symbols(callgraph_container const & cg, bool multiple_apps)
 		xml_out->output(cout);
 	} else {
 		text_out->output(cout, symbols);
+		delete text_out;
+	}
+
+}
+
+
+bool has_multiple_apps(profile_classes const & pclasses)
+{
+	for (size_t i = 0; i < pclasses.v.size(); ++i) {
+		if (pclasses.v[i].profiles.size() > 1)
+			return true;
+	}
+
+	return false;
+}
+
+
+void populate_profiles(profile_container & samples,
+                       list<inverted_profile> const & iprofiles)
+{
+	list<inverted_profile>::const_iterator it = iprofiles.begin();
+	list<inverted_profile>::const_iterator const end = iprofiles.end();
+
+	for (; it != end; ++it)
+		populate_for_image(samples, *it, options::symbol_filter, 0);
+}
+
+
+/// save the options a --serve query can change, restore them on exit
+class query_options {
+public:
+	query_options()
+		:
+		threshold(options::threshold),
+		sort_by(options::sort_by),
+		reverse_sort(options::reverse_sort),
+		limit(options::limit),
+		show_address(options::show_address),
+		long_filenames(options::long_filenames),
+		show_header(options::show_header),
+		global_percent(options::global_percent),
+		accumulated(options::accumulated)
+	{
+	}
+
+	~query_options() {
+		options::threshold = threshold;
+		options::sort_by = sort_by;
+		options::reverse_sort = reverse_sort;
+		options::limit = limit;
+		options::show_address = show_address;
+		options::long_filenames = long_filenames;
+		options::show_header = show_header;
+		options::global_percent = global_percent;
+		options::accumulated = accumulated;
+	}
+
+	/// apply one --option[=value] argument of a query
+	void apply(string const & arg) const;
+
+private:
+	double threshold;
+	sort_options sort_by;
+	bool reverse_sort;
+	int limit;
+	bool show_address;
+	bool long_filenames;
+	bool show_header;
+	bool global_percent;
+	bool accumulated;
+};
+
+
+void query_options::apply(string const & arg) const
+{
+	string name = arg;
+	string value;
+	string::size_type pos = arg.find('=');
+	if (pos != string::npos) {
+		name = arg.substr(0, pos);
+		value = arg.substr(pos + 1);
+	}
+
+	if (name == "--threshold") {
+		istringstream ss(value);
+		double val;
+		if (!(ss >> val) || val < 0.0 || val > 100.0) {
+			throw op_runtime_error("illegal threshold value: "
+				+ value + " allowed range: [0-100]");
+		}
+		// applied by callgraph_container::populate()
+		if (options::callgraph && val != threshold) {
+			throw op_runtime_error("--threshold can't be changed "
+				"by a query on a callgraph session");
+		}
+		options::threshold = val;
+	} else if (name == "--sort") {
+		vector<string> sort = separate_token(value, ',');
+		options::sort_by = sort_options();
+		for (size_t i = 0; i < sort.size(); ++i)
+			options::sort_by.add_sort_option(sort[i]);
+	} else if (name == "--limit") {
+		istringstream ss(value);
+		if (!(ss >> options::limit) || options::limit < 0)
+			throw op_runtime_error("illegal limit value: " + value);
+	} else if (name == "--reverse-sort") {
+		options::reverse_sort = true;
+	} else if (name == "--show-address") {
+		options::show_address = true;
+	} else if (name == "--long-filenames") {
+		options::long_filenames = true;
+	} else if (name == "--no-header") {
+		options::show_header = false;
+	} else if (name == "--global-percent") {
+		options::global_percent = true;
+	} else if (name == "--accumulated") {
+		options::accumulated = true;
+	} else {
+		throw op_runtime_error("unsupported query option: " + arg);
+	}
+}
+
+
+/// load the --demangle-cache file and save it back when done
+class demangle_cache_file {
+public:
+	demangle_cache_file() {
+		if (!options::demangle_cache.empty())
+			symbol_names.load_demangle_cache(options::demangle_cache);
+	}
+
+	~demangle_cache_file() {
+		if (options::demangle_cache.empty())
+			return;
+		try {
+			symbol_names.save_demangle_cache(options::demangle_cache);
+		} catch (op_runtime_error const & e) {
+			cerr << "warning: " << e.what() << endl;
+		}
+	}
+};
+
+
+/// send cout to another stream for the lifetime of this object
+class cout_redirect {
+public:
+	cout_redirect(ostream & out) : old(cout.rdbuf(out.rdbuf())) {}
+	~cout_redirect() { cout.rdbuf(old); }
+
+private:
+	streambuf * old;
+};
+
+
+/**
+ * The session loaded once by --serve. The containers are only populated
+ * again when a query finds the set of sample files, or their mtime, has
+ * changed since the last population.
+ */
+class report_session : public query_handler {
+public:
+	report_session(options::spec const & spec);
+
+	bool answer(string const & query, ostream & out);
+
+private:
+	/// (re)build the containers from classes and classes2
+	void populate();
+
+	/// output a report, args are the query options
+	void report(vector<string> const & args, ostream & out) const;
+
+	options::spec const & spec;
+	bool multiple_apps;
+	scoped_ptr<profile_container> samples;
+	scoped_ptr<profile_container> samples2;
+	scoped_ptr<callgraph_container> cg_container;
+};
+
+
+report_session::report_session(options::spec const & s)
+	:
+	spec(s),
+	multiple_apps(false)
+{
+	populate();
+}
+
+
+void report_session::populate()
+{
+	nr_classes = classes.v.size();
+	multiple_apps = has_multiple_apps(classes) ||
+		has_multiple_apps(classes2);
+
+	// release the old containers first, peak memory matters here
+	samples.reset();
+	samples2.reset();
+	cg_container.reset();
+
+	list<inverted_profile> iprofiles = invert_profiles(classes);
+
+	report_image_errors(iprofiles, classes.extra_found_images);
+
+	if (options::callgraph) {
+		cg_container.reset(new callgraph_container);
+		cg_container->populate(iprofiles, classes.extra_found_images,
+			options::debug_info, options::threshold,
+			options::merge_by.lib, options::symbol_filter);
+		return;
+	}
+
+	samples.reset(new profile_container(options::debug_info,
+		options::details, classes.extra_found_images));
+	populate_profiles(*samples, iprofiles);
+
+	if (classes2.v.size()) {
+		list<inverted_profile> iprofiles2 = invert_profiles(classes2);
+
+		report_image_errors(iprofiles2, classes2.extra_found_images);
+
+		samples2.reset(new profile_container(options::debug_info,
+			options::details, classes2.extra_found_images));
+		populate_profiles(*samples2, iprofiles2);
+	}
+}
+
+
+bool report_session::answer(string const & query, ostream & out)
+{
+	vector<string> args;
+	vector<string> const tokens = separate_token(query, ' ');
+	for (size_t i = 0; i < tokens.size(); ++i) {
+		if (!tokens[i].empty())
+			args.push_back(tokens[i]);
+	}
+
+	if (args.empty())
+		return true;
+
+	string const command = args[0];
+	args.erase(args.begin());
+
+	try {
+		if (command == "quit") {
+			out << "ok" << endl;
+			return false;
+		} else if (command == "reload") {
+			if (reload_classes(spec))
+				populate();
+			out << "ok" << endl;
+		} else if (command == "report") {
+			report(args, out);
+		} else {
+			out << "error: unknown query: " << command << endl;
+		}
+	}
+	catch (op_runtime_error const & e) {
+		out << "error: " << e.what() << endl;
 	}
+	catch (op_exception const & e) {
+		out << "error: " << e.what() << endl;
+	}
+
+	return true;
+}
+
+
+void report_session::report(vector<string> const & args, ostream & out) const
+{
+	query_options saved;
+	for (size_t i = 0; i < args.size(); ++i)
+		saved.apply(args[i]);
+
+	cout_redirect redirect(out);
+
+	output_header();
+
+	if (samples2.get())
+		output_diff_symbols(*samples, *samples2, multiple_apps);
+	else if (cg_container.get())
+		output_cg_symbols(*cg_container, multiple_apps);
+	else
+		output_symbols(*samples, multiple_apps);
+}
+
+
+/// output a report from the profile saved in options::from_snapshot
+int report_snapshot()
+{
+	bool multiple_apps;
+	scoped_ptr<profile_container> samples(
+		load_snapshot(options::from_snapshot, classes, multiple_apps));
+
+	if (options::details && !samples->record_details()) {
+		throw op_runtime_error("--details needs a snapshot saved "
+		                       "with --details");
+	}
+
+	if (options::debug_info && !samples->record_debug_info()) {
+		throw op_runtime_error("--debug-info needs a snapshot saved "
+		                       "with --debug-info");
+	}
+
+	nr_classes = classes.v.size();
+
+	if (options::xml) {
+		xml_utils::output_xml_header(options::command_options,
+		                             classes.cpuinfo, classes.event);
+	} else {
+		output_header();
+	}
+
+	output_symbols(*samples, multiple_apps);
 
+	return 0;
 }
 
 
@@ -499,8 +886,19 @@ int opreport(options::spec const & spec)
 
 	handle_options(spec);
 
+	demangle_cache_file demangle_cache;
+
+	if (!options::from_snapshot.empty())
+		return report_snapshot();
+
 	nr_classes = classes.v.size();
 
+	if (!options::serve.empty()) {
+		report_session session(spec);
+		serve_queries(options::serve, session);
+		return 0;
+	}
+
 	if (!options::symbols && !options::xml) {
 		summary_container summaries(classes.v);
 		output_header();
@@ -508,12 +906,7 @@ int opreport(options::spec const & spec)
 		return 0;
 	}
 
-	bool multiple_apps = false;
-
-	for (size_t i = 0; i < classes.v.size(); ++i) {
-		if (classes.v[i].profiles.size() > 1)
-			multiple_apps = true;
-	}
+	bool multiple_apps = has_multiple_apps(classes);
 
 	list<inverted_profile> iprofiles = invert_profiles(classes);
 
@@ -527,20 +920,12 @@ int opreport(options::spec const & spec)
 	}
 
 	if (classes2.v.size()) {
-		for (size_t i = 0; i < classes2.v.size(); ++i) {
-			if (classes2.v[i].profiles.size() > 1)
-				multiple_apps |= true;
-		}
+		multiple_apps |= has_multiple_apps(classes2);
 
 		profile_container pc1(options::debug_info, options::details,
 				      classes.extra_found_images);
 
-		list<inverted_profile>::iterator it = iprofiles.begin();
-		list<inverted_profile>::iterator const end = iprofiles.end();
-
-		for (; it != end; ++it)
-			populate_for_image(pc1, *it,
-					   options::symbol_filter, 0);
+		populate_profiles(pc1, iprofiles);
 
 		list<inverted_profile> iprofiles2 = invert_profiles(classes2);
 
@@ -549,12 +934,7 @@ int opreport(options::spec const & spec)
 		profile_container pc2(options::debug_info, options::details,
 				      classes2.extra_found_images);
 
-		list<inverted_profile>::iterator it2 = iprofiles2.begin();
-		list<inverted_profile>::iterator const end2 = iprofiles2.end();
-
-		for (; it2 != end2; ++it2)
-			populate_for_image(pc2, *it2,
-					   options::symbol_filter, 0);
+		populate_profiles(pc2, iprofiles2);
 
 		output_diff_symbols(pc1, pc2, multiple_apps);
 	} else if (options::callgraph) {
@@ -568,12 +948,12 @@ int opreport(options::spec const & spec)
 		profile_container samples(options::debug_info,
 			options::details, classes.extra_found_images);
 
-		list<inverted_profile>::iterator it = iprofiles.begin();
-		list<inverted_profile>::iterator const end = iprofiles.end();
+		populate_profiles(samples, iprofiles);
 
-		for (; it != end; ++it)
-			populate_for_image(samples, *it,
-					   options::symbol_filter, 0);
+		if (!options::to_snapshot.empty()) {
+			save_snapshot(options::to_snapshot, samples,
+			              classes, multiple_apps);
+		}
 
 		output_symbols(samples, multiple_apps);
 	}
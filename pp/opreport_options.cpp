@@ -15,6 +15,7 @@
 #include <algorithm>
 #include <iterator>
 #include <fstream>
+#include <utility>
 
 #include "op_config.h"
 #include "profile_spec.h"
@@ -23,9 +24,11 @@
 #include "popt_options.h"
 #include "string_filter.h"
 #include "file_manip.h"
+#include "op_file.h"
 #include "xml_output.h"
 #include "xml_utils.h"
 #include "cverb.h"
+#include "op_exception.h"
 
 using namespace std;
 
@@ -50,6 +53,12 @@ namespace options {
 	bool global_percent;
 	bool xml;
 	string xml_options;
+	bool binary;
+	int limit;
+	string serve;
+	string from_snapshot;
+	string to_snapshot;
+	string demangle_cache;
 }
 
 
@@ -62,6 +71,10 @@ vector<string> exclude_symbols;
 vector<string> include_symbols;
 string demangle_option = "normal";
 
+/// sample filenames and their mtime, as seen by the last process_spec()
+typedef vector<pair<string, time_t> > sample_stamps_t;
+sample_stamps_t sample_stamps;
+
 popt::option options_array[] = {
 	popt::option(options::callgraph, "callgraph", 'c',
 	             "show call graph"),
@@ -88,10 +101,15 @@ popt::option options_array[] = {
 	popt::option(options::threshold_opt, "threshold", 't',
 		     "minimum percentage needed to produce output",
 		     "percent"),
+	popt::option(options::limit, "limit", '\0',
+		     "output only the given number of symbols", "count"),
 
 	popt::option(demangle_option, "demangle", 'D',
 		     "demangle GNU C++ symbol names (default normal)",
 	             "none|normal|smart"),
+	popt::option(options::demangle_cache, "demangle-cache", '\0',
+		     "reuse and update the demangled names saved in the "
+		     "given file", "file"),
 	// PP:5
 	popt::option(options::debug_info, "debug-info", 'g',
 		     "add source file and line number to output"),
@@ -109,6 +127,17 @@ popt::option options_array[] = {
 
 	popt::option(options::xml, "xml", 'X',
 		     "XML output"),
+	popt::option(options::binary, "binary", '\0',
+		     "compact binary output for other programs"),
+	popt::option(options::to_snapshot, "save-snapshot", '\0',
+		     "save the populated profile to the given file", "file"),
+	popt::option(options::from_snapshot, "from-snapshot", '\0',
+		     "report from a profile saved with --save-snapshot",
+		     "file"),
+	popt::option(options::serve, "serve", '\0',
+		     "load the session once then answer queries on the given "
+		     "Unix socket, only accessible by the current user",
+		     "socket"),
 
 };
 
@@ -189,6 +218,91 @@ void check_options(bool diff)
 			cerr << "--global_percent is incompatible with --xml" << endl;
 			do_exit = true;
 		}
+
+		if (limit) {
+			cerr << "--limit is incompatible with --xml" << endl;
+			do_exit = true;
+		}
+
+		if (!serve.empty()) {
+			cerr << "--serve is incompatible with --xml" << endl;
+			do_exit = true;
+		}
+	}
+
+	if (binary) {
+		symbols = true;
+		if (xml) {
+			cerr << "--binary is incompatible with --xml" << endl;
+			do_exit = true;
+		}
+
+		if (details) {
+			cerr << "--binary is incompatible with --details" << endl;
+			do_exit = true;
+		}
+
+		if (diff) {
+			cerr << "differential profiles are incompatible with --binary" << endl;
+			do_exit = true;
+		}
+
+		if (!serve.empty()) {
+			cerr << "--serve is incompatible with --binary" << endl;
+			do_exit = true;
+		}
+	}
+
+	if (limit < 0) {
+		cerr << "illegal limit value: " << limit << endl;
+		do_exit = true;
+	}
+
+	if (!from_snapshot.empty() || !to_snapshot.empty()) {
+		if (callgraph) {
+			cerr << "snapshots are incompatible with --callgraph" << endl;
+			do_exit = true;
+		}
+
+		if (diff) {
+			cerr << "differential profiles are incompatible with snapshots" << endl;
+			do_exit = true;
+		}
+
+		if (!symbols && !xml) {
+			cerr << "snapshots are meaningless without --symbols" << endl;
+			do_exit = true;
+		}
+	}
+
+	if (!from_snapshot.empty()) {
+		if (!to_snapshot.empty()) {
+			cerr << "--from-snapshot is incompatible with --save-snapshot" << endl;
+			do_exit = true;
+		}
+
+		if (!serve.empty()) {
+			cerr << "--from-snapshot is incompatible with --serve" << endl;
+			do_exit = true;
+		}
+
+		// the snapshot holds the symbols and classes as populated
+		if (!exclude_symbols.empty() || !include_symbols.empty()) {
+			cerr << "--exclude-symbols and --include-symbols are "
+			     << "incompatible with --from-snapshot" << endl;
+			do_exit = true;
+		}
+
+		if (!mergespec.empty() || exclude_dependent) {
+			cerr << "--merge and --exclude-dependent are "
+			     << "incompatible with --from-snapshot" << endl;
+			do_exit = true;
+		}
+	}
+
+	if (!to_snapshot.empty() && !serve.empty()) {
+		cerr << "--save-snapshot is incompatible with --serve" << endl;
+		do_exit = true;
 	}
 
 
@@ -210,6 +324,18 @@ void check_options(bool diff)
 			do_exit = true;
 		}
 
+		if (limit) {
+			cerr << "--limit is meaningless "
+				"without --symbols" << endl;
+			do_exit = true;
+		}
+
+		if (!serve.empty()) {
+			cerr << "--serve is meaningless "
+				"without --symbols" << endl;
+			do_exit = true;
+		}
+
 		if (debug_info || accumulated) {
 			cerr << "--debug-info and --accumulated are "
 			     << "meaningless without --symbols" << endl;
@@ -241,8 +367,43 @@ void check_options(bool diff)
 }
 
 
+/**
+ * Report an unusable profile specification: --serve must keep answering
+ * queries, it gets an exception turned into an error reply, otherwise
+ * we exit.
+ */
+void spec_error(string const & msg)
+{
+	if (!options::serve.empty())
+		throw op_runtime_error(msg);
+
+	cerr << "error: " << msg << endl;
+	exit(EXIT_FAILURE);
+}
+
+
+/// append the sample files matched by spec and their mtime to stamps
+void scan_spec(list<string> const & spec, sample_stamps_t & stamps)
+{
+	profile_spec const pspec =
+		profile_spec::create(spec, options::image_path,
+				     options::root_path);
+
+	list<string> const sample_files =
+		pspec.generate_file_list(options::exclude_dependent,
+		                         !options::callgraph);
+
+	list<string>::const_iterator it = sample_files.begin();
+	for (; it != sample_files.end(); ++it) {
+		time_t mtime = op_get_mtime(it->c_str());
+		stamps.push_back(make_pair(*it, mtime));
+	}
+}
+
+
 /// process a spec into classes
-void process_spec(profile_classes & classes, list<string> const & spec)
+void process_spec(profile_classes & classes, list<string> const & spec,
+                  bool quiet)
 {
 	using namespace options;
 
@@ -254,7 +415,7 @@ void process_spec(profile_classes & classes, list<string> const & spec)
 		profile_spec::create(spec, options::image_path,
 				     options::root_path);
 
-	if (!was_session_dir_supplied())
+	if (!was_session_dir_supplied() && !quiet)
 		cerr << "Using " << op_samples_dir << " for samples directory." << endl;
 
 	list<string> sample_files = pspec.generate_file_list(exclude_dependent,
@@ -267,15 +428,52 @@ void process_spec(profile_classes & classes, list<string> const & spec)
 	copy(sample_files.begin(), sample_files.end(),
 	     ostream_iterator<string>(cverb << vsfile, "\n"));
 
+	if (!options::serve.empty()) {
+		list<string>::const_iterator it = sample_files.begin();
+		for (; it != sample_files.end(); ++it) {
+			time_t mtime = op_get_mtime(it->c_str());
+			sample_stamps.push_back(make_pair(*it, mtime));
+		}
+	}
+
 	classes = arrange_profiles(sample_files, merge_by,
 				   pspec.extra_found_images);
 
 	cverb << vsfile << "profile_classes:\n" << classes << endl;
 
-	if (classes.v.empty()) {
-		cerr << "error: no sample files found: profile specification "
-		     "too strict ?" << endl;
-		exit(EXIT_FAILURE);
+	if (classes.v.empty())
+		spec_error("no sample files found: profile specification "
+		           "too strict ?");
+}
+
+
+/**
+ * Process the profile specification(s) into classes and classes2, which
+ * are left untouched if an error is thrown.
+ */
+void process_specs(options::spec const & spec, bool quiet)
+{
+	profile_classes new_classes;
+
+	if (!spec.first.size()) {
+		process_spec(new_classes, spec.common, quiet);
+		classes = new_classes;
+	} else {
+		if (options::xml) {
+			cerr << "differential profiles are incompatible with --xml" << endl;
+			exit(EXIT_FAILURE);
+		}
+		profile_classes new_classes2;
+		cverb << vsfile << "profile spec 1:" << endl;
+		process_spec(new_classes, spec.first, quiet);
+		cverb << vsfile << "profile spec 2:" << endl;
+		process_spec(new_classes2, spec.second, quiet);
+
+		if (!new_classes.matches(new_classes2))
+			spec_error("profile classes are incompatible");
+
+		classes = new_classes;
+		classes2 = new_classes2;
 	}
 }
 
@@ -319,21 +517,41 @@ void handle_options(options::spec const & spec)
 
 	symbol_filter = string_filter(include_symbols, exclude_symbols);
 
-	if (!spec.first.size()) {
-		process_spec(classes, spec.common);
-	} else {
-		if (options::xml) {
-			cerr << "differential profiles are incompatible with --xml" << endl;
+	if (!from_snapshot.empty()) {
+		// the classes are read back from the snapshot
+		if (!spec.common.empty()) {
+			cerr << "profile specification is meaningless with "
+			     "--from-snapshot" << endl;
 			exit(EXIT_FAILURE);
 		}
-		cverb << vsfile << "profile spec 1:" << endl;
-		process_spec(classes, spec.first);
-		cverb << vsfile << "profile spec 2:" << endl;
-		process_spec(classes2, spec.second);
+		return;
+	}
 
-		if (!classes.matches(classes2)) {
-			cerr << "profile classes are incompatible" << endl;
-			exit(EXIT_FAILURE);
-		}
+	process_specs(spec, false);
+}
+
+
+bool reload_classes(options::spec const & spec)
+{
+	sample_stamps_t stamps;
+	if (!spec.first.size()) {
+		scan_spec(spec.common, stamps);
+	} else {
+		scan_spec(spec.first, stamps);
+		scan_spec(spec.second, stamps);
 	}
+	if (stamps == sample_stamps)
+		return false;
+
+	sample_stamps_t old_stamps;
+	old_stamps.swap(sample_stamps);
+
+	try {
+		process_specs(spec, true);
+	} catch (...) {
+		sample_stamps.swap(old_stamps);
+		throw;
+	}
+
+	return true;
 }
@@ -41,6 +41,12 @@ namespace options {
 	extern bool accumulated;
 	extern bool xml;
 	extern std::string xml_options;
+	extern bool binary;
+	extern int limit;
+	extern std::string serve;
+	extern std::string from_snapshot;
+	extern std::string to_snapshot;
+	extern std::string demangle_cache;
 }
 
 /// All the chosen sample files.
@@ -55,4 +61,16 @@ extern profile_classes classes2;
  */
 void handle_options(options::spec const & spec);
 
+/**
+ * reload_classes - re-scan the sample files of a --serve session
+ * @param spec  profile specification
+ *
+ * Re-generate the sample file list and rebuild classes and classes2
+ * from it. Return false, leaving the classes untouched, if neither the
+ * set of sample files nor their modification time changed since the
+ * previous scan. This walks the whole session, it is only done on an
+ * explicit reload query.
+ */
+bool reload_classes(options::spec const & spec);
+
 #endif // OPREPORT_OPTIONS_H
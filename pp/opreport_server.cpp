@@ -0,0 +1,162 @@
+/**
+ * @file opreport_server.cpp
+ * Unix socket server used by opreport --serve
+ *
+ * @remark Copyright 2013 OProfile authors
+ * @remark Read the file COPYING
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+
+#include <cstring>
+#include <iostream>
+#include <sstream>
+
+#include "op_exception.h"
+#include "cverb.h"
+#include "opreport_server.h"
+
+using namespace std;
+
+namespace {
+
+/// longest query we accept, longer ones are truncated
+size_t const max_query_size = 4096;
+
+
+int create_socket(string const & path)
+{
+	struct sockaddr_un addr;
+
+	if (path.size() >= sizeof(addr.sun_path))
+		throw op_runtime_error("socket path too long: " + path);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path.c_str());
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		throw op_runtime_error("socket() failed", errno);
+
+	// a stale socket left by a killed server would make bind() fail,
+	// but never remove anything else
+	struct stat st;
+	if (lstat(path.c_str(), &st) == 0) {
+		if (!S_ISSOCK(st.st_mode)) {
+			close(fd);
+			throw op_runtime_error(path + " exists and is not "
+			                       "a socket");
+		}
+		unlink(path.c_str());
+	}
+
+	// only the owner may connect
+	mode_t const old_umask = umask(077);
+	int err = 0;
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+		err = errno;
+	umask(old_umask);
+
+	if (err || listen(fd, 8) < 0) {
+		if (!err)
+			err = errno;
+		close(fd);
+		throw op_runtime_error("can't listen on " + path, err);
+	}
+
+	return fd;
+}
+
+
+/// read one query line, return false if the client sent nothing usable
+bool read_query(int fd, string & query)
+{
+	char buf[512];
+
+	query.erase();
+	while (query.size() < max_query_size) {
+		ssize_t count = read(fd, buf, sizeof(buf));
+		if (count < 0 && errno == EINTR)
+			continue;
+		if (count <= 0)
+			break;
+		query.append(buf, count);
+		if (query.find('\n') != string::npos)
+			break;
+	}
+
+	string::size_type pos = query.find_first_of("\r\n");
+	if (pos != string::npos)
+		query.erase(pos);
+
+	return !query.empty();
+}
+
+
+void write_reply(int fd, string const & reply)
+{
+	char const * buf = reply.data();
+	size_t size = reply.size();
+
+	while (size) {
+		ssize_t count = write(fd, buf, size);
+		if (count < 0 && errno == EINTR)
+			continue;
+		// client went away, nothing we can do
+		if (count <= 0)
+			return;
+		buf += count;
+		size -= count;
+	}
+}
+
+}  // anonymous namespace
+
+
+void serve_queries(string const & path, query_handler & handler)
+{
+	int const fd = create_socket(path);
+
+	// a client closing early must not kill the server
+	signal(SIGPIPE, SIG_IGN);
+
+	cverb << vdebug << "serving queries on " << path << endl;
+
+	bool serving = true;
+	while (serving) {
+		int client = accept(fd, 0, 0);
+		if (client < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			int err = errno;
+			close(fd);
+			unlink(path.c_str());
+			throw op_runtime_error("accept() failed", err);
+		}
+
+		// don't let a silent client hang the server
+		struct timeval timeout = { 5, 0 };
+		setsockopt(client, SOL_SOCKET, SO_RCVTIMEO,
+		           &timeout, sizeof(timeout));
+
+		string query;
+		if (read_query(client, query)) {
+			ostringstream reply;
+			serving = handler.answer(query, reply);
+			write_reply(client, reply.str());
+		}
+
+		close(client);
+	}
+
+	close(fd);
+	unlink(path.c_str());
+}
@@ -0,0 +1,43 @@
+/**
+ * @file opreport_server.h
+ * Unix socket server used by opreport --serve
+ *
+ * @remark Copyright 2013 OProfile authors
+ * @remark Read the file COPYING
+ */
+
+#ifndef OPREPORT_SERVER_H
+#define OPREPORT_SERVER_H
+
+#include <string>
+#include <iosfwd>
+
+/// answer the queries received by serve_queries()
+class query_handler {
+public:
+	virtual ~query_handler() {}
+
+	/**
+	 * @param query  the query line, without its trailing newline
+	 * @param out  where to write the reply
+	 *
+	 * Return false to stop serving once the reply has been sent.
+	 */
+	virtual bool answer(std::string const & query, std::ostream & out) = 0;
+};
+
+/**
+ * serve_queries - answer queries on a Unix socket
+ * @param path  filename of the socket to create
+ * @param handler  the query handler
+ *
+ * Each connection carries a single newline terminated query, the reply
+ * is written back and the connection closed. Queries are answered one
+ * at a time until the handler asks to stop, at which point the socket
+ * is removed. The socket is only accessible by its owner, an existing
+ * socket at path is replaced but any other file is left alone. Throws
+ * op_runtime_error if the socket can't be created.
+ */
+void serve_queries(std::string const & path, query_handler & handler);
+
+#endif /* !OPREPORT_SERVER_H */
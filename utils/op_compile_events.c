@@ -0,0 +1,45 @@
+/**
+ * @file op_compile_events.c
+ * Compile cpu event description files into event databases, run at
+ * install time
+ *
+ * @remark Copyright 2013 OProfile authors
+ * @remark Read the file COPYING
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "op_events.h"
+#include "op_events_db.h"
+#include "op_libiberty.h"
+
+int main(int argc, char const * argv[])
+{
+	char const * dir = getenv("OPROFILE_EVENTS_DIR");
+	int i, ret = EXIT_SUCCESS;
+
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s cpu_events_dir...\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	if (dir == NULL)
+		dir = OP_DATADIR;
+
+	for (i = 1; i < argc; ++i) {
+		char * db_file = xmalloc(strlen(dir) + strlen(argv[i]) +
+		                         strlen(OP_EVENTS_DB_NAME) + 3);
+		sprintf(db_file, "%s/%s/%s", dir, argv[i], OP_EVENTS_DB_NAME);
+		if (op_events_compile(argv[i], db_file)) {
+			fprintf(stderr, "%s: can't write %s: %s\n", argv[0],
+			        db_file, strerror(errno));
+			ret = EXIT_FAILURE;
+		}
+		free(db_file);
+	}
+
+	return ret;
+}
@@ -259,7 +259,17 @@ static void resolve_events(void)
 	counter_map = map_event_to_counter(selected_events, count, cpu_type);
 
 	if (!counter_map) {
+		int conflict[num_chosen_events];
+
 		fprintf(stderr, "Couldn't allocate hardware counters for the selected events.\n");
+		if (find_counter_conflict(selected_events, count, cpu_type,
+		                          conflict)) {
+			fprintf(stderr, "These events can't be counted together:");
+			for (i = 0; i < count; ++i)
+				if (conflict[i])
+					fprintf(stderr, " %s", selected_events[i]->name);
+			fprintf(stderr, "\n");
+		}
 		exit(EXIT_FAILURE);
 	}
 